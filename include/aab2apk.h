@@ -0,0 +1,135 @@
+/*
+ * libaab2apk: AAB to APK conversion for embedding in other programs.
+ *
+ * This is the library's only public header and a stable C ABI: types are
+ * opaque or plain C structs, functions never throw, and everything a call
+ * returns is owned by the library until the matching *_free or *_destroy.
+ * Symbols are added, never changed; aab2apk_api_version() reports the
+ * revision of this header the library implements.
+ *
+ * A context holds what a long-running embedder wants to pay for once:
+ * discovered tools, the apksigner lookup and the memory-aware job scheduler.
+ * Jobs are described by the same flat JSON requests `aab2apk serve` accepts
+ * ("input", "output", "mode", "staging", "manifest", "keystore", "ks_pass",
+ * "key_alias", "key_pass", plus an optional "id") and run concurrently on
+ * the context, each on its own thread. A job without an "output" is
+ * written to ./dist/<id>/ (the id defaults to "job-<n>").
+ */
+#ifndef AAB2APK_H
+#define AAB2APK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#  if defined(AAB2APK_BUILDING_LIBRARY)
+#    define AAB2APK_API __declspec(dllexport)
+#  else
+#    define AAB2APK_API __declspec(dllimport)
+#  endif
+#else
+#  define AAB2APK_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AAB2APK_API_VERSION 1
+
+typedef struct aab2apk_context aab2apk_context;
+typedef struct aab2apk_job aab2apk_job;
+typedef struct aab2apk_result aab2apk_result;
+
+typedef enum aab2apk_status {
+    AAB2APK_OK = 0,
+    AAB2APK_INVALID_ARGUMENT = 1,   /* malformed options or request */
+    AAB2APK_TOOLS_NOT_FOUND = 2,    /* no bundletool or java */
+    AAB2APK_CONVERSION_FAILED = 3
+} aab2apk_status;
+
+/* A step of a running job: "started", "bundletool", "extracted" and
+ * "signed" (once per APK, apk set), then "published". bytes is the size of
+ * the input, .apks or APK concerned, or the total published. The strings
+ * are valid for the duration of the callback only. */
+typedef struct aab2apk_progress {
+    const char* job_id;
+    const char* phase;
+    const char* apk;        /* "" for whole-job phases */
+    uint64_t bytes;
+} aab2apk_progress;
+
+/* May be called from several library threads at once */
+typedef void (*aab2apk_progress_fn)(const aab2apk_progress* progress, void* user_data);
+
+/* One published APK; the strings live as long as the result */
+typedef struct aab2apk_apk {
+    const char* name;
+    const char* path;
+    uint64_t size;
+    const char* sha256;     /* lowercase hex */
+    const char* module;     /* "" for standalone APKs */
+    const char* split_id;   /* "" for master splits and standalone APKs */
+} aab2apk_apk;
+
+AAB2APK_API int aab2apk_api_version(void);
+
+/* Why the last call on this thread failed; never NULL */
+AAB2APK_API const char* aab2apk_last_error(void);
+
+/* options_json (may be NULL) is a flat JSON object: "bundletool" and
+ * "java" paths (discovered like the CLI does when absent) and "jobs", the
+ * most conversions running at once (default 1; submitted jobs beyond it
+ * wait their turn). */
+AAB2APK_API aab2apk_status aab2apk_context_create(const char* options_json, aab2apk_context** context);
+
+/* Waits for the context's unfinished jobs, then releases it. Jobs that were
+ * not freed yet must still be freed. */
+AAB2APK_API void aab2apk_context_destroy(aab2apk_context* context);
+
+/* Starts a conversion and returns without waiting for it. progress may be
+ * NULL. Fails only when the request is malformed; conversion failures are
+ * reported by the result. */
+AAB2APK_API aab2apk_status aab2apk_submit(
+    aab2apk_context* context,
+    const char* request_json,
+    aab2apk_progress_fn progress,
+    void* user_data,
+    aab2apk_job** job);
+
+/* Blocks until the job finishes. The result belongs to the job and stays
+ * valid until aab2apk_job_free; result may be NULL. */
+AAB2APK_API aab2apk_status aab2apk_job_wait(aab2apk_job* job, const aab2apk_result** result);
+
+/* Waits for the job if it is still running, then releases it */
+AAB2APK_API void aab2apk_job_free(aab2apk_job* job);
+
+/* Submits, waits and hands over the result, which the caller releases with
+ * aab2apk_result_free (also when the status is not AAB2APK_OK) */
+AAB2APK_API aab2apk_status aab2apk_convert(
+    aab2apk_context* context,
+    const char* request_json,
+    aab2apk_progress_fn progress,
+    void* user_data,
+    aab2apk_result** result);
+
+AAB2APK_API aab2apk_status aab2apk_result_status(const aab2apk_result* result);
+
+/* "" on success */
+AAB2APK_API const char* aab2apk_result_error(const aab2apk_result* result);
+
+AAB2APK_API size_t aab2apk_result_apk_count(const aab2apk_result* result);
+
+/* Fills apk with the index-th published APK; 0 when index is out of range */
+AAB2APK_API int aab2apk_result_apk(const aab2apk_result* result, size_t index, aab2apk_apk* apk);
+
+/* The outcome as one line of JSON, shaped like serve's final status line */
+AAB2APK_API const char* aab2apk_result_json(const aab2apk_result* result);
+
+AAB2APK_API void aab2apk_result_free(aab2apk_result* result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AAB2APK_H */
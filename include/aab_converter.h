@@ -1,14 +1,48 @@
 #pragma once
 
+#include "artifact_manifest.h"
+#include "artifact_stream.h"
 #include "config.h"
 #include "process_runner.h"
 #include "signing.h"
 #include <string>
 #include <filesystem>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
 #include <vector>
 
 namespace aab2apk {
 
+// Measurements of one conversion, for schedulers
+struct ConversionStats {
+    uint64_t bundletool_peak_rss = 0;   // bytes; 0 when the platform does not report it
+};
+
+// A step of a conversion, reported as it completes: "started",
+// "bundletool" (its .apks is ready), "extracted" and "signed" for each APK,
+// then "published". bytes is the size of the APK, .apks or input concerned,
+// or the total published.
+struct ProgressEvent {
+    std::string phase;
+    std::string apk;        // empty for whole-conversion phases
+    uint64_t bytes = 0;
+};
+
+// Called from whichever thread completed the step; several signers may
+// report at once
+using ProgressCallback = std::function<void(const ProgressEvent& event)>;
+
+// Keeps signed splits across runs. restore() gets a freshly extracted
+// unsigned split (sha256 is of the unsigned bytes) and, when it holds a
+// signed copy, places it at dest and updates path, size and sha256;
+// store() gets every newly signed split with its unsigned digest.
+struct SignedSplitCache {
+    std::function<bool(ApkArtifact& apk, const std::filesystem::path& dest)> restore;
+    std::function<void(const std::string& unsigned_sha256, const ApkArtifact& signed_apk)> store;
+};
+
 class AabConverter {
 public:
     AabConverter(
@@ -18,18 +52,95 @@ public:
 
     bool convert(const Config& config) const;
 
+    // Same as convert(), additionally describing every published APK
+    bool convert(const Config& config, ArtifactManifest& manifest) const;
+
+    // Runs preflight (input validation and the like) concurrently with
+    // setup and bundletool; bundletool is killed and the conversion fails
+    // as soon as preflight returns false
+    bool convert(
+        const Config& config,
+        ArtifactManifest& manifest,
+        const std::function<bool()>& preflight,
+        ConversionStats* stats = nullptr,
+        const SignedSplitCache* signed_cache = nullptr,
+        const ProgressCallback& progress = {}
+    ) const;
+
 private:
     const ProcessRunner& runner_;
     const SigningManager& signer_;
 
+    // Directories and hooks shared by the steps of one conversion
+    struct Workspace {
+        std::filesystem::path scratch_dir;   // bundletool output; tmpfs when it fits
+        std::filesystem::path temp_dir;      // extraction, on the output filesystem
+        std::filesystem::path stage_dir;     // finished APKs awaiting publication
+        std::function<bool()> await_preflight;
+        ConversionStats* stats = nullptr;
+        const SignedSplitCache* signed_cache = nullptr;
+        ArtifactStream* stream = nullptr;    // --output -/--output-fd instead of stage_dir
+        std::mutex* stream_mutex = nullptr;
+        const ProgressCallback* progress = nullptr;
+
+        void report(const char* phase, const std::string& apk = "", uint64_t bytes = 0) const {
+            if (progress != nullptr && *progress) {
+                (*progress)(ProgressEvent{phase, apk, bytes});
+            }
+        }
+    };
+
     bool convert_to_universal(
         const Config& config,
-        const std::filesystem::path& temp_dir
+        const Workspace& workspace,
+        ArtifactManifest& manifest
     ) const;
 
     bool convert_to_split(
         const Config& config,
-        const std::filesystem::path& temp_dir
+        const Workspace& workspace,
+        ArtifactManifest& manifest
+    ) const;
+
+    // Publishes bundletool's .apks archive itself, its APKs signed in place
+    bool convert_to_apks_archive(
+        const Config& config,
+        const Workspace& workspace,
+        ArtifactManifest& manifest
+    ) const;
+
+    // Alignment (--align) and signing, in that order, for one extracted APK,
+    // then the --verify-align check of the result. rewritten reports whether
+    // the file changed, so its digest needs recomputing.
+    bool finish_apk(
+        const Config& config,
+        const std::filesystem::path& apk_path,
+        const std::string& name,
+        bool& rewritten
+    ) const;
+
+    bool run_bundletool(
+        const Config& config,
+        const std::vector<std::string>& args,
+        const Workspace& workspace,
+        bool report_failure = true
+    ) const;
+
+    // With --module-cache: looks up the bundle's unchanged modules and, when
+    // there are any, writes the bundle without them for bundletool
+    void plan_module_reuse(
+        const Config& config,
+        const Workspace& workspace,
+        std::map<std::string, std::string>& module_keys,
+        std::map<std::string, std::vector<ApkArtifact>>& reused,
+        std::filesystem::path& bundle
+    ) const;
+
+    bool extract_apks(
+        const std::filesystem::path& apks_file,
+        const std::filesystem::path& extract_dir,
+        const std::function<bool(ApkArtifact&&)>& on_extracted,
+        ArtifactStream* direct = nullptr
     ) const;
 };
 
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace aab2apk {
+
+struct AlignmentPolicy {
+    uint32_t stored = 4;            // every uncompressed entry
+    uint32_t native_libs = 16384;   // uncompressed lib/<abi>/*.so, for direct mmap at install
+};
+
+// Native zipalign. Entry data is never decoded or recompressed: only local
+// headers are rewritten with padding, and the data is copied raw.
+class ApkAligner {
+public:
+    // Alignment the entry's data needs under policy; 0 when none (compressed)
+    static uint32_t required(const std::string& name, uint16_t method, const AlignmentPolicy& policy);
+
+    // Rewrites the APK in place when any entry is misaligned; rewritten
+    // reports whether it was
+    static bool align(
+        const std::filesystem::path& apk,
+        const AlignmentPolicy& policy,
+        bool& rewritten,
+        std::string& error
+    );
+
+    // Lists misaligned entries ("name: offset N, needs M-byte alignment")
+    // without changing anything
+    static bool verify(
+        const std::filesystem::path& apk,
+        const AlignmentPolicy& policy,
+        std::vector<std::string>& misaligned,
+        std::string& error
+    );
+};
+
+} // namespace aab2apk
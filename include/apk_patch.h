@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+namespace aab2apk {
+
+struct PatchStats {
+    uint64_t new_size = 0;
+    uint64_t patch_size = 0;
+    size_t copied = 0;      // regions taken unchanged from the old APK
+    size_t deltas = 0;      // entries rebuilt from a binary delta
+    size_t literals = 0;    // regions shipped as deflated bytes
+};
+
+// Entry-aware binary patches between two APKs. The new APK is walked entry
+// by entry: stored bytes identical to an old entry (by name or by content)
+// are copied, changed entries get a bsdiff-style delta against the old
+// entry of the same name, and everything else ships deflated. A changed
+// deflated entry is diffed inflated when some zlib setting deflates it back
+// to its stored bytes, and on the stored bytes otherwise; either way
+// applying a patch reproduces the new APK exactly, signature included.
+// Both APKs are held in memory while patching.
+class ApkPatch {
+public:
+    // Writes a patch turning old_apk into new_apk; deltas are computed on
+    // up to threads threads (0 = one per core)
+    static bool create(
+        const std::filesystem::path& old_apk,
+        const std::filesystem::path& new_apk,
+        const std::filesystem::path& patch,
+        unsigned threads,
+        PatchStats& stats,
+        std::string& error
+    );
+
+    // Rebuilds the new APK at output. Fails without touching output when
+    // old_apk is not the APK the patch was made against or the result does
+    // not match the recorded SHA-256.
+    static bool apply(
+        const std::filesystem::path& old_apk,
+        const std::filesystem::path& patch,
+        const std::filesystem::path& output,
+        std::string& error
+    );
+};
+
+} // namespace aab2apk
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "apk_align.h"
+#include "config.h"
+#include <filesystem>
+#include <string>
+
+namespace aab2apk {
+
+// Rewrites an APK with every deflated entry recompressed at another level
+// (or stored). Entries are inflated and compressed on several threads at
+// once and written in their original order. Entries bundletool stored
+// (resources.arsc, uncompressed native libraries, media) stay stored and
+// are copied as they are, realigned under policy.
+//
+// Compression uses libdeflate when the build found it, zlib otherwise.
+class ApkRecompressor {
+public:
+    static bool recompress(
+        const std::filesystem::path& apk,
+        CompressionMode mode,
+        const AlignmentPolicy& policy,
+        unsigned threads,
+        std::string& error
+    );
+
+    // "libdeflate" or "zlib"
+    static const char* backend();
+};
+
+} // namespace aab2apk
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "sha256.h"
+#include <filesystem>
+#include <string>
+
+namespace aab2apk {
+
+// fs-verity style Merkle tree of a file, as APK Signature Scheme v4 uses
+// it: SHA-256 over 4 KiB blocks, no salt, each level zero-padded to whole
+// blocks, levels stored root-most first
+struct MerkleTree {
+    std::string tree;
+    Sha256::Digest root_hash{};
+};
+
+// Native v4 (.idsig) support. The Merkle tree is built on several threads:
+// the data blocks are split into one contiguous range per thread, read and
+// hashed independently, and each upper level is hashed in parallel from
+// the one below it.
+class ApkVerity {
+public:
+    static constexpr size_t BLOCK_SIZE = 4096;
+
+    // threads = 0 uses one per core
+    static bool build_tree(
+        const std::filesystem::path& file,
+        unsigned threads,
+        MerkleTree& tree,
+        std::string& error
+    );
+
+    // Completes the .idsig apksigner wrote for apk without its Merkle tree
+    // (or replaces the one it holds): checks the signed root hash against
+    // the tree built natively and writes the tree into the file
+    static bool complete_idsig(
+        const std::filesystem::path& apk,
+        const std::filesystem::path& idsig,
+        unsigned threads,
+        std::string& error
+    );
+};
+
+} // namespace aab2apk
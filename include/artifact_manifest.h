@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace aab2apk {
+
+// Device targeting of a single APK as recorded by bundletool
+struct SplitTargeting {
+    std::string module;
+    std::string split_id;   // empty for master splits and standalone APKs
+    bool master = false;
+    std::vector<std::string> abis;
+    std::vector<std::string> densities;
+    std::vector<std::string> languages;
+};
+
+struct ApkArtifact {
+    std::string name;               // file name in the output directory
+    std::string source;             // entry path inside bundletool's .apks
+    std::filesystem::path path;     // current location on disk
+    uint64_t size = 0;
+    std::string sha256;
+    SplitTargeting targeting;
+};
+
+// Per-APK description of a conversion's outputs (name, size, digest and
+// split targeting), so publishers never have to re-read the APKs.
+class ArtifactManifest {
+public:
+    std::vector<ApkArtifact> apks;
+
+    // Parses bundletool's toc.pb (BuildApksResult), keyed by APK path in the .apks
+    static std::map<std::string, SplitTargeting> parse_toc(const std::string& toc);
+
+    // Fallback when toc.pb is missing: derive targeting from bundletool's
+    // "<module>-<suffix>.apk" naming scheme
+    static SplitTargeting guess_targeting(const std::string& entry_path);
+
+    // JSON array of artifacts; every line after the first is prefixed with indent
+    std::string to_json(const std::string& indent = "") const;
+
+    // input_sha256 is recorded when known (a bundle read from a pipe)
+    bool write_file(const std::filesystem::path& path, const std::string& input_aab,
+                    const std::string& input_sha256 = "") const;
+
+    // One APK as a single-line flat JSON object with the given "type" (list
+    // targeting comma-joined), for line-based records such as the batch journal
+    static std::string to_record(const ApkArtifact& apk, const std::string& type);
+    static ApkArtifact from_record(const std::map<std::string, std::string>& fields);
+};
+
+} // namespace aab2apk
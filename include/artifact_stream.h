@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+namespace aab2apk {
+
+// Writes conversion outputs to a file descriptor (a pipe, socket or stdout)
+// instead of the output directory. A single APK is written as is; a set of
+// APKs as a POSIX ustar archive. Data is written as it is produced, so the
+// stream works on pipes and nothing has to be read back from disk.
+class ArtifactStream {
+public:
+    ArtifactStream(int fd, bool archive) : fd_(fd), archive_(archive) {}
+
+    bool archive() const { return archive_; }
+
+    // Starts an output of the given size; write() must then deliver exactly
+    // size bytes before end_file()
+    bool begin_file(const std::string& name, uint64_t size, std::string& error);
+    bool write(const void* data, size_t size, std::string& error);
+    bool end_file(std::string& error);
+
+    // Streams a finished file from disk
+    bool add_file(const std::filesystem::path& path, const std::string& name, std::string& error);
+
+    // Ends the archive; required for archives, harmless otherwise
+    bool finish(std::string& error);
+
+private:
+    int fd_;
+    bool archive_;
+    bool in_file_ = false;
+    bool wrote_file_ = false;
+    std::string name_;
+    uint64_t expected_ = 0;
+    uint64_t written_ = 0;
+
+    bool write_all(const void* data, size_t size, std::string& error);
+};
+
+} // namespace aab2apk
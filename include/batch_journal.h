@@ -0,0 +1,101 @@
+#pragma once
+
+#include "aab_converter.h"
+#include "artifact_manifest.h"
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace aab2apk {
+
+// Identity of an input bundle as recorded in the journal
+struct JournalInput {
+    std::string path;       // absolute
+    uint64_t size = 0;
+    int64_t mtime = 0;      // file clock ticks; only compared for equality
+    std::string sha256;
+};
+
+// Append-only record of a multi-input run, kept in <output>/.aab2apk-journal
+// so an interrupted batch can be restarted without redoing finished work.
+//
+// Every record is one flat JSON object per line, appended with a single
+// write() and flushed with fdatasync() before the work it describes is
+// considered done. A torn final line from a crash is ignored on load, and
+// opening the journal to resume rewrites it down to the records still in
+// effect, so it does not grow with every run of the batch.
+//
+//   {"type": "apk", ...}     one per APK of the job that follows
+//   {"type": "job", ...}     a finished job: input identity, settings, status
+//   {"type": "signed", ...}  a split signed by a run that may not finish;
+//                            the signed copy is kept in .aab2apk-resume/
+class BatchJournal {
+public:
+    explicit BatchJournal(const std::filesystem::path& output_dir);
+    ~BatchJournal();
+
+    BatchJournal(const BatchJournal&) = delete;
+    BatchJournal& operator=(const BatchJournal&) = delete;
+
+    // Loads the existing journal (unless discard) and opens it for appending
+    bool open(bool discard, std::string& error);
+
+    // Identity of input as it is on disk now; the SHA-256 is only computed
+    // when with_hash is set
+    static bool stat_input(const std::string& input, JournalInput& state, bool with_hash);
+
+    // True when input already converted successfully into output_dir with the
+    // same settings and every recorded APK is still there with its recorded
+    // size. Unchanged inputs are matched by size and mtime without reading
+    // them; a touched input is re-hashed.
+    bool find_complete(
+        const std::string& input,
+        const std::string& settings,
+        const std::string& output_dir,
+        ArtifactManifest& manifest
+    );
+
+    bool record_job(
+        const JournalInput& input,
+        const std::string& settings,
+        const std::string& output_dir,
+        bool success,
+        const ArtifactManifest& manifest
+    );
+
+    // Hooks that keep every split signed with signer_id, so a restarted run
+    // reuses them instead of signing again
+    SignedSplitCache signed_cache(const std::string& signer_id);
+
+    // Drops the signed copies once the whole batch is published
+    void remove_resume_data();
+
+private:
+    struct JobRecord {
+        JournalInput input;
+        std::string settings;
+        std::string output_dir;
+        ArtifactManifest manifest;
+    };
+    struct SignedRecord {
+        uint64_t size = 0;
+        std::string sha256;
+    };
+
+    std::filesystem::path path_;
+    std::filesystem::path resume_dir_;
+    int fd_ = -1;
+    std::mutex mutex_;
+    std::map<std::string, JobRecord> jobs_;     // by input path; successful jobs only
+    std::map<std::pair<std::string, std::string>, SignedRecord> signed_;   // by (signer, unsigned sha256)
+
+    void load();
+    void compact();
+    bool append(const std::string& lines);
+    std::filesystem::path signed_path(const std::string& signer_id, const std::string& unsigned_sha256) const;
+};
+
+} // namespace aab2apk
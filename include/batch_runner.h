@@ -0,0 +1,42 @@
+#pragma once
+
+#include "aab_converter.h"
+#include "artifact_manifest.h"
+#include "config.h"
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace aab2apk {
+
+struct BatchJobResult {
+    std::string input;
+    std::string output_dir;
+    bool success = false;
+    bool resumed = false;       // already converted by an earlier run of the batch
+    double execution_time = 0.0;
+    ArtifactManifest manifest;
+};
+
+// Converts every --input of a multi-input run, each into
+// <output>/<input stem>/, running as many at once as JobScheduler admits.
+// Progress is kept in a BatchJournal, so a restarted batch skips the jobs
+// that already finished and reuses splits that were already signed.
+class BatchRunner {
+public:
+    BatchRunner(const Config& config, const AabConverter& converter)
+        : config_(config), converter_(converter) {}
+
+    // Returns true when every job succeeded; results are in input order
+    bool run(std::vector<BatchJobResult>& results) const;
+
+    // {"jobs": [...]} with each job's status and per-APK manifest
+    static std::string to_json(const std::vector<BatchJobResult>& results, const std::string& indent = "");
+    static bool write_manifest(const std::filesystem::path& path, const std::vector<BatchJobResult>& results);
+
+private:
+    const Config& config_;
+    const AabConverter& converter_;
+};
+
+} // namespace aab2apk
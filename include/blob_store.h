@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+namespace aab2apk {
+
+struct BlobStoreStats {
+    size_t blobs_kept = 0;
+    size_t references = 0;      // output files linked to the kept blobs
+    size_t blobs_removed = 0;
+    uint64_t bytes_freed = 0;
+    size_t keys_removed = 0;
+};
+
+// Content-addressed store of finished APKs, shared across runs and output
+// directories. Published files are hard links to the blobs, so an APK that
+// comes out byte-identical to an earlier one costs no extra disk space, and
+// a blob's link count is its reference count: once every output linking it
+// has been deleted or replaced, gc() removes it. Where a hard link is not
+// possible (another filesystem) the blob is reflinked or copied instead,
+// which holds no reference.
+//
+//   <root>/blobs/<ab>/<sha256>   the APK, read-only
+//   <root>/keys/<ab>/<key>       "<sha256> <size>" of the finished APK made
+//                                from an unsigned split and finisher
+class BlobStore {
+public:
+    explicit BlobStore(const std::filesystem::path& root) : root_(root) {}
+
+    // Key of the APK an unsigned split (by digest) turns into once aligned
+    // and signed as finisher describes
+    static std::string key(const std::string& unsigned_sha256, const std::string& finisher);
+
+    // The finished APK recorded under key, if its blob is still stored
+    bool find(const std::string& key, std::string& sha256, uint64_t& size) const;
+
+    // Places the blob at dest (which must not exist): a hard link, else a
+    // reflink or copy. False when the blob is gone or has the wrong size.
+    bool link(const std::string& sha256, uint64_t size, const std::filesystem::path& dest) const;
+
+    // Takes file into the store. When an identical blob already exists file
+    // is replaced by a link to it; otherwise file becomes the blob. key,
+    // when not empty, records file as its finished APK.
+    bool admit(
+        const std::filesystem::path& file,
+        const std::string& sha256,
+        uint64_t size,
+        const std::string& key
+    ) const;
+
+    // Removes blobs no output links to any more, and keys whose blob is gone
+    bool gc(BlobStoreStats& stats, std::string& error) const;
+
+private:
+    std::filesystem::path root_;
+
+    std::filesystem::path blob_path(const std::string& sha256) const;
+    std::filesystem::path key_path(const std::string& key) const;
+};
+
+} // namespace aab2apk
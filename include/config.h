@@ -1,14 +1,31 @@
 #pragma once
 
+#include <map>
 #include <string>
 #include <optional>
 #include <vector>
+#include <cstdint>
 
 namespace aab2apk {
 
 enum class OutputMode {
     Universal,
-    Split
+    Split,
+    Apks        // bundletool's split set archive (.apks), signed in place
+};
+
+enum class StagingMode {
+    Auto,
+    Memory,
+    Disk
+};
+
+// Entry compression of the universal APK
+enum class CompressionMode {
+    Keep,   // as bundletool wrote it
+    Store,
+    Fast,
+    Max
 };
 
 struct SigningConfig {
@@ -25,23 +42,86 @@ struct Config {
     std::optional<SigningConfig> signing;
     bool verbose = false;
     bool quiet = false;
+    bool log_json = false;      // --log-format json: diagnostics as JSON lines
+    std::string log_file;       // --log-file: diagnostics go here instead of stdout/stderr
     bool list_tools = false;
     bool show_timing = false;
     bool check_only = false;
     bool json_output = false;
+    bool events = false;        // --events ndjson: progress events as JSON lines while jobs run
+    std::string manifest_path;
+    StagingMode staging = StagingMode::Auto;
+    uint64_t memory_budget_mb = 1024;
+    uint64_t tool_output_kb = 256;   // --tool-output-limit: child output kept in memory per stream
+    std::string tool_log_dir;        // --tool-log: full bundletool/apksigner output, one file per job
+    unsigned sign_jobs = 0;     // concurrent apksigner runs in split mode; 0 = auto
+    unsigned queue_depth = 0;   // extracted splits waiting for a signer; 0 = 2 x sign_jobs
+    CompressionMode compression = CompressionMode::Keep;
+    uint32_t align_page = 0;    // --align: native library alignment (4 KiB or 16 KiB); 0 = leave as built
+    bool verify_align = false;  // --verify-align: check alignment of the finished APKs instead
+    bool v4_signature = false;  // --v4-signature: write <apk>.idsig next to each signed APK
+    int output_fd = -1;         // --output - / --output-fd: stream APKs here instead of output_dir
+    std::string module_cache;   // split mode: reuse unchanged modules' splits from this store
+    std::string dedup_store;    // split mode: link identical finished splits from this blob store
+    bool dedup_gc = false;      // "gc" subcommand: prune the dedup store
     std::string bundletool_path;
     std::string java_path;
+    std::vector<std::string> inputs;     // every --input; input_aab is the first
+    std::string input_name = "stdin.aab"; // file name given to a bundle read from stdin (--input -)
+    unsigned jobs = 0;                   // concurrent conversions in multi-job runs; 0 = auto
+    bool resume = true;                  // multi-input runs skip jobs their journal records as done
+    std::vector<std::string> jvm_args;   // options for bundletool's JVM, e.g. -Xmx
+    int bundletool_nice = 0;
+    bool bundletool_background_io = false;
+    bool serve = false;          // "serve" subcommand: run as a job server
+    std::string socket_path;
+    unsigned workers = 1;
+    std::string queue_dir;       // --queue-dir: run as a worker of a shared-directory queue
+    std::string worker_id;       // name of this worker's claims; default <host>-<pid>
+    unsigned lease_seconds = 60; // claims not renewed for this long are re-queued
+    bool queue_watch = false;    // keep polling an empty queue instead of exiting
+    std::string patch_command;   // "diff" or "apply" subcommand: APK delta patches
+    std::string patch_old;       // --old: the APK a patch goes from
+    std::string patch_new;       // --new: the APK a patch leads to (diff reads it, apply writes it)
+    std::string patch_file;      // --patch
 };
 
 class ConfigParser {
 public:
+    // Parses arguments, discovers tools and validates inputs; exits on error
     static Config parse(int argc, char* argv[]);
+    // parse() without the input validation, so the caller can overlap
+    // validate_config() with starting bundletool
+    static Config parse_arguments(int argc, char* argv[]);
+    // Overrides config with the fields of a JSON job request ("input",
+    // "output", "mode", "staging", "manifest", "keystore", "ks_pass",
+    // "key_alias", "key_pass") as used by serve and queue workers. False
+    // when the job's options do not combine with the defaults it inherits.
+    static bool apply_job_request(
+        const std::map<std::string, std::string>& fields,
+        Config& config,
+        std::string& error
+    );
+    // A job whose request has no "output" publishes into <output>/<name>,
+    // so jobs sharing the defaults never publish into (and replace) the
+    // same directory. False when name cannot serve as a directory name.
+    static bool apply_job_output(
+        const std::map<std::string, std::string>& fields,
+        const std::string& name,
+        Config& config,
+        std::string& error
+    );
+    // Options that cannot be used together (--v4-signature with .apks
+    // output, --dedup-store outside split mode, ...); parse() and every job
+    // request check the same rules
+    static bool check_combinations(const Config& config, std::string& error);
+    // Checks the input AAB and signing inputs, reporting problems on stderr
+    static bool validate_config(const Config& config);
     static void print_usage(const char* program_name);
     static void print_version();
 
-private:
+    // Expands "env:NAME" to the value of that environment variable
     static std::string resolve_env_var(const std::string& value);
-    static bool validate_config(const Config& config);
 };
 
 } // namespace aab2apk
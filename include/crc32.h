@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace aab2apk {
+
+// CRC-32 (ISO-HDLC, as used by ZIP) with runtime dispatch to PCLMULQDQ
+// folding on x86-64 or the ARMv8 CRC32 instructions when available.
+class Crc32 {
+public:
+    // Continues a running CRC. Start with 0 and feed chunks in order.
+    static uint32_t update(uint32_t crc, const void* data, size_t size);
+    static uint32_t compute(const void* data, size_t size) { return update(0, data, size); }
+
+    // Name of the implementation selected for this CPU ("pclmul", "armv8-crc" or "table").
+    static const char* implementation();
+};
+
+} // namespace aab2apk
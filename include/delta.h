@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace aab2apk {
+
+// bsdiff-style binary delta between two buffers: a suffix array of the old
+// data finds approximate matches, stored as bytewise differences (mostly
+// zeros, so they compress well) plus literal runs. The encoded delta is
+// raw-deflated.
+class Delta {
+public:
+    static bool create(
+        const unsigned char* old_data,
+        size_t old_size,
+        const unsigned char* new_data,
+        size_t new_size,
+        std::string& delta,
+        std::string& error
+    );
+
+    // Rebuilds new_size bytes from old_data and a delta made by create()
+    static bool apply(
+        const unsigned char* old_data,
+        size_t old_size,
+        const std::string& delta,
+        size_t new_size,
+        std::string& out,
+        std::string& error
+    );
+
+    // Raw deflate / inflate helpers for patch payloads
+    static bool compress(const std::string& data, std::string& out, std::string& error);
+    static bool decompress(const std::string& data, size_t size, std::string& out, std::string& error);
+};
+
+} // namespace aab2apk
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "aab_converter.h"
+#include "config.h"
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace aab2apk {
+
+// --events ndjson: one job's progress as a JSON object per line, written as
+// each step completes so a scheduler can follow long conversions (and stop
+// stragglers) instead of waiting for the final report:
+//
+//   {"event": "extracted", "job": "app.aab", "time": "2026-01-01T12:00:03.120Z",
+//    "elapsed": 3.120, "apk": "base-master.apk", "bytes": 812345,
+//    "phase_bytes": 1624690, "rate": 1523100}
+//
+// elapsed is seconds since "started". rate is bytes per second through the
+// phase so far: the .apks against bundletool's run, the extracted and signed
+// bytes since bundletool finished, the published total against the whole
+// job. A "finished" event with the job's status closes the stream.
+class EventStream {
+public:
+    // Receives whole lines, without the newline; called under the stream's lock
+    using Sink = std::function<void(const std::string& line)>;
+
+    EventStream(std::string job, Sink sink);
+
+    // stdout, or stderr while the APKs stream to stdout. Lines of every
+    // job in the process are written whole and flushed one by one.
+    static Sink console(const Config& config);
+
+    // For AabConverter::convert; the stream must outlive the conversion
+    ProgressCallback callback();
+
+    void finished(bool success, const std::string& error = "");
+
+private:
+    void report(const ProgressEvent& event);
+    // fields: the event's own fields, each preceded by ", "
+    void emit(const std::string& event, const std::string& fields);
+
+    using Clock = std::chrono::steady_clock;
+
+    const std::string job_;
+    const Sink sink_;
+    std::mutex mutex_;
+    Clock::time_point started_;
+    Clock::time_point bundletool_done_;
+    std::map<std::string, uint64_t> phase_bytes_;
+};
+
+} // namespace aab2apk
@@ -3,6 +3,7 @@
 #include <string>
 #include <filesystem>
 #include <optional>
+#include <cstdint>
 
 namespace aab2apk {
 
@@ -20,8 +21,27 @@ public:
     static bool validate_aab_file(const fs::path& aab_path);
     static bool validate_keystore_file(const fs::path& keystore_path);
     static std::string get_temp_directory();
-    static fs::path create_temp_directory();
+    // When near is given and the system temp directory lives on another
+    // filesystem, the temp directory is created next to near (or inside it,
+    // when near is a mount point) so results can later be renamed into place.
+    static fs::path create_temp_directory(const fs::path& near = {});
+    static fs::path create_temp_directory_in(const fs::path& base, const std::string& prefix = "aab2apk_");
+    static bool same_filesystem(const fs::path& a, const fs::path& b);
+    // rename, falling back to copy_file_fast + remove across filesystems
+    static bool move_file(const fs::path& from, const fs::path& to);
+    // Moves a fully prepared directory to target: one rename when target is
+    // missing or empty, a RENAME_EXCHANGE swap on Linux when it only holds
+    // older APKs (and their .idsig files), otherwise one rename per file.
+    // A replaced directory keeps its mode, owner and ACLs; when they cannot be
+    // carried over to staged it is published file by file instead.
+    static bool publish_directory(const fs::path& staged, const fs::path& target);
+    // FICLONE reflink, then copy_file_range, then a plain read/write loop
+    static bool copy_file_fast(const fs::path& from, const fs::path& to);
     static void remove_temp_directory(const fs::path& path);
+    // Asks the kernel to start reading a file into the page cache (no-op
+    // where posix_fadvise is unavailable)
+    static void prefetch_file(const fs::path& path);
+    static bool hash_file(const fs::path& path, std::string& sha256_hex, uint64_t& size);
 };
 
 } // namespace aab2apk
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "config.h"
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+namespace aab2apk {
+
+// Receives a bundle from a pipe (--input -) into a file bundletool can open.
+// The spool lives in memory (tmpfs) while it fits the memory budget and
+// moves to disk when it outgrows it; the SHA-256 is computed from the same
+// buffers as they are written, so the data is read exactly once.
+class InputSpool {
+public:
+    InputSpool() = default;
+    ~InputSpool();
+    InputSpool(const InputSpool&) = delete;
+    InputSpool& operator=(const InputSpool&) = delete;
+
+    // Reads fd to end of file into <spool dir>/<name>, then checks that what
+    // arrived is a complete ZIP archive (a sender that died midway leaves
+    // no central directory)
+    bool receive(int fd, const std::string& name, const Config& config, std::string& error);
+
+    const std::filesystem::path& path() const { return path_; }
+    const std::string& sha256() const { return sha256_; }
+    uint64_t size() const { return size_; }
+    bool in_memory() const { return in_memory_; }
+
+private:
+    std::filesystem::path dir_;
+    std::filesystem::path path_;
+    std::string sha256_;
+    uint64_t size_ = 0;
+    bool in_memory_ = false;
+
+    bool move_to_disk(std::string& error);
+};
+
+} // namespace aab2apk
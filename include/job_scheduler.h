@@ -0,0 +1,76 @@
+#pragma once
+
+#include "config.h"
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <vector>
+
+namespace aab2apk {
+
+// Admits concurrent conversions by memory rather than by core count. Each
+// job reserves an estimate of bundletool's peak RSS, derived from the AAB
+// size and the peaks measured on earlier runs, and starts only while the
+// reservations fit in the memory that was available when the pool was last
+// idle. Admitted JVMs get an -Xmx matching their reservation (unless
+// jvm_args already set one) and run at background CPU and I/O priority.
+class JobScheduler {
+public:
+    struct Ticket {
+        uint64_t reserved = 0;
+        uint64_t aab_size = 0;
+    };
+
+    explicit JobScheduler(unsigned max_jobs);
+
+    // Blocks until the job may start, then sets its JVM heap and priority
+    Ticket admit(Config& config);
+
+    // Returns the reservation; a measured peak RSS refines later estimates
+    void release(const Ticket& ticket, uint64_t peak_rss);
+
+    // admit() and release() as a scope, so a conversion that throws cannot
+    // keep its reservation and block later jobs for good
+    class Admission {
+    public:
+        Admission(JobScheduler& scheduler, Config& config)
+            : scheduler_(scheduler), ticket_(scheduler.admit(config)) {}
+        ~Admission() { scheduler_.release(ticket_, peak_rss_); }
+
+        Admission(const Admission&) = delete;
+        Admission& operator=(const Admission&) = delete;
+
+        // bundletool's measured peak, passed on to release()
+        void set_peak_rss(uint64_t peak_rss) { peak_rss_ = peak_rss; }
+
+    private:
+        JobScheduler& scheduler_;
+        const Ticket ticket_;
+        uint64_t peak_rss_ = 0;
+    };
+
+    uint64_t estimate_peak_rss(uint64_t aab_size) const;
+
+    // MemAvailable from /proc/meminfo, capped by the cgroup limit; 0 if unknown
+    static uint64_t available_memory();
+
+private:
+    const unsigned max_jobs_;
+    std::filesystem::path history_path_;
+    std::vector<double> ratios_;   // peak RSS above the JVM baseline per byte of AAB
+
+    mutable std::mutex mutex_;
+    mutable std::mutex history_mutex_; // serializes this process's rewrites of history_path_
+    std::condition_variable released_;
+    unsigned running_ = 0;
+    uint64_t reserved_ = 0;
+    uint64_t budget_ = 0;
+
+    void load_history();
+    // Rewrites the file with the measurement added, keeping the last
+    // HISTORY_LIMIT; called without mutex_ held
+    void record_history(uint64_t aab_size, uint64_t peak_rss) const;
+};
+
+} // namespace aab2apk
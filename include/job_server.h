@@ -0,0 +1,60 @@
+#pragma once
+
+#include "aab_converter.h"
+#include "config.h"
+#include "job_scheduler.h"
+#include "signing.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace aab2apk {
+
+// Resident conversion service behind `aab2apk serve`. Clients connect to a
+// Unix domain socket and send one JSON job request per line; jobs are queued
+// by priority and run on a worker pool sharing one converter, so tool
+// discovery and the apksigner lookup happen once for the server's lifetime.
+// Status lines for each job are streamed back on the connection that
+// submitted it.
+class JobServer {
+public:
+    JobServer(const Config& defaults, const AabConverter& converter, const SigningManager& signer)
+        : defaults_(defaults), converter_(converter), signer_(signer), scheduler_(defaults.workers) {}
+
+    // Serves until a shutdown request, SIGINT or SIGTERM; returns the exit code
+    int run();
+
+private:
+    struct Connection;
+    struct Job;
+
+    const Config& defaults_;
+    const AabConverter& converter_;
+    const SigningManager& signer_;
+    JobScheduler scheduler_;
+
+    std::mutex mutex_;
+    std::condition_variable work_available_;
+    std::vector<std::shared_ptr<Job>> queue_;   // heap ordered by priority, then arrival
+    uint64_t next_sequence_ = 0;
+    unsigned running_ = 0;
+    bool draining_ = false;
+    std::atomic<bool> stop_requested_{false};
+
+    // Heap order: higher priority first, then first come first served
+    static bool runs_later(const std::shared_ptr<Job>& a, const std::shared_ptr<Job>& b);
+
+    void handle_connection(const std::shared_ptr<Connection>& client);
+    void handle_request(const std::shared_ptr<Connection>& client, const std::string& line);
+    bool make_job(const std::map<std::string, std::string>& fields, Job& job, std::string& error) const;
+    void worker_loop();
+    void run_job(Job& job);
+};
+
+} // namespace aab2apk
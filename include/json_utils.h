@@ -0,0 +1,20 @@
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <string>
+
+namespace aab2apk {
+
+// Escapes a string for embedding in a JSON string literal (without quotes)
+std::string json_escape(const std::string& str);
+
+// Parses a flat JSON object such as a job request. String values are
+// unescaped; numbers, booleans and null are kept as their literal text.
+// Nested objects and arrays are rejected.
+bool parse_json_object(const std::string& text, std::map<std::string, std::string>& fields, std::string& error);
+
+// UTC with millisecond precision, e.g. 2026-01-01T12:00:00.000Z
+std::string json_timestamp(std::chrono::system_clock::time_point time);
+
+} // namespace aab2apk
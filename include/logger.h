@@ -0,0 +1,116 @@
+#pragma once
+
+#include <optional>
+#include <sstream>
+#include <string>
+
+namespace aab2apk {
+
+enum class LogLevel {
+    Debug,      // --verbose
+    Info,
+    Warning,
+    Error       // always shown
+};
+
+enum class LogFormat {
+    Text,       // Info and Debug on stdout, the rest on stderr, as plain lines
+    Json        // one JSON object per line on stderr (or the log file)
+};
+
+struct LogOptions {
+    LogLevel level = LogLevel::Info;
+    LogFormat format = LogFormat::Text;
+    std::string path;       // --log-file: every record goes here instead
+    bool stdout_is_output = false;   // APKs stream to stdout: text records all go to stderr
+};
+
+// The job a thread is working for and the level its records need, so
+// concurrent conversions are told apart and a quiet job stays quiet
+// whatever the process-wide level
+struct LogContext {
+    std::string job;
+    std::optional<LogLevel> level;
+};
+
+// Process-wide asynchronous logger. Each thread writes its records into its
+// own fixed-size single-producer ring, without locks; a background writer
+// drains every ring, orders the batch by sequence number and writes whole
+// records, so lines from concurrent jobs never interleave and workers never
+// wait on a stream. A full ring makes its thread wait for the writer rather
+// than drop records. Pending records are written at exit.
+class Logger {
+public:
+    // Sets the level, format and sink; records already queued keep theirs.
+    // False when the log file cannot be opened.
+    static bool configure(const LogOptions& options);
+
+    static LogLevel level_for(bool verbose, bool quiet);
+
+    // Whether a record at level would be written by the calling thread
+    static bool enabled(LogLevel level);
+
+    static void write(LogLevel level, std::string message);
+
+    // Returns once every record queued before the call has been written
+    static void flush();
+
+    // The calling thread's context, for handing to threads it starts
+    static LogContext context();
+
+    // Overrides part of the calling thread's context until destroyed
+    class Scope {
+    public:
+        explicit Scope(const std::string& job);
+        explicit Scope(LogLevel level);
+        explicit Scope(const LogContext& context);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        LogContext saved_;
+    };
+};
+
+// One record, written when the statement ends:
+//   Log::error() << "Cannot read " << path;
+class LogLine {
+public:
+    explicit LogLine(LogLevel level) : level_(level) {
+        if (Logger::enabled(level)) {
+            stream_.emplace();
+        }
+    }
+    ~LogLine() {
+        if (stream_) {
+            Logger::write(level_, stream_->str());
+        }
+    }
+
+    LogLine(const LogLine&) = delete;
+    LogLine& operator=(const LogLine&) = delete;
+
+    template <typename T>
+    LogLine& operator<<(const T& value) {
+        if (stream_) {
+            *stream_ << value;
+        }
+        return *this;
+    }
+
+private:
+    LogLevel level_;
+    std::optional<std::ostringstream> stream_;
+};
+
+class Log {
+public:
+    static LogLine error() { return LogLine(LogLevel::Error); }
+    static LogLine warning() { return LogLine(LogLevel::Warning); }
+    static LogLine info() { return LogLine(LogLevel::Info); }
+    static LogLine debug() { return LogLine(LogLevel::Debug); }
+};
+
+} // namespace aab2apk
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "artifact_manifest.h"
+#include <filesystem>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace aab2apk {
+
+// Local cache of finished split APKs per bundle module, so successive
+// versions of a bundle only send the modules that changed through
+// bundletool and signing.
+//
+// A module's key covers its own entries (names, sizes and CRC-32s from the
+// AAB's central directory, so nothing is inflated) and everything its
+// splits inherit: BundleConfig.pb, the base manifest (package and version
+// code), the bundletool build and the signing key, if any.
+//
+//   <root>/<module>/<key>/index    one APK record per line
+//   <root>/<module>/<key>/<name>   the split as published (signed when signing)
+class ModuleStore {
+public:
+    explicit ModuleStore(const std::filesystem::path& root) : root_(root) {}
+
+    // Keys of every feature and asset-pack module in the bundle; the base
+    // module is always rebuilt. context identifies the tools and signing key.
+    static bool module_keys(
+        const std::filesystem::path& aab,
+        const std::string& context,
+        std::map<std::string, std::string>& keys,
+        std::string& error
+    );
+
+    // Writes a copy of the bundle without the given modules; entries are
+    // copied as stored, without recompression
+    static bool prune_bundle(
+        const std::filesystem::path& aab,
+        const std::filesystem::path& dest,
+        const std::set<std::string>& modules,
+        std::string& error
+    );
+
+    // The module's stored splits, with path pointing into the store
+    bool lookup(const std::string& module, const std::string& key, std::vector<ApkArtifact>& apks) const;
+
+    // Copies the splits in; keeps the most recently used keys of each module
+    bool save(const std::string& module, const std::string& key, const std::vector<ApkArtifact>& apks) const;
+
+private:
+    std::filesystem::path root_;
+
+    void evict(const std::filesystem::path& module_dir) const;
+};
+
+} // namespace aab2apk
@@ -11,9 +11,46 @@ struct ProcessResult {
     int exit_code;
     std::string stdout_output;
     std::string stderr_output;
+    uint64_t peak_rss_bytes = 0;   // child's maximum resident set, where reported
+    uint64_t stdout_bytes = 0;     // written by the child; more than stdout_output
+    uint64_t stderr_bytes = 0;     // holds when the middle was dropped
     bool success() const { return exit_code == 0; }
 };
 
+// How much of a child's output is kept. Each stream is held to limit bytes
+// in memory: its first and last halves, with a marker in place of whatever
+// was dropped between them, since tools print their banner first and their
+// error last. log_path, when set, is appended the complete output of both
+// streams as it arrives.
+struct CaptureOptions {
+    size_t limit = 256 * 1024;
+    std::string log_path;
+};
+
+// Scheduling hints applied to a child before it executes
+struct ProcessPriority {
+    int nice = 0;                  // added to the inherited nice value
+    bool background_io = false;    // Linux: lowest best-effort I/O priority
+};
+
+// A child started by ProcessRunner::spawn(). Hand it to wait() or kill()
+// exactly once; both release its handles.
+struct ChildProcess {
+#ifdef _WIN32
+    void* process = nullptr;
+    void* thread = nullptr;
+    void* stdout_pipe = nullptr;
+    void* stderr_pipe = nullptr;
+    bool running() const { return process != nullptr; }
+#else
+    int pid = -1;
+    int stdout_fd = -1;
+    int stderr_fd = -1;
+    bool running() const { return pid > 0; }
+#endif
+    std::string error;   // why the spawn failed, when !running()
+};
+
 class ProcessRunner {
 public:
     ProcessRunner() = default;
@@ -29,16 +66,46 @@ public:
         const std::string& command,
         const std::vector<std::string>& args,
         const std::optional<std::string>& working_dir = std::nullopt,
-        const std::optional<std::vector<std::pair<std::string, std::string>>>& env = std::nullopt
+        const std::optional<std::vector<std::pair<std::string, std::string>>>& env = std::nullopt,
+        const CaptureOptions& capture = {}
     ) const;
 
     ProcessResult run_java(
         const std::string& java_path,
         const std::string& jar_path,
         const std::vector<std::string>& java_args,
-        const std::optional<std::string>& working_dir = std::nullopt
+        const std::optional<std::string>& working_dir = std::nullopt,
+        const std::vector<std::string>& jvm_args = {},
+        const ProcessPriority& priority = {},
+        const CaptureOptions& capture = {}
+    ) const;
+
+    // Starts a process without waiting for it, so the caller can overlap
+    // other work with its startup
+    ChildProcess spawn(
+        const std::string& command,
+        const std::vector<std::string>& args,
+        const std::optional<std::string>& working_dir = std::nullopt,
+        const std::optional<std::vector<std::pair<std::string, std::string>>>& env = std::nullopt,
+        const ProcessPriority& priority = {}
+    ) const;
+
+    // jvm_args (e.g. -Xmx) are placed before -jar
+    ChildProcess spawn_java(
+        const std::string& java_path,
+        const std::string& jar_path,
+        const std::vector<std::string>& java_args,
+        const std::optional<std::string>& working_dir = std::nullopt,
+        const std::vector<std::string>& jvm_args = {},
+        const ProcessPriority& priority = {}
     ) const;
 
+    // Collects the output of a spawned process and reaps it
+    ProcessResult wait(ChildProcess& child, const CaptureOptions& capture = {}) const;
+
+    // Terminates a spawned process and reaps it
+    void kill(ChildProcess& child) const;
+
 private:
     std::string join_args(const std::vector<std::string>& args) const;
     std::string escape_argument(const std::string& arg) const;
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace aab2apk {
+
+// Incremental SHA-256, fed from the same buffers that are being written so
+// output digests never cost an extra read pass.
+class Sha256 {
+public:
+    using Digest = std::array<uint8_t, 32>;
+
+    Sha256() { reset(); }
+
+    void reset();
+    void update(const void* data, size_t size);
+    Digest finish();
+
+    static Digest hash(const void* data, size_t size);
+    static std::string to_hex(const Digest& digest);
+
+private:
+    std::array<uint32_t, 8> state_;
+    std::array<uint8_t, 64> buffer_;
+    size_t buffered_ = 0;
+    uint64_t total_ = 0;
+
+    void compress(const uint8_t* block, size_t blocks);
+};
+
+} // namespace aab2apk
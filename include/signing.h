@@ -4,6 +4,7 @@
 #include "process_runner.h"
 #include <string>
 #include <filesystem>
+#include <mutex>
 
 namespace aab2apk {
 
@@ -11,19 +12,48 @@ class SigningManager {
 public:
     explicit SigningManager(const ProcessRunner& runner) : runner_(runner) {}
 
+    // With v4, also writes the APK Signature Scheme v4 signature to
+    // <apk>.idsig: apksigner signs the root hash, and the Merkle tree is
+    // built natively on several threads
     bool sign_apk(
         const std::filesystem::path& apk_path,
-        const SigningConfig& config
+        const SigningConfig& config,
+        bool v4 = false,
+        const CaptureOptions& capture = {}
     ) const;
 
+    // Signs every APK inside a .apks archive (or every APK in a directory).
+    // An archive's APKs are extracted and signed on up to jobs signers at
+    // once (0 = auto), then the archive is rewritten in place in one pass,
+    // with its other entries copied as they are stored.
     bool sign_apks(
         const std::filesystem::path& apks_path,
-        const SigningConfig& config
+        const SigningConfig& config,
+        unsigned jobs = 0,
+        const CaptureOptions& capture = {}
     ) const;
 
+    // Identifies the signing key (keystore contents and alias), so outputs
+    // signed with another key are never reused; empty when the keystore
+    // cannot be read
+    static std::string key_fingerprint(const SigningConfig& config);
+
+    // Resolves apksigner ahead of the first signature; the result is cached
+    // for every later sign_apk() call
+    std::string apksigner() const;
+
 private:
     const ProcessRunner& runner_;
+    mutable std::once_flag apksigner_once_;
+    mutable std::string apksigner_path_;
+
     std::string find_apksigner() const;
+    bool sign_apks_archive(
+        const std::filesystem::path& apks_path,
+        const SigningConfig& config,
+        unsigned jobs,
+        const CaptureOptions& capture
+    ) const;
     bool validate_signing_result(const ProcessResult& result) const;
 };
 
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "config.h"
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+
+namespace aab2apk {
+
+struct StagingPlan {
+    // Where bundletool's output.apks goes; empty keeps it with the other temp files
+    std::filesystem::path scratch_base;
+    bool in_memory = false;
+    uint64_t estimated_bytes = 0;
+};
+
+// Chooses where intermediates live. Bundles whose expected bundletool output
+// (the uncompressed size, four times that in split and apks mode) fits the
+// memory budget are staged on tmpfs; otherwise they go to disk. Free
+// space is checked up front so a run cannot hit ENOSPC halfway through.
+class StagingArea {
+public:
+    static bool plan(const Config& config, StagingPlan& plan, std::string& error);
+
+    // A tmpfs mount usable for scratch files (e.g. /dev/shm), if any
+    static std::optional<std::filesystem::path> find_memory_filesystem();
+    static std::optional<uint64_t> available_bytes(const std::filesystem::path& path);
+    // Sum of the uncompressed entry sizes recorded in a ZIP's central directory
+    static std::optional<uint64_t> uncompressed_size(const std::filesystem::path& archive);
+};
+
+} // namespace aab2apk
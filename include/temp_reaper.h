@@ -0,0 +1,23 @@
+#pragma once
+
+#include <filesystem>
+
+namespace aab2apk {
+
+// Takes temp directory deletion off the critical path. A directory is
+// renamed aside (so it is gone from its original name immediately) and
+// then deleted by a detached background process.
+class TempReaper {
+public:
+    static void reap(const std::filesystem::path& path);
+
+    // Removes aab2apk temp directories left behind by crashed runs. Local
+    // temp roots are swept when the owning process is gone and the directory
+    // is over an hour old (the owner may live in another PID namespace that
+    // shares /tmp or /dev/shm); directories beside output directories
+    // (possibly on shared storage, where the pid means nothing) only once
+    // they are older than a day.
+    static void sweep_stale(const std::filesystem::path& base, bool local);
+};
+
+} // namespace aab2apk
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "aab_converter.h"
+#include "config.h"
+#include "job_scheduler.h"
+#include <atomic>
+#include <filesystem>
+#include <string>
+
+namespace aab2apk {
+
+// Worker for a job queue kept in a shared directory, so any number of
+// aab2apk processes on any number of hosts (e.g. over NFS) can split a
+// workload using nothing but POSIX file operations:
+//
+//   pending/<job>.json          job requests (same fields as serve)
+//   claimed/<job>@<worker>.json claimed by a worker; the mtime is its lease
+//   done/<job>.json, failed/<job>.json plus <job>.result.json next to them
+//
+// A job is claimed by renaming it out of pending/, which exactly one worker
+// can win. The owner renews the lease by touching the claim while the job
+// runs; a claim whose lease has expired is renamed back into pending/ by
+// whichever worker notices first.
+class WorkQueue {
+public:
+    WorkQueue(const Config& defaults, const AabConverter& converter)
+        : defaults_(defaults), converter_(converter) {}
+
+    // Processes jobs until the queue is drained (or, with --watch, until
+    // SIGINT/SIGTERM); returns non-zero if any job this worker ran failed
+    int run();
+
+private:
+    const Config& defaults_;
+    const AabConverter& converter_;
+    std::filesystem::path root_;
+    std::string worker_id_;
+    std::atomic<bool> any_failed_{false};
+
+    bool prepare();
+    // Current time as seen by the filesystem holding the queue, so leases
+    // are compared without relying on clocks being in sync across hosts
+    bool queue_time(std::filesystem::file_time_type& now) const;
+    void requeue_expired() const;
+    bool claim(std::filesystem::path& claimed, std::string& job_name) const;
+    bool has_claims() const;
+    void run_job(const std::filesystem::path& claimed, const std::string& job_name, JobScheduler& scheduler);
+};
+
+} // namespace aab2apk
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace aab2apk {
+
+struct ZipEntry {
+    std::string name;
+    uint16_t flags = 0;
+    uint16_t method = 0;
+    uint16_t mod_time = 0;
+    uint16_t mod_date = 0;
+    uint32_t crc32 = 0;
+    uint64_t compressed_size = 0;
+    uint64_t uncompressed_size = 0;
+    uint64_t local_header_offset = 0;
+    uint32_t external_attributes = 0;
+
+    bool is_directory() const { return !name.empty() && name.back() == '/'; }
+};
+
+// Read-only ZIP archive access (.aab, .apks, .apk). Entries are streamed
+// straight from the archive and their CRC-32 is checked on the fly, so
+// corruption is detected without a second read pass.
+//
+// Reads use positional I/O, so a single open reader may be shared by
+// several threads extracting different entries.
+class ZipReader {
+public:
+    static constexpr uint16_t METHOD_STORED = 0;
+    static constexpr uint16_t METHOD_DEFLATED = 8;
+
+    // Receives uncompressed data in order; return false to abort extraction
+    using Sink = std::function<bool(const unsigned char* data, size_t size)>;
+
+    ZipReader() = default;
+    ~ZipReader();
+
+    ZipReader(const ZipReader&) = delete;
+    ZipReader& operator=(const ZipReader&) = delete;
+
+    bool open(const std::filesystem::path& path, std::string& error);
+    void close();
+
+    const std::filesystem::path& path() const { return path_; }
+    const std::vector<ZipEntry>& entries() const { return entries_; }
+    const ZipEntry* find(const std::string& name) const;
+
+    bool extract(const ZipEntry& entry, const Sink& sink, std::string& error) const;
+
+    // Where the entry's stored bytes start, from its local header
+    bool data_offset(const ZipEntry& entry, uint64_t& offset, std::string& error) const;
+
+    // Streams the entry's stored bytes (still compressed) without checking them
+    bool read_raw(const ZipEntry& entry, const Sink& sink, std::string& error) const;
+
+    // Writes the entry to dest. A partially written file is removed on failure.
+    bool extract_to_file(
+        const ZipEntry& entry,
+        const std::filesystem::path& dest,
+        std::string& error
+    ) const;
+
+    // Extracts every entry below dest_dir, rejecting names that escape it.
+    bool extract_all(const std::filesystem::path& dest_dir, std::string& error) const;
+
+private:
+#ifdef _WIN32
+    void* handle_ = nullptr;
+#else
+    int fd_ = -1;
+#endif
+    std::filesystem::path path_;
+    uint64_t file_size_ = 0;
+    std::vector<ZipEntry> entries_;
+
+    bool read_at(uint64_t offset, void* buffer, size_t size) const;
+    bool read_central_directory(std::string& error);
+
+    friend class ZipWriter;
+};
+
+struct ZipAddOptions {
+    bool compress = true;       // deflate, unless that does not make the entry smaller
+    int level = 6;              // zlib level, 1 (fastest) to 9 (smallest)
+    uint32_t alignment = 0;     // stored entries: align the data to this many bytes
+    uint16_t mod_time = 0;
+    uint16_t mod_date = 0x0221; // 1981-01-01, as bundletool writes
+    uint32_t external_attributes = 0;
+};
+
+// Sequential ZIP writer. Entries copied from another archive keep their
+// stored bytes, so rewriting an archive never recompresses them. New entries
+// are deflated pigz-style: the data is cut into blocks that are compressed
+// on several threads and joined into a single deflate stream. Zip64 records
+// are written only when sizes, offsets or the entry count need them.
+class ZipWriter {
+public:
+    ZipWriter() = default;
+    ~ZipWriter();
+
+    ZipWriter(const ZipWriter&) = delete;
+    ZipWriter& operator=(const ZipWriter&) = delete;
+
+    bool open(const std::filesystem::path& path, std::string& error);
+
+    // Threads used to deflate a single entry (default 1)
+    void set_threads(unsigned threads) { threads_ = threads > 0 ? threads : 1; }
+
+    // Copies entry from source unchanged (method, CRC-32, timestamps); only
+    // the local header is rewritten, padded to alignment for stored entries.
+    // The data moves with copy_file_range where the kernel supports it.
+    bool add_raw(const ZipReader& source, const ZipEntry& entry, std::string& error, uint32_t alignment = 0);
+
+    bool add_data(
+        const std::string& name,
+        const unsigned char* data,
+        size_t size,
+        const ZipAddOptions& options,
+        std::string& error
+    );
+    // Streams source in bounded chunks rather than reading it whole; the
+    // deflated form is spooled to a temporary file until its size is known
+    bool add_file(
+        const std::string& name,
+        const std::filesystem::path& source,
+        const ZipAddOptions& options,
+        std::string& error
+    );
+
+    // Writes data the caller already compressed (or chose to store): entry
+    // carries the name, method, CRC-32, both sizes and timestamps
+    bool add_prepared(ZipEntry entry, const std::string& data, uint32_t alignment, std::string& error);
+
+    // Raw deflate of data, compressed in blocks on up to threads threads
+    static bool deflate_parallel(
+        const unsigned char* data,
+        size_t size,
+        int level,
+        unsigned threads,
+        std::string& out,
+        std::string& error
+    );
+
+    // Writes the central directory and closes the file
+    bool finish(std::string& error);
+
+private:
+    int fd_ = -1;
+    std::filesystem::path path_;
+    std::string buffer_;        // headers, gathered into larger writes
+    bool write_failed_ = false;
+    uint64_t offset_ = 0;
+    unsigned threads_ = 1;
+    std::vector<ZipEntry> entries_;
+
+    void write(const std::string& bytes);
+    void write(const unsigned char* data, size_t size);
+    bool flush();
+    void close_file();
+    // Places entry at the current offset and writes its local header,
+    // padded so a stored entry's data starts on an alignment boundary
+    void write_local_header(ZipEntry& entry, uint32_t alignment);
+};
+
+} // namespace aab2apk
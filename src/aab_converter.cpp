@@ -1,8 +1,25 @@
 #include "aab_converter.h"
+#include "apk_align.h"
+#include "apk_recompress.h"
+#include "blob_store.h"
+#include "bounded_queue.h"
 #include "file_utils.h"
-#include <iostream>
+#include "logger.h"
+#include "module_store.h"
+#include "sha256.h"
+#include "staging.h"
+#include "temp_reaper.h"
+#include "zip_archive.h"
 #include <fstream>
 #include <algorithm>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <thread>
 #include <vector>
 
 #ifdef _WIN32
@@ -16,57 +33,460 @@ namespace aab2apk {
 
 namespace fs = std::filesystem;
 
+namespace {
+
+// bundletool's and apksigner's output: bounded in memory, complete in the
+// job's --tool-log file
+CaptureOptions tool_capture(const Config& config) {
+    CaptureOptions capture;
+    capture.limit = static_cast<size_t>(config.tool_output_kb * 1024);
+    if (!config.tool_log_dir.empty()) {
+        fs::path log = fs::path(config.tool_log_dir) / (fs::path(config.input_aab).stem().string() + ".log");
+        capture.log_path = log.string();
+    }
+    return capture;
+}
+
+uint64_t published_bytes(const ArtifactManifest& manifest) {
+    uint64_t total = 0;
+    for (const auto& apk : manifest.apks) {
+        total += apk.size;
+    }
+    return total;
+}
+
+} // anonymous namespace
+
 bool AabConverter::convert(const Config& config) const {
-    // Create output directory
-    fs::path output_path(config.output_dir);
-    if (!FileUtils::create_directories(output_path)) {
-        std::cerr << "Error: Failed to create output directory: " << config.output_dir << "\n";
+    ArtifactManifest manifest;
+    return convert(config, manifest);
+}
+
+bool AabConverter::convert(const Config& config, ArtifactManifest& manifest) const {
+    return convert(config, manifest, {});
+}
+
+bool AabConverter::convert(
+    const Config& config,
+    ArtifactManifest& manifest,
+    const std::function<bool()>& preflight,
+    ConversionStats* stats,
+    const SignedSplitCache* signed_cache,
+    const ProgressCallback& progress
+) const {
+    // Preflight checks run alongside the setup below and bundletool's JVM
+    // startup; their verdict is only needed before bundletool's output is
+    // used. Setup errors are reported only if the preflight passed, since a
+    // failed validation is the more useful message.
+    // The job's verbosity applies to every thread working for it
+    Logger::Scope log_scope(Logger::level_for(config.verbose, config.quiet));
+    const LogContext log_context = Logger::context();
+
+    std::future<bool> preflight_result;
+    if (preflight) {
+        preflight_result = std::async(std::launch::async, [&preflight, &log_context] {
+            Logger::Scope scope(log_context);
+            return preflight();
+        });
+    }
+    std::optional<bool> preflight_passed;
+    std::function<bool()> await_preflight = [&]() {
+        if (!preflight_passed.has_value()) {
+            preflight_passed = !preflight_result.valid() || preflight_result.get();
+        }
+        return preflight_passed.value();
+    };
+    auto fail = [&](const std::string& message) {
+        if (await_preflight()) {
+            Log::error() << message;
+        }
         return false;
+    };
+
+    // Streamed outputs never touch the output directory
+    const bool streaming = config.output_fd >= 0;
+    fs::path output_path(config.output_dir);
+    if (!streaming && !FileUtils::create_directories(output_path)) {
+        return fail("Failed to create output directory: " + config.output_dir);
+    }
+
+    // Each run starts its job's log afresh; bundletool and the signers append
+    if (!config.tool_log_dir.empty()) {
+        const std::string log = tool_capture(config).log_path;
+        if (!FileUtils::create_directories(config.tool_log_dir) || !std::ofstream(log, std::ios::trunc)) {
+            return fail("Cannot write tool log: " + log);
+        }
     }
 
     // Create temporary directory for intermediate files
     fs::path temp_dir;
     try {
-        temp_dir = FileUtils::create_temp_directory();
+        temp_dir = FileUtils::create_temp_directory(streaming ? fs::path() : output_path);
     } catch (const std::exception& e) {
-        std::cerr << "Error: Failed to create temporary directory: " << e.what() << "\n";
-        return false;
+        return fail(std::string("Failed to create temporary directory: ") + e.what());
     }
 
-    // Ensure cleanup
+    // Ensure cleanup. Deletion runs in the background so it does not delay
+    // reporting; the outputs are already published by the time it starts.
     struct TempDirGuard {
         fs::path path;
-        ~TempDirGuard() { FileUtils::remove_temp_directory(path); }
+        ~TempDirGuard() {
+            if (!path.empty()) {
+                TempReaper::reap(path);
+            }
+        }
     } guard{temp_dir};
 
+    // bundletool's output.apks is thrown away after extraction; keep it on
+    // tmpfs when the bundle fits the memory budget
+    StagingPlan staging;
+    std::string staging_error;
+    if (!StagingArea::plan(config, staging, staging_error)) {
+        return fail(staging_error);
+    }
+
+    fs::path scratch_dir = temp_dir;
+    TempDirGuard scratch_guard{};
+    if (staging.in_memory) {
+        try {
+            scratch_dir = FileUtils::create_temp_directory_in(staging.scratch_base);
+            scratch_guard.path = scratch_dir;
+        } catch (const std::exception&) {
+            scratch_dir = temp_dir;
+        }
+    }
+
+    Log::debug() << "Staging intermediates in " << scratch_dir.string()
+                 << (staging.in_memory ? " (memory)" : " (disk)");
+
+    // Everything is extracted and signed in a staging directory next to the
+    // output, which is then published in one step: consumers watching the
+    // output never see unsigned or partially written APKs, and a failed run
+    // leaves the output untouched. When streaming nothing is published: APKs
+    // that are still rewritten (signed, aligned, recompressed) before being
+    // streamed wait next to bundletool's output, in memory when it fits.
+    fs::path stage_dir = (streaming ? scratch_dir : temp_dir) / "publish";
+    if (!FileUtils::create_directories(stage_dir)) {
+        return fail("Failed to create staging directory: " + stage_dir.string());
+    }
+
+    // A split set is streamed as a tar archive, a universal APK as is
+    std::optional<ArtifactStream> stream;
+    std::mutex stream_mutex;
+    if (streaming) {
+        stream.emplace(config.output_fd, config.mode == OutputMode::Split);
+    }
+
+    Workspace workspace{scratch_dir, temp_dir, stage_dir, await_preflight, stats, signed_cache,
+                        stream ? &*stream : nullptr, &stream_mutex, &progress};
+    std::error_code size_ec;
+    uint64_t input_size = fs::file_size(config.input_aab, size_ec);
+    workspace.report("started", "", size_ec ? 0 : input_size);
     bool success = false;
     if (config.mode == OutputMode::Universal) {
-        success = convert_to_universal(config, temp_dir);
+        success = convert_to_universal(config, workspace, manifest);
+    } else if (config.mode == OutputMode::Apks) {
+        success = convert_to_apks_archive(config, workspace, manifest);
     } else {
-        success = convert_to_split(config, temp_dir);
+        success = convert_to_split(config, workspace, manifest);
     }
 
     if (!success) {
         return false;
     }
 
-    // Sign APKs if signing config is provided
+    // Align and sign the universal APK (recompressed, if asked, during
+    // conversion). Split mode does this for each split inside its
+    // extraction pipeline instead.
+    const bool rewritten_universal = config.signing.has_value() || config.align_page > 0 ||
+                                     config.compression != CompressionMode::Keep;
+    if (rewritten_universal && config.mode == OutputMode::Universal) {
+        fs::path apk_path = stage_dir / (fs::path(config.input_aab).stem().string() + ".apk");
+        bool rewritten = false;
+        if (!finish_apk(config, apk_path, apk_path.filename().string(), rewritten)) {
+            return false;
+        }
+        if (config.signing.has_value()) {
+            std::error_code ec;
+            workspace.report("signed", apk_path.filename().string(), fs::file_size(apk_path, ec));
+        }
+
+        // apksigner rewrites the files, so digests taken during extraction are
+        // stale; re-hash the signed outputs once while they are still cached
+        for (auto& apk : manifest.apks) {
+            if (rewritten && !FileUtils::hash_file(apk.path, apk.sha256, apk.size)) {
+                Log::error() << "Failed to hash signed APK: " << apk.path;
+                return false;
+            }
+        }
+
+        std::string stream_error;
+        if (stream && !stream->add_file(apk_path, apk_path.filename().string(), stream_error)) {
+            Log::error() << stream_error;
+            return false;
+        }
+    }
+
+    if (stream) {
+        std::string stream_error;
+        if (!stream->finish(stream_error)) {
+            Log::error() << stream_error;
+            return false;
+        }
+        for (auto& apk : manifest.apks) {
+            apk.path.clear();
+        }
+        Log::info() << "Streamed " << manifest.apks.size() << " APK(s) to file descriptor " << config.output_fd;
+        workspace.report("published", "", published_bytes(manifest));
+        return true;
+    }
+
+    if (!FileUtils::publish_directory(stage_dir, output_path)) {
+        Log::error() << "Failed to publish APKs to output directory: " << config.output_dir;
+        return false;
+    }
+    for (auto& apk : manifest.apks) {
+        apk.path = output_path / apk.name;
+    }
+    workspace.report("published", "", published_bytes(manifest));
+
+    Log::info() << "Successfully converted AAB to APK(s) in: " << config.output_dir;
+
+    return true;
+}
+
+bool AabConverter::finish_apk(
+    const Config& config,
+    const fs::path& apk_path,
+    const std::string& name,
+    bool& rewritten
+) const {
+    rewritten = false;
+    AlignmentPolicy policy;
+    policy.native_libs = config.align_page;
+    std::string error;
+
+    // Before signing: the v2+ signature covers the file's layout
+    if (config.align_page > 0 && !config.verify_align) {
+        if (!ApkAligner::align(apk_path, policy, rewritten, error)) {
+            Log::error() << "Failed to align " << name << ": " << error;
+            return false;
+        }
+    }
+
+    if (config.signing.has_value()) {
+        if (!signer_.sign_apk(apk_path, config.signing.value(), config.v4_signature, tool_capture(config))) {
+            return false;
+        }
+        rewritten = true;
+    }
+
+    if (config.verify_align) {
+        std::vector<std::string> misaligned;
+        if (!ApkAligner::verify(apk_path, policy, misaligned, error)) {
+            Log::error() << "Failed to check alignment of " << name << ": " << error;
+            return false;
+        }
+        if (!misaligned.empty()) {
+            LogLine line(LogLevel::Error);
+            line << name << " has " << misaligned.size() << " misaligned entr"
+                 << (misaligned.size() == 1 ? "y" : "ies") << ":";
+            for (const auto& entry : misaligned) {
+                line << "\n  " << entry;
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+bool AabConverter::run_bundletool(
+    const Config& config,
+    const std::vector<std::string>& args,
+    const Workspace& workspace,
+    bool report_failure
+) const {
+    // The JVM is started speculatively: its startup dominates short runs, so
+    // it proceeds while the preflight finishes, and is killed if that fails
+    ProcessPriority priority;
+    priority.nice = config.bundletool_nice;
+    priority.background_io = config.bundletool_background_io;
+    ChildProcess bundletool = runner_.spawn_java(
+        config.java_path,
+        config.bundletool_path,
+        args,
+        workspace.scratch_dir.string(),
+        config.jvm_args,
+        priority
+    );
+
+    if (!workspace.await_preflight()) {
+        runner_.kill(bundletool);
+        return false;
+    }
+
+    ProcessResult result = runner_.wait(bundletool, tool_capture(config));
+    if (workspace.stats != nullptr) {
+        workspace.stats->bundletool_peak_rss = result.peak_rss_bytes;
+    }
+    if (!result.success()) {
+        if (!report_failure) {
+            return false;
+        }
+        // One record, so the tool's output stays with its error
+        Log::error() << "bundletool execution failed"
+                     << (result.stderr_output.empty() ? "" : "\n") << result.stderr_output;
+        return false;
+    }
+    std::error_code ec;
+    workspace.report("bundletool", "", fs::file_size(workspace.scratch_dir / "output.apks", ec));
+    return true;
+}
+
+void AabConverter::plan_module_reuse(
+    const Config& config,
+    const Workspace& workspace,
+    std::map<std::string, std::string>& module_keys,
+    std::map<std::string, std::vector<ApkArtifact>>& reused,
+    fs::path& bundle
+) const {
+    // Splits depend on the bundletool build, the alignment pass and, once
+    // signed, on the key
+    std::error_code ec;
+    fs::path bundletool = FileUtils::get_absolute_path(config.bundletool_path);
+    std::string context = "split\n" + bundletool.string() + "\n" +
+                          std::to_string(fs::file_size(bundletool, ec)) + "\n" +
+                          std::to_string(fs::last_write_time(bundletool, ec).time_since_epoch().count()) + "\n";
     if (config.signing.has_value()) {
-        if (config.mode == OutputMode::Universal) {
-            fs::path apk_path = output_path / (fs::path(config.input_aab).stem().string() + ".apk");
-            if (!signer_.sign_apk(apk_path, config.signing.value())) {
+        std::string key = SigningManager::key_fingerprint(config.signing.value());
+        if (key.empty()) {
+            return;
+        }
+        context += key;
+    }
+    if (config.align_page > 0 && !config.verify_align) {
+        context += "\nalign=" + std::to_string(config.align_page);
+    }
+
+    // Unreadable bundles are left for validation to report
+    std::string error;
+    if (!ModuleStore::module_keys(config.input_aab, context, module_keys, error)) {
+        module_keys.clear();
+        return;
+    }
+
+    ModuleStore store(config.module_cache);
+    std::set<std::string> pruned;
+    for (const auto& [module, key] : module_keys) {
+        std::vector<ApkArtifact> apks;
+        if (store.lookup(module, key, apks)) {
+            reused[module] = std::move(apks);
+            pruned.insert(module);
+        }
+    }
+    if (pruned.empty()) {
+        return;
+    }
+
+    fs::path pruned_bundle = workspace.temp_dir / "pruned.aab";
+    if (!ModuleStore::prune_bundle(config.input_aab, pruned_bundle, pruned, error)) {
+        reused.clear();
+        return;
+    }
+    bundle = pruned_bundle;
+
+    Log::debug() << "Reusing " << pruned.size() << " unchanged module(s) from " << config.module_cache;
+}
+
+bool AabConverter::extract_apks(
+    const fs::path& apks_file,
+    const fs::path& extract_dir,
+    const std::function<bool(ApkArtifact&&)>& on_extracted,
+    ArtifactStream* direct
+) const {
+    // Entries are inflated straight from the archive and checked against
+    // their recorded CRC-32 while streaming, so a corrupt .apks (or a flaky
+    // network filesystem) fails the conversion instead of publishing bad APKs.
+    // The SHA-256 for the manifest is computed from the same buffers.
+    ZipReader archive;
+    std::string error;
+    if (!archive.open(apks_file, error)) {
+        Log::error() << error;
+        return false;
+    }
+
+    std::map<std::string, SplitTargeting> toc;
+    if (const ZipEntry* toc_entry = archive.find("toc.pb")) {
+        std::string toc_data;
+        toc_data.reserve(static_cast<size_t>(toc_entry->uncompressed_size));
+        bool read = archive.extract(*toc_entry, [&toc_data](const unsigned char* data, size_t size) {
+            toc_data.append(reinterpret_cast<const char*>(data), size);
+            return true;
+        }, error);
+        if (read) {
+            toc = ArtifactManifest::parse_toc(toc_data);
+        }
+    }
+
+    for (const auto& entry : archive.entries()) {
+        if (entry.is_directory() || fs::path(entry.name).extension() != ".apk") {
+            continue;
+        }
+
+        ApkArtifact apk;
+        apk.source = entry.name;
+        apk.name = fs::path(entry.name).filename().string();
+        apk.path = extract_dir / apk.name;
+        auto targeting = toc.find(entry.name);
+        apk.targeting = targeting != toc.end() ? targeting->second
+                                               : ArtifactManifest::guess_targeting(entry.name);
+
+        // Straight from the archive into the output stream, without a file
+        if (direct != nullptr) {
+            Sha256 sha;
+            bool ok = direct->begin_file(apk.name, entry.uncompressed_size, error) &&
+                      archive.extract(entry, [direct, &sha, &error](const unsigned char* data, size_t size) {
+                          sha.update(data, size);
+                          return direct->write(data, size, error);
+                      }, error) &&
+                      direct->end_file(error);
+            if (!ok) {
+                Log::error() << error;
                 return false;
             }
-        } else {
-            // Sign all APKs in output directory
-            if (!signer_.sign_apks(output_path, config.signing.value())) {
+            apk.path.clear();
+            apk.size = entry.uncompressed_size;
+            apk.sha256 = Sha256::to_hex(sha.finish());
+            if (!on_extracted(std::move(apk))) {
                 return false;
             }
+            continue;
+        }
+
+        std::ofstream out(apk.path, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            Log::error() << "Failed to create " << apk.path;
+            return false;
         }
-    }
 
-    if (!config.quiet) {
-        std::cout << "Successfully converted AAB to APK(s) in: " << config.output_dir << "\n";
+        Sha256 sha;
+        bool ok = archive.extract(entry, [&out, &sha](const unsigned char* data, size_t size) {
+            sha.update(data, size);
+            out.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+            return static_cast<bool>(out);
+        }, error);
+        out.close();
+
+        if (!ok || out.fail()) {
+            Log::error() << (ok ? "write failed for " + apk.path.string() : error);
+            return false;
+        }
+
+        apk.size = entry.uncompressed_size;
+        apk.sha256 = Sha256::to_hex(sha.finish());
+        if (!on_extracted(std::move(apk))) {
+            return false;
+        }
     }
 
     return true;
@@ -74,46 +494,37 @@ bool AabConverter::convert(const Config& config) const {
 
 bool AabConverter::convert_to_universal(
     const Config& config,
-    const fs::path& temp_dir
+    const Workspace& workspace,
+    ArtifactManifest& manifest
 ) const {
+    const fs::path& scratch_dir = workspace.scratch_dir;
+    const fs::path& temp_dir = workspace.temp_dir;
+    const fs::path& stage_dir = workspace.stage_dir;
+
     fs::path bundletool_path(config.bundletool_path);
     if (!FileUtils::file_exists(bundletool_path)) {
-        std::cerr << "Error: bundletool.jar not found: " << bundletool_path << "\n";
+        Log::error() << "bundletool.jar not found: " << bundletool_path;
         return false;
     }
 
-    fs::path output_path(config.output_dir);
-    fs::path output_apk = output_path / (fs::path(config.input_aab).stem().string() + ".apk");
+    fs::path output_apk = stage_dir / (fs::path(config.input_aab).stem().string() + ".apk");
 
     std::vector<std::string> args;
     args.push_back("build-apks");
     args.push_back("--bundle=" + FileUtils::get_absolute_path(config.input_aab));
-    args.push_back("--output=" + (temp_dir / "output.apks").string());
+    args.push_back("--output=" + (scratch_dir / "output.apks").string());
     args.push_back("--mode=universal");
 
-    if (!config.quiet) {
-        std::cout << "Converting AAB to universal APK...\n";
-    }
-
-    ProcessResult result = runner_.run_java(
-        config.java_path,
-        bundletool_path.string(),
-        args,
-        temp_dir.string()
-    );
+    Log::info() << "Converting AAB to universal APK...";
 
-    if (!result.success()) {
-        std::cerr << "Error: bundletool execution failed\n";
-        if (!result.stderr_output.empty()) {
-            std::cerr << result.stderr_output << "\n";
-        }
+    if (!run_bundletool(config, args, workspace)) {
         return false;
     }
 
     // Extract universal APK from .apks file
-    fs::path apks_file = temp_dir / "output.apks";
+    fs::path apks_file = scratch_dir / "output.apks";
     if (!FileUtils::file_exists(apks_file)) {
-        std::cerr << "Error: bundletool did not generate output file\n";
+        Log::error() << "bundletool did not generate output file";
         return false;
     }
 
@@ -123,216 +534,416 @@ bool AabConverter::convert_to_universal(
     
     // Extract .apks ZIP file to get the APK
     // .apks is a ZIP file, so we extract it directly
-    fs::path extract_dir = temp_dir / "extracted";
+    // When streaming, extracted APKs wait next to bundletool's output (in
+    // memory when it fits) rather than on disk
+    fs::path extract_dir = (workspace.stream != nullptr ? scratch_dir : temp_dir) / "extracted";
     try {
         fs::create_directories(extract_dir);
     } catch (const std::exception& e) {
-        std::cerr << "Error: Failed to create extraction directory: " << e.what() << "\n";
+        Log::error() << "Failed to create extraction directory: " << e.what();
         return false;
     }
 
-#ifdef _WIN32
-    // On Windows, use PowerShell Expand-Archive
-    // PowerShell requires .zip extension, so copy file temporarily
-    fs::path zip_copy = temp_dir / "output.zip";
-    try {
-        fs::copy_file(apks_file, zip_copy, fs::copy_options::overwrite_existing);
-    } catch (const std::exception& e) {
-        std::cerr << "Error: Failed to copy .apks file: " << e.what() << "\n";
+    const bool rewriting = config.signing.has_value() || config.align_page > 0 ||
+                           config.compression != CompressionMode::Keep;
+    ArtifactStream* direct = rewriting ? nullptr : workspace.stream;
+    ArtifactManifest extracted;
+    bool extracted_ok = extract_apks(apks_file, extract_dir, [&](ApkArtifact&& apk) {
+        workspace.report("extracted", output_apk.filename().string(), apk.size);
+        extracted.apks.push_back(std::move(apk));
+        return true;
+    }, direct);
+    if (!extracted_ok) {
+        Log::error() << "Failed to extract APK from .apks file";
         return false;
     }
-    
-    std::vector<std::string> extract_args;
-    extract_args.push_back("-Command");
-    extract_args.push_back("Expand-Archive -Path \"" + zip_copy.string() + "\" -DestinationPath \"" + extract_dir.string() + "\" -Force");
-    
-    ProcessResult extract_result = runner_.run(
-        "powershell.exe",
-        extract_args,
-        temp_dir.string()
-    );
-    
-    // Clean up temporary zip file
-    try {
-        fs::remove(zip_copy);
-    } catch (...) {
-        // Ignore cleanup errors
-    }
-#else
-    // On Unix, use unzip
-    std::vector<std::string> extract_args;
-    extract_args.push_back("-q");
-    extract_args.push_back(apks_file.string());
-    extract_args.push_back("-d");
-    extract_args.push_back(extract_dir.string());
-    
-    ProcessResult extract_result = runner_.run(
-        "unzip",
-        extract_args,
-        temp_dir.string()
-    );
-#endif
 
-    if (!extract_result.success()) {
-        std::cerr << "Error: Failed to extract APK from .apks file\n";
-        if (!extract_result.stderr_output.empty()) {
-            std::cerr << extract_result.stderr_output << "\n";
-        }
+    if (extracted.apks.empty()) {
+        Log::error() << "No APK found in extracted files";
         return false;
     }
 
-    // Find the extracted APK
-    fs::path extracted_apk;
-    for (const auto& entry : fs::recursive_directory_iterator(extract_dir)) {
-        if (entry.is_regular_file() && entry.path().extension() == ".apk") {
-            extracted_apk = entry.path();
-            break;
-        }
+    ApkArtifact apk = extracted.apks.front();
+    fs::path extracted_apk = apk.path;
+    if (direct != nullptr) {
+        apk.name = output_apk.filename().string();
+        manifest.apks.push_back(std::move(apk));
+        return true;
     }
 
-    if (extracted_apk.empty()) {
-        std::cerr << "Error: No APK found in extracted files\n";
+    // Move APK to output directory
+    if (!FileUtils::move_file(extracted_apk, output_apk)) {
+        Log::error() << "Failed to stage APK: " << output_apk;
         return false;
     }
 
-    // Move APK to output directory
-    try {
-        fs::rename(extracted_apk, output_apk);
-    } catch (const std::exception&) {
-        // Try copy if rename fails (cross-filesystem)
-        try {
-            fs::copy_file(extracted_apk, output_apk, fs::copy_options::overwrite_existing);
-            fs::remove(extracted_apk);
-        } catch (const std::exception& e2) {
-            std::cerr << "Error: Failed to move APK to output directory: " << e2.what() << "\n";
+    apk.name = output_apk.filename().string();
+    apk.path = output_apk;
+
+    // Recompression comes before alignment and signing, which both depend
+    // on the final entry layout
+    if (config.compression != CompressionMode::Keep) {
+        AlignmentPolicy policy;
+        policy.native_libs = config.align_page > 0 ? config.align_page : 4096;
+        unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+        std::string error;
+        if (!ApkRecompressor::recompress(output_apk, config.compression, policy, threads, error)) {
+            Log::error() << "Failed to recompress " << apk.name << ": " << error;
+            return false;
+        }
+        if (!FileUtils::hash_file(output_apk, apk.sha256, apk.size)) {
+            Log::error() << "Failed to hash APK: " << output_apk;
             return false;
         }
+        Log::debug() << "Recompressed " << apk.name << " with " << ApkRecompressor::backend()
+                     << " on " << threads << " threads (" << apk.size << " bytes)";
     }
 
+    manifest.apks.push_back(std::move(apk));
+
     return true;
 }
 
-bool AabConverter::convert_to_split(
+bool AabConverter::convert_to_apks_archive(
     const Config& config,
-    const fs::path& temp_dir
+    const Workspace& workspace,
+    ArtifactManifest& manifest
 ) const {
+    const fs::path& scratch_dir = workspace.scratch_dir;
+    const fs::path& stage_dir = workspace.stage_dir;
+
     fs::path bundletool_path(config.bundletool_path);
     if (!FileUtils::file_exists(bundletool_path)) {
-        std::cerr << "Error: bundletool.jar not found: " << bundletool_path << "\n";
+        Log::error() << "bundletool.jar not found: " << bundletool_path;
         return false;
     }
 
-    fs::path output_path(config.output_dir);
-
+    fs::path apks_file = scratch_dir / "output.apks";
     std::vector<std::string> args;
     args.push_back("build-apks");
     args.push_back("--bundle=" + FileUtils::get_absolute_path(config.input_aab));
-    args.push_back("--output=" + (temp_dir / "output.apks").string());
+    args.push_back("--output=" + apks_file.string());
     args.push_back("--mode=default");
 
-    if (!config.quiet) {
-        std::cout << "Converting AAB to split APKs...\n";
+    Log::info() << "Converting AAB to an APK set archive...";
+
+    if (!run_bundletool(config, args, workspace)) {
+        return false;
+    }
+    if (!FileUtils::file_exists(apks_file)) {
+        Log::error() << "bundletool did not generate output file";
+        return false;
     }
 
-    ProcessResult result = runner_.run_java(
-        config.java_path,
-        bundletool_path.string(),
-        args,
-        temp_dir.string()
-    );
+    if (config.signing.has_value() &&
+        !signer_.sign_apks(apks_file, config.signing.value(), config.sign_jobs, tool_capture(config))) {
+        return false;
+    }
 
-    if (!result.success()) {
-        std::cerr << "Error: bundletool execution failed\n";
-        if (!result.stderr_output.empty()) {
-            std::cerr << result.stderr_output << "\n";
+    ApkArtifact archive;
+    archive.name = fs::path(config.input_aab).stem().string() + ".apks";
+    if (!FileUtils::hash_file(apks_file, archive.sha256, archive.size)) {
+        Log::error() << "Failed to read " << apks_file;
+        return false;
+    }
+    if (config.signing.has_value()) {
+        workspace.report("signed", archive.name, archive.size);
+    }
+
+    if (workspace.stream != nullptr) {
+        std::string stream_error;
+        if (!workspace.stream->add_file(apks_file, archive.name, stream_error)) {
+            Log::error() << stream_error;
+            return false;
+        }
+    } else {
+        archive.path = stage_dir / archive.name;
+        if (!FileUtils::move_file(apks_file, archive.path)) {
+            Log::error() << "Failed to stage " << archive.name;
+            return false;
         }
+    }
+    manifest.apks.push_back(std::move(archive));
+    return true;
+}
+
+bool AabConverter::convert_to_split(
+    const Config& config,
+    const Workspace& workspace,
+    ArtifactManifest& manifest
+) const {
+    const fs::path& scratch_dir = workspace.scratch_dir;
+    const fs::path& temp_dir = workspace.temp_dir;
+    const fs::path& stage_dir = workspace.stage_dir;
+
+    fs::path bundletool_path(config.bundletool_path);
+    if (!FileUtils::file_exists(bundletool_path)) {
+        Log::error() << "bundletool.jar not found: " << bundletool_path;
+        return false;
+    }
+
+    // Modules unchanged since an earlier conversion come from the module
+    // store; bundletool only builds a copy of the bundle without them
+    std::map<std::string, std::string> module_keys;
+    std::map<std::string, std::vector<ApkArtifact>> reused;
+    fs::path bundle(config.input_aab);
+    if (!config.module_cache.empty()) {
+        plan_module_reuse(config, workspace, module_keys, reused, bundle);
+    }
+
+    auto build_args = [&](const fs::path& input) {
+        std::vector<std::string> args;
+        args.push_back("build-apks");
+        args.push_back("--bundle=" + FileUtils::get_absolute_path(input));
+        args.push_back("--output=" + (scratch_dir / "output.apks").string());
+        args.push_back("--mode=default");
+        return args;
+    };
+
+    Log::info() << "Converting AAB to split APKs...";
+
+    bool built = run_bundletool(config, build_args(bundle), workspace, reused.empty());
+    if (!built && !reused.empty() && workspace.await_preflight()) {
+        // bundletool may reject a bundle missing modules others depend on
+        Log::debug() << "bundletool rejected the pruned bundle; rebuilding every module";
+        reused.clear();
+        std::error_code ec;
+        fs::remove(scratch_dir / "output.apks", ec);
+        built = run_bundletool(config, build_args(config.input_aab), workspace);
+    }
+    if (!built) {
         return false;
     }
 
     // Extract split APKs from .apks file
-    fs::path apks_file = temp_dir / "output.apks";
+    fs::path apks_file = scratch_dir / "output.apks";
     if (!FileUtils::file_exists(apks_file)) {
-        std::cerr << "Error: bundletool did not generate output file\n";
+        Log::error() << "bundletool did not generate output file";
         return false;
     }
 
     // Extract .apks ZIP file to get all split APKs
     // .apks is a ZIP file containing all split APKs
-    fs::path extract_dir = temp_dir / "extracted";
+    fs::path extract_dir = (workspace.stream != nullptr ? scratch_dir : temp_dir) / "extracted";
     try {
         fs::create_directories(extract_dir);
     } catch (const std::exception& e) {
-        std::cerr << "Error: Failed to create extraction directory: " << e.what() << "\n";
+        Log::error() << "Failed to create extraction directory: " << e.what();
         return false;
     }
 
-#ifdef _WIN32
-    // On Windows, use PowerShell Expand-Archive
-    // PowerShell requires .zip extension, so copy file temporarily
-    fs::path zip_copy = temp_dir / "output.zip";
-    try {
-        fs::copy_file(apks_file, zip_copy, fs::copy_options::overwrite_existing);
-    } catch (const std::exception& e) {
-        std::cerr << "Error: Failed to copy .apks file: " << e.what() << "\n";
-        return false;
+    // Splits are signed while later ones are still being extracted: the
+    // extractor feeds a bounded queue drained by a pool of signers, so the
+    // wall time approaches the slower of the two stages rather than their sum.
+    const bool signing = config.signing.has_value();
+    const bool finishing = signing || config.align_page > 0;
+    // Splits kept by an interrupted run have no .idsig to go with them
+    const SignedSplitCache* cache = signing && !config.v4_signature ? workspace.signed_cache : nullptr;
+    unsigned signer_count = config.sign_jobs;
+    if (signer_count == 0) {
+        signer_count = std::max(1u, std::min(4u, std::thread::hardware_concurrency()));
     }
-    
-    std::vector<std::string> extract_args;
-    extract_args.push_back("-Command");
-    extract_args.push_back("Expand-Archive -Path \"" + zip_copy.string() + "\" -DestinationPath \"" + extract_dir.string() + "\" -Force");
-    
-    ProcessResult extract_result = runner_.run(
-        "powershell.exe",
-        extract_args,
-        temp_dir.string()
-    );
-    
-    // Clean up temporary zip file
-    try {
-        fs::remove(zip_copy);
-    } catch (...) {
-        // Ignore cleanup errors
+    size_t queue_depth = config.queue_depth > 0 ? config.queue_depth : signer_count * 2;
+
+    // Splits identical to ones an earlier run finished are linked from the
+    // dedup store; the key covers everything finishing adds to a split
+    std::optional<BlobStore> blobs;
+    std::string finisher;
+    if (!config.dedup_store.empty() && workspace.stream == nullptr) {
+        blobs.emplace(config.dedup_store);
+        finisher = signing ? SigningManager::key_fingerprint(config.signing.value()) : "unsigned";
+        if (!finisher.empty() && config.align_page > 0) {
+            finisher += (config.verify_align ? ":verify=" : ":align=") + std::to_string(config.align_page);
+        }
     }
-#else
-    // On Unix, use unzip
-    std::vector<std::string> extract_args;
-    extract_args.push_back("-q");
-    extract_args.push_back(apks_file.string());
-    extract_args.push_back("-d");
-    extract_args.push_back(extract_dir.string());
-    
-    ProcessResult extract_result = runner_.run(
-        "unzip",
-        extract_args,
-        temp_dir.string()
-    );
-#endif
+    std::atomic<size_t> deduplicated{0};
+
+    BoundedQueue<ApkArtifact> pending(queue_depth);
+    std::atomic<bool> failed{false};
+    std::mutex manifest_mutex;
+    std::vector<std::string> order;
+
+    // Signs (when configured) and publishes one split
+    auto finish_split = [&](ApkArtifact& apk) {
+        fs::path dest_apk = stage_dir / apk.name;
+        // Splits signed by an earlier, interrupted run are reused as they are
+        std::string unsigned_sha256 = apk.sha256;
+        bool restored = cache != nullptr && cache->restore && cache->restore(apk, dest_apk);
+
+        std::string blob_key;
+        bool linked = false;
+        if (blobs && !restored && !finisher.empty()) {
+            blob_key = BlobStore::key(unsigned_sha256, finisher);
+            std::string sha256;
+            uint64_t size = 0;
+            if (blobs->find(blob_key, sha256, size) && blobs->link(sha256, size, dest_apk)) {
+                std::error_code ec;
+                fs::remove(apk.path, ec);
+                apk.path = dest_apk;
+                apk.sha256 = sha256;
+                apk.size = size;
+                restored = true;
+                linked = true;
+                deduplicated++;
+            }
+        }
+
+        if (finishing && !restored) {
+            bool rewritten = false;
+            if (!finish_apk(config, apk.path, apk.name, rewritten)) {
+                return false;
+            }
+            if (rewritten && !FileUtils::hash_file(apk.path, apk.sha256, apk.size)) {
+                Log::error() << "Failed to hash signed APK: " << apk.path;
+                return false;
+            }
+            if (signing) {
+                workspace.report("signed", apk.name, apk.size);
+            }
+        }
+
+        if (workspace.stream != nullptr) {
+            // Unsigned splits went out during extraction; signed ones go now,
+            // in whichever order the signers finish
+            if (!apk.path.empty()) {
+                std::string stream_error;
+                std::lock_guard<std::mutex> lock(*workspace.stream_mutex);
+                if (!workspace.stream->add_file(apk.path, apk.name, stream_error)) {
+                    Log::error() << stream_error;
+                    return false;
+                }
+                std::error_code ec;
+                fs::remove(apk.path, ec);
+                apk.path.clear();
+            }
+        } else if (!restored) {
+            if (!FileUtils::move_file(apk.path, dest_apk)) {
+                Log::error() << "Failed to stage APK " << apk.name;
+                return false;
+            }
+            if (config.v4_signature && signing) {
+                fs::path idsig = apk.path;
+                idsig += ".idsig";
+                if (!FileUtils::move_file(idsig, stage_dir / (apk.name + ".idsig"))) {
+                    Log::error() << "Failed to stage " << apk.name << ".idsig";
+                    return false;
+                }
+            }
+            apk.path = dest_apk;
+            if (cache != nullptr && cache->store) {
+                cache->store(unsigned_sha256, apk);
+            }
+        }
+        // Failing to store a split only costs the next run a rebuild
+        if (blobs && !linked) {
+            blobs->admit(dest_apk, apk.sha256, apk.size, blob_key);
+        }
 
-    if (!extract_result.success()) {
-        std::cerr << "Error: Failed to extract split APKs from .apks file\n";
-        if (!extract_result.stderr_output.empty()) {
-            std::cerr << extract_result.stderr_output << "\n";
+        std::lock_guard<std::mutex> lock(manifest_mutex);
+        manifest.apks.push_back(std::move(apk));
+        return true;
+    };
+
+    std::vector<std::thread> signers;
+    if (finishing) {
+        for (unsigned i = 0; i < signer_count; ++i) {
+            signers.emplace_back([&, log_context = Logger::context()] {
+                Logger::Scope scope(log_context);
+                ApkArtifact apk;
+                while (pending.pop(apk)) {
+                    if (!failed && !finish_split(apk)) {
+                        failed = true;
+                        pending.close();
+                    }
+                }
+            });
+        }
+    }
+
+    bool extracted_ok = extract_apks(apks_file, extract_dir, [&](ApkArtifact&& apk) {
+        if (failed) {
+            return false;
         }
+        workspace.report("extracted", apk.name, apk.size);
+        order.push_back(apk.name);
+        if (finishing) {
+            return pending.push(std::move(apk));
+        }
+        if (!finish_split(apk)) {
+            failed = true;
+        }
+        return !failed;
+    }, finishing ? nullptr : workspace.stream);
+
+    pending.close();
+    for (auto& signer : signers) {
+        signer.join();
+    }
+
+    if (failed) {
+        return false;
+    }
+    if (!extracted_ok) {
+        Log::error() << "Failed to extract split APKs from .apks file";
         return false;
     }
 
-    // Copy all extracted APKs to output directory
-    bool found_apk = false;
-    for (const auto& entry : fs::recursive_directory_iterator(extract_dir)) {
-        if (entry.is_regular_file() && entry.path().extension() == ".apk") {
-            fs::path dest_apk = output_path / entry.path().filename();
-            try {
-                fs::copy_file(entry.path(), dest_apk, fs::copy_options::overwrite_existing);
-                found_apk = true;
-            } catch (const std::exception& e) {
-                std::cerr << "Error: Failed to copy APK " << entry.path().filename() << ": " << e.what() << "\n";
+    for (auto& [module, apks] : reused) {
+        for (auto& apk : apks) {
+            std::string stream_error;
+            fs::path dest_apk = stage_dir / apk.name;
+            if (workspace.stream != nullptr) {
+                if (!workspace.stream->add_file(apk.path, apk.name, stream_error)) {
+                    Log::error() << stream_error;
+                    return false;
+                }
+                dest_apk.clear();
+            } else if (blobs && blobs->link(apk.sha256, apk.size, dest_apk)) {
+                deduplicated++;
+            } else if (!FileUtils::copy_file_fast(apk.path, dest_apk)) {
+                Log::error() << "Failed to stage stored APK " << apk.name;
                 return false;
+            } else if (blobs) {
+                blobs->admit(dest_apk, apk.sha256, apk.size, "");
+            }
+            apk.path = dest_apk;
+            order.push_back(apk.name);
+            manifest.apks.push_back(apk);
+        }
+    }
+
+    // Keep what was just built for the next conversion; a failure to store
+    // only costs that run a rebuild. Streamed splits are gone by now.
+    if (!config.module_cache.empty() && workspace.stream == nullptr) {
+        ModuleStore store(config.module_cache);
+        for (const auto& [module, key] : module_keys) {
+            if (reused.count(module) > 0) {
+                continue;
+            }
+            std::vector<ApkArtifact> apks;
+            for (const auto& apk : manifest.apks) {
+                if (apk.targeting.module == module) {
+                    apks.push_back(apk);
+                }
+            }
+            if (!apks.empty()) {
+                store.save(module, key, apks);
             }
         }
     }
 
+    if (deduplicated > 0) {
+        Log::debug() << "Linked " << deduplicated << " unchanged split(s) from " << config.dedup_store;
+    }
+
+    // Keep the manifest in archive order regardless of which signer finished first
+    std::sort(manifest.apks.begin(), manifest.apks.end(), [&order](const ApkArtifact& a, const ApkArtifact& b) {
+        return std::find(order.begin(), order.end(), a.name) < std::find(order.begin(), order.end(), b.name);
+    });
+    bool found_apk = !order.empty();
+
     if (!found_apk) {
-        std::cerr << "Error: No APK files found in extracted .apks file\n";
+        Log::error() << "No APK files found in extracted .apks file";
         return false;
     }
 
@@ -0,0 +1,94 @@
+#include "apk_align.h"
+#include "zip_archive.h"
+
+namespace aab2apk {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+bool is_native_lib(const std::string& name) {
+    return name.compare(0, 4, "lib/") == 0 && name.size() > 3 && name.compare(name.size() - 3, 3, ".so") == 0;
+}
+
+} // anonymous namespace
+
+uint32_t ApkAligner::required(const std::string& name, uint16_t method, const AlignmentPolicy& policy) {
+    if (method != ZipReader::METHOD_STORED || name.empty() || name.back() == '/') {
+        return 0;
+    }
+    return is_native_lib(name) ? policy.native_libs : policy.stored;
+}
+
+bool ApkAligner::verify(
+    const fs::path& apk,
+    const AlignmentPolicy& policy,
+    std::vector<std::string>& misaligned,
+    std::string& error
+) {
+    ZipReader archive;
+    if (!archive.open(apk, error)) {
+        return false;
+    }
+    misaligned.clear();
+    for (const auto& entry : archive.entries()) {
+        uint32_t alignment = required(entry.name, entry.method, policy);
+        if (alignment <= 1) {
+            continue;
+        }
+        uint64_t offset = 0;
+        if (!archive.data_offset(entry, offset, error)) {
+            return false;
+        }
+        if (offset % alignment != 0) {
+            misaligned.push_back(entry.name + ": offset " + std::to_string(offset) + ", needs " +
+                                 std::to_string(alignment) + "-byte alignment");
+        }
+    }
+    return true;
+}
+
+bool ApkAligner::align(const fs::path& apk, const AlignmentPolicy& policy, bool& rewritten, std::string& error) {
+    rewritten = false;
+    std::vector<std::string> misaligned;
+    if (!verify(apk, policy, misaligned, error)) {
+        return false;
+    }
+    if (misaligned.empty()) {
+        return true;
+    }
+
+    ZipReader archive;
+    if (!archive.open(apk, error)) {
+        return false;
+    }
+    fs::path aligned = apk;
+    aligned += ".aligning";
+    ZipWriter writer;
+    bool ok = writer.open(aligned, error);
+    for (const auto& entry : archive.entries()) {
+        if (!ok) {
+            break;
+        }
+        ok = writer.add_raw(archive, entry, error, required(entry.name, entry.method, policy));
+    }
+    ok = ok && writer.finish(error);
+    archive.close();
+
+    std::error_code ec;
+    if (ok) {
+        fs::rename(aligned, apk, ec);
+        if (ec) {
+            error = "cannot replace " + apk.string() + ": " + ec.message();
+            ok = false;
+        }
+    }
+    if (!ok) {
+        fs::remove(aligned, ec);
+        return false;
+    }
+    rewritten = true;
+    return true;
+}
+
+} // namespace aab2apk
@@ -0,0 +1,750 @@
+#include "apk_patch.h"
+#include "delta.h"
+#include "sha256.h"
+#include "zip_archive.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include <zlib.h>
+
+namespace aab2apk {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr char PATCH_MAGIC[8] = {'A', '2', 'A', 'P', 'A', 'T', 'C', 'H'};
+// Version 2 added OP_RECOMPRESS; version 1 patches still apply
+constexpr uint32_t PATCH_VERSION = 2;
+
+// Entries larger than this ship whole: the suffix sort needs eight bytes of
+// memory per byte of the old entry, per thread
+constexpr uint64_t MAX_DELTA_INPUT = 64ull * 1024 * 1024;
+// Below this a delta's framing costs more than it saves
+constexpr uint64_t MIN_DELTA_INPUT = 256;
+
+enum OpType : uint8_t {
+    OP_COPY = 1,    // old_offset, length
+    OP_DATA = 2,    // length, payload size, deflated bytes
+    OP_DELTA = 3,   // old_offset, old_length, length, payload size, delta
+    OP_RECOMPRESS = 4   // old_offset, old_length, old method, old inflated size,
+                        // inflated size, deflate mode, level, length, payload size, delta
+};
+
+// How a deflated entry was compressed, so applying a patch deflates the
+// rebuilt data to the same bytes
+enum DeflateMode : uint8_t {
+    DEFLATE_ZLIB = 1,   // a single zlib stream, as Java's Deflater writes
+    DEFLATE_BLOCKS = 2  // ZipWriter::deflate_parallel, as aab2apk writes
+};
+
+// Most likely first: zlib's default level, then its best
+constexpr int DEFLATE_LEVELS[] = {6, 9, 1, 2, 3, 4, 5, 7, 8};
+
+struct Op {
+    OpType type = OP_DATA;
+    uint64_t new_offset = 0;
+    uint64_t new_length = 0;
+    uint64_t old_offset = 0;
+    uint64_t old_length = 0;
+    // OP_RECOMPRESS: the delta is between the inflated entries
+    uint16_t old_method = 0;
+    uint64_t old_inflated = 0;
+    uint64_t inflated = 0;
+    uint8_t mode = 0;
+    uint8_t level = 0;
+    std::string payload;
+    std::string error;
+};
+
+struct EntrySpan {
+    uint64_t header = 0;    // local header offset
+    uint64_t data = 0;      // stored bytes start
+    uint64_t end = 0;       // stored bytes end
+};
+
+bool read_whole_file(const fs::path& path, std::string& out, std::string& error) {
+    std::error_code ec;
+    uint64_t size = fs::file_size(path, ec);
+    std::ifstream in(path, std::ios::binary);
+    if (ec || !in) {
+        error = "Cannot read " + path.string();
+        return false;
+    }
+    out.resize(static_cast<size_t>(size));
+    if (size > 0 && !in.read(&out[0], static_cast<std::streamsize>(size))) {
+        error = "Cannot read " + path.string();
+        return false;
+    }
+    return true;
+}
+
+bool entry_spans(const ZipReader& archive, uint64_t file_size, std::vector<EntrySpan>& spans, std::string& error) {
+    spans.clear();
+    for (const auto& entry : archive.entries()) {
+        EntrySpan span;
+        span.header = entry.local_header_offset;
+        if (!archive.data_offset(entry, span.data, error)) {
+            return false;
+        }
+        span.end = span.data + entry.compressed_size;
+        if (span.end > file_size) {
+            error = entry.name + " extends past the end of " + archive.path().string();
+            return false;
+        }
+        spans.push_back(span);
+    }
+    return true;
+}
+
+bool same_bytes(const std::string& a, uint64_t a_offset, const std::string& b, uint64_t b_offset, uint64_t length) {
+    return std::memcmp(a.data() + a_offset, b.data() + b_offset, static_cast<size_t>(length)) == 0;
+}
+
+// Appends an op, joining it to the previous one where both copy adjacent
+// old bytes or both ship literal bytes
+void emit(std::vector<Op>& ops, Op op) {
+    if (op.new_length == 0) {
+        return;
+    }
+    if (!ops.empty()) {
+        Op& last = ops.back();
+        if (op.type == OP_COPY && last.type == OP_COPY && last.old_offset + last.new_length == op.old_offset) {
+            last.new_length += op.new_length;
+            return;
+        }
+        if (op.type == OP_DATA && last.type == OP_DATA) {
+            last.new_length += op.new_length;
+            return;
+        }
+    }
+    ops.push_back(std::move(op));
+}
+
+Op copy_op(uint64_t new_offset, uint64_t old_offset, uint64_t length) {
+    Op op;
+    op.type = OP_COPY;
+    op.new_offset = new_offset;
+    op.old_offset = old_offset;
+    op.new_length = length;
+    return op;
+}
+
+Op data_op(uint64_t new_offset, uint64_t length) {
+    Op op;
+    op.new_offset = new_offset;
+    op.new_length = length;
+    return op;
+}
+
+bool delta_fits(uint64_t length, uint64_t old_length) {
+    return length >= MIN_DELTA_INPUT && old_length > 0 && length <= MAX_DELTA_INPUT && old_length <= MAX_DELTA_INPUT;
+}
+
+Op delta_op(uint64_t new_offset, uint64_t length, uint64_t old_offset, uint64_t old_length) {
+    if (!delta_fits(length, old_length)) {
+        return data_op(new_offset, length);
+    }
+    Op op;
+    op.type = OP_DELTA;
+    op.new_offset = new_offset;
+    op.new_length = length;
+    op.old_offset = old_offset;
+    op.old_length = old_length;
+    return op;
+}
+
+// A changed deflated entry: its compressed bytes differ almost everywhere
+// after the first change, so the delta is taken between the inflated
+// entries, as archive-patcher does. compute_payload falls back to a delta
+// of the stored bytes unless deflating the new data again reproduces them.
+Op recompress_op(uint64_t new_offset, const ZipEntry& entry, uint64_t old_offset, const ZipEntry& old) {
+    if ((old.method != ZipReader::METHOD_STORED && old.method != ZipReader::METHOD_DEFLATED) ||
+        !delta_fits(entry.uncompressed_size, old.uncompressed_size)) {
+        return delta_op(new_offset, entry.compressed_size, old_offset, old.compressed_size);
+    }
+    Op op;
+    op.type = OP_RECOMPRESS;
+    op.new_offset = new_offset;
+    op.new_length = entry.compressed_size;
+    op.old_offset = old_offset;
+    op.old_length = old.compressed_size;
+    op.old_method = old.method;
+    op.old_inflated = old.uncompressed_size;
+    op.inflated = entry.uncompressed_size;
+    return op;
+}
+
+bool deflate_as(const std::string& data, uint8_t mode, int level, unsigned threads, std::string& out,
+                std::string& error) {
+    const auto* bytes = reinterpret_cast<const unsigned char*>(data.data());
+    if (mode == DEFLATE_BLOCKS) {
+        return ZipWriter::deflate_parallel(bytes, data.size(), level, threads, out, error);
+    }
+    z_stream zs{};
+    if (deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        error = "failed to initialise deflate";
+        return false;
+    }
+    out.resize(deflateBound(&zs, static_cast<uLong>(data.size())) + 16);
+    zs.next_in = const_cast<Bytef*>(bytes);
+    zs.avail_in = static_cast<uInt>(data.size());
+    zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    zs.avail_out = static_cast<uInt>(out.size());
+    int status = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    if (status != Z_STREAM_END) {
+        error = "deflate failed";
+        return false;
+    }
+    return true;
+}
+
+// Whether deflating data this way gives exactly target. zlib streams are
+// compared as they come out, so a wrong level stops at the first chunk.
+bool deflates_to(const std::string& data, uint8_t mode, int level, const char* target, size_t target_size) {
+    if (mode == DEFLATE_BLOCKS) {
+        std::string out;
+        std::string error;
+        return deflate_as(data, mode, level, 1, out, error) && out.size() == target_size &&
+               std::memcmp(out.data(), target, target_size) == 0;
+    }
+    z_stream zs{};
+    if (deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    zs.avail_in = static_cast<uInt>(data.size());
+    char buffer[64 * 1024];
+    size_t pos = 0;
+    int status = Z_OK;
+    bool same = true;
+    while (same && status == Z_OK) {
+        zs.next_out = reinterpret_cast<Bytef*>(buffer);
+        zs.avail_out = sizeof(buffer);
+        status = deflate(&zs, Z_FINISH);
+        size_t produced = sizeof(buffer) - zs.avail_out;
+        same = produced <= target_size - pos && std::memcmp(buffer, target + pos, produced) == 0;
+        pos += produced;
+    }
+    deflateEnd(&zs);
+    return same && status == Z_STREAM_END && pos == target_size;
+}
+
+// Fills an OP_RECOMPRESS payload; false when no deflate setting reproduces
+// the new entry's stored bytes
+bool recompress_payload(Op& op, const std::string& old_data, const std::string& new_data) {
+    std::string inflated;
+    std::string old_inflated;
+    std::string error;
+    const char* stored = new_data.data() + op.new_offset;
+    if (!Delta::decompress(std::string(stored, static_cast<size_t>(op.new_length)),
+                           static_cast<size_t>(op.inflated), inflated, error)) {
+        return false;
+    }
+    op.mode = 0;
+    for (uint8_t mode : {DEFLATE_ZLIB, DEFLATE_BLOCKS}) {
+        for (int level : DEFLATE_LEVELS) {
+            if (op.mode == 0 && deflates_to(inflated, mode, level, stored, static_cast<size_t>(op.new_length))) {
+                op.mode = mode;
+                op.level = static_cast<uint8_t>(level);
+            }
+        }
+    }
+    if (op.mode == 0) {
+        return false;
+    }
+    old_inflated.assign(old_data, static_cast<size_t>(op.old_offset), static_cast<size_t>(op.old_length));
+    if (op.old_method == ZipReader::METHOD_DEFLATED &&
+        !Delta::decompress(std::string(old_inflated), static_cast<size_t>(op.old_inflated), old_inflated, error)) {
+        return false;
+    }
+    return Delta::create(reinterpret_cast<const unsigned char*>(old_inflated.data()), old_inflated.size(),
+                         reinterpret_cast<const unsigned char*>(inflated.data()), inflated.size(), op.payload,
+                         op.error) &&
+           op.payload.size() < op.new_length;
+}
+
+void compute_payload(Op& op, const std::string& old_data, const std::string& new_data) {
+    const auto* next = reinterpret_cast<const unsigned char*>(new_data.data()) + op.new_offset;
+    if (op.type == OP_RECOMPRESS) {
+        if (recompress_payload(op, old_data, new_data) || !op.error.empty()) {
+            return;
+        }
+        op.payload.clear();
+        op.type = delta_fits(op.new_length, op.old_length) ? OP_DELTA : OP_DATA;
+    }
+    if (op.type == OP_DELTA) {
+        const auto* old = reinterpret_cast<const unsigned char*>(old_data.data()) + op.old_offset;
+        if (!Delta::create(old, static_cast<size_t>(op.old_length), next, static_cast<size_t>(op.new_length),
+                           op.payload, op.error)) {
+            return;
+        }
+        if (op.payload.size() < op.new_length) {
+            return;
+        }
+        // Nothing in common after all
+        op.type = OP_DATA;
+    }
+    std::string literal(reinterpret_cast<const char*>(next), static_cast<size_t>(op.new_length));
+    Delta::compress(literal, op.payload, op.error);
+}
+
+void put32(std::string& out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out += static_cast<char>((value >> (8 * i)) & 0xFF);
+    }
+}
+
+void put64(std::string& out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        out += static_cast<char>((value >> (8 * i)) & 0xFF);
+    }
+}
+
+// Applies an OP_RECOMPRESS delta: inflates the old entry if needed, applies
+// the delta and deflates the result the way the new entry was deflated
+bool rebuild_recompressed(
+    std::string old_entry,
+    bool old_deflated,
+    uint64_t old_inflated,
+    const std::string& delta,
+    uint64_t inflated,
+    uint8_t mode,
+    uint8_t level,
+    std::string& out,
+    std::string& error
+) {
+    if (old_deflated && !Delta::decompress(std::string(old_entry), static_cast<size_t>(old_inflated), old_entry, error)) {
+        return false;
+    }
+    std::string plain;
+    return Delta::apply(reinterpret_cast<const unsigned char*>(old_entry.data()), old_entry.size(), delta,
+                        static_cast<size_t>(inflated), plain, error) &&
+           deflate_as(plain, mode, level, std::max(1u, std::thread::hardware_concurrency()), out, error);
+}
+
+class PatchReader {
+public:
+    explicit PatchReader(const std::string& data) : data_(data) {}
+
+    bool bytes(size_t size, const char*& out) {
+        if (data_.size() - pos_ < size) {
+            return false;
+        }
+        out = data_.data() + pos_;
+        pos_ += size;
+        return true;
+    }
+
+    bool u32(uint32_t& value) {
+        const char* p;
+        if (!bytes(4, p)) {
+            return false;
+        }
+        value = 0;
+        for (int i = 3; i >= 0; --i) {
+            value = (value << 8) | static_cast<unsigned char>(p[i]);
+        }
+        return true;
+    }
+
+    bool u64(uint64_t& value) {
+        const char* p;
+        if (!bytes(8, p)) {
+            return false;
+        }
+        value = 0;
+        for (int i = 7; i >= 0; --i) {
+            value = (value << 8) | static_cast<unsigned char>(p[i]);
+        }
+        return true;
+    }
+
+    bool u8(uint8_t& value) {
+        const char* p;
+        if (!bytes(1, p)) {
+            return false;
+        }
+        value = static_cast<unsigned char>(*p);
+        return true;
+    }
+
+    bool at_end() const { return pos_ == data_.size(); }
+
+private:
+    const std::string& data_;
+    size_t pos_ = 0;
+};
+
+} // anonymous namespace
+
+bool ApkPatch::create(
+    const fs::path& old_apk,
+    const fs::path& new_apk,
+    const fs::path& patch,
+    unsigned threads,
+    PatchStats& stats,
+    std::string& error
+) {
+    std::string old_data;
+    std::string new_data;
+    if (!read_whole_file(old_apk, old_data, error) || !read_whole_file(new_apk, new_data, error)) {
+        return false;
+    }
+    ZipReader old_zip;
+    ZipReader new_zip;
+    if (!old_zip.open(old_apk, error) || !new_zip.open(new_apk, error)) {
+        return false;
+    }
+    std::vector<EntrySpan> old_spans;
+    std::vector<EntrySpan> new_spans;
+    if (!entry_spans(old_zip, old_data.size(), old_spans, error) ||
+        !entry_spans(new_zip, new_data.size(), new_spans, error)) {
+        return false;
+    }
+
+    const std::vector<ZipEntry>& old_entries = old_zip.entries();
+    const std::vector<ZipEntry>& new_entries = new_zip.entries();
+    std::map<std::string, size_t> old_by_name;
+    std::map<std::tuple<uint32_t, uint64_t, uint16_t>, size_t> old_by_content;
+    uint64_t old_tail = 0;
+    for (size_t i = 0; i < old_entries.size(); ++i) {
+        old_by_name.emplace(old_entries[i].name, i);
+        old_by_content.emplace(
+            std::make_tuple(old_entries[i].crc32, old_entries[i].compressed_size, old_entries[i].method), i);
+        old_tail = std::max(old_tail, old_spans[i].end);
+    }
+
+    std::vector<size_t> order(new_entries.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&new_spans](size_t a, size_t b) {
+        return new_spans[a].header < new_spans[b].header;
+    });
+
+    // Lay the new APK out as ops, in file order
+    std::vector<Op> ops;
+    uint64_t pos = 0;
+    for (size_t index : order) {
+        const ZipEntry& entry = new_entries[index];
+        const EntrySpan& span = new_spans[index];
+        if (span.header < pos) {
+            error = "Overlapping entries in " + new_apk.string();
+            return false;
+        }
+        emit(ops, data_op(pos, span.header - pos));
+
+        const size_t none = old_entries.size();
+        size_t named = none;
+        size_t source = none;
+        auto it = old_by_name.find(entry.name);
+        if (it != old_by_name.end()) {
+            named = it->second;
+            const EntrySpan& old = old_spans[named];
+            if (old.end - old.data == span.end - span.data &&
+                same_bytes(old_data, old.data, new_data, span.data, span.end - span.data)) {
+                source = named;
+            }
+        }
+        if (source == none) {
+            auto match = old_by_content.find(std::make_tuple(entry.crc32, entry.compressed_size, entry.method));
+            if (match != old_by_content.end() &&
+                same_bytes(old_data, old_spans[match->second].data, new_data, span.data, span.end - span.data)) {
+                source = match->second;
+            }
+        }
+
+        const size_t header_source = source != none ? source : named;
+        const uint64_t header_length = span.data - span.header;
+        if (header_source != none && old_spans[header_source].data - old_spans[header_source].header == header_length &&
+            same_bytes(old_data, old_spans[header_source].header, new_data, span.header, header_length)) {
+            emit(ops, copy_op(span.header, old_spans[header_source].header, header_length));
+        } else {
+            emit(ops, data_op(span.header, header_length));
+        }
+
+        if (source != none) {
+            emit(ops, copy_op(span.data, old_spans[source].data, span.end - span.data));
+        } else if (named != none && entry.method == ZipReader::METHOD_DEFLATED) {
+            emit(ops, recompress_op(span.data, entry, old_spans[named].data, old_entries[named]));
+        } else if (named != none) {
+            const EntrySpan& old = old_spans[named];
+            emit(ops, delta_op(span.data, span.end - span.data, old.data, old.end - old.data));
+        } else {
+            emit(ops, data_op(span.data, span.end - span.data));
+        }
+        pos = span.end;
+    }
+    // Signing block, central directory and end record
+    emit(ops, delta_op(pos, new_data.size() - pos, old_tail, old_data.size() - old_tail));
+
+    // Deltas and literals are independent; the largest go first so one big
+    // entry does not finish last on its own
+    std::vector<size_t> jobs;
+    for (size_t i = 0; i < ops.size(); ++i) {
+        if (ops[i].type != OP_COPY) {
+            jobs.push_back(i);
+        }
+    }
+    std::sort(jobs.begin(), jobs.end(), [&ops](size_t a, size_t b) {
+        return ops[a].new_length > ops[b].new_length;
+    });
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::max(1u, std::min(threads, static_cast<unsigned>(jobs.size())));
+    std::atomic<size_t> next_job{0};
+    auto worker = [&]() {
+        for (size_t job = next_job++; job < jobs.size(); job = next_job++) {
+            compute_payload(ops[jobs[job]], old_data, new_data);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; ++t) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : pool) {
+        thread.join();
+    }
+
+    std::string out(PATCH_MAGIC, sizeof(PATCH_MAGIC));
+    put32(out, PATCH_VERSION);
+    Sha256::Digest old_digest = Sha256::hash(old_data.data(), old_data.size());
+    Sha256::Digest new_digest = Sha256::hash(new_data.data(), new_data.size());
+    put64(out, old_data.size());
+    out.append(reinterpret_cast<const char*>(old_digest.data()), old_digest.size());
+    put64(out, new_data.size());
+    out.append(reinterpret_cast<const char*>(new_digest.data()), new_digest.size());
+    put64(out, ops.size());
+
+    stats = PatchStats{};
+    stats.new_size = new_data.size();
+    for (const Op& op : ops) {
+        if (!op.error.empty()) {
+            error = op.error;
+            return false;
+        }
+        out += static_cast<char>(op.type);
+        switch (op.type) {
+        case OP_COPY:
+            put64(out, op.old_offset);
+            put64(out, op.new_length);
+            stats.copied++;
+            break;
+        case OP_DATA:
+            put64(out, op.new_length);
+            put64(out, op.payload.size());
+            out += op.payload;
+            stats.literals++;
+            break;
+        case OP_DELTA:
+            put64(out, op.old_offset);
+            put64(out, op.old_length);
+            put64(out, op.new_length);
+            put64(out, op.payload.size());
+            out += op.payload;
+            stats.deltas++;
+            break;
+        case OP_RECOMPRESS:
+            put64(out, op.old_offset);
+            put64(out, op.old_length);
+            out += static_cast<char>(op.old_method == ZipReader::METHOD_DEFLATED ? 1 : 0);
+            put64(out, op.old_inflated);
+            put64(out, op.inflated);
+            out += static_cast<char>(op.mode);
+            out += static_cast<char>(op.level);
+            put64(out, op.new_length);
+            put64(out, op.payload.size());
+            out += op.payload;
+            stats.deltas++;
+            break;
+        }
+    }
+    stats.patch_size = out.size();
+
+    fs::path partial = patch;
+    partial += ".partial";
+    {
+        std::ofstream file(partial, std::ios::binary | std::ios::trunc);
+        if (!file || !file.write(out.data(), static_cast<std::streamsize>(out.size())) || !file.flush()) {
+            error = "Cannot write " + patch.string();
+            std::error_code ec;
+            fs::remove(partial, ec);
+            return false;
+        }
+    }
+    std::error_code ec;
+    fs::rename(partial, patch, ec);
+    if (ec) {
+        error = "Cannot write " + patch.string() + ": " + ec.message();
+        fs::remove(partial, ec);
+        return false;
+    }
+    return true;
+}
+
+bool ApkPatch::apply(
+    const fs::path& old_apk,
+    const fs::path& patch,
+    const fs::path& output,
+    std::string& error
+) {
+    std::string old_data;
+    std::string patch_data;
+    if (!read_whole_file(old_apk, old_data, error) || !read_whole_file(patch, patch_data, error)) {
+        return false;
+    }
+
+    PatchReader reader(patch_data);
+    auto corrupt = [&error, &patch]() {
+        error = patch.string() + " is not a valid APK patch";
+        return false;
+    };
+    const char* magic;
+    const char* old_digest;
+    const char* new_digest;
+    uint32_t version = 0;
+    uint64_t old_size = 0;
+    uint64_t new_size = 0;
+    uint64_t op_count = 0;
+    if (!reader.bytes(sizeof(PATCH_MAGIC), magic) || std::memcmp(magic, PATCH_MAGIC, sizeof(PATCH_MAGIC)) != 0 ||
+        !reader.u32(version)) {
+        return corrupt();
+    }
+    if (version == 0 || version > PATCH_VERSION) {
+        error = patch.string() + " has unsupported patch version " + std::to_string(version);
+        return false;
+    }
+    if (!reader.u64(old_size) || !reader.bytes(32, old_digest) || !reader.u64(new_size) ||
+        !reader.bytes(32, new_digest) || !reader.u64(op_count)) {
+        return corrupt();
+    }
+    Sha256::Digest base = Sha256::hash(old_data.data(), old_data.size());
+    if (old_size != old_data.size() || std::memcmp(base.data(), old_digest, base.size()) != 0) {
+        error = "The patch was made against a different APK than " + old_apk.string();
+        return false;
+    }
+
+    fs::path partial = output;
+    partial += ".partial";
+    std::ofstream file(partial, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        error = "Cannot write " + output.string();
+        return false;
+    }
+    auto fail = [&]() {
+        file.close();
+        std::error_code ec;
+        fs::remove(partial, ec);
+        return false;
+    };
+
+    Sha256 sha;
+    uint64_t written = 0;
+    std::string rebuilt;
+    const auto* old_bytes = reinterpret_cast<const unsigned char*>(old_data.data());
+    for (uint64_t i = 0; i < op_count; ++i) {
+        const char* type;
+        if (!reader.bytes(1, type)) {
+            corrupt();
+            return fail();
+        }
+        uint64_t old_offset = 0;
+        uint64_t old_length = 0;
+        uint64_t length = 0;
+        uint64_t payload_size = 0;
+        uint64_t old_inflated = 0;
+        uint64_t inflated = 0;
+        uint8_t old_deflated = 0;
+        uint8_t mode = 0;
+        uint8_t level = 0;
+        const char* payload = nullptr;
+        const char* data = nullptr;
+        bool ok = false;
+        switch (static_cast<uint8_t>(*type)) {
+        case OP_COPY:
+            ok = reader.u64(old_offset) && reader.u64(length) && old_offset <= old_data.size() &&
+                 length <= old_data.size() - old_offset;
+            data = old_data.data() + old_offset;
+            break;
+        case OP_DATA:
+            ok = reader.u64(length) && reader.u64(payload_size) && reader.bytes(payload_size, payload) &&
+                 length <= new_size - written &&
+                 Delta::decompress(std::string(payload, payload_size), length, rebuilt, error);
+            data = rebuilt.data();
+            break;
+        case OP_DELTA:
+            ok = reader.u64(old_offset) && reader.u64(old_length) && reader.u64(length) && reader.u64(payload_size) &&
+                 reader.bytes(payload_size, payload) && old_offset <= old_data.size() &&
+                 old_length <= old_data.size() - old_offset && length <= new_size - written &&
+                 Delta::apply(old_bytes + old_offset, old_length, std::string(payload, payload_size), length,
+                              rebuilt, error);
+            data = rebuilt.data();
+            break;
+        case OP_RECOMPRESS:
+            ok = reader.u64(old_offset) && reader.u64(old_length) && reader.u8(old_deflated) &&
+                 reader.u64(old_inflated) && reader.u64(inflated) && reader.u8(mode) && reader.u8(level) &&
+                 reader.u64(length) && reader.u64(payload_size) && reader.bytes(payload_size, payload) &&
+                 version >= 2 && old_offset <= old_data.size() && old_length <= old_data.size() - old_offset &&
+                 old_deflated <= 1 && old_inflated <= MAX_DELTA_INPUT && inflated <= MAX_DELTA_INPUT &&
+                 (mode == DEFLATE_ZLIB || mode == DEFLATE_BLOCKS) && level >= 1 && level <= 9 &&
+                 length <= new_size - written &&
+                 rebuild_recompressed(old_data.substr(static_cast<size_t>(old_offset), static_cast<size_t>(old_length)),
+                                      old_deflated != 0, old_inflated, std::string(payload, payload_size), inflated,
+                                      mode, level, rebuilt, error) &&
+                 rebuilt.size() == length;
+            data = rebuilt.data();
+            break;
+        default:
+            break;
+        }
+        if (!ok || written + length > new_size) {
+            if (error.empty()) {
+                corrupt();
+            } else {
+                error = patch.string() + ": " + error;
+            }
+            return fail();
+        }
+        sha.update(data, static_cast<size_t>(length));
+        if (!file.write(data, static_cast<std::streamsize>(length))) {
+            error = "Cannot write " + output.string();
+            return fail();
+        }
+        written += length;
+    }
+    if (!reader.at_end() || written != new_size) {
+        corrupt();
+        return fail();
+    }
+    Sha256::Digest result = sha.finish();
+    if (std::memcmp(result.data(), new_digest, result.size()) != 0) {
+        error = "The APK rebuilt from " + patch.string() + " does not match its recorded SHA-256";
+        return fail();
+    }
+    if (!file.flush()) {
+        error = "Cannot write " + output.string();
+        return fail();
+    }
+    file.close();
+
+    std::error_code ec;
+    fs::rename(partial, output, ec);
+    if (ec) {
+        error = "Cannot write " + output.string() + ": " + ec.message();
+        fs::remove(partial, ec);
+        return false;
+    }
+    return true;
+}
+
+} // namespace aab2apk
@@ -0,0 +1,232 @@
+#include "apk_recompress.h"
+#include "zip_archive.h"
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef AAB2APK_HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+namespace aab2apk {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Entries prepared ahead of the writer per thread; bounds memory use
+constexpr size_t ENTRIES_AHEAD_PER_THREAD = 4;
+
+int level_for(CompressionMode mode) {
+#ifdef AAB2APK_HAVE_LIBDEFLATE
+    return mode == CompressionMode::Max ? 12 : 1;
+#else
+    return mode == CompressionMode::Max ? 9 : 1;
+#endif
+}
+
+bool compress(const std::string& data, int level, std::string& out, std::string& error) {
+#ifdef AAB2APK_HAVE_LIBDEFLATE
+    // One compressor per worker thread, reused for every entry it handles
+    struct Compressor {
+        libdeflate_compressor* handle = nullptr;
+        int level = 0;
+        ~Compressor() {
+            if (handle != nullptr) {
+                libdeflate_free_compressor(handle);
+            }
+        }
+    };
+    thread_local Compressor compressor;
+    if (compressor.handle == nullptr || compressor.level != level) {
+        if (compressor.handle != nullptr) {
+            libdeflate_free_compressor(compressor.handle);
+        }
+        compressor.handle = libdeflate_alloc_compressor(level);
+        compressor.level = level;
+        if (compressor.handle == nullptr) {
+            error = "failed to initialise libdeflate";
+            return false;
+        }
+    }
+    out.resize(libdeflate_deflate_compress_bound(compressor.handle, data.size()));
+    size_t size = libdeflate_deflate_compress(compressor.handle, data.data(), data.size(), &out[0], out.size());
+    if (size == 0) {
+        error = "deflate failed";
+        return false;
+    }
+    out.resize(size);
+    return true;
+#else
+    // Entries already run in parallel, so each one is a single deflate
+    return ZipWriter::deflate_parallel(reinterpret_cast<const unsigned char*>(data.data()), data.size(),
+                                       level, 1, out, error);
+#endif
+}
+
+struct PreparedEntry {
+    bool ready = false;
+    bool raw = false;       // copied as stored
+    ZipEntry entry;
+    std::string data;
+    std::string error;
+};
+
+} // anonymous namespace
+
+const char* ApkRecompressor::backend() {
+#ifdef AAB2APK_HAVE_LIBDEFLATE
+    return "libdeflate";
+#else
+    return "zlib";
+#endif
+}
+
+bool ApkRecompressor::recompress(
+    const fs::path& apk,
+    CompressionMode mode,
+    const AlignmentPolicy& policy,
+    unsigned threads,
+    std::string& error
+) {
+    if (mode == CompressionMode::Keep) {
+        return true;
+    }
+    ZipReader archive;
+    if (!archive.open(apk, error)) {
+        return false;
+    }
+    const std::vector<ZipEntry>& entries = archive.entries();
+    const int level = level_for(mode);
+
+    auto prepare = [&](size_t index, PreparedEntry& prepared) {
+        const ZipEntry& entry = entries[index];
+        if (entry.is_directory() || entry.method == ZipReader::METHOD_STORED) {
+            prepared.raw = true;
+            return;
+        }
+
+        std::string plain;
+        plain.reserve(static_cast<size_t>(entry.uncompressed_size));
+        bool ok = archive.extract(entry, [&plain](const unsigned char* data, size_t size) {
+            plain.append(reinterpret_cast<const char*>(data), size);
+            return true;
+        }, prepared.error);
+        if (!ok) {
+            return;
+        }
+
+        prepared.entry = entry;
+        prepared.entry.flags = static_cast<uint16_t>(entry.flags & ~0x0008);
+        if (mode != CompressionMode::Store && !plain.empty()) {
+            std::string compressed;
+            if (!compress(plain, level, compressed, prepared.error)) {
+                prepared.error += " for " + entry.name;
+                return;
+            }
+            if (compressed.size() < plain.size()) {
+                prepared.entry.method = ZipReader::METHOD_DEFLATED;
+                prepared.entry.compressed_size = compressed.size();
+                prepared.data = std::move(compressed);
+                return;
+            }
+        }
+        prepared.entry.method = ZipReader::METHOD_STORED;
+        prepared.entry.compressed_size = plain.size();
+        prepared.data = std::move(plain);
+    };
+
+    // Workers run ahead of the writer by a bounded number of entries; the
+    // writer takes them in archive order
+    std::vector<PreparedEntry> slots(entries.size());
+    std::mutex mutex;
+    std::condition_variable changed;
+    size_t next = 0;
+    size_t written = 0;
+    bool abort = false;
+    threads = std::max(1u, threads);
+    const size_t window = threads * ENTRIES_AHEAD_PER_THREAD;
+
+    auto worker = [&]() {
+        for (;;) {
+            size_t index;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&] { return abort || next >= entries.size() || next < written + window; });
+                if (abort || next >= entries.size()) {
+                    return;
+                }
+                index = next++;
+            }
+            PreparedEntry prepared;
+            prepare(index, prepared);
+            prepared.ready = true;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                slots[index] = std::move(prepared);
+            }
+            changed.notify_all();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < threads; ++t) {
+        pool.emplace_back(worker);
+    }
+
+    fs::path rewritten = apk;
+    rewritten += ".recompressing";
+    ZipWriter writer;
+    bool ok = writer.open(rewritten, error);
+    for (size_t i = 0; ok && i < entries.size(); ++i) {
+        PreparedEntry prepared;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&] { return slots[i].ready; });
+            prepared = std::move(slots[i]);
+        }
+        if (!prepared.error.empty()) {
+            error = prepared.error;
+            ok = false;
+        } else if (prepared.raw) {
+            ok = writer.add_raw(archive, entries[i], error,
+                                ApkAligner::required(entries[i].name, entries[i].method, policy));
+        } else {
+            uint32_t alignment = ApkAligner::required(prepared.entry.name, prepared.entry.method, policy);
+            ok = writer.add_prepared(std::move(prepared.entry), prepared.data, alignment, error);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            written = i + 1;
+            abort = !ok;
+        }
+        changed.notify_all();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        abort = true;
+    }
+    changed.notify_all();
+    for (auto& thread : pool) {
+        thread.join();
+    }
+
+    ok = ok && writer.finish(error);
+    archive.close();
+    std::error_code ec;
+    if (ok) {
+        fs::rename(rewritten, apk, ec);
+        if (ec) {
+            error = "cannot replace " + apk.string() + ": " + ec.message();
+            ok = false;
+        }
+    }
+    if (!ok) {
+        fs::remove(rewritten, ec);
+    }
+    return ok;
+}
+
+} // namespace aab2apk
@@ -0,0 +1,222 @@
+#include "apk_verity.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace aab2apk {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr size_t DIGEST_SIZE = 32;
+constexpr size_t BLOCKS_PER_READ = 256;     // 1 MiB reads
+constexpr uint32_t HASH_ALGORITHM_SHA256 = 1;
+constexpr uint8_t LOG2_BLOCK_SIZE = 12;
+
+// Runs fn over [0, count) split into one contiguous range per thread
+void parallel_ranges(uint64_t count, unsigned threads, const std::function<void(uint64_t, uint64_t)>& fn) {
+    threads = static_cast<unsigned>(std::max<uint64_t>(1, std::min<uint64_t>(threads, count)));
+    uint64_t per_thread = (count + threads - 1) / threads;
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; ++t) {
+        uint64_t begin = std::min(count, per_thread * t);
+        uint64_t end = std::min(count, begin + per_thread);
+        if (begin < end) {
+            pool.emplace_back(fn, begin, end);
+        }
+    }
+    fn(0, std::min(count, per_thread));
+    for (auto& thread : pool) {
+        thread.join();
+    }
+}
+
+bool read_bytes(const std::string& data, size_t& pos, std::string& out) {
+    if (data.size() - pos < 4) {
+        return false;
+    }
+    uint32_t size = 0;
+    for (int i = 3; i >= 0; --i) {
+        size = (size << 8) | static_cast<unsigned char>(data[pos + static_cast<size_t>(i)]);
+    }
+    pos += 4;
+    if (data.size() - pos < size) {
+        return false;
+    }
+    out = data.substr(pos, size);
+    pos += size;
+    return true;
+}
+
+uint32_t get32(const std::string& data, size_t pos) {
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; --i) {
+        value = (value << 8) | static_cast<unsigned char>(data[pos + static_cast<size_t>(i)]);
+    }
+    return value;
+}
+
+void put32(std::string& out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out += static_cast<char>((value >> (8 * i)) & 0xFF);
+    }
+}
+
+void put_bytes(std::string& out, const std::string& bytes) {
+    put32(out, static_cast<uint32_t>(bytes.size()));
+    out += bytes;
+}
+
+} // anonymous namespace
+
+bool ApkVerity::build_tree(const fs::path& file, unsigned threads, MerkleTree& result, std::string& error) {
+    std::error_code ec;
+    uint64_t size = fs::file_size(file, ec);
+    if (ec || size == 0) {
+        error = "Cannot read " + file.string();
+        return false;
+    }
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Block counts per level, data blocks first; the top level fits a block
+    std::vector<uint64_t> blocks;
+    for (uint64_t data = size;;) {
+        uint64_t count = (data + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        blocks.push_back(count);
+        if (count * DIGEST_SIZE <= BLOCK_SIZE) {
+            break;
+        }
+        data = count * DIGEST_SIZE;
+    }
+    // Level i holds the digests of level i - 1's blocks (level 0: of the
+    // data) and is stored after every level above it
+    std::vector<uint64_t> offsets(blocks.size());
+    uint64_t total = 0;
+    for (size_t i = blocks.size(); i-- > 0;) {
+        offsets[i] = total;
+        total += (blocks[i] * DIGEST_SIZE + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    }
+    result.tree.assign(static_cast<size_t>(total), '\0');
+    auto* tree = reinterpret_cast<unsigned char*>(&result.tree[0]);
+
+    std::atomic<bool> failed{false};
+    parallel_ranges(blocks[0], threads, [&](uint64_t begin, uint64_t end) {
+        std::ifstream in(file, std::ios::binary);
+        std::unique_ptr<char[]> buffer(new char[BLOCK_SIZE * BLOCKS_PER_READ]);
+        in.seekg(static_cast<std::streamoff>(begin * BLOCK_SIZE));
+        for (uint64_t block = begin; block < end && !failed;) {
+            uint64_t count = std::min<uint64_t>(BLOCKS_PER_READ, end - block);
+            size_t want = static_cast<size_t>(std::min<uint64_t>(count * BLOCK_SIZE, size - block * BLOCK_SIZE));
+            if (!in.read(buffer.get(), static_cast<std::streamsize>(want))) {
+                failed = true;
+                return;
+            }
+            // The last block is hashed zero-padded
+            std::memset(buffer.get() + want, 0, static_cast<size_t>(count * BLOCK_SIZE) - want);
+            for (uint64_t i = 0; i < count; ++i) {
+                Sha256::Digest digest = Sha256::hash(buffer.get() + i * BLOCK_SIZE, BLOCK_SIZE);
+                std::memcpy(tree + offsets[0] + (block + i) * DIGEST_SIZE, digest.data(), DIGEST_SIZE);
+            }
+            block += count;
+        }
+    });
+    if (failed) {
+        error = "Failed to read " + file.string();
+        return false;
+    }
+
+    for (size_t level = 1; level < blocks.size(); ++level) {
+        const unsigned char* below = tree + offsets[level - 1];
+        unsigned char* out = tree + offsets[level];
+        parallel_ranges(blocks[level], threads, [&](uint64_t begin, uint64_t end) {
+            for (uint64_t block = begin; block < end; ++block) {
+                Sha256::Digest digest = Sha256::hash(below + block * BLOCK_SIZE, BLOCK_SIZE);
+                std::memcpy(out + block * DIGEST_SIZE, digest.data(), DIGEST_SIZE);
+            }
+        });
+    }
+
+    result.root_hash = Sha256::hash(tree + offsets.back(), BLOCK_SIZE);
+    return true;
+}
+
+bool ApkVerity::complete_idsig(const fs::path& apk, const fs::path& idsig, unsigned threads, std::string& error) {
+    // int32 version, then length-prefixed hashing info and signing info;
+    // whatever follows is the tree, if any
+    std::string data;
+    {
+        std::ifstream in(idsig, std::ios::binary);
+        if (!in) {
+            error = "apksigner wrote no v4 signature for " + apk.filename().string();
+            return false;
+        }
+        data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    size_t pos = 4;
+    std::string hashing_info;
+    std::string signing_info;
+    if (data.size() < 4 || !read_bytes(data, pos, hashing_info) || !read_bytes(data, pos, signing_info)) {
+        error = "Unreadable v4 signature " + idsig.string();
+        return false;
+    }
+
+    // Hashing info: int32 algorithm, int8 log2(block size), salt, root hash
+    size_t info_pos = 5;
+    std::string salt;
+    std::string signed_root;
+    if (hashing_info.size() < 5 || !read_bytes(hashing_info, info_pos, salt) ||
+        !read_bytes(hashing_info, info_pos, signed_root)) {
+        error = "Unreadable v4 hashing info in " + idsig.string();
+        return false;
+    }
+    if (get32(hashing_info, 0) != HASH_ALGORITHM_SHA256 ||
+        static_cast<uint8_t>(hashing_info[4]) != LOG2_BLOCK_SIZE || !salt.empty()) {
+        error = "Unsupported v4 hashing parameters in " + idsig.string();
+        return false;
+    }
+
+    MerkleTree tree;
+    if (!build_tree(apk, threads, tree, error)) {
+        return false;
+    }
+    if (signed_root.size() != tree.root_hash.size() ||
+        std::memcmp(signed_root.data(), tree.root_hash.data(), tree.root_hash.size()) != 0) {
+        error = "The v4 signature of " + apk.filename().string() + " does not match its contents";
+        return false;
+    }
+
+    std::string out = data.substr(0, 4);
+    put_bytes(out, hashing_info);
+    put_bytes(out, signing_info);
+    put_bytes(out, tree.tree);
+
+    fs::path partial = idsig;
+    partial += ".partial";
+    {
+        std::ofstream file(partial, std::ios::binary | std::ios::trunc);
+        if (!file || !file.write(out.data(), static_cast<std::streamsize>(out.size())) || !file.flush()) {
+            error = "Cannot write " + idsig.string();
+            std::error_code ec;
+            fs::remove(partial, ec);
+            return false;
+        }
+    }
+    std::error_code ec;
+    fs::rename(partial, idsig, ec);
+    if (ec) {
+        error = "Cannot write " + idsig.string() + ": " + ec.message();
+        fs::remove(partial, ec);
+        return false;
+    }
+    return true;
+}
+
+} // namespace aab2apk
@@ -0,0 +1,418 @@
+#include "artifact_manifest.h"
+#include "json_utils.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+namespace aab2apk {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Minimal protobuf wire-format reader, enough to walk toc.pb
+class ProtoReader {
+public:
+    ProtoReader(const char* data, size_t size) : p_(data), end_(data + size) {}
+
+    bool next(uint32_t& field, uint32_t& wire_type) {
+        if (p_ >= end_) {
+            return false;
+        }
+        uint64_t key = 0;
+        if (!varint(key)) {
+            return false;
+        }
+        field = static_cast<uint32_t>(key >> 3);
+        wire_type = static_cast<uint32_t>(key & 7);
+        return true;
+    }
+
+    bool varint(uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64 && p_ < end_; shift += 7) {
+            auto byte = static_cast<unsigned char>(*p_++);
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool bytes(std::string& out) {
+        uint64_t len = 0;
+        if (!varint(len) || len > static_cast<uint64_t>(end_ - p_)) {
+            return false;
+        }
+        out.assign(p_, static_cast<size_t>(len));
+        p_ += len;
+        return true;
+    }
+
+    bool skip(uint32_t wire_type) {
+        uint64_t ignored = 0;
+        std::string ignored_bytes;
+        switch (wire_type) {
+            case 0: return varint(ignored);
+            case 1: return advance(8);
+            case 2: return bytes(ignored_bytes);
+            case 5: return advance(4);
+            default: return false;
+        }
+    }
+
+private:
+    const char* p_;
+    const char* end_;
+
+    bool advance(size_t n) {
+        if (static_cast<size_t>(end_ - p_) < n) {
+            return false;
+        }
+        p_ += n;
+        return true;
+    }
+};
+
+const char* abi_name(uint64_t alias) {
+    switch (alias) {
+        case 1: return "armeabi";
+        case 2: return "armeabi-v7a";
+        case 3: return "arm64-v8a";
+        case 4: return "x86";
+        case 5: return "x86_64";
+        case 6: return "mips";
+        case 7: return "mips64";
+        case 8: return "riscv64";
+        default: return "unknown";
+    }
+}
+
+const char* density_name(uint64_t alias) {
+    switch (alias) {
+        case 1: return "nodpi";
+        case 2: return "ldpi";
+        case 3: return "mdpi";
+        case 4: return "tvdpi";
+        case 5: return "hdpi";
+        case 6: return "xhdpi";
+        case 7: return "xxhdpi";
+        case 8: return "xxxhdpi";
+        default: return "unknown";
+    }
+}
+
+// Applies fn(field, wire_type, reader) to each field of a message; false on malformed input
+template <typename Fn>
+bool for_each_field(const std::string& message, Fn fn) {
+    ProtoReader reader(message.data(), message.size());
+    uint32_t field = 0;
+    uint32_t wire_type = 0;
+    while (reader.next(field, wire_type)) {
+        if (!fn(field, wire_type, reader)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+enum class TargetingKind {
+    Abi,
+    Density,
+    Language
+};
+
+// Reads the "value" list (field 1) of an Abi/ScreenDensity/Language targeting message
+bool parse_targeting_values(const std::string& message, TargetingKind kind, std::vector<std::string>& out) {
+    return for_each_field(message, [&](uint32_t field, uint32_t wire_type, ProtoReader& r) {
+        if (field != 1 || wire_type != 2) {
+            return r.skip(wire_type);
+        }
+        std::string value;
+        if (!r.bytes(value)) {
+            return false;
+        }
+        if (kind == TargetingKind::Language) {
+            out.push_back(value);
+            return true;
+        }
+        // Abi { alias = 1 } / ScreenDensity { density_alias = 1 | density_dpi = 2 }
+        return for_each_field(value, [&](uint32_t f, uint32_t wt, ProtoReader& inner) {
+            if (wt != 0) {
+                return inner.skip(wt);
+            }
+            uint64_t v = 0;
+            if (!inner.varint(v)) {
+                return false;
+            }
+            if (kind == TargetingKind::Abi && f == 1) {
+                out.push_back(abi_name(v));
+            } else if (kind == TargetingKind::Density && f == 1) {
+                out.push_back(density_name(v));
+            } else if (kind == TargetingKind::Density && f == 2) {
+                out.push_back(std::to_string(v) + "dpi");
+            }
+            return true;
+        });
+    });
+}
+
+bool parse_apk_description(const std::string& message, const std::string& module,
+                           std::map<std::string, SplitTargeting>& result) {
+    SplitTargeting targeting;
+    targeting.module = module;
+    std::string path;
+
+    bool ok = for_each_field(message, [&](uint32_t field, uint32_t wire_type, ProtoReader& r) {
+        if (wire_type != 2) {
+            return r.skip(wire_type);
+        }
+        std::string value;
+        if (!r.bytes(value)) {
+            return false;
+        }
+        if (field == 1) {
+            // ApkTargeting: abi = 1, language = 3, screen_density = 4
+            return for_each_field(value, [&](uint32_t f, uint32_t wt, ProtoReader& t) {
+                std::string sub;
+                if (wt != 2) {
+                    return t.skip(wt);
+                }
+                if (!t.bytes(sub)) {
+                    return false;
+                }
+                if (f == 1) return parse_targeting_values(sub, TargetingKind::Abi, targeting.abis);
+                if (f == 3) return parse_targeting_values(sub, TargetingKind::Language, targeting.languages);
+                if (f == 4) return parse_targeting_values(sub, TargetingKind::Density, targeting.densities);
+                return true;
+            });
+        }
+        if (field == 2) {
+            path = value;
+        } else if (field == 3) {
+            // SplitApkMetadata { split_id = 1; is_master_split = 2 }
+            return for_each_field(value, [&](uint32_t f, uint32_t wt, ProtoReader& s) {
+                if (f == 1 && wt == 2) {
+                    return s.bytes(targeting.split_id);
+                }
+                if (f == 2 && wt == 0) {
+                    uint64_t v = 0;
+                    bool read = s.varint(v);
+                    targeting.master = v != 0;
+                    return read;
+                }
+                return s.skip(wt);
+            });
+        }
+        return true;
+    });
+
+    if (ok && !path.empty()) {
+        result[path] = std::move(targeting);
+    }
+    return ok;
+}
+
+bool parse_apk_set(const std::string& message, std::map<std::string, SplitTargeting>& result) {
+    std::string module;
+    std::vector<std::string> descriptions;
+
+    bool ok = for_each_field(message, [&](uint32_t field, uint32_t wire_type, ProtoReader& r) {
+        if (wire_type != 2) {
+            return r.skip(wire_type);
+        }
+        std::string value;
+        if (!r.bytes(value)) {
+            return false;
+        }
+        if (field == 1) {
+            // ModuleMetadata { name = 1 }
+            return for_each_field(value, [&](uint32_t f, uint32_t wt, ProtoReader& m) {
+                return (f == 1 && wt == 2) ? m.bytes(module) : m.skip(wt);
+            });
+        }
+        if (field == 2) {
+            descriptions.push_back(std::move(value));
+        }
+        return true;
+    });
+
+    for (const auto& description : descriptions) {
+        ok = ok && parse_apk_description(description, module, result);
+    }
+    return ok;
+}
+
+std::string join(const std::vector<std::string>& values) {
+    std::string joined;
+    for (const auto& value : values) {
+        joined += (joined.empty() ? "" : ",") + value;
+    }
+    return joined;
+}
+
+std::vector<std::string> split(const std::string& joined) {
+    std::vector<std::string> values;
+    std::istringstream in(joined);
+    std::string value;
+    while (std::getline(in, value, ',')) {
+        if (!value.empty()) {
+            values.push_back(value);
+        }
+    }
+    return values;
+}
+
+void write_string_array(std::ostringstream& out, const std::vector<std::string>& values) {
+    out << "[";
+    for (size_t i = 0; i < values.size(); ++i) {
+        out << (i > 0 ? ", " : "") << "\"" << json_escape(values[i]) << "\"";
+    }
+    out << "]";
+}
+
+} // anonymous namespace
+
+std::map<std::string, SplitTargeting> ArtifactManifest::parse_toc(const std::string& toc) {
+    std::map<std::string, SplitTargeting> result;
+
+    // BuildApksResult { repeated Variant variant = 1 }, Variant { repeated ApkSet apk_set = 2 }
+    bool ok = for_each_field(toc, [&](uint32_t field, uint32_t wire_type, ProtoReader& r) {
+        if (field != 1 || wire_type != 2) {
+            return r.skip(wire_type);
+        }
+        std::string variant;
+        if (!r.bytes(variant)) {
+            return false;
+        }
+        return for_each_field(variant, [&](uint32_t f, uint32_t wt, ProtoReader& v) {
+            if (f != 2 || wt != 2) {
+                return v.skip(wt);
+            }
+            std::string apk_set;
+            return v.bytes(apk_set) && parse_apk_set(apk_set, result);
+        });
+    });
+
+    if (!ok) {
+        result.clear();
+    }
+    return result;
+}
+
+SplitTargeting ArtifactManifest::guess_targeting(const std::string& entry_path) {
+    static const std::vector<std::string> abis = {
+        "armeabi", "armeabi_v7a", "arm64_v8a", "x86", "x86_64", "mips", "mips64", "riscv64"};
+    static const std::vector<std::string> densities = {
+        "nodpi", "ldpi", "mdpi", "tvdpi", "hdpi", "xhdpi", "xxhdpi", "xxxhdpi"};
+
+    SplitTargeting targeting;
+    std::string stem = fs::path(entry_path).stem().string();
+    size_t dash = stem.find('-');
+    if (dash == std::string::npos) {
+        targeting.module = stem == "universal" ? "base" : stem;
+        return targeting;
+    }
+
+    targeting.module = stem.substr(0, dash);
+    std::string suffix = stem.substr(dash + 1);
+    if (suffix == "master") {
+        targeting.master = true;
+        return targeting;
+    }
+
+    targeting.split_id = "config." + suffix;
+    if (std::find(abis.begin(), abis.end(), suffix) != abis.end()) {
+        std::string abi = suffix;
+        std::replace(abi.begin(), abi.end(), '_', '-');
+        targeting.abis.push_back(abi == "x86-64" ? "x86_64" : abi);
+    } else if (std::find(densities.begin(), densities.end(), suffix) != densities.end()) {
+        targeting.densities.push_back(suffix);
+    } else {
+        targeting.languages.push_back(suffix);
+    }
+    return targeting;
+}
+
+std::string ArtifactManifest::to_json(const std::string& indent) const {
+    std::ostringstream out;
+    out << "[";
+    for (size_t i = 0; i < apks.size(); ++i) {
+        const auto& apk = apks[i];
+        const auto& t = apk.targeting;
+        out << (i > 0 ? "," : "") << "\n" << indent << "  {";
+        out << "\"name\": \"" << json_escape(apk.name) << "\", ";
+        out << "\"size\": " << apk.size << ", ";
+        out << "\"sha256\": \"" << apk.sha256 << "\", ";
+        out << "\"module\": \"" << json_escape(t.module) << "\", ";
+        out << "\"split\": \"" << json_escape(t.split_id) << "\", ";
+        out << "\"master\": " << (t.master ? "true" : "false") << ", ";
+        out << "\"targeting\": {\"abi\": ";
+        write_string_array(out, t.abis);
+        out << ", \"density\": ";
+        write_string_array(out, t.densities);
+        out << ", \"language\": ";
+        write_string_array(out, t.languages);
+        out << "}}";
+    }
+    if (!apks.empty()) {
+        out << "\n" << indent;
+    }
+    out << "]";
+    return out.str();
+}
+
+bool ArtifactManifest::write_file(
+    const fs::path& path,
+    const std::string& input_aab,
+    const std::string& input_sha256
+) const {
+    std::ofstream out(path, std::ios::trunc);
+    if (!out.is_open()) {
+        return false;
+    }
+    out << "{\n";
+    out << "  \"input_aab\": \"" << json_escape(input_aab) << "\",\n";
+    if (!input_sha256.empty()) {
+        out << "  \"input_sha256\": \"" << input_sha256 << "\",\n";
+    }
+    out << "  \"apks\": " << to_json("  ") << "\n";
+    out << "}\n";
+    return static_cast<bool>(out);
+}
+
+std::string ArtifactManifest::to_record(const ApkArtifact& apk, const std::string& type) {
+    const auto& t = apk.targeting;
+    std::ostringstream out;
+    out << "{\"type\": \"" << json_escape(type) << "\", \"name\": \"" << json_escape(apk.name) << "\", "
+        << "\"size\": " << apk.size << ", \"sha256\": \"" << apk.sha256 << "\", "
+        << "\"module\": \"" << json_escape(t.module) << "\", "
+        << "\"split\": \"" << json_escape(t.split_id) << "\", "
+        << "\"master\": " << (t.master ? "true" : "false") << ", "
+        << "\"abi\": \"" << json_escape(join(t.abis)) << "\", "
+        << "\"density\": \"" << json_escape(join(t.densities)) << "\", "
+        << "\"language\": \"" << json_escape(join(t.languages)) << "\"}";
+    return out.str();
+}
+
+ApkArtifact ArtifactManifest::from_record(const std::map<std::string, std::string>& fields) {
+    auto field = [&fields](const char* name) {
+        auto it = fields.find(name);
+        return it != fields.end() ? it->second : std::string();
+    };
+    ApkArtifact apk;
+    apk.name = field("name");
+    apk.size = std::strtoull(field("size").c_str(), nullptr, 10);
+    apk.sha256 = field("sha256");
+    apk.targeting.module = field("module");
+    apk.targeting.split_id = field("split");
+    apk.targeting.master = field("master") == "true";
+    apk.targeting.abis = split(field("abi"));
+    apk.targeting.densities = split(field("density"));
+    apk.targeting.languages = split(field("language"));
+    return apk;
+}
+
+} // namespace aab2apk
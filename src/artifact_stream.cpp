@@ -0,0 +1,160 @@
+#include "artifact_stream.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <memory>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace aab2apk {
+
+namespace {
+
+constexpr size_t TAR_BLOCK = 512;
+constexpr size_t COPY_BUFFER_SIZE = 256 * 1024;
+
+// Octal field terminated by NUL, as ustar expects
+void put_octal(char* field, size_t width, uint64_t value) {
+    std::snprintf(field, width, "%0*llo", static_cast<int>(width - 1), static_cast<unsigned long long>(value));
+}
+
+} // anonymous namespace
+
+bool ArtifactStream::write_all(const void* data, size_t size, std::string& error) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+#ifdef _WIN32
+        int n = _write(fd_, p, static_cast<unsigned>(std::min<size_t>(size, 1u << 30)));
+#else
+        ssize_t n = ::write(fd_, p, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+#endif
+        if (n <= 0) {
+            error = std::string("write to output stream failed: ") + std::strerror(errno);
+            return false;
+        }
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool ArtifactStream::begin_file(const std::string& name, uint64_t size, std::string& error) {
+    if (in_file_) {
+        error = "output stream: " + name_ + " is still being written";
+        return false;
+    }
+    if (!archive_ && wrote_file_) {
+        error = "output stream holds a single APK; got a second one: " + name;
+        return false;
+    }
+    name_ = name;
+    expected_ = size;
+    written_ = 0;
+    in_file_ = true;
+    if (!archive_) {
+        return true;
+    }
+
+    // APK names are short, so the 100-byte ustar name field always suffices
+    if (name.size() >= 100) {
+        error = "name too long for the output archive: " + name;
+        return false;
+    }
+    if (size >= (1ULL << 33)) {
+        error = "file too large for the output archive: " + name;
+        return false;
+    }
+
+    char header[TAR_BLOCK] = {};
+    std::memcpy(header, name.data(), name.size());
+    put_octal(header + 100, 8, 0644);
+    put_octal(header + 108, 8, 0);
+    put_octal(header + 116, 8, 0);
+    put_octal(header + 124, 12, size);
+    put_octal(header + 136, 12, static_cast<uint64_t>(std::time(nullptr)));
+    header[156] = '0';
+    std::memcpy(header + 257, "ustar", 6);
+    std::memcpy(header + 263, "00", 2);
+
+    // The checksum is computed with its own field read as spaces
+    std::memset(header + 148, ' ', 8);
+    unsigned checksum = 0;
+    for (unsigned char c : header) {
+        checksum += c;
+    }
+    std::snprintf(header + 148, 8, "%06o", checksum);
+    header[155] = ' ';
+
+    return write_all(header, sizeof(header), error);
+}
+
+bool ArtifactStream::write(const void* data, size_t size, std::string& error) {
+    if (!in_file_ || written_ + size > expected_) {
+        error = "output stream: more data than announced for " + name_;
+        return false;
+    }
+    written_ += size;
+    return write_all(data, size, error);
+}
+
+bool ArtifactStream::end_file(std::string& error) {
+    if (!in_file_ || written_ != expected_) {
+        error = "output stream: " + name_ + " ended after " + std::to_string(written_) +
+                " of " + std::to_string(expected_) + " bytes";
+        return false;
+    }
+    in_file_ = false;
+    wrote_file_ = true;
+    size_t tail = static_cast<size_t>(written_ % TAR_BLOCK);
+    if (!archive_ || tail == 0) {
+        return true;
+    }
+    char padding[TAR_BLOCK] = {};
+    return write_all(padding, TAR_BLOCK - tail, error);
+}
+
+bool ArtifactStream::add_file(const std::filesystem::path& path, const std::string& name, std::string& error) {
+    std::ifstream in(path, std::ios::binary);
+    std::error_code ec;
+    uint64_t size = std::filesystem::file_size(path, ec);
+    if (!in.is_open() || ec) {
+        error = "cannot read " + path.string();
+        return false;
+    }
+    if (!begin_file(name, size, error)) {
+        return false;
+    }
+    std::unique_ptr<char[]> buffer(new char[COPY_BUFFER_SIZE]);
+    while (in) {
+        in.read(buffer.get(), static_cast<std::streamsize>(COPY_BUFFER_SIZE));
+        std::streamsize got = in.gcount();
+        if (got > 0 && !write(buffer.get(), static_cast<size_t>(got), error)) {
+            return false;
+        }
+    }
+    return end_file(error);
+}
+
+bool ArtifactStream::finish(std::string& error) {
+    if (in_file_) {
+        error = "output stream: " + name_ + " was not completed";
+        return false;
+    }
+    if (!archive_) {
+        return true;
+    }
+    char end[TAR_BLOCK * 2] = {};
+    return write_all(end, sizeof(end), error);
+}
+
+} // namespace aab2apk
@@ -0,0 +1,359 @@
+#include "batch_journal.h"
+#include "file_utils.h"
+#include "json_utils.h"
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace aab2apk {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+bool link_or_copy(const fs::path& from, const fs::path& to) {
+    std::error_code ec;
+    fs::remove(to, ec);
+    fs::create_hard_link(from, to, ec);
+    return !ec || FileUtils::copy_file_fast(from, to);
+}
+
+int open_for_append(const fs::path& path, bool truncate) {
+#ifdef _WIN32
+    int flags = _O_WRONLY | _O_APPEND | _O_CREAT | _O_BINARY | (truncate ? _O_TRUNC : 0);
+    return _open(path.string().c_str(), flags, _S_IREAD | _S_IWRITE);
+#else
+    int flags = O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC | (truncate ? O_TRUNC : 0);
+    return ::open(path.c_str(), flags, 0644);
+#endif
+}
+
+void close_file(int fd) {
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+}
+
+// The APK records of a job followed by the job record itself
+std::string job_lines(
+    const JournalInput& input,
+    const std::string& settings,
+    const std::string& output_dir,
+    bool success,
+    const ArtifactManifest& manifest
+) {
+    std::ostringstream lines;
+    if (success) {
+        for (const auto& apk : manifest.apks) {
+            lines << ArtifactManifest::to_record(apk, "apk") << "\n";
+        }
+    }
+    lines << "{\"type\": \"job\", \"input\": \"" << json_escape(input.path) << "\", "
+          << "\"size\": " << input.size << ", \"mtime\": " << input.mtime << ", "
+          << "\"sha256\": \"" << input.sha256 << "\", "
+          << "\"settings\": \"" << json_escape(settings) << "\", "
+          << "\"output_dir\": \"" << json_escape(output_dir) << "\", "
+          << "\"status\": \"" << (success ? "success" : "failure") << "\"}\n";
+    return lines.str();
+}
+
+std::string signed_line(
+    const std::string& signer_id,
+    const std::string& unsigned_sha256,
+    uint64_t size,
+    const std::string& sha256
+) {
+    std::ostringstream line;
+    line << "{\"type\": \"signed\", \"signer\": \"" << signer_id << "\", "
+         << "\"unsigned_sha256\": \"" << unsigned_sha256 << "\", "
+         << "\"size\": " << size << ", \"sha256\": \"" << sha256 << "\"}\n";
+    return line.str();
+}
+
+} // anonymous namespace
+
+BatchJournal::BatchJournal(const fs::path& output_dir)
+    : path_(output_dir / ".aab2apk-journal"),
+      resume_dir_(output_dir / ".aab2apk-resume") {}
+
+BatchJournal::~BatchJournal() {
+    if (fd_ >= 0) {
+        close_file(fd_);
+    }
+}
+
+bool BatchJournal::open(bool discard, std::string& error) {
+    if (discard) {
+        std::error_code ec;
+        fs::remove(path_, ec);
+        remove_resume_data();
+    } else {
+        load();
+        compact();
+    }
+
+    fd_ = open_for_append(path_, false);
+    if (fd_ < 0) {
+        error = "Failed to open batch journal: " + path_.string();
+        return false;
+    }
+
+    // Terminate a torn last line so the next record starts on its own
+    std::error_code ec;
+    uint64_t size = fs::file_size(path_, ec);
+    if (!ec && size > 0) {
+        std::ifstream in(path_, std::ios::binary);
+        in.seekg(static_cast<std::streamoff>(size - 1));
+        if (in.get() != '\n' && !append("\n")) {
+            error = "Failed to write batch journal: " + path_.string();
+            return false;
+        }
+    }
+    return true;
+}
+
+void BatchJournal::load() {
+    std::ifstream in(path_, std::ios::binary);
+    if (!in.is_open()) {
+        return;
+    }
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    const std::string text = buffer.str();
+
+    // APK records belong to the job record that follows them
+    std::vector<ApkArtifact> apks;
+    size_t start = 0;
+    for (size_t end = text.find('\n'); end != std::string::npos; start = end + 1, end = text.find('\n', start)) {
+        std::map<std::string, std::string> fields;
+        std::string parse_error;
+        if (end == start || !parse_json_object(text.substr(start, end - start), fields, parse_error)) {
+            apks.clear();
+            continue;
+        }
+
+        const std::string& type = fields["type"];
+        if (type == "apk") {
+            apks.push_back(ArtifactManifest::from_record(fields));
+        } else if (type == "job") {
+            if (fields["status"] == "success") {
+                JobRecord& record = jobs_[fields["input"]];
+                record.input.path = fields["input"];
+                record.input.size = std::strtoull(fields["size"].c_str(), nullptr, 10);
+                record.input.mtime = std::strtoll(fields["mtime"].c_str(), nullptr, 10);
+                record.input.sha256 = fields["sha256"];
+                record.settings = fields["settings"];
+                record.output_dir = fields["output_dir"];
+                record.manifest.apks = std::move(apks);
+            } else {
+                jobs_.erase(fields["input"]);
+            }
+            apks.clear();
+        } else if (type == "signed") {
+            SignedRecord& record = signed_[{fields["signer"], fields["unsigned_sha256"]}];
+            record.size = std::strtoull(fields["size"].c_str(), nullptr, 10);
+            record.sha256 = fields["sha256"];
+        }
+    }
+}
+
+// Superseded and failed job records, and torn lines, are dropped by
+// rewriting the journal from what load() kept. The rewrite is synced before
+// it replaces the journal, so a crash leaves one or the other intact; if it
+// cannot be written, the old journal is simply appended to.
+void BatchJournal::compact() {
+    std::error_code ec;
+    if (fs::file_size(path_, ec) == 0 || ec) {
+        return;
+    }
+    std::string records;
+    for (const auto& [input, job] : jobs_) {
+        records += job_lines(job.input, job.settings, job.output_dir, true, job.manifest);
+    }
+    for (const auto& [key, record] : signed_) {
+        records += signed_line(key.first, key.second, record.size, record.sha256);
+    }
+
+    fs::path temp = path_;
+    temp += ".tmp";
+    fd_ = open_for_append(temp, true);
+    if (fd_ < 0) {
+        return;
+    }
+    bool written = records.empty() || append(records);
+    close_file(fd_);
+    fd_ = -1;
+    if (written) {
+        fs::rename(temp, path_, ec);
+    }
+    if (!written || ec) {
+        fs::remove(temp, ec);
+    }
+}
+
+bool BatchJournal::append(const std::string& lines) {
+    // One write() per record group so concurrent appends never interleave,
+    // then a data sync before the caller treats the work as done
+#ifdef _WIN32
+    bool written = _write(fd_, lines.data(), static_cast<unsigned>(lines.size())) == static_cast<int>(lines.size());
+    return written && _commit(fd_) == 0;
+#else
+    bool written = ::write(fd_, lines.data(), lines.size()) == static_cast<ssize_t>(lines.size());
+#if defined(__APPLE__)
+    return written && fsync(fd_) == 0;
+#else
+    return written && fdatasync(fd_) == 0;
+#endif
+#endif
+}
+
+bool BatchJournal::stat_input(const std::string& input, JournalInput& state, bool with_hash) {
+    std::error_code ec;
+    state.path = FileUtils::get_absolute_path(input);
+    state.size = fs::file_size(state.path, ec);
+    if (ec) {
+        return false;
+    }
+    state.mtime = static_cast<int64_t>(fs::last_write_time(state.path, ec).time_since_epoch().count());
+    if (ec) {
+        return false;
+    }
+    if (!with_hash) {
+        return true;
+    }
+    uint64_t hashed_size = 0;
+    return FileUtils::hash_file(state.path, state.sha256, hashed_size) && hashed_size == state.size;
+}
+
+bool BatchJournal::find_complete(
+    const std::string& input,
+    const std::string& settings,
+    const std::string& output_dir,
+    ArtifactManifest& manifest
+) {
+    JobRecord record;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = jobs_.find(FileUtils::get_absolute_path(input));
+        if (it == jobs_.end()) {
+            return false;
+        }
+        record = it->second;
+    }
+    if (record.settings != settings || record.output_dir != output_dir) {
+        return false;
+    }
+
+    JournalInput now;
+    if (!stat_input(input, now, false) || now.size != record.input.size) {
+        return false;
+    }
+    bool touched = now.mtime != record.input.mtime;
+    if (touched && (!stat_input(input, now, true) || now.sha256 != record.input.sha256)) {
+        return false;
+    }
+
+    for (auto& apk : record.manifest.apks) {
+        apk.path = fs::path(output_dir) / apk.name;
+        std::error_code ec;
+        if (fs::file_size(apk.path, ec) != apk.size || ec) {
+            return false;
+        }
+    }
+
+    // Same content under a new mtime: record it so the next run needs no hash
+    if (touched) {
+        record_job(now, settings, output_dir, true, record.manifest);
+    }
+    manifest = std::move(record.manifest);
+    return true;
+}
+
+bool BatchJournal::record_job(
+    const JournalInput& input,
+    const std::string& settings,
+    const std::string& output_dir,
+    bool success,
+    const ArtifactManifest& manifest
+) {
+    const std::string lines = job_lines(input, settings, output_dir, success, manifest);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!append(lines)) {
+        return false;
+    }
+    if (success) {
+        jobs_[input.path] = JobRecord{input, settings, output_dir, manifest};
+    } else {
+        jobs_.erase(input.path);
+    }
+    return true;
+}
+
+fs::path BatchJournal::signed_path(const std::string& signer_id, const std::string& unsigned_sha256) const {
+    return resume_dir_ / (signer_id.substr(0, 16) + "-" + unsigned_sha256 + ".apk");
+}
+
+SignedSplitCache BatchJournal::signed_cache(const std::string& signer_id) {
+    SignedSplitCache cache;
+
+    cache.restore = [this, signer_id](ApkArtifact& apk, const fs::path& dest) {
+        SignedRecord record;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = signed_.find({signer_id, apk.sha256});
+            if (it == signed_.end()) {
+                return false;
+            }
+            record = it->second;
+        }
+
+        // The copy may predate a crash; only an intact one is reused
+        fs::path kept = signed_path(signer_id, apk.sha256);
+        std::string sha256;
+        uint64_t size = 0;
+        if (!FileUtils::hash_file(kept, sha256, size) || size != record.size || sha256 != record.sha256) {
+            return false;
+        }
+        if (!link_or_copy(kept, dest)) {
+            return false;
+        }
+        apk.path = dest;
+        apk.size = record.size;
+        apk.sha256 = record.sha256;
+        return true;
+    };
+
+    cache.store = [this, signer_id](const std::string& unsigned_sha256, const ApkArtifact& signed_apk) {
+        fs::path kept = signed_path(signer_id, unsigned_sha256);
+        if (!FileUtils::create_directories(resume_dir_) || !link_or_copy(signed_apk.path, kept)) {
+            return;
+        }
+        const std::string line = signed_line(signer_id, unsigned_sha256, signed_apk.size, signed_apk.sha256);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (append(line)) {
+            signed_[{signer_id, unsigned_sha256}] = SignedRecord{signed_apk.size, signed_apk.sha256};
+        }
+    };
+
+    return cache;
+}
+
+void BatchJournal::remove_resume_data() {
+    std::error_code ec;
+    fs::remove_all(resume_dir_, ec);
+}
+
+} // namespace aab2apk
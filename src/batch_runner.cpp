@@ -0,0 +1,193 @@
+#include "batch_runner.h"
+#include "batch_journal.h"
+#include "event_stream.h"
+#include "file_utils.h"
+#include "job_scheduler.h"
+#include "json_utils.h"
+#include "logger.h"
+#include "sha256.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <thread>
+
+namespace aab2apk {
+
+namespace fs = std::filesystem;
+
+bool BatchRunner::run(std::vector<BatchJobResult>& results) const {
+    const auto& inputs = config_.inputs;
+    results.assign(inputs.size(), BatchJobResult{});
+
+    // Each bundle gets its own output directory; two inputs with the same
+    // name would overwrite each other
+    std::map<std::string, std::string> stems;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        std::string stem = fs::path(inputs[i]).stem().string();
+        auto existing = stems.emplace(stem, inputs[i]);
+        if (!existing.second) {
+            Log::error() << "Inputs " << existing.first->second << " and " << inputs[i]
+                         << " would both be written to " << (fs::path(config_.output_dir) / stem).string();
+            return false;
+        }
+        results[i].input = inputs[i];
+        results[i].output_dir = (fs::path(config_.output_dir) / stem).string();
+    }
+
+    if (!FileUtils::create_directories(config_.output_dir)) {
+        Log::error() << "Failed to create output directory: " << config_.output_dir;
+        return false;
+    }
+    BatchJournal journal(config_.output_dir);
+    std::string journal_error;
+    if (!journal.open(!config_.resume, journal_error)) {
+        Log::error() << journal_error;
+        return false;
+    }
+    const std::string signer = config_.signing.has_value() ? SigningManager::key_fingerprint(*config_.signing) : "unsigned";
+    const char* mode = config_.mode == OutputMode::Split ? "split"
+                     : config_.mode == OutputMode::Apks ? "apks"
+                     : "universal";
+    // Aligned splits differ from plain ones signed with the same key
+    std::string finisher = signer;
+    if (config_.align_page > 0 && !config_.verify_align) {
+        std::string identity = signer + ":align=" + std::to_string(config_.align_page);
+        finisher = Sha256::to_hex(Sha256::hash(identity.data(), identity.size()));
+    }
+    const char* compression = config_.compression == CompressionMode::Store ? ":store"
+                            : config_.compression == CompressionMode::Fast ? ":fast"
+                            : config_.compression == CompressionMode::Max ? ":max"
+                            : "";
+    // .idsig files are only written when asked for, so a batch first run
+    // without --v4-signature must not count as done with it
+    const char* v4 = config_.signing.has_value() && config_.v4_signature ? ":v4" : "";
+    // A verifying run must check every input's APKs, including those an
+    // earlier plain run already converted
+    const std::string verify = config_.verify_align ? ":verify=" + std::to_string(config_.align_page) : "";
+    const std::string settings = std::string(mode) + compression + ":" + finisher + v4 + verify;
+    const SignedSplitCache signed_cache = journal.signed_cache(finisher);
+
+    JobScheduler scheduler(config_.jobs);
+    unsigned workers = config_.jobs > 0 ? config_.jobs : std::max(1u, std::thread::hardware_concurrency());
+    workers = std::min<unsigned>(workers, static_cast<unsigned>(inputs.size()));
+
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> finished{0};
+
+    auto worker = [&] {
+        for (size_t index = next++; index < inputs.size(); index = next++) {
+            BatchJobResult& result = results[index];
+            Config job = config_;
+            job.input_aab = result.input;
+            job.inputs = {result.input};
+            job.output_dir = result.output_dir;
+            job.quiet = true;
+            auto start_time = std::chrono::steady_clock::now();
+            std::optional<EventStream> events;
+            std::string error = "Conversion failed";
+            if (config_.events) {
+                events.emplace(result.input, EventStream::console(config_));
+            }
+
+            if (config_.resume && journal.find_complete(result.input, settings, result.output_dir, result.manifest)) {
+                result.success = true;
+                result.resumed = true;
+            } else {
+                // The input is hashed for the journal while bundletool starts
+                Logger::Scope log_scope(result.input);
+                JournalInput input_state;
+                {
+                    JobScheduler::Admission admission(scheduler, job);
+                    ConversionStats stats;
+                    result.success = converter_.convert(job, result.manifest, [&job, &input_state] {
+                        if (!ConfigParser::validate_config(job)) {
+                            return false;
+                        }
+                        if (!BatchJournal::stat_input(job.input_aab, input_state, true)) {
+                            Log::error() << "Failed to read input AAB: " << job.input_aab;
+                            return false;
+                        }
+                        return true;
+                    }, &stats, signer.empty() ? nullptr : &signed_cache,
+                       events ? events->callback() : ProgressCallback());
+                    admission.set_peak_rss(stats.bundletool_peak_rss);
+                }
+
+                if (!input_state.path.empty() &&
+                    !journal.record_job(input_state, settings, result.output_dir, result.success, result.manifest)) {
+                    error = "Failed to write batch journal in " + config_.output_dir;
+                    Log::error() << error;
+                    result.success = false;
+                }
+            }
+
+            if (events) {
+                events->finished(result.success, error);
+            }
+
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start_time);
+            result.execution_time = elapsed.count() / 1000.0;
+
+            LogLine progress = Log::info();
+            progress << "[" << ++finished << "/" << inputs.size() << "] " << result.input
+                     << (result.success ? " -> " + result.output_dir : " FAILED");
+            if (result.resumed) {
+                progress << " (already converted)";
+            } else {
+                progress << std::fixed << std::setprecision(3) << " (" << result.execution_time << "s)";
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < workers; ++i) {
+        threads.emplace_back(worker);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    bool all_succeeded = std::all_of(results.begin(), results.end(), [](const BatchJobResult& r) { return r.success; });
+    if (all_succeeded) {
+        journal.remove_resume_data();
+    }
+    return all_succeeded;
+}
+
+std::string BatchRunner::to_json(const std::vector<BatchJobResult>& results, const std::string& indent) {
+    std::ostringstream out;
+    out << "[";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto& result = results[i];
+        out << (i > 0 ? "," : "") << "\n" << indent << "  {";
+        out << "\"input_aab\": \"" << json_escape(result.input) << "\", ";
+        out << "\"output_dir\": \"" << json_escape(result.output_dir) << "\", ";
+        out << "\"status\": \"" << (result.success ? "success" : "failure") << "\", ";
+        out << "\"execution_time\": " << std::fixed << std::setprecision(3) << result.execution_time << ", ";
+        out << "\"apks\": " << result.manifest.to_json(indent + "  ") << "}";
+    }
+    if (!results.empty()) {
+        out << "\n" << indent;
+    }
+    out << "]";
+    return out.str();
+}
+
+bool BatchRunner::write_manifest(const fs::path& path, const std::vector<BatchJobResult>& results) {
+    std::ofstream out(path, std::ios::trunc);
+    if (!out.is_open()) {
+        return false;
+    }
+    out << "{\n";
+    out << "  \"jobs\": " << to_json(results, "  ") << "\n";
+    out << "}\n";
+    return static_cast<bool>(out);
+}
+
+} // namespace aab2apk
@@ -0,0 +1,217 @@
+#include "blob_store.h"
+#include "file_utils.h"
+#include "sha256.h"
+#include <atomic>
+#include <fstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace aab2apk {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+std::string unique_suffix() {
+    static std::atomic<unsigned> counter{0};
+#ifdef _WIN32
+    unsigned long pid = GetCurrentProcessId();
+#else
+    long pid = static_cast<long>(getpid());
+#endif
+    return std::to_string(pid) + "-" + std::to_string(counter++);
+}
+
+bool is_digest(const std::string& value) {
+    return value.size() == 64 && value.find_first_not_of("0123456789abcdef") == std::string::npos;
+}
+
+// Hard link, falling back to a reflink or copy across filesystems
+bool link_or_copy(const fs::path& from, const fs::path& to) {
+    std::error_code ec;
+    fs::create_hard_link(from, to, ec);
+    return !ec || FileUtils::copy_file_fast(from, to);
+}
+
+} // anonymous namespace
+
+std::string BlobStore::key(const std::string& unsigned_sha256, const std::string& finisher) {
+    std::string identity = unsigned_sha256 + "\n" + finisher;
+    return Sha256::to_hex(Sha256::hash(identity.data(), identity.size()));
+}
+
+fs::path BlobStore::blob_path(const std::string& sha256) const {
+    return root_ / "blobs" / sha256.substr(0, 2) / sha256;
+}
+
+fs::path BlobStore::key_path(const std::string& key) const {
+    return root_ / "keys" / key.substr(0, 2) / key;
+}
+
+bool BlobStore::find(const std::string& key, std::string& sha256, uint64_t& size) const {
+    if (!is_digest(key)) {
+        return false;
+    }
+    std::ifstream in(key_path(key));
+    if (!(in >> sha256 >> size) || !is_digest(sha256)) {
+        return false;
+    }
+    std::error_code ec;
+    return fs::file_size(blob_path(sha256), ec) == size && !ec;
+}
+
+bool BlobStore::link(const std::string& sha256, uint64_t size, const fs::path& dest) const {
+    if (!is_digest(sha256)) {
+        return false;
+    }
+    fs::path blob = blob_path(sha256);
+    std::error_code ec;
+    if (fs::file_size(blob, ec) != size || ec) {
+        return false;
+    }
+    fs::create_hard_link(blob, dest, ec);
+    if (!ec) {
+        return true;
+    }
+    // A copy is the caller's own file; only the blob is read-only
+    if (!FileUtils::copy_file_fast(blob, dest)) {
+        fs::remove(dest, ec);
+        return false;
+    }
+    fs::permissions(dest, fs::perms::owner_write, fs::perm_options::add, ec);
+    return true;
+}
+
+bool BlobStore::admit(
+    const fs::path& file,
+    const std::string& sha256,
+    uint64_t size,
+    const std::string& key
+) const {
+    if (!is_digest(sha256) || (!key.empty() && !is_digest(key))) {
+        return false;
+    }
+    fs::path blob = blob_path(sha256);
+    std::error_code ec;
+    if (!FileUtils::create_directories(blob.parent_path())) {
+        return false;
+    }
+
+    const std::string suffix = ".tmp-" + unique_suffix();
+    if (fs::file_size(blob, ec) == size && !ec) {
+        // Already stored: swap file for a link to the stored copy, which
+        // frees file's own blocks once nothing else links it
+        fs::path linked = file;
+        linked += suffix;
+        fs::create_hard_link(blob, linked, ec);
+        if (!ec) {
+            fs::rename(linked, file, ec);
+            if (ec) {
+                fs::remove(linked, ec);
+            }
+        }
+    } else {
+        // Links are made under a temporary name and renamed in, so a
+        // blob is never seen half-written
+        fs::path incoming = blob;
+        incoming += suffix;
+        if (!link_or_copy(file, incoming)) {
+            fs::remove(incoming, ec);
+            return false;
+        }
+        fs::permissions(incoming, fs::perms::owner_write | fs::perms::group_write | fs::perms::others_write,
+                        fs::perm_options::remove, ec);
+        fs::rename(incoming, blob, ec);
+        if (ec) {
+            fs::remove(incoming, ec);
+            return false;
+        }
+    }
+
+    if (key.empty()) {
+        return true;
+    }
+    fs::path record = key_path(key);
+    if (!FileUtils::create_directories(record.parent_path())) {
+        return false;
+    }
+    fs::path partial = record;
+    partial += suffix;
+    {
+        std::ofstream out(partial, std::ios::trunc);
+        out << sha256 << " " << size << "\n";
+        if (!out.flush()) {
+            fs::remove(partial, ec);
+            return false;
+        }
+    }
+    fs::rename(partial, record, ec);
+    if (ec) {
+        fs::remove(partial, ec);
+        return false;
+    }
+    return true;
+}
+
+bool BlobStore::gc(BlobStoreStats& stats, std::string& error) const {
+    stats = BlobStoreStats{};
+    std::error_code ec;
+    fs::path blobs = root_ / "blobs";
+    if (!fs::is_directory(root_, ec)) {
+        error = "Not a blob store: " + root_.string();
+        return false;
+    }
+
+    // A blob whose only link is its own name is referenced by no output.
+    // Leftover temporary names from interrupted runs go too.
+    for (fs::recursive_directory_iterator it(blobs, ec), end; !ec && it != end; it.increment(ec)) {
+        if (!it->is_regular_file(ec)) {
+            continue;
+        }
+        const fs::path& path = it->path();
+        std::error_code file_ec;
+        uintmax_t links = fs::hard_link_count(path, file_ec);
+        if (file_ec) {
+            continue;
+        }
+        if (links > 1 && is_digest(path.filename().string())) {
+            stats.blobs_kept++;
+            stats.references += static_cast<size_t>(links - 1);
+            continue;
+        }
+        uintmax_t size = fs::file_size(path, file_ec);
+        if (file_ec) {
+            size = 0;
+        }
+        if (fs::remove(path, file_ec)) {
+            stats.blobs_removed++;
+            stats.bytes_freed += size;
+        }
+    }
+    if (ec && ec != std::errc::no_such_file_or_directory) {
+        error = "Cannot scan " + blobs.string() + ": " + ec.message();
+        return false;
+    }
+
+    ec.clear();
+    fs::path keys = root_ / "keys";
+    for (fs::recursive_directory_iterator it(keys, ec), end; !ec && it != end; it.increment(ec)) {
+        if (!it->is_regular_file(ec)) {
+            continue;
+        }
+        std::string sha256;
+        uint64_t size = 0;
+        std::string name = it->path().filename().string();
+        std::error_code file_ec;
+        if (!find(name, sha256, size) && fs::remove(it->path(), file_ec)) {
+            stats.keys_removed++;
+        }
+    }
+    return true;
+}
+
+} // namespace aab2apk
@@ -0,0 +1,366 @@
+#include "aab2apk.h"
+#include "aab_converter.h"
+#include "artifact_manifest.h"
+#include "config.h"
+#include "file_utils.h"
+#include "job_scheduler.h"
+#include "json_utils.h"
+#include "logger.h"
+#include "process_runner.h"
+#include "signing.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+using aab2apk::AabConverter;
+using aab2apk::ApkArtifact;
+using aab2apk::ArtifactManifest;
+using aab2apk::Config;
+using aab2apk::ConfigParser;
+using aab2apk::ConversionStats;
+using aab2apk::FileUtils;
+using aab2apk::JobScheduler;
+using aab2apk::ProcessRunner;
+using aab2apk::ProgressEvent;
+using aab2apk::SigningManager;
+using aab2apk::json_escape;
+
+struct aab2apk_result {
+    aab2apk_status status = AAB2APK_CONVERSION_FAILED;
+    std::string error;
+    std::string json;
+    std::vector<ApkArtifact> apks;
+    std::vector<std::string> paths;   // apks[i].path as narrow strings
+};
+
+struct aab2apk_context {
+    Config defaults;
+    ProcessRunner runner;
+    SigningManager signer{runner};
+    AabConverter converter{runner, signer};
+    std::unique_ptr<JobScheduler> scheduler;
+
+    std::mutex mutex;
+    std::condition_variable idle;
+    unsigned active = 0;
+    uint64_t next_job = 0;
+};
+
+struct aab2apk_job {
+    aab2apk_context* context = nullptr;
+    std::string id;
+    Config config;
+    aab2apk_progress_fn progress = nullptr;
+    void* user_data = nullptr;
+
+    std::thread thread;
+    std::once_flag joined;
+    std::unique_ptr<aab2apk_result> result;
+};
+
+namespace {
+
+thread_local std::string g_last_error;
+
+aab2apk_status fail(aab2apk_status status, const std::string& error) {
+    g_last_error = error;
+    return status;
+}
+
+// Status lines must stay on one line, as serve's do
+std::string single_line(std::string json) {
+    json.erase(std::remove(json.begin(), json.end(), '\n'), json.end());
+    return json;
+}
+
+// Runs on the job's own thread; never throws
+void run_job(aab2apk_job& job) {
+    aab2apk::Logger::Scope log_scope(job.id);
+    aab2apk_context& context = *job.context;
+    auto result = std::make_unique<aab2apk_result>();
+    auto start_time = std::chrono::steady_clock::now();
+
+    aab2apk::ProgressCallback progress;
+    if (job.progress != nullptr) {
+        progress = [&job](const ProgressEvent& event) {
+            aab2apk_progress report{job.id.c_str(), event.phase.c_str(), event.apk.c_str(), event.bytes};
+            job.progress(&report, job.user_data);
+        };
+    }
+
+    ArtifactManifest manifest;
+    bool success = false;
+    result->error = "Conversion failed";
+    try {
+        const Config& config = job.config;
+        {
+            // Held back until its JVM fits next to the context's other jobs
+            JobScheduler::Admission admission(*context.scheduler, job.config);
+            ConversionStats stats;
+            success = context.converter.convert(config, manifest, [&config] {
+                return ConfigParser::validate_config(config);
+            }, &stats, nullptr, progress);
+            admission.set_peak_rss(stats.bundletool_peak_rss);
+        }
+
+        if (success && !config.manifest_path.empty() &&
+            !manifest.write_file(config.manifest_path, config.input_aab)) {
+            result->error = "Failed to write manifest: " + config.manifest_path;
+            success = false;
+        }
+    } catch (const std::exception& e) {
+        result->error = e.what();
+        success = false;
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start_time);
+    std::ostringstream line;
+    line << "{\"id\": \"" << json_escape(job.id) << "\", \"status\": \"" << (success ? "success" : "failure") << "\"";
+    line << ", \"execution_time\": " << std::fixed << std::setprecision(3) << elapsed.count() / 1000.0;
+    if (success) {
+        line << ", \"output_dir\": \"" << json_escape(job.config.output_dir) << "\"";
+        line << ", \"apks\": " << single_line(manifest.to_json());
+        result->status = AAB2APK_OK;
+        result->error.clear();
+        result->apks = std::move(manifest.apks);
+        for (const auto& apk : result->apks) {
+            result->paths.push_back(apk.path.string());
+        }
+    } else {
+        line << ", \"error\": \"" << json_escape(result->error) << "\"";
+    }
+    line << "}";
+    result->json = line.str();
+    job.result = std::move(result);
+
+    // Notified under the lock: a destroy waiting on it may free the
+    // context as soon as the lock is released
+    std::lock_guard<std::mutex> lock(context.mutex);
+    --context.active;
+    context.idle.notify_all();
+}
+
+void join_job(aab2apk_job& job) {
+    std::call_once(job.joined, [&job] {
+        if (job.thread.joinable()) {
+            job.thread.join();
+        }
+    });
+}
+
+} // anonymous namespace
+
+extern "C" {
+
+int aab2apk_api_version(void) {
+    return AAB2APK_API_VERSION;
+}
+
+const char* aab2apk_last_error(void) {
+    return g_last_error.c_str();
+}
+
+aab2apk_status aab2apk_context_create(const char* options_json, aab2apk_context** context) {
+    if (context == nullptr) {
+        return fail(AAB2APK_INVALID_ARGUMENT, "context must not be NULL");
+    }
+    *context = nullptr;
+    try {
+        std::map<std::string, std::string> fields;
+        std::string error;
+        if (options_json != nullptr && !aab2apk::parse_json_object(options_json, fields, error)) {
+            return fail(AAB2APK_INVALID_ARGUMENT, "Invalid options: " + error);
+        }
+        auto created = std::make_unique<aab2apk_context>();
+        Config& defaults = created->defaults;
+        defaults.output_dir = "./dist";
+        defaults.quiet = true;
+        defaults.bundletool_path = fields["bundletool"];
+        defaults.java_path = fields["java"];
+        if (!fields["jobs"].empty()) {
+            // As --jobs: stoul would wrap "-1" around to a huge count
+            const std::string& jobs = fields["jobs"];
+            unsigned long value = 0;
+            try {
+                value = jobs.find_first_not_of("0123456789") == std::string::npos ? std::stoul(jobs) : 0;
+            } catch (const std::exception&) {
+                value = 0;
+            }
+            if (value == 0 || value > 256) {
+                return fail(AAB2APK_INVALID_ARGUMENT, "Invalid jobs: " + jobs + " (1 to 256)");
+            }
+            defaults.jobs = static_cast<unsigned>(value);
+        }
+        defaults.workers = std::max(1u, defaults.jobs);
+
+        if (defaults.bundletool_path.empty()) {
+            auto bundletool = FileUtils::find_bundletool();
+            if (!bundletool.has_value()) {
+                return fail(AAB2APK_TOOLS_NOT_FOUND, "bundletool.jar not found");
+            }
+            defaults.bundletool_path = bundletool->string();
+        }
+        if (defaults.java_path.empty()) {
+            auto java = FileUtils::find_java_executable();
+            if (!java.has_value()) {
+                return fail(AAB2APK_TOOLS_NOT_FOUND, "Java executable not found");
+            }
+            defaults.java_path = java->string();
+        }
+
+        created->scheduler = std::make_unique<JobScheduler>(defaults.workers);
+        // Warm the signing session once for every job of the context
+        created->signer.apksigner();
+        *context = created.release();
+        return AAB2APK_OK;
+    } catch (const std::exception& e) {
+        return fail(AAB2APK_INVALID_ARGUMENT, e.what());
+    }
+}
+
+void aab2apk_context_destroy(aab2apk_context* context) {
+    if (context == nullptr) {
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> lock(context->mutex);
+        context->idle.wait(lock, [context] { return context->active == 0; });
+    }
+    delete context;
+}
+
+aab2apk_status aab2apk_submit(
+    aab2apk_context* context,
+    const char* request_json,
+    aab2apk_progress_fn progress,
+    void* user_data,
+    aab2apk_job** job
+) {
+    if (context == nullptr || request_json == nullptr || job == nullptr) {
+        return fail(AAB2APK_INVALID_ARGUMENT, "context, request and job must not be NULL");
+    }
+    *job = nullptr;
+    try {
+        std::map<std::string, std::string> fields;
+        std::string error;
+        if (!aab2apk::parse_json_object(request_json, fields, error)) {
+            return fail(AAB2APK_INVALID_ARGUMENT, "Invalid request: " + error);
+        }
+        auto created = std::make_unique<aab2apk_job>();
+        created->context = context;
+        created->config = context->defaults;
+        created->progress = progress;
+        created->user_data = user_data;
+        if (!ConfigParser::apply_job_request(fields, created->config, error)) {
+            return fail(AAB2APK_INVALID_ARGUMENT, error);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(context->mutex);
+            created->id = fields.count("id") ? fields["id"] : "job-" + std::to_string(context->next_job);
+            context->next_job++;
+            if (!ConfigParser::apply_job_output(fields, created->id, created->config, error)) {
+                return fail(AAB2APK_INVALID_ARGUMENT, error);
+            }
+            context->active++;
+        }
+        aab2apk_job* started = created.get();
+        try {
+            created->thread = std::thread([started] { run_job(*started); });
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(context->mutex);
+            context->active--;
+            throw;
+        }
+        *job = created.release();
+        return AAB2APK_OK;
+    } catch (const std::exception& e) {
+        return fail(AAB2APK_INVALID_ARGUMENT, e.what());
+    }
+}
+
+aab2apk_status aab2apk_job_wait(aab2apk_job* job, const aab2apk_result** result) {
+    if (job == nullptr) {
+        return fail(AAB2APK_INVALID_ARGUMENT, "job must not be NULL");
+    }
+    join_job(*job);
+    if (result != nullptr) {
+        *result = job->result.get();
+    }
+    if (job->result->status != AAB2APK_OK) {
+        return fail(job->result->status, job->result->error);
+    }
+    return AAB2APK_OK;
+}
+
+void aab2apk_job_free(aab2apk_job* job) {
+    if (job == nullptr) {
+        return;
+    }
+    join_job(*job);
+    delete job;
+}
+
+aab2apk_status aab2apk_convert(
+    aab2apk_context* context,
+    const char* request_json,
+    aab2apk_progress_fn progress,
+    void* user_data,
+    aab2apk_result** result
+) {
+    if (result == nullptr) {
+        return fail(AAB2APK_INVALID_ARGUMENT, "result must not be NULL");
+    }
+    *result = nullptr;
+    aab2apk_job* job = nullptr;
+    aab2apk_status status = aab2apk_submit(context, request_json, progress, user_data, &job);
+    if (status != AAB2APK_OK) {
+        return status;
+    }
+    status = aab2apk_job_wait(job, nullptr);
+    *result = job->result.release();
+    aab2apk_job_free(job);
+    return status;
+}
+
+aab2apk_status aab2apk_result_status(const aab2apk_result* result) {
+    return result != nullptr ? result->status : AAB2APK_INVALID_ARGUMENT;
+}
+
+const char* aab2apk_result_error(const aab2apk_result* result) {
+    return result != nullptr ? result->error.c_str() : "";
+}
+
+size_t aab2apk_result_apk_count(const aab2apk_result* result) {
+    return result != nullptr ? result->apks.size() : 0;
+}
+
+int aab2apk_result_apk(const aab2apk_result* result, size_t index, aab2apk_apk* apk) {
+    if (result == nullptr || apk == nullptr || index >= result->apks.size()) {
+        return 0;
+    }
+    const ApkArtifact& artifact = result->apks[index];
+    apk->name = artifact.name.c_str();
+    apk->path = result->paths[index].c_str();
+    apk->size = artifact.size;
+    apk->sha256 = artifact.sha256.c_str();
+    apk->module = artifact.targeting.module.c_str();
+    apk->split_id = artifact.targeting.split_id.c_str();
+    return 1;
+}
+
+const char* aab2apk_result_json(const aab2apk_result* result) {
+    return result != nullptr ? result->json.c_str() : "";
+}
+
+void aab2apk_result_free(aab2apk_result* result) {
+    delete result;
+}
+
+} // extern "C"
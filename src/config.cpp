@@ -1,5 +1,6 @@
 #include "config.h"
 #include "file_utils.h"
+#include "logger.h"
 #include <iostream>
 #include <cstdlib>
 #include <algorithm>
@@ -11,27 +12,94 @@ namespace {
     constexpr const char* VERSION = "1.0.0";
     constexpr const char* USAGE_TEMPLATE = R"(
 Usage: %s [OPTIONS]
+       %s serve --socket <path> [OPTIONS]
+       %s --queue-dir <dir> [OPTIONS]
+       %s diff --old <apk> --new <apk> [--patch <file>]
+       %s apply --old <apk> --patch <file> --new <apk>
+       %s gc --dedup-store <dir>
 
 Convert Android App Bundle (.aab) to APK files.
 
 Required:
-  -i, --input <path>          Input .aab file path
+  -i, --input <path>          Input .aab file path (repeat to convert several
+                              bundles, each into <output>/<name>/)
 
 Optional:
-  -o, --output <path>         Output directory (default: ./dist)
-  -m, --mode <mode>           Output mode: universal or split (default: universal)
+  --input-name <name>         Name of a bundle read from stdin with "-i -" (default: stdin.aab)
+  -o, --output <path>         Output directory (default: ./dist); "-" streams to stdout
+  --output-fd <n>             Stream to file descriptor n instead of a directory: the
+                              universal APK as is, a split set as a tar archive
+  -m, --mode <mode>           Output mode: universal, split or apks (default: universal)
   --keystore <path>           Keystore file path for signing
   --ks-pass <password>        Keystore password (or env:VAR_NAME)
   --key-alias <alias>         Key alias
   --key-pass <password>       Key password (or env:VAR_NAME)
+  --v4-signature              Also write an APK Signature Scheme v4 signature (.idsig)
+                              next to each signed APK, for incremental installs
   --bundletool <path>         Path to bundletool.jar (auto-detected if not specified)
   --java <path>               Path to java executable (auto-detected if not specified)
+  --jvm-arg <option>          Option for bundletool's JVM, e.g. -Xmx8g (repeatable);
+                              an -Xmx here replaces the scheduler's heap cap
   -v, --verbose               Verbose output
   -q, --quiet                 Quiet mode (errors only)
+  --log-format <format>       Diagnostics as text or json (one object per line with
+                              time, level, thread, job and message; default: text)
+  --log-file <path>           Append diagnostics to a file instead of stdout/stderr
   --list-tools                List detected tools (Java, bundletool) and exit
   --time                      Show conversion timing information
   --check, --validate         Validate configuration and inputs only (no conversion)
   --json-output               Output results in JSON format
+  --events ndjson             Stream each job's progress (started, bundletool, each APK
+                              extracted and signed, published, finished) as JSON lines
+                              with timestamps, byte counts and rates
+  --manifest <path>           Write a per-APK manifest (name, size, sha256, targeting) as JSON
+  --staging <mode>            Where intermediates live: auto, memory or disk (default: auto)
+  --memory-budget <MiB>       Memory for staging bundletool's output (default: 1024);
+                              split and apks mode reserve 4x the uncompressed bundle
+  --tool-output-limit <KiB>   bundletool/apksigner output kept in memory for error
+                              messages, per stream: its start and end (default: 256)
+  --tool-log <dir>            Write each job's complete bundletool/apksigner output to
+                              <dir>/<input name>.log
+  -j, --jobs <n>              Conversions run at once with several inputs
+                              (default: as many as fit in available memory)
+  --no-resume                 Reconvert every input instead of skipping those a
+                              previous run of the batch already finished
+  --sign-jobs <n>             Splits signed concurrently in split mode (default: up to 4)
+  --queue-depth <n>           Extracted splits buffered ahead of the signers (default: 2 x sign-jobs)
+  --compression <level>       Recompress the universal APK: store, fast or max
+                              (default: keep bundletool's compression)
+  --align <4k|16k>            Align stored entries to 4 bytes and uncompressed native
+                              libraries to 4 KiB or 16 KiB pages before signing
+  --verify-align              Only check the finished APKs' alignment (16 KiB unless
+                              --align says otherwise); misaligned entries fail the run
+  --module-cache <dir>        Split mode: reuse splits of modules unchanged since an
+                              earlier conversion instead of rebuilding and re-signing them
+  --dedup-store <dir>         Split mode: hard-link splits identical to ones finished
+                              before from a content-addressed store instead of signing
+                              and writing them again ("gc" prunes unreferenced ones)
+
+Server mode (serve):
+  --socket <path>             Unix socket to accept JSON job requests on
+  --workers <n>               Conversions run concurrently (default: 1)
+  Other options set the defaults for every job.
+
+Work queue mode (--queue-dir):
+  --queue-dir <dir>           Claim JSON job requests from <dir>/pending/ and write
+                              results to <dir>/done/ or <dir>/failed/
+  --worker-id <name>          Name this worker's claims carry (default: <host>-<pid>)
+  --lease <seconds>           Claims not renewed for this long are re-queued (default: 60)
+  --watch                     Keep waiting for jobs instead of exiting once drained
+  -j sets the jobs run at once; other options set the defaults for every job.
+
+Delta patches (diff, apply):
+  --old <apk>                 The previous APK the patch goes from
+  --new <apk>                 diff: the new APK (default: <output>/<name>.apk, the
+                              universal APK converting -i <name>.aab publishes);
+                              apply: where the rebuilt APK is written
+  --patch <file>              diff: where the patch is written (default: <new>.patch);
+                              apply: the patch to apply
+  -j sets the threads computing deltas.
+
   -h, --help                  Show this help message
   --version                   Show version information
 
@@ -53,31 +121,148 @@ std::string ConfigParser::resolve_env_var(const std::string& value) {
     return value;
 }
 
+bool ConfigParser::apply_job_request(
+    const std::map<std::string, std::string>& fields,
+    Config& config,
+    std::string& error
+) {
+    auto field = [&fields](const char* name) {
+        auto it = fields.find(name);
+        return it != fields.end() ? it->second : std::string();
+    };
+
+    // A job is a plain single conversion reported by its runner
+    config.serve = false;
+    config.quiet = true;
+    config.json_output = false;
+    config.check_only = false;
+    config.output_fd = -1;
+    config.queue_dir.clear();
+
+    config.input_aab = field("input");
+    if (config.input_aab.empty() || config.input_aab == "-") {
+        error = "\"input\" must be the path of an AAB";
+        return false;
+    }
+    config.inputs = {config.input_aab};
+    if (field("output") == "-") {
+        error = "\"output\" must be a directory; jobs cannot stream";
+        return false;
+    }
+    if (!field("output").empty()) {
+        config.output_dir = field("output");
+    }
+    config.manifest_path = field("manifest");
+
+    std::string mode = field("mode");
+    if (mode == "split") {
+        config.mode = OutputMode::Split;
+    } else if (mode == "universal") {
+        config.mode = OutputMode::Universal;
+    } else if (mode == "apks") {
+        config.mode = OutputMode::Apks;
+    } else if (!mode.empty()) {
+        error = "Invalid mode. Must be 'universal', 'split' or 'apks'";
+        return false;
+    }
+
+    std::string staging = field("staging");
+    if (staging == "auto") {
+        config.staging = StagingMode::Auto;
+    } else if (staging == "memory") {
+        config.staging = StagingMode::Memory;
+    } else if (staging == "disk") {
+        config.staging = StagingMode::Disk;
+    } else if (!staging.empty()) {
+        error = "Invalid staging mode. Must be 'auto', 'memory' or 'disk'";
+        return false;
+    }
+
+    if (!field("keystore").empty()) {
+        SigningConfig signing;
+        signing.keystore_path = field("keystore");
+        signing.key_alias = field("key_alias");
+        try {
+            signing.keystore_password = resolve_env_var(field("ks_pass"));
+            signing.key_password = resolve_env_var(field("key_pass"));
+        } catch (const std::exception& e) {
+            error = e.what();
+            return false;
+        }
+        config.signing = signing;
+    }
+    // The server's or queue's options combined with this job's
+    return check_combinations(config, error);
+}
+
+bool ConfigParser::check_combinations(const Config& config, std::string& error) {
+    if (config.compression != CompressionMode::Keep && config.mode != OutputMode::Universal) {
+        error = "--compression applies to --mode universal only";
+        return false;
+    }
+    if (!config.dedup_store.empty() && (config.mode != OutputMode::Split || config.output_fd >= 0)) {
+        error = "--dedup-store applies to --mode split with an output directory";
+        return false;
+    }
+    if (config.v4_signature) {
+        // serve and queue jobs bring their own keystore, checked per job
+        if (!config.signing.has_value() && !config.serve && config.queue_dir.empty()) {
+            error = "--v4-signature requires signing (--keystore)";
+            return false;
+        }
+        // Streams, .apks archives and stored splits carry no .idsig files
+        if (config.mode == OutputMode::Apks || config.output_fd >= 0 || !config.module_cache.empty() ||
+            !config.dedup_store.empty()) {
+            error = "--v4-signature cannot be combined with --mode apks, streamed output, "
+                    "--module-cache or --dedup-store";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ConfigParser::apply_job_output(
+    const std::map<std::string, std::string>& fields,
+    const std::string& name,
+    Config& config,
+    std::string& error
+) {
+    if (fields.count("output") != 0) {
+        return true;
+    }
+    if (name.empty() || name == "." || name == ".." || name.find_first_of("/\\") != std::string::npos) {
+        error = "\"id\" must be a plain name when \"output\" is not given: " + name;
+        return false;
+    }
+    config.output_dir = (fs::path(config.output_dir) / name).string();
+    return true;
+}
+
 bool ConfigParser::validate_config(const Config& config) {
     if (config.input_aab.empty()) {
-        std::cerr << "Error: Input AAB file is required\n";
+        Log::error() << "Input AAB file is required";
         return false;
     }
 
     if (!FileUtils::file_exists(config.input_aab)) {
-        std::cerr << "Error: Input AAB file does not exist: " << config.input_aab << "\n";
+        Log::error() << "Input AAB file does not exist: " << config.input_aab;
         return false;
     }
 
     if (!FileUtils::validate_aab_file(config.input_aab)) {
-        std::cerr << "Error: Invalid AAB file: " << config.input_aab << "\n";
+        Log::error() << "Invalid AAB file: " << config.input_aab;
         return false;
     }
 
     if (config.signing.has_value()) {
         const auto& sig = config.signing.value();
         if (!FileUtils::file_exists(sig.keystore_path)) {
-            std::cerr << "Error: Keystore file does not exist: " << sig.keystore_path << "\n";
+            Log::error() << "Keystore file does not exist: " << sig.keystore_path;
             return false;
         }
 
         if (sig.key_alias.empty()) {
-            std::cerr << "Error: Key alias is required when signing\n";
+            Log::error() << "Key alias is required when signing";
             return false;
         }
     }
@@ -86,7 +271,10 @@ bool ConfigParser::validate_config(const Config& config) {
 }
 
 void ConfigParser::print_usage(const char* program_name) {
-    std::printf(USAGE_TEMPLATE, program_name, program_name, program_name);
+    // After the error that led here, not in the middle of it
+    Logger::flush();
+    std::printf(USAGE_TEMPLATE, program_name, program_name, program_name, program_name, program_name,
+                program_name, program_name, program_name);
 }
 
 void ConfigParser::print_version() {
@@ -94,6 +282,18 @@ void ConfigParser::print_version() {
 }
 
 Config ConfigParser::parse(int argc, char* argv[]) {
+    Config config = parse_arguments(argc, argv);
+
+    // Skip validation if --list-tools is set (no input file needed)
+    if (!config.list_tools && !config.serve && config.queue_dir.empty() && config.patch_command.empty() &&
+        !config.dedup_gc && !validate_config(config)) {
+        std::exit(1);
+    }
+
+    return config;
+}
+
+Config ConfigParser::parse_arguments(int argc, char* argv[]) {
     Config config;
 
     if (argc < 2) {
@@ -120,21 +320,208 @@ Config ConfigParser::parse(int argc, char* argv[]) {
 
         if (arg == "-i" || arg == "--input") {
             if (i + 1 >= argc) {
-                std::cerr << "Error: --input requires a file path\n";
+                Log::error() << "--input requires a file path";
+                std::exit(1);
+            }
+            config.inputs.push_back(argv[++i]);
+            if (config.input_aab.empty()) {
+                config.input_aab = config.inputs.back();
+            }
+        }
+        else if (arg == "--input-name") {
+            if (i + 1 >= argc) {
+                Log::error() << "--input-name requires a file name";
+                std::exit(1);
+            }
+            config.input_name = argv[++i];
+            if (config.input_name.find_first_of("/\\") != std::string::npos ||
+                config.input_name == "." || config.input_name == "..") {
+                Log::error() << "--input-name must be a plain file name";
+                std::exit(1);
+            }
+            if (fs::path(config.input_name).extension() != ".aab") {
+                config.input_name += ".aab";
+            }
+        }
+        else if (arg == "serve" && i == 1) {
+            config.serve = true;
+        }
+        else if (arg == "gc" && i == 1) {
+            config.dedup_gc = true;
+        }
+        else if ((arg == "diff" || arg == "apply") && i == 1) {
+            config.patch_command = arg;
+        }
+        else if (arg == "--old" || arg == "--new" || arg == "--patch") {
+            if (i + 1 >= argc) {
+                Log::error() << arg << " requires a file path";
+                std::exit(1);
+            }
+            (arg == "--old" ? config.patch_old : arg == "--new" ? config.patch_new : config.patch_file) = argv[++i];
+        }
+        else if (arg == "--socket") {
+            if (i + 1 >= argc) {
+                Log::error() << "--socket requires a path";
+                std::exit(1);
+            }
+            config.socket_path = argv[++i];
+        }
+        else if (arg == "-j" || arg == "--jobs") {
+            if (i + 1 >= argc) {
+                Log::error() << "--jobs requires a number";
+                std::exit(1);
+            }
+            unsigned long value = 0;
+            try {
+                value = std::stoul(argv[++i]);
+            } catch (const std::exception&) {
+                value = 0;
+            }
+            if (value == 0 || value > 256) {
+                Log::error() << "Invalid --jobs value: " << argv[i];
+                std::exit(1);
+            }
+            config.jobs = static_cast<unsigned>(value);
+        }
+        else if (arg == "--workers") {
+            if (i + 1 >= argc) {
+                Log::error() << "--workers requires a number";
+                std::exit(1);
+            }
+            unsigned long value = 0;
+            try {
+                value = std::stoul(argv[++i]);
+            } catch (const std::exception&) {
+                value = 0;
+            }
+            if (value == 0 || value > 256) {
+                Log::error() << "Invalid --workers value: " << argv[i];
+                std::exit(1);
+            }
+            config.workers = static_cast<unsigned>(value);
+        }
+        else if (arg == "--module-cache") {
+            if (i + 1 >= argc) {
+                Log::error() << "--module-cache requires a directory path";
+                std::exit(1);
+            }
+            config.module_cache = argv[++i];
+        }
+        else if (arg == "--v4-signature") {
+            config.v4_signature = true;
+        }
+        else if (arg == "--dedup-store") {
+            if (i + 1 >= argc) {
+                Log::error() << "--dedup-store requires a directory path";
+                std::exit(1);
+            }
+            config.dedup_store = argv[++i];
+        }
+        else if (arg == "--no-resume") {
+            config.resume = false;
+        }
+        else if (arg == "--queue-dir") {
+            if (i + 1 >= argc) {
+                Log::error() << "--queue-dir requires a directory path";
                 std::exit(1);
             }
-            config.input_aab = argv[++i];
+            config.queue_dir = argv[++i];
+        }
+        else if (arg == "--worker-id") {
+            if (i + 1 >= argc) {
+                Log::error() << "--worker-id requires a name";
+                std::exit(1);
+            }
+            config.worker_id = argv[++i];
+        }
+        else if (arg == "--lease") {
+            if (i + 1 >= argc) {
+                Log::error() << "--lease requires a number of seconds";
+                std::exit(1);
+            }
+            unsigned long value = 0;
+            try {
+                value = std::stoul(argv[++i]);
+            } catch (const std::exception&) {
+                value = 0;
+            }
+            if (value < 3 || value > 86400) {
+                Log::error() << "Invalid --lease value (3-86400 seconds): " << argv[i];
+                std::exit(1);
+            }
+            config.lease_seconds = static_cast<unsigned>(value);
+        }
+        else if (arg == "--watch") {
+            config.queue_watch = true;
         }
         else if (arg == "-o" || arg == "--output") {
             if (i + 1 >= argc) {
-                std::cerr << "Error: --output requires a directory path\n";
+                Log::error() << "--output requires a directory path";
                 std::exit(1);
             }
             config.output_dir = argv[++i];
+            if (config.output_dir == "-") {
+                config.output_fd = 1;
+            }
+        }
+        else if (arg == "--compression") {
+            if (i + 1 >= argc) {
+                Log::error() << "--compression requires 'store', 'fast' or 'max'";
+                std::exit(1);
+            }
+            std::string level = argv[++i];
+            std::transform(level.begin(), level.end(), level.begin(), ::tolower);
+            if (level == "store") {
+                config.compression = CompressionMode::Store;
+            } else if (level == "fast") {
+                config.compression = CompressionMode::Fast;
+            } else if (level == "max") {
+                config.compression = CompressionMode::Max;
+            } else {
+                Log::error() << "Invalid --compression value. Must be 'store', 'fast' or 'max'";
+                std::exit(1);
+            }
+        }
+        else if (arg == "--align") {
+            if (i + 1 >= argc) {
+                Log::error() << "--align requires 4k or 16k";
+                std::exit(1);
+            }
+            std::string page = argv[++i];
+            std::transform(page.begin(), page.end(), page.begin(), ::tolower);
+            if (page == "4k" || page == "4096") {
+                config.align_page = 4096;
+            } else if (page == "16k" || page == "16384") {
+                config.align_page = 16384;
+            } else {
+                Log::error() << "Invalid --align value. Must be '4k' or '16k'";
+                std::exit(1);
+            }
+        }
+        else if (arg == "--verify-align") {
+            config.verify_align = true;
+        }
+        else if (arg == "--output-fd") {
+            if (i + 1 >= argc) {
+                Log::error() << "--output-fd requires a file descriptor number";
+                std::exit(1);
+            }
+            long value = -1;
+            try {
+                value = std::stol(argv[++i]);
+            } catch (const std::exception&) {
+                value = -1;
+            }
+            if (value < 1 || value == 2 || value > 65535) {
+                Log::error() << "Invalid --output-fd value: " << argv[i];
+                std::exit(1);
+            }
+            config.output_fd = static_cast<int>(value);
+            config.output_dir = "-";
         }
         else if (arg == "-m" || arg == "--mode") {
             if (i + 1 >= argc) {
-                std::cerr << "Error: --mode requires 'universal' or 'split'\n";
+                Log::error() << "--mode requires 'universal', 'split' or 'apks'";
                 std::exit(1);
             }
             std::string mode = argv[++i];
@@ -143,14 +530,16 @@ Config ConfigParser::parse(int argc, char* argv[]) {
                 config.mode = OutputMode::Universal;
             } else if (mode == "split") {
                 config.mode = OutputMode::Split;
+            } else if (mode == "apks") {
+                config.mode = OutputMode::Apks;
             } else {
-                std::cerr << "Error: Invalid mode. Must be 'universal' or 'split'\n";
+                Log::error() << "Invalid mode. Must be 'universal', 'split' or 'apks'";
                 std::exit(1);
             }
         }
         else if (arg == "--keystore") {
             if (i + 1 >= argc) {
-                std::cerr << "Error: --keystore requires a file path\n";
+                Log::error() << "--keystore requires a file path";
                 std::exit(1);
             }
             if (!config.signing.has_value()) {
@@ -160,7 +549,7 @@ Config ConfigParser::parse(int argc, char* argv[]) {
         }
         else if (arg == "--ks-pass") {
             if (i + 1 >= argc) {
-                std::cerr << "Error: --ks-pass requires a password or env:VAR_NAME\n";
+                Log::error() << "--ks-pass requires a password or env:VAR_NAME";
                 std::exit(1);
             }
             if (!config.signing.has_value()) {
@@ -169,13 +558,13 @@ Config ConfigParser::parse(int argc, char* argv[]) {
             try {
                 config.signing->keystore_password = resolve_env_var(argv[++i]);
             } catch (const std::exception& e) {
-                std::cerr << "Error: " << e.what() << "\n";
+                Log::error() << e.what();
                 std::exit(1);
             }
         }
         else if (arg == "--key-alias") {
             if (i + 1 >= argc) {
-                std::cerr << "Error: --key-alias requires an alias name\n";
+                Log::error() << "--key-alias requires an alias name";
                 std::exit(1);
             }
             if (!config.signing.has_value()) {
@@ -185,7 +574,7 @@ Config ConfigParser::parse(int argc, char* argv[]) {
         }
         else if (arg == "--key-pass") {
             if (i + 1 >= argc) {
-                std::cerr << "Error: --key-pass requires a password or env:VAR_NAME\n";
+                Log::error() << "--key-pass requires a password or env:VAR_NAME";
                 std::exit(1);
             }
             if (!config.signing.has_value()) {
@@ -194,24 +583,31 @@ Config ConfigParser::parse(int argc, char* argv[]) {
             try {
                 config.signing->key_password = resolve_env_var(argv[++i]);
             } catch (const std::exception& e) {
-                std::cerr << "Error: " << e.what() << "\n";
+                Log::error() << e.what();
                 std::exit(1);
             }
         }
         else if (arg == "--bundletool") {
             if (i + 1 >= argc) {
-                std::cerr << "Error: --bundletool requires a file path\n";
+                Log::error() << "--bundletool requires a file path";
                 std::exit(1);
             }
             config.bundletool_path = argv[++i];
         }
         else if (arg == "--java") {
             if (i + 1 >= argc) {
-                std::cerr << "Error: --java requires an executable path\n";
+                Log::error() << "--java requires an executable path";
                 std::exit(1);
             }
             config.java_path = argv[++i];
         }
+        else if (arg == "--jvm-arg") {
+            if (i + 1 >= argc) {
+                Log::error() << "--jvm-arg requires a JVM option";
+                std::exit(1);
+            }
+            config.jvm_args.push_back(argv[++i]);
+        }
         else if (arg == "-v" || arg == "--verbose") {
             config.verbose = true;
         }
@@ -227,13 +623,188 @@ Config ConfigParser::parse(int argc, char* argv[]) {
         else if (arg == "--json-output") {
             config.json_output = true;
         }
+        else if (arg == "--events") {
+            if (i + 1 >= argc) {
+                Log::error() << "--events requires 'ndjson'";
+                std::exit(1);
+            }
+            if (std::string(argv[++i]) != "ndjson") {
+                Log::error() << "Invalid --events value. Must be 'ndjson'";
+                std::exit(1);
+            }
+            config.events = true;
+        }
+        else if (arg == "--staging") {
+            if (i + 1 >= argc) {
+                Log::error() << "--staging requires 'auto', 'memory' or 'disk'";
+                std::exit(1);
+            }
+            std::string staging = argv[++i];
+            std::transform(staging.begin(), staging.end(), staging.begin(), ::tolower);
+            if (staging == "auto") {
+                config.staging = StagingMode::Auto;
+            } else if (staging == "memory") {
+                config.staging = StagingMode::Memory;
+            } else if (staging == "disk") {
+                config.staging = StagingMode::Disk;
+            } else {
+                Log::error() << "Invalid staging mode. Must be 'auto', 'memory' or 'disk'";
+                std::exit(1);
+            }
+        }
+        else if (arg == "--memory-budget") {
+            if (i + 1 >= argc) {
+                Log::error() << "--memory-budget requires a size in MiB";
+                std::exit(1);
+            }
+            // Callers shift the value to bytes, so it must stay far from
+            // 2^64 >> 20; stoull would also wrap "-1" around
+            const std::string value = argv[++i];
+            constexpr uint64_t max_budget_mb = 1ull << 30;
+            bool valid = !value.empty() && value.find_first_not_of("0123456789") == std::string::npos;
+            try {
+                config.memory_budget_mb = valid ? std::stoull(value) : 0;
+            } catch (const std::exception&) {
+                valid = false;
+            }
+            if (!valid || config.memory_budget_mb > max_budget_mb) {
+                Log::error() << "Invalid --memory-budget value: " << value << " (0 to " << max_budget_mb << " MiB)";
+                std::exit(1);
+            }
+        }
+        else if (arg == "--log-format") {
+            if (i + 1 >= argc) {
+                Log::error() << "--log-format requires 'text' or 'json'";
+                std::exit(1);
+            }
+            std::string format = argv[++i];
+            if (format != "text" && format != "json") {
+                Log::error() << "Invalid --log-format value. Must be 'text' or 'json'";
+                std::exit(1);
+            }
+            config.log_json = format == "json";
+        }
+        else if (arg == "--log-file") {
+            if (i + 1 >= argc) {
+                Log::error() << "--log-file requires a file path";
+                std::exit(1);
+            }
+            config.log_file = argv[++i];
+        }
+        else if (arg == "--tool-output-limit") {
+            if (i + 1 >= argc) {
+                Log::error() << "--tool-output-limit requires a size in KiB";
+                std::exit(1);
+            }
+            try {
+                config.tool_output_kb = std::stoull(argv[++i]);
+            } catch (const std::exception&) {
+                config.tool_output_kb = 0;
+            }
+            if (config.tool_output_kb == 0 || config.tool_output_kb > 1024 * 1024) {
+                Log::error() << "Invalid --tool-output-limit value (1-1048576 KiB): " << argv[i];
+                std::exit(1);
+            }
+        }
+        else if (arg == "--tool-log") {
+            if (i + 1 >= argc) {
+                Log::error() << "--tool-log requires a directory path";
+                std::exit(1);
+            }
+            config.tool_log_dir = argv[++i];
+        }
+        else if (arg == "--sign-jobs" || arg == "--queue-depth") {
+            if (i + 1 >= argc) {
+                Log::error() << arg << " requires a number";
+                std::exit(1);
+            }
+            unsigned long value = 0;
+            try {
+                value = std::stoul(argv[++i]);
+            } catch (const std::exception&) {
+                value = 0;
+            }
+            if (value == 0 || value > 256) {
+                Log::error() << "Invalid " << arg << " value: " << argv[i];
+                std::exit(1);
+            }
+            (arg == "--sign-jobs" ? config.sign_jobs : config.queue_depth) = static_cast<unsigned>(value);
+        }
+        else if (arg == "--manifest") {
+            if (i + 1 >= argc) {
+                Log::error() << "--manifest requires a file path";
+                std::exit(1);
+            }
+            config.manifest_path = argv[++i];
+        }
         else {
-            std::cerr << "Error: Unknown argument: " << arg << "\n";
+            Log::error() << "Unknown argument: " << arg;
             print_usage(argv[0]);
             std::exit(1);
         }
     }
 
+    if (config.dedup_gc) {
+        if (config.dedup_store.empty()) {
+            Log::error() << "gc requires --dedup-store <dir>";
+            std::exit(1);
+        }
+        return config;
+    }
+    if (!config.patch_command.empty()) {
+        if (config.patch_old.empty()) {
+            Log::error() << config.patch_command << " requires --old <apk>";
+            std::exit(1);
+        }
+        if (config.patch_command == "apply" && (config.patch_file.empty() || config.patch_new.empty())) {
+            Log::error() << "apply requires --patch <file> and --new <apk>";
+            std::exit(1);
+        }
+        if (config.patch_new.empty() && !config.input_aab.empty()) {
+            // The universal APK a conversion of --input publishes
+            config.patch_new = (fs::path(config.output_dir.empty() ? "./dist" : config.output_dir) /
+                                (fs::path(config.input_aab).stem().string() + ".apk")).string();
+        }
+        if (config.patch_new.empty()) {
+            Log::error() << "diff requires --new <apk> (or -i <aab> to use its universal APK)";
+            std::exit(1);
+        }
+        if (config.patch_file.empty()) {
+            config.patch_file = config.patch_new + ".patch";
+        }
+        // Patching needs neither bundletool nor Java
+        return config;
+    }
+    if (!config.patch_old.empty() || !config.patch_new.empty() || !config.patch_file.empty()) {
+        Log::error() << "--old, --new and --patch belong to the diff and apply commands";
+        std::exit(1);
+    }
+    if (config.serve && config.socket_path.empty()) {
+        Log::error() << "serve requires --socket <path>";
+        std::exit(1);
+    }
+    std::string combination_error;
+    if (!check_combinations(config, combination_error)) {
+        Log::error() << combination_error;
+        std::exit(1);
+    }
+    if (config.verify_align && config.align_page == 0) {
+        config.align_page = 16384;
+    }
+    if (config.inputs.size() > 1 &&
+        std::find(config.inputs.begin(), config.inputs.end(), "-") != config.inputs.end()) {
+        Log::error() << "--input - (stdin) cannot be combined with other inputs";
+        std::exit(1);
+    }
+    if (config.output_fd >= 0 && (config.inputs.size() > 1 || config.serve || !config.queue_dir.empty())) {
+        Log::error() << "Streamed output (--output - or --output-fd) needs a single --input";
+        std::exit(1);
+    }
+    if (config.serve && !config.queue_dir.empty()) {
+        Log::error() << "serve and --queue-dir cannot be combined";
+        std::exit(1);
+    }
+
     // Set defaults
     if (config.output_dir.empty()) {
         config.output_dir = "./dist";
@@ -243,7 +814,7 @@ Config ConfigParser::parse(int argc, char* argv[]) {
     if (config.bundletool_path.empty()) {
         auto bundletool = FileUtils::find_bundletool();
         if (!bundletool.has_value()) {
-            std::cerr << "Error: bundletool.jar not found. Please specify --bundletool or place bundletool.jar in current directory or PATH\n";
+            Log::error() << "bundletool.jar not found. Please specify --bundletool or place bundletool.jar in current directory or PATH";
             std::exit(1);
         }
         config.bundletool_path = bundletool->string();
@@ -252,17 +823,12 @@ Config ConfigParser::parse(int argc, char* argv[]) {
     if (config.java_path.empty()) {
         auto java = FileUtils::find_java_executable();
         if (!java.has_value()) {
-            std::cerr << "Error: Java executable not found. Please install Java or specify --java\n";
+            Log::error() << "Java executable not found. Please install Java or specify --java";
             std::exit(1);
         }
         config.java_path = java->string();
     }
 
-    // Skip validation if --list-tools is set (no input file needed)
-    if (!config.list_tools && !validate_config(config)) {
-        std::exit(1);
-    }
-
     return config;
 }
 
@@ -0,0 +1,249 @@
+#include "crc32.h"
+#include <array>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define AAB2APK_CRC32_PCLMUL 1
+#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define AAB2APK_CRC32_ARMV8 1
+#include <arm_acle.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+namespace aab2apk {
+
+namespace {
+
+using Table = std::array<std::array<uint32_t, 256>, 8>;
+
+Table make_table() {
+    Table table{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+        }
+        table[0][i] = crc;
+    }
+    for (size_t k = 1; k < table.size(); ++k) {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t prev = table[k - 1][i];
+            table[k][i] = (prev >> 8) ^ table[0][prev & 0xFF];
+        }
+    }
+    return table;
+}
+
+const Table& crc_table() {
+    static const Table table = make_table();
+    return table;
+}
+
+// Slicing-by-8 software fallback, also used for short tails.
+uint32_t crc32_table(uint32_t crc, const unsigned char* p, size_t n) {
+    const Table& t = crc_table();
+    crc = ~crc;
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (n >= 8) {
+        uint32_t one;
+        uint32_t two;
+        std::memcpy(&one, p, 4);
+        std::memcpy(&two, p + 4, 4);
+        one ^= crc;
+        crc = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^
+              t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24] ^
+              t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^
+              t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+        p += 8;
+        n -= 8;
+    }
+#endif
+    while (n-- > 0) {
+        crc = t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#if defined(AAB2APK_CRC32_PCLMUL)
+
+// Carry-less multiplication folding as described in Intel's "Fast CRC
+// Computation for Generic Polynomials Using PCLMULQDQ Instruction".
+// Requires len >= 64 and a multiple of 16; crc is in non-inverted form.
+__attribute__((target("pclmul,sse4.1")))
+uint32_t crc32_pclmul_blocks(const unsigned char* buf, size_t len, uint32_t crc) {
+    alignas(16) static const uint64_t k1k2[] = {0x0154442bd4, 0x01c6e41596};
+    alignas(16) static const uint64_t k3k4[] = {0x01751997d0, 0x00ccaa009e};
+    alignas(16) static const uint64_t k5k0[] = {0x0163cd6124, 0x0000000000};
+    alignas(16) static const uint64_t poly[] = {0x01db710641, 0x01f7011641};
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x00));
+    x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x10));
+    x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x20));
+    x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc)));
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k1k2));
+    buf += 64;
+    len -= 64;
+
+    // Fold four 128-bit lanes in parallel
+    while (len >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        y5 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x00));
+        y6 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x10));
+        y7 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x20));
+        y8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x30));
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+        buf += 64;
+        len -= 64;
+    }
+
+    // Fold the four lanes into one
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k3k4));
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // Remaining 16-byte blocks
+    while (len >= 16) {
+        x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf));
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        buf += 16;
+        len -= 16;
+    }
+
+    // Fold 128 bits down to 64
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+    x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(k5k0));
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(poly));
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+}
+
+uint32_t crc32_pclmul(uint32_t crc, const unsigned char* p, size_t n) {
+    if (n >= 64) {
+        size_t chunk = n & ~static_cast<size_t>(15);
+        crc = ~crc32_pclmul_blocks(p, chunk, ~crc);
+        p += chunk;
+        n -= chunk;
+    }
+    return crc32_table(crc, p, n);
+}
+
+bool cpu_has_pclmul() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+}
+
+#elif defined(AAB2APK_CRC32_ARMV8)
+
+#if defined(__clang__)
+__attribute__((target("crc")))
+#else
+__attribute__((target("+crc")))
+#endif
+uint32_t crc32_armv8(uint32_t crc, const unsigned char* p, size_t n) {
+    crc = ~crc;
+    while (n > 0 && (reinterpret_cast<uintptr_t>(p) & 7) != 0) {
+        crc = __crc32b(crc, *p++);
+        --n;
+    }
+    while (n >= 8) {
+        uint64_t v;
+        std::memcpy(&v, p, 8);
+        crc = __crc32d(crc, v);
+        p += 8;
+        n -= 8;
+    }
+    while (n-- > 0) {
+        crc = __crc32b(crc, *p++);
+    }
+    return ~crc;
+}
+
+bool cpu_has_armv8_crc() {
+#if defined(__APPLE__)
+    return true;
+#elif defined(__linux__)
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+    return false;
+#endif
+}
+
+#endif
+
+using CrcFunction = uint32_t (*)(uint32_t, const unsigned char*, size_t);
+
+struct Dispatch {
+    CrcFunction function;
+    const char* name;
+};
+
+const Dispatch& dispatch() {
+    static const Dispatch selected = [] {
+#if defined(AAB2APK_CRC32_PCLMUL)
+        if (cpu_has_pclmul()) {
+            return Dispatch{crc32_pclmul, "pclmul"};
+        }
+#elif defined(AAB2APK_CRC32_ARMV8)
+        if (cpu_has_armv8_crc()) {
+            return Dispatch{crc32_armv8, "armv8-crc"};
+        }
+#endif
+        return Dispatch{crc32_table, "table"};
+    }();
+    return selected;
+}
+
+} // anonymous namespace
+
+uint32_t Crc32::update(uint32_t crc, const void* data, size_t size) {
+    if (size == 0) {
+        return crc;
+    }
+    return dispatch().function(crc, static_cast<const unsigned char*>(data), size);
+}
+
+const char* Crc32::implementation() {
+    return dispatch().name;
+}
+
+} // namespace aab2apk
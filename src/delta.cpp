@@ -0,0 +1,445 @@
+#include "delta.h"
+#include "zip_archive.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <zlib.h>
+
+namespace aab2apk {
+
+namespace {
+
+using Index = int32_t;
+
+// Larsson-Sadakane suffix sorting, as in bsdiff
+void split(Index* I, Index* V, Index start, Index len, Index h) {
+    if (len < 16) {
+        for (Index k = start, j; k < start + len; k += j) {
+            j = 1;
+            Index x = V[I[k] + h];
+            for (Index i = 1; k + i < start + len; i++) {
+                if (V[I[k + i] + h] < x) {
+                    x = V[I[k + i] + h];
+                    j = 0;
+                }
+                if (V[I[k + i] + h] == x) {
+                    std::swap(I[k + j], I[k + i]);
+                    j++;
+                }
+            }
+            for (Index i = 0; i < j; i++) {
+                V[I[k + i]] = k + j - 1;
+            }
+            if (j == 1) {
+                I[k] = -1;
+            }
+        }
+        return;
+    }
+
+    Index x = V[I[start + len / 2] + h];
+    Index jj = 0;
+    Index kk = 0;
+    for (Index i = start; i < start + len; i++) {
+        if (V[I[i] + h] < x) {
+            jj++;
+        }
+        if (V[I[i] + h] == x) {
+            kk++;
+        }
+    }
+    jj += start;
+    kk += jj;
+
+    Index i = start;
+    Index j = 0;
+    Index k = 0;
+    while (i < jj) {
+        if (V[I[i] + h] < x) {
+            i++;
+        } else if (V[I[i] + h] == x) {
+            std::swap(I[i], I[jj + j]);
+            j++;
+        } else {
+            std::swap(I[i], I[kk + k]);
+            k++;
+        }
+    }
+    while (jj + j < kk) {
+        if (V[I[jj + j] + h] == x) {
+            j++;
+        } else {
+            std::swap(I[jj + j], I[kk + k]);
+            k++;
+        }
+    }
+
+    if (jj > start) {
+        split(I, V, start, jj - start, h);
+    }
+    for (i = 0; i < kk - jj; i++) {
+        V[I[jj + i]] = kk - 1;
+    }
+    if (jj == kk - 1) {
+        I[jj] = -1;
+    }
+    if (start + len > kk) {
+        split(I, V, kk, start + len - kk, h);
+    }
+}
+
+void suffix_sort(std::vector<Index>& I, std::vector<Index>& V, const unsigned char* old, Index size) {
+    Index buckets[256] = {};
+    for (Index i = 0; i < size; i++) {
+        buckets[old[i]]++;
+    }
+    for (int i = 1; i < 256; i++) {
+        buckets[i] += buckets[i - 1];
+    }
+    for (int i = 255; i > 0; i--) {
+        buckets[i] = buckets[i - 1];
+    }
+    buckets[0] = 0;
+
+    for (Index i = 0; i < size; i++) {
+        I[++buckets[old[i]]] = i;
+    }
+    I[0] = size;
+    for (Index i = 0; i < size; i++) {
+        V[i] = buckets[old[i]];
+    }
+    V[size] = 0;
+    for (int i = 1; i < 256; i++) {
+        if (buckets[i] == buckets[i - 1] + 1) {
+            I[buckets[i]] = -1;
+        }
+    }
+    I[0] = -1;
+
+    for (Index h = 1; I[0] != -(size + 1); h += h) {
+        Index len = 0;
+        Index i = 0;
+        while (i < size + 1) {
+            if (I[i] < 0) {
+                len -= I[i];
+                i -= I[i];
+            } else {
+                if (len) {
+                    I[i - len] = -len;
+                }
+                len = V[I[i]] + 1 - i;
+                split(I.data(), V.data(), i, len, h);
+                i += len;
+                len = 0;
+            }
+        }
+        if (len) {
+            I[i - len] = -len;
+        }
+    }
+    for (Index i = 0; i < size + 1; i++) {
+        I[V[i]] = i;
+    }
+}
+
+Index match_length(const unsigned char* a, Index a_size, const unsigned char* b, Index b_size) {
+    Index i = 0;
+    while (i < a_size && i < b_size && a[i] == b[i]) {
+        i++;
+    }
+    return i;
+}
+
+// Longest match of target among the old data's suffixes, by binary search
+Index search(const std::vector<Index>& I, const unsigned char* old, Index old_size,
+             const unsigned char* target, Index target_size, Index st, Index en, Index& pos) {
+    while (en - st >= 2) {
+        Index x = st + (en - st) / 2;
+        if (std::memcmp(old + I[x], target, static_cast<size_t>(std::min(old_size - I[x], target_size))) < 0) {
+            st = x;
+        } else {
+            en = x;
+        }
+    }
+    Index x = match_length(old + I[st], old_size - I[st], target, target_size);
+    Index y = match_length(old + I[en], old_size - I[en], target, target_size);
+    if (x > y) {
+        pos = I[st];
+        return x;
+    }
+    pos = I[en];
+    return y;
+}
+
+void put64(std::string& out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        out += static_cast<char>((value >> (8 * i)) & 0xFF);
+    }
+}
+
+uint64_t get64(const unsigned char* p) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; --i) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+// Raw inflate of data into out. limit(out) gives the most bytes the output
+// may reach given what has been inflated so far; going past it fails at
+// once, so a hostile payload cannot inflate without bound.
+template <typename Limit>
+bool inflate_bounded(const std::string& data, const Limit& limit, std::string& out) {
+    z_stream zs{};
+    if (inflateInit2(&zs, -MAX_WBITS) != Z_OK) {
+        return false;
+    }
+    out.clear();
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    zs.avail_in = static_cast<uInt>(data.size());
+    char buffer[64 * 1024];
+    int status = Z_OK;
+    while (status == Z_OK) {
+        zs.next_out = reinterpret_cast<Bytef*>(buffer);
+        zs.avail_out = sizeof(buffer);
+        status = inflate(&zs, Z_NO_FLUSH);
+        out.append(buffer, sizeof(buffer) - zs.avail_out);
+        if (out.size() > limit(out)) {
+            status = Z_DATA_ERROR;
+            break;
+        }
+        if (status == Z_BUF_ERROR && zs.avail_in == 0) {
+            break;
+        }
+    }
+    inflateEnd(&zs);
+    return status == Z_STREAM_END;
+}
+
+} // anonymous namespace
+
+bool Delta::create(
+    const unsigned char* old_data,
+    size_t old_size,
+    const unsigned char* new_data,
+    size_t new_size,
+    std::string& delta,
+    std::string& error
+) {
+    if (old_size >= 0x7FFFFFFF || new_size >= 0x7FFFFFFF) {
+        error = "input too large for a delta";
+        return false;
+    }
+    const Index oldsize = static_cast<Index>(old_size);
+    const Index newsize = static_cast<Index>(new_size);
+    const unsigned char* old = old_data;
+    const unsigned char* next = new_data;
+
+    std::vector<Index> I(static_cast<size_t>(oldsize) + 1);
+    {
+        std::vector<Index> V(static_cast<size_t>(oldsize) + 1);
+        suffix_sort(I, V, old, oldsize);
+    }
+
+    std::string controls;
+    std::string diff;
+    std::string extra;
+    uint64_t control_count = 0;
+
+    Index scan = 0;
+    Index len = 0;
+    Index pos = 0;
+    Index lastscan = 0;
+    Index lastpos = 0;
+    Index lastoffset = 0;
+    while (scan < newsize) {
+        Index oldscore = 0;
+        Index scsc = scan += len;
+        for (; scan < newsize; scan++) {
+            len = search(I, old, oldsize, next + scan, newsize - scan, 0, oldsize, pos);
+            for (; scsc < scan + len; scsc++) {
+                if (scsc + lastoffset < oldsize && old[scsc + lastoffset] == next[scsc]) {
+                    oldscore++;
+                }
+            }
+            if ((len == oldscore && len != 0) || len > oldscore + 8) {
+                break;
+            }
+            if (scan + lastoffset < oldsize && old[scan + lastoffset] == next[scan]) {
+                oldscore--;
+            }
+        }
+
+        if (len != oldscore || scan == newsize) {
+            // Extend the previous match forwards and this one backwards,
+            // keeping whichever stretch matches better
+            Index s = 0;
+            Index sf = 0;
+            Index lenf = 0;
+            for (Index i = 0; lastscan + i < scan && lastpos + i < oldsize;) {
+                if (old[lastpos + i] == next[lastscan + i]) {
+                    s++;
+                }
+                i++;
+                if (s * 2 - i > sf * 2 - lenf) {
+                    sf = s;
+                    lenf = i;
+                }
+            }
+
+            Index lenb = 0;
+            if (scan < newsize) {
+                s = 0;
+                Index sb = 0;
+                for (Index i = 1; scan >= lastscan + i && pos >= i; i++) {
+                    if (old[pos - i] == next[scan - i]) {
+                        s++;
+                    }
+                    if (s * 2 - i > sb * 2 - lenb) {
+                        sb = s;
+                        lenb = i;
+                    }
+                }
+            }
+
+            if (lastscan + lenf > scan - lenb) {
+                Index overlap = (lastscan + lenf) - (scan - lenb);
+                s = 0;
+                Index ss = 0;
+                Index lens = 0;
+                for (Index i = 0; i < overlap; i++) {
+                    if (next[lastscan + lenf - overlap + i] == old[lastpos + lenf - overlap + i]) {
+                        s++;
+                    }
+                    if (next[scan - lenb + i] == old[pos - lenb + i]) {
+                        s--;
+                    }
+                    if (s > ss) {
+                        ss = s;
+                        lens = i + 1;
+                    }
+                }
+                lenf += lens - overlap;
+                lenb -= lens;
+            }
+
+            for (Index i = 0; i < lenf; i++) {
+                diff += static_cast<char>(next[lastscan + i] - old[lastpos + i]);
+            }
+            Index extra_length = (scan - lenb) - (lastscan + lenf);
+            extra.append(reinterpret_cast<const char*>(next + lastscan + lenf), static_cast<size_t>(extra_length));
+
+            put64(controls, static_cast<uint64_t>(static_cast<int64_t>(lenf)));
+            put64(controls, static_cast<uint64_t>(static_cast<int64_t>(extra_length)));
+            put64(controls, static_cast<uint64_t>(static_cast<int64_t>((pos - lenb) - (lastpos + lenf))));
+            control_count++;
+
+            lastscan = scan - lenb;
+            lastpos = pos - lenb;
+            lastoffset = pos - scan;
+        }
+    }
+
+    std::string encoded;
+    encoded.reserve(8 + controls.size() + diff.size() + extra.size());
+    put64(encoded, control_count);
+    encoded += controls;
+    encoded += diff;
+    encoded += extra;
+    return compress(encoded, delta, error);
+}
+
+bool Delta::apply(
+    const unsigned char* old_data,
+    size_t old_size,
+    const std::string& delta,
+    size_t new_size,
+    std::string& out,
+    std::string& error
+) {
+    auto corrupt = [&error]() {
+        error = "corrupt delta";
+        return false;
+    };
+    // A delta holds its control count, 24 bytes per control and at most
+    // new_size bytes each of diff and extra data. create() emits a control
+    // only after scan moves forward, so there are at most new_size + 1.
+    std::string encoded;
+    auto limit = [new_size](const std::string& inflated) -> uint64_t {
+        if (inflated.size() < 8) {
+            return 8;
+        }
+        uint64_t controls = get64(reinterpret_cast<const unsigned char*>(inflated.data()));
+        if (controls > static_cast<uint64_t>(new_size) + 1) {
+            return 0;
+        }
+        return 8 + 24 * controls + 2 * static_cast<uint64_t>(new_size);
+    };
+    if (!inflate_bounded(delta, limit, encoded) || encoded.size() < 8) {
+        return corrupt();
+    }
+    const auto* data = reinterpret_cast<const unsigned char*>(encoded.data());
+    uint64_t control_count = get64(data);
+    if (control_count > (encoded.size() - 8) / 24) {
+        return corrupt();
+    }
+    const unsigned char* control = data + 8;
+    const unsigned char* diff = control + control_count * 24;
+    const unsigned char* end = data + encoded.size();
+    // Each length is checked against what is left before it is added, so
+    // hostile lengths cannot wrap the total around
+    const auto diff_available = static_cast<uint64_t>(end - diff);
+    uint64_t diff_total = 0;
+    for (uint64_t c = 0; c < control_count; ++c) {
+        uint64_t length = get64(control + c * 24);
+        if (length > diff_available - diff_total) {
+            return corrupt();
+        }
+        diff_total += length;
+    }
+    const unsigned char* extra = diff + diff_total;
+
+    out.clear();
+    out.reserve(new_size);
+    int64_t old_pos = 0;
+    for (uint64_t c = 0; c < control_count; ++c) {
+        auto x = static_cast<int64_t>(get64(control + c * 24));
+        auto y = static_cast<int64_t>(get64(control + c * 24 + 8));
+        auto z = static_cast<int64_t>(get64(control + c * 24 + 16));
+        // x is bounded by diff_total above; y is checked before the sum
+        if (x < 0 || y < 0 || y > end - extra ||
+            out.size() + static_cast<uint64_t>(x) + static_cast<uint64_t>(y) > new_size) {
+            return corrupt();
+        }
+        for (int64_t i = 0; i < x; ++i, ++old_pos) {
+            unsigned char base = old_pos >= 0 && static_cast<uint64_t>(old_pos) < old_size ? old_data[old_pos] : 0;
+            out += static_cast<char>(static_cast<unsigned char>(*diff++ + base));
+        }
+        out.append(reinterpret_cast<const char*>(extra), static_cast<size_t>(y));
+        extra += y;
+        if (z > 0 ? old_pos > INT64_MAX - z : old_pos < INT64_MIN - z) {
+            return corrupt();
+        }
+        old_pos += z;
+    }
+    if (out.size() != new_size) {
+        return corrupt();
+    }
+    return true;
+}
+
+bool Delta::compress(const std::string& data, std::string& out, std::string& error) {
+    return ZipWriter::deflate_parallel(reinterpret_cast<const unsigned char*>(data.data()), data.size(),
+                                       Z_BEST_COMPRESSION, 1, out, error);
+}
+
+bool Delta::decompress(const std::string& data, size_t size, std::string& out, std::string& error) {
+    auto limit = [size](const std::string&) { return static_cast<uint64_t>(size); };
+    if (!inflate_bounded(data, limit, out) || out.size() != size) {
+        error = "corrupt patch payload";
+        return false;
+    }
+    return true;
+}
+
+} // namespace aab2apk
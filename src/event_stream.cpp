@@ -0,0 +1,78 @@
+#include "event_stream.h"
+#include "json_utils.h"
+#include <cstdio>
+#include <iomanip>
+#include <sstream>
+
+namespace aab2apk {
+
+EventStream::EventStream(std::string job, Sink sink)
+    : job_(std::move(job)), sink_(std::move(sink)), started_(Clock::now()), bundletool_done_(started_) {}
+
+EventStream::Sink EventStream::console(const Config& config) {
+    std::FILE* out = config.output_fd == 1 ? stderr : stdout;
+    return [out](const std::string& line) {
+        // Shared by every job of the process
+        static std::mutex write_mutex;
+        std::lock_guard<std::mutex> lock(write_mutex);
+        std::fwrite(line.data(), 1, line.size(), out);
+        std::fputc('\n', out);
+        std::fflush(out);
+    };
+}
+
+ProgressCallback EventStream::callback() {
+    return [this](const ProgressEvent& event) { report(event); };
+}
+
+void EventStream::report(const ProgressEvent& event) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Clock::time_point now = Clock::now();
+    if (event.phase == "started") {
+        started_ = now;
+        bundletool_done_ = now;
+    } else if (event.phase == "bundletool") {
+        bundletool_done_ = now;
+    }
+
+    // Throughput of the phase: bundletool from the start, extraction and
+    // signing from bundletool's end, publishing over the whole job
+    Clock::time_point since = event.phase == "extracted" || event.phase == "signed" ? bundletool_done_ : started_;
+    uint64_t& phase_bytes = phase_bytes_[event.phase];
+    phase_bytes += event.bytes;
+    double seconds = std::chrono::duration<double>(now - since).count();
+
+    std::ostringstream fields;
+    if (!event.apk.empty()) {
+        fields << ", \"apk\": \"" << json_escape(event.apk) << "\"";
+    }
+    fields << ", \"bytes\": " << event.bytes;
+    if (event.phase == "extracted" || event.phase == "signed") {
+        fields << ", \"phase_bytes\": " << phase_bytes;
+    }
+    if (event.phase != "started") {
+        fields << ", \"rate\": " << (seconds > 0.0 ? static_cast<uint64_t>(phase_bytes / seconds) : 0);
+    }
+    emit(event.phase, fields.str());
+}
+
+void EventStream::finished(bool success, const std::string& error) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string fields = ", \"status\": \"" + std::string(success ? "success" : "failure") + "\"";
+    if (!success && !error.empty()) {
+        fields += ", \"error\": \"" + json_escape(error) + "\"";
+    }
+    emit("finished", fields);
+}
+
+// Called with mutex_ held
+void EventStream::emit(const std::string& event, const std::string& fields) {
+    double elapsed = std::chrono::duration<double>(Clock::now() - started_).count();
+    std::ostringstream line;
+    line << "{\"event\": \"" << json_escape(event) << "\", \"job\": \"" << json_escape(job_)
+         << "\", \"time\": \"" << json_timestamp(std::chrono::system_clock::now()) << "\", \"elapsed\": "
+         << std::fixed << std::setprecision(3) << elapsed << fields << "}";
+    sink_(line.str());
+}
+
+} // namespace aab2apk
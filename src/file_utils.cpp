@@ -1,9 +1,15 @@
 #include "file_utils.h"
+#include "sha256.h"
 #include <fstream>
 #include <cstdlib>
 #include <algorithm>
 #include <ctime>
 #include <vector>
+#include <set>
+#include <cstring>
+#include <memory>
+#include <atomic>
+#include <stdexcept>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -11,6 +17,16 @@
 #else
 #include <unistd.h>
 #include <pwd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <cerrno>
+#endif
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/xattr.h>
+#include <linux/fs.h>
 #endif
 
 namespace aab2apk {
@@ -236,26 +252,285 @@ std::string FileUtils::get_temp_directory() {
 #endif
 }
 
-fs::path FileUtils::create_temp_directory() {
+bool FileUtils::same_filesystem(const fs::path& a, const fs::path& b) {
+#ifdef _WIN32
+    return fs::absolute(a).root_name() == fs::absolute(b).root_name();
+#else
+    struct stat sa;
+    struct stat sb;
+    if (stat(a.c_str(), &sa) != 0 || stat(b.c_str(), &sb) != 0) {
+        return false;
+    }
+    return sa.st_dev == sb.st_dev;
+#endif
+}
+
+fs::path FileUtils::create_temp_directory(const fs::path& near) {
     std::string base_temp = get_temp_directory();
     fs::path temp_base(base_temp);
-    
+
+    // Keep intermediates on the output's filesystem so publishing is a rename
+    bool place_near = !near.empty() && is_directory(near) && !same_filesystem(temp_base, near);
+    if (place_near) {
+        fs::path target = fs::absolute(near).lexically_normal();
+        if (!target.has_filename()) {
+            target = target.parent_path();
+        }
+        // The parent lets the whole directory be renamed into place, but only
+        // when it shares the output's filesystem: an output that is a mount
+        // point hosts its own intermediates, published file by file
+        fs::path parent = target.parent_path();
+        temp_base = is_directory(parent) && same_filesystem(parent, target) ? parent : target;
+    }
+
+    if (!place_near) {
+        return create_temp_directory_in(temp_base);
+    }
+
+    try {
+        return create_temp_directory_in(temp_base, ".aab2apk_");
+    } catch (const std::exception&) {
+        // The output's filesystem may not be writable; the system temp still works
+        return create_temp_directory_in(base_temp);
+    }
+}
+
+fs::path FileUtils::create_temp_directory_in(const fs::path& base, const std::string& prefix) {
+    static std::atomic<unsigned> sequence{0};
+
     // Create unique directory name
-    std::string dir_name = "aab2apk_";
+    std::string dir_name = prefix;
 #ifdef _WIN32
     dir_name += std::to_string(GetCurrentProcessId());
 #else
     dir_name += std::to_string(getpid());
 #endif
     dir_name += "_" + std::to_string(std::time(nullptr));
+    dir_name += "_" + std::to_string(sequence++);
+
+    fs::path temp_dir = base / dir_name;
 
-    fs::path temp_dir = temp_base / dir_name;
-    
     if (create_directories(temp_dir)) {
         return temp_dir;
     }
 
-    throw std::runtime_error("Failed to create temporary directory");
+    throw std::runtime_error("Failed to create temporary directory in " + base.string());
+}
+
+bool FileUtils::move_file(const fs::path& from, const fs::path& to) {
+    std::error_code ec;
+    fs::rename(from, to, ec);
+    if (!ec) {
+        return true;
+    }
+
+    // Cross-filesystem: copy as cheaply as the filesystems allow
+    if (!copy_file_fast(from, to)) {
+        return false;
+    }
+    fs::remove(from, ec);
+    return true;
+}
+
+void FileUtils::prefetch_file(const fs::path& path) {
+#if defined(__linux__) || defined(__FreeBSD__)
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+#else
+    (void)path;
+#endif
+}
+
+namespace {
+
+// Gives the directory at to the mode, owner and extended attributes (access
+// and default ACLs among them) of the one at from, so replacing from with it
+// changes nothing but the contents. False when any of them cannot be copied.
+bool adopt_directory_metadata(const fs::path& from, const fs::path& to) {
+#ifdef _WIN32
+    (void)from;
+    (void)to;
+    return true;
+#else
+    struct stat wanted;
+    struct stat current;
+    if (stat(from.c_str(), &wanted) != 0 || !S_ISDIR(wanted.st_mode) || stat(to.c_str(), &current) != 0) {
+        return false;
+    }
+    if ((current.st_uid != wanted.st_uid || current.st_gid != wanted.st_gid) &&
+        chown(to.c_str(), wanted.st_uid, wanted.st_gid) != 0) {
+        return false;
+    }
+    if (chmod(to.c_str(), wanted.st_mode & 07777) != 0) {
+        return false;
+    }
+#ifdef __linux__
+    ssize_t size = listxattr(from.c_str(), nullptr, 0);
+    if (size < 0) {
+        return errno == ENOTSUP;
+    }
+    std::vector<char> names(static_cast<size_t>(size));
+    size = listxattr(from.c_str(), names.data(), names.size());
+    if (size < 0) {
+        return false;
+    }
+    for (const char* name = names.data(); name < names.data() + size; name += std::strlen(name) + 1) {
+        ssize_t length = getxattr(from.c_str(), name, nullptr, 0);
+        if (length < 0) {
+            return false;
+        }
+        std::vector<char> value(static_cast<size_t>(length));
+        length = getxattr(from.c_str(), name, value.data(), value.size());
+        if (length < 0 || setxattr(to.c_str(), name, value.data(), static_cast<size_t>(length), 0) != 0) {
+            return false;
+        }
+    }
+#endif
+    return true;
+#endif
+}
+
+} // anonymous namespace
+
+bool FileUtils::publish_directory(const fs::path& staged, const fs::path& target) {
+    fs::path dest = target.lexically_normal();
+    if (!dest.has_filename()) {
+        dest = dest.parent_path();
+    }
+
+    // Renaming over an existing directory replaces its inode, so that is only
+    // done once the stage carries the directory's metadata; a directory that
+    // cannot be matched (owned by another user, say) is published file by file
+    std::error_code ec;
+    if (!fs::is_symlink(dest, ec) && (!fs::exists(dest, ec) || adopt_directory_metadata(dest, staged))) {
+        // rename() atomically replaces a missing or empty directory
+        fs::rename(staged, dest, ec);
+        if (!ec) {
+            return true;
+        }
+
+#if defined(__linux__) && defined(SYS_renameat2) && defined(RENAME_EXCHANGE)
+        // A directory holding nothing but files this run republishes is swapped
+        // out in a single step; the old contents end up at staged for the caller
+        // to delete. Anything else there (another bundle's APKs, say) must
+        // survive, so such a directory is published file by file below.
+        std::set<fs::path> staged_names;
+        for (fs::directory_iterator it(staged, ec), end; !ec && it != end; it.increment(ec)) {
+            staged_names.insert(it->path().filename());
+        }
+        bool previous_output = !ec && fs::is_directory(dest, ec);
+        for (fs::directory_iterator it(dest, ec), end; previous_output && !ec && it != end; it.increment(ec)) {
+            previous_output = it->is_regular_file(ec) && staged_names.count(it->path().filename()) != 0;
+        }
+        if (previous_output && !ec &&
+            syscall(SYS_renameat2, AT_FDCWD, staged.c_str(), AT_FDCWD, dest.c_str(), RENAME_EXCHANGE) == 0) {
+            return true;
+        }
+#endif
+    }
+
+    // The directory holds other files: publish file by file, each rename
+    // still replacing its target atomically
+    if (!create_directories(dest)) {
+        return false;
+    }
+    std::vector<fs::path> files;
+    for (fs::directory_iterator it(staged, ec), end; !ec && it != end; it.increment(ec)) {
+        files.push_back(it->path());
+    }
+    if (ec) {
+        return false;
+    }
+    for (const auto& file : files) {
+        if (!move_file(file, dest / file.filename())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FileUtils::copy_file_fast(const fs::path& from, const fs::path& to) {
+#ifdef __linux__
+    int in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(in, &st) != 0) {
+        close(in);
+        return false;
+    }
+    int out = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 0777);
+    if (out < 0) {
+        close(in);
+        return false;
+    }
+
+    // Reflink shares extents on btrfs/XFS: no data is copied at all
+    bool ok = ioctl(out, FICLONE, in) == 0;
+
+    // copy_file_range keeps the copy in the kernel (and server-side on NFS 4.2)
+    off_t copied = 0;
+    bool use_read_write = false;
+    while (!ok && !use_read_write) {
+        ssize_t n = copy_file_range(in, nullptr, out, nullptr, static_cast<size_t>(st.st_size - copied), 0);
+        if (n > 0) {
+            copied += n;
+            ok = copied >= st.st_size;
+        } else if (n == 0) {
+            ok = copied >= st.st_size;
+            use_read_write = !ok;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (copied == 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL ||
+                                   errno == EOPNOTSUPP || errno == EPERM)) {
+            use_read_write = true;
+        } else {
+            break;
+        }
+    }
+
+    if (use_read_write) {
+        std::vector<char> buffer(256 * 1024);
+        ok = lseek(in, copied, SEEK_SET) == copied && lseek(out, copied, SEEK_SET) == copied;
+        while (ok) {
+            ssize_t n = read(in, buffer.data(), buffer.size());
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                ok = n == 0;
+                break;
+            }
+            for (ssize_t written = 0; ok && written < n;) {
+                ssize_t w = write(out, buffer.data() + written, static_cast<size_t>(n - written));
+                if (w < 0 && errno == EINTR) {
+                    continue;
+                }
+                ok = w > 0;
+                written += ok ? w : 0;
+            }
+        }
+    }
+
+    close(in);
+    if (close(out) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        std::error_code ec;
+        fs::remove(to, ec);
+    }
+    return ok;
+#else
+    std::error_code ec;
+    fs::copy_file(from, to, fs::copy_options::overwrite_existing, ec);
+    return !ec;
+#endif
 }
 
 void FileUtils::remove_temp_directory(const fs::path& path) {
@@ -268,5 +543,32 @@ void FileUtils::remove_temp_directory(const fs::path& path) {
     }
 }
 
+bool FileUtils::hash_file(const fs::path& path, std::string& sha256_hex, uint64_t& size) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    constexpr size_t buffer_size = 256 * 1024;
+    std::unique_ptr<char[]> buffer(new char[buffer_size]);
+    Sha256 sha;
+    size = 0;
+    while (file) {
+        file.read(buffer.get(), static_cast<std::streamsize>(buffer_size));
+        std::streamsize got = file.gcount();
+        if (got <= 0) {
+            break;
+        }
+        sha.update(buffer.get(), static_cast<size_t>(got));
+        size += static_cast<uint64_t>(got);
+    }
+    if (file.bad()) {
+        return false;
+    }
+
+    sha256_hex = Sha256::to_hex(sha.finish());
+    return true;
+}
+
 } // namespace aab2apk
 
@@ -0,0 +1,216 @@
+#include "input_spool.h"
+#include "file_utils.h"
+#include "sha256.h"
+#include "staging.h"
+#include "zip_archive.h"
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <optional>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace aab2apk {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr size_t SPOOL_BUFFER_SIZE = 1024 * 1024;
+
+int open_spool(const fs::path& path, bool append) {
+#ifdef _WIN32
+    int flags = _O_WRONLY | _O_CREAT | _O_BINARY | (append ? _O_APPEND : _O_TRUNC);
+    return _open(path.string().c_str(), flags, _S_IREAD | _S_IWRITE);
+#else
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC);
+    return ::open(path.c_str(), flags, 0600);
+#endif
+}
+
+long read_some(int fd, void* buffer, size_t size) {
+#ifdef _WIN32
+    return _read(fd, buffer, static_cast<unsigned>(size));
+#else
+    ssize_t n;
+    do {
+        n = ::read(fd, buffer, size);
+    } while (n < 0 && errno == EINTR);
+    return static_cast<long>(n);
+#endif
+}
+
+bool write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+#ifdef _WIN32
+        int n = _write(fd, data, static_cast<unsigned>(size));
+#else
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+#endif
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool close_spool(int fd) {
+#ifdef _WIN32
+    return _close(fd) == 0;
+#else
+    return ::close(fd) == 0;
+#endif
+}
+
+bool truncate_spool(int fd, uint64_t size) {
+#ifdef _WIN32
+    return _chsize_s(fd, static_cast<long long>(size)) == 0;
+#else
+    return ftruncate(fd, static_cast<off_t>(size)) == 0;
+#endif
+}
+
+} // anonymous namespace
+
+InputSpool::~InputSpool() {
+    if (!dir_.empty()) {
+        std::error_code ec;
+        fs::remove_all(dir_, ec);
+    }
+}
+
+bool InputSpool::move_to_disk(std::string& error) {
+    fs::path disk_dir;
+    try {
+        disk_dir = FileUtils::create_temp_directory_in(FileUtils::get_temp_directory());
+    } catch (const std::exception& e) {
+        error = e.what();
+        return false;
+    }
+    fs::path disk_path = disk_dir / path_.filename();
+    if (!FileUtils::copy_file_fast(path_, disk_path)) {
+        error = "Failed to move the input spool to " + disk_dir.string();
+        std::error_code ec;
+        fs::remove_all(disk_dir, ec);
+        return false;
+    }
+    std::error_code ec;
+    fs::remove_all(dir_, ec);
+    dir_ = disk_dir;
+    path_ = disk_path;
+    in_memory_ = false;
+    return true;
+}
+
+bool InputSpool::receive(int fd, const std::string& name, const Config& config, std::string& error) {
+#ifdef _WIN32
+    _setmode(fd, _O_BINARY);
+#endif
+    std::optional<fs::path> memory_dir;
+    if (config.staging != StagingMode::Disk) {
+        memory_dir = StagingArea::find_memory_filesystem();
+    }
+    try {
+        dir_ = FileUtils::create_temp_directory_in(memory_dir.value_or(FileUtils::get_temp_directory()));
+    } catch (const std::exception& e) {
+        error = e.what();
+        return false;
+    }
+    in_memory_ = memory_dir.has_value();
+    path_ = dir_ / name;
+
+    int out = open_spool(path_, false);
+    if (out < 0) {
+        error = "Failed to create input spool " + path_.string() + ": " + std::strerror(errno);
+        return false;
+    }
+
+    // Memory is only borrowed up to the staging budget (or until tmpfs
+    // fills up); the rest of the bundle goes to disk
+    const uint64_t budget = config.memory_budget_mb << 20;
+    auto spill = [&]() {
+        close_spool(out);
+        out = -1;
+        if (!move_to_disk(error)) {
+            return false;
+        }
+        out = open_spool(path_, true);
+        if (out < 0) {
+            error = "Failed to reopen input spool " + path_.string() + ": " + std::strerror(errno);
+            return false;
+        }
+        return true;
+    };
+
+    Sha256 sha;
+    std::unique_ptr<char[]> buffer(new char[SPOOL_BUFFER_SIZE]);
+    size_ = 0;
+    bool ok = true;
+    while (ok) {
+        long n = read_some(fd, buffer.get(), SPOOL_BUFFER_SIZE);
+        if (n == 0) {
+            break;
+        }
+        if (n < 0) {
+            error = std::string("Failed to read input: ") + std::strerror(errno);
+            ok = false;
+            break;
+        }
+        size_t chunk = static_cast<size_t>(n);
+        sha.update(buffer.get(), chunk);
+
+        if (in_memory_ && size_ + chunk > budget && !spill()) {
+            ok = false;
+            break;
+        }
+        if (!write_all(out, buffer.get(), chunk)) {
+            // A full tmpfs leaves a partial chunk behind; cut it off and
+            // continue on disk
+            bool spilled = in_memory_ && errno == ENOSPC && truncate_spool(out, size_) && spill() &&
+                           write_all(out, buffer.get(), chunk);
+            if (!spilled) {
+                if (error.empty()) {
+                    error = "Failed to write input spool " + path_.string() + ": " + std::strerror(errno);
+                }
+                ok = false;
+                break;
+            }
+        }
+        size_ += chunk;
+    }
+    if (out >= 0 && !close_spool(out) && ok) {
+        error = "Failed to write input spool " + path_.string();
+        ok = false;
+    }
+    if (!ok) {
+        return false;
+    }
+
+    if (size_ == 0) {
+        error = "No data received on the input stream";
+        return false;
+    }
+    sha256_ = Sha256::to_hex(sha.finish());
+
+    ZipReader archive;
+    std::string zip_error;
+    if (!archive.open(path_, zip_error)) {
+        error = "Input stream is not a complete AAB (" + std::to_string(size_) + " bytes received): " + zip_error;
+        return false;
+    }
+    return true;
+}
+
+} // namespace aab2apk
@@ -0,0 +1,276 @@
+#include "job_scheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace aab2apk {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr uint64_t MiB = 1024 * 1024;
+
+// Resident size of an idle bundletool JVM, on top of which heap use grows
+constexpr uint64_t JVM_BASELINE = 256 * MiB;
+constexpr uint64_t MIN_ESTIMATE = 1024 * MiB;
+
+// Used until a peak has been measured: bundletool holds the bundle's
+// resources in memory several times over while building APKs
+constexpr double DEFAULT_RATIO = 8.0;
+constexpr double SAFETY_MARGIN = 1.25;
+constexpr size_t HISTORY_LIMIT = 64;
+
+// Leave room for the page cache and everything else on the machine
+constexpr double BUDGET_FRACTION = 0.9;
+
+constexpr int BACKGROUND_NICE = 10;
+
+fs::path history_file() {
+    const char* cache = std::getenv("XDG_CACHE_HOME");
+    const char* home = std::getenv("HOME");
+#ifdef _WIN32
+    if (cache == nullptr) {
+        cache = std::getenv("LOCALAPPDATA");
+    }
+#endif
+    if (cache != nullptr && *cache != '\0') {
+        return fs::path(cache) / "aab2apk" / "peak_rss";
+    }
+    if (home != nullptr && *home != '\0') {
+        return fs::path(home) / ".cache" / "aab2apk" / "peak_rss";
+    }
+    return {};
+}
+
+#ifdef __linux__
+// Bytes still allowed by the enclosing cgroup v2, or 0 when unlimited
+uint64_t cgroup_headroom() {
+    std::ifstream max_file("/sys/fs/cgroup/memory.max");
+    std::ifstream current_file("/sys/fs/cgroup/memory.current");
+    std::string max_value;
+    uint64_t current = 0;
+    if (!(max_file >> max_value) || max_value == "max" || !(current_file >> current)) {
+        return 0;
+    }
+    uint64_t limit = std::strtoull(max_value.c_str(), nullptr, 10);
+    return limit > current ? limit - current : 1;
+}
+#endif
+
+bool sets_max_heap(const std::string& arg) {
+    return arg.compare(0, 4, "-Xmx") == 0 || arg.compare(0, 16, "-XX:MaxHeapSize=") == 0;
+}
+
+// The JVM reads these before its command line, so an -Xmx there would
+// otherwise lose to ours
+bool env_sets_max_heap(const char* name) {
+    const char* value = std::getenv(name);
+    if (!value) {
+        return false;
+    }
+    std::istringstream options(value);
+    std::string option;
+    while (options >> option) {
+        if (sets_max_heap(option)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // anonymous namespace
+
+JobScheduler::JobScheduler(unsigned max_jobs)
+    : max_jobs_(max_jobs > 0 ? max_jobs : std::max(1u, std::thread::hardware_concurrency())),
+      history_path_(history_file()) {
+    load_history();
+}
+
+void JobScheduler::load_history() {
+    if (history_path_.empty()) {
+        return;
+    }
+    std::ifstream in(history_path_);
+    uint64_t aab_size = 0;
+    uint64_t peak_rss = 0;
+    while (in >> aab_size >> peak_rss) {
+        if (aab_size > 0 && peak_rss > JVM_BASELINE) {
+            ratios_.push_back(static_cast<double>(peak_rss - JVM_BASELINE) / static_cast<double>(aab_size));
+        }
+    }
+    if (ratios_.size() > HISTORY_LIMIT) {
+        ratios_.erase(ratios_.begin(), ratios_.end() - HISTORY_LIMIT);
+    }
+}
+
+uint64_t JobScheduler::estimate_peak_rss(uint64_t aab_size) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // The worst ratio seen so far, so one large outlier is not averaged away
+    double ratio = ratios_.empty() ? DEFAULT_RATIO : *std::max_element(ratios_.begin(), ratios_.end());
+    auto heap = static_cast<uint64_t>(ratio * SAFETY_MARGIN * static_cast<double>(aab_size));
+    return std::max(MIN_ESTIMATE, JVM_BASELINE + heap);
+}
+
+uint64_t JobScheduler::available_memory() {
+#if defined(__linux__)
+    uint64_t available = 0;
+    std::ifstream meminfo("/proc/meminfo");
+    std::string line;
+    while (std::getline(meminfo, line)) {
+        if (line.compare(0, 13, "MemAvailable:") == 0) {
+            available = std::strtoull(line.c_str() + 13, nullptr, 10) * 1024;
+            break;
+        }
+    }
+    uint64_t headroom = cgroup_headroom();
+    if (headroom > 0 && (available == 0 || headroom < available)) {
+        available = headroom;
+    }
+    return available;
+#elif defined(_WIN32)
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    return GlobalMemoryStatusEx(&status) ? static_cast<uint64_t>(status.ullAvailPhys) : 0;
+#elif defined(_SC_AVPHYS_PAGES)
+    long pages = sysconf(_SC_AVPHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    return pages > 0 && page_size > 0 ? static_cast<uint64_t>(pages) * static_cast<uint64_t>(page_size) : 0;
+#else
+    return 0;
+#endif
+}
+
+JobScheduler::Ticket JobScheduler::admit(Config& config) {
+    Ticket ticket;
+    std::error_code ec;
+    ticket.aab_size = fs::file_size(config.input_aab, ec);
+    if (ec) {
+        ticket.aab_size = 0;
+    }
+    ticket.reserved = estimate_peak_rss(ticket.aab_size);
+
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            // The first job always runs; a bundle too large for the machine
+            // should fail on its own rather than wait forever
+            if (running_ == 0) {
+                budget_ = static_cast<uint64_t>(static_cast<double>(available_memory()) * BUDGET_FRACTION);
+                break;
+            }
+            if (running_ < max_jobs_) {
+                // Memory taken by other processes since the budget was set
+                // also counts, so the live figure is checked as well
+                uint64_t available = available_memory();
+                bool fits_budget = budget_ == 0 || reserved_ + ticket.reserved <= budget_;
+                bool fits_now = available == 0 || ticket.reserved <= available;
+                if (fits_budget && fits_now) {
+                    break;
+                }
+            }
+            released_.wait_for(lock, std::chrono::seconds(1));
+        }
+        ++running_;
+        reserved_ += ticket.reserved;
+    }
+
+    // Cap the heap so the JVM stays inside its reservation, unless the user
+    // already chose one: the JVM takes the last -Xmx, which would be ours
+    bool user_heap = std::any_of(config.jvm_args.begin(), config.jvm_args.end(), sets_max_heap) ||
+                     env_sets_max_heap("JDK_JAVA_OPTIONS") || env_sets_max_heap("JAVA_TOOL_OPTIONS");
+    if (!user_heap) {
+        uint64_t heap = std::max(ticket.reserved - JVM_BASELINE, JVM_BASELINE);
+        config.jvm_args.push_back("-Xmx" + std::to_string(heap / MiB) + "m");
+    }
+    config.bundletool_nice = BACKGROUND_NICE;
+    config.bundletool_background_io = true;
+    return ticket;
+}
+
+void JobScheduler::release(const Ticket& ticket, uint64_t peak_rss) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --running_;
+        reserved_ -= ticket.reserved;
+        released_.notify_all();
+
+        if (ticket.aab_size == 0 || peak_rss <= JVM_BASELINE) {
+            return;
+        }
+        ratios_.push_back(static_cast<double>(peak_rss - JVM_BASELINE) / static_cast<double>(ticket.aab_size));
+        if (ratios_.size() > HISTORY_LIMIT) {
+            ratios_.erase(ratios_.begin());
+        }
+    }
+
+    // File I/O stays outside mutex_ so it never holds up admissions
+    record_history(ticket.aab_size, peak_rss);
+}
+
+// Rewritten rather than appended to, so resident servers and queue workers
+// do not grow it forever. Other processes' measurements are re-read first;
+// one racing with this rewrite may be lost, which only costs an estimate.
+void JobScheduler::record_history(uint64_t aab_size, uint64_t peak_rss) const {
+    if (history_path_.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(history_mutex_);
+    std::vector<std::pair<uint64_t, uint64_t>> records;
+    {
+        std::ifstream in(history_path_);
+        uint64_t size = 0;
+        uint64_t peak = 0;
+        while (in >> size >> peak) {
+            if (size > 0 && peak > JVM_BASELINE) {
+                records.emplace_back(size, peak);
+            }
+        }
+    }
+    records.emplace_back(aab_size, peak_rss);
+    if (records.size() > HISTORY_LIMIT) {
+        records.erase(records.begin(), records.end() - HISTORY_LIMIT);
+    }
+
+    static std::atomic<unsigned> sequence{0};
+#ifdef _WIN32
+    unsigned long pid = GetCurrentProcessId();
+#else
+    long pid = static_cast<long>(getpid());
+#endif
+    fs::path temp = history_path_;
+    temp += "." + std::to_string(pid) + "." + std::to_string(sequence++) + ".tmp";
+
+    std::error_code ec;
+    fs::create_directories(history_path_.parent_path(), ec);
+    {
+        std::ofstream out(temp, std::ios::trunc);
+        for (const auto& record : records) {
+            out << record.first << " " << record.second << "\n";
+        }
+        if (!out.flush()) {
+            out.close();
+            fs::remove(temp, ec);
+            return;
+        }
+    }
+    fs::rename(temp, history_path_, ec);
+    if (ec) {
+        fs::remove(temp, ec);
+    }
+}
+
+} // namespace aab2apk
@@ -0,0 +1,407 @@
+#include "job_server.h"
+#include "artifact_manifest.h"
+#include "event_stream.h"
+#include "json_utils.h"
+#include "logger.h"
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <iomanip>
+#include <optional>
+#include <sstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0   // SIGPIPE is ignored instead
+#endif
+#endif
+
+namespace aab2apk {
+
+#ifdef _WIN32
+
+int JobServer::run() {
+    Log::error() << "serve is only available on POSIX systems";
+    return 1;
+}
+
+#else
+
+namespace {
+
+// Requests are a few hundred bytes; a client sending more without a
+// newline is dropped rather than buffered without bound
+constexpr size_t MAX_REQUEST_LINE = 64 * 1024;
+
+volatile std::sig_atomic_t g_signal_stop = 0;
+
+void on_stop_signal(int) {
+    g_signal_stop = 1;
+}
+
+// Sockets must not leak into the bundletool and apksigner children
+int cloexec(int fd) {
+    if (fd >= 0) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    return fd;
+}
+
+// Status lines must stay on one line; formatting newlines in the manifest
+// JSON are the only raw newlines it contains
+std::string single_line(std::string json) {
+    json.erase(std::remove(json.begin(), json.end(), '\n'), json.end());
+    return json;
+}
+
+} // anonymous namespace
+
+struct JobServer::Connection {
+    int fd;
+    std::mutex write_mutex;
+    std::atomic<bool> reader_done{false};
+
+    explicit Connection(int socket_fd) : fd(socket_fd) {}
+    ~Connection() { close(fd); }
+
+    // Best effort: a client that went away simply stops receiving updates
+    void send_line(const std::string& line) {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        std::string data = line + "\n";
+        size_t sent = 0;
+        while (sent < data.size()) {
+            ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return;
+            }
+            sent += static_cast<size_t>(n);
+        }
+    }
+};
+
+struct JobServer::Job {
+    std::string id;
+    int priority = 0;
+    uint64_t sequence = 0;
+    Config config;
+    std::shared_ptr<Connection> client;
+};
+
+int JobServer::run() {
+    const std::string& socket_path = defaults_.socket_path;
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        Log::error() << "Socket path is too long: " << socket_path;
+        return 1;
+    }
+    std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+    int listen_fd = cloexec(socket(AF_UNIX, SOCK_STREAM, 0));
+    if (listen_fd < 0) {
+        Log::error() << "Failed to create socket: " << std::strerror(errno);
+        return 1;
+    }
+
+    // A socket file left by a server that is no longer running is replaced;
+    // a live one is not
+    struct stat st;
+    if (lstat(socket_path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        int probe = cloexec(socket(AF_UNIX, SOCK_STREAM, 0));
+        bool live = probe >= 0 &&
+                    connect(probe, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+        if (probe >= 0) {
+            close(probe);
+        }
+        if (live) {
+            Log::error() << "Another server is already listening on " << socket_path;
+            close(listen_fd);
+            return 1;
+        }
+        unlink(socket_path.c_str());
+    }
+
+    if (bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        chmod(socket_path.c_str(), S_IRUSR | S_IWUSR) != 0 ||
+        listen(listen_fd, 64) != 0) {
+        Log::error() << "Failed to listen on " << socket_path << ": " << std::strerror(errno);
+        close(listen_fd);
+        return 1;
+    }
+
+    std::signal(SIGINT, on_stop_signal);
+    std::signal(SIGTERM, on_stop_signal);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    // Warm the signing session once instead of on every job
+    signer_.apksigner();
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < std::max(1u, defaults_.workers); ++i) {
+        workers.emplace_back([this] { worker_loop(); });
+    }
+
+    Log::info() << "Listening on " << socket_path << " with " << workers.size() << " worker(s)";
+
+    std::vector<std::pair<std::thread, std::weak_ptr<Connection>>> clients;
+    while (!stop_requested_ && !g_signal_stop) {
+        pollfd pfd{listen_fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, 250);
+        if (ready <= 0) {
+            continue;
+        }
+        int client_fd = cloexec(accept(listen_fd, nullptr, nullptr));
+        if (client_fd < 0) {
+            continue;
+        }
+        auto client = std::make_shared<Connection>(client_fd);
+        clients.emplace_back(std::thread([this, client] {
+            handle_connection(client);
+            client->reader_done = true;
+        }), client);
+
+        // Join readers of connections that have been closed
+        clients.erase(std::remove_if(clients.begin(), clients.end(), [](auto& entry) {
+            auto connection = entry.second.lock();
+            if (connection && !connection->reader_done) {
+                return false;
+            }
+            entry.first.join();
+            return true;
+        }), clients.end());
+    }
+
+    close(listen_fd);
+    unlink(socket_path.c_str());
+
+    // Finish everything already queued, then release the readers
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        draining_ = true;
+    }
+    work_available_.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    for (auto& client : clients) {
+        if (auto connection = client.second.lock()) {
+            shutdown(connection->fd, SHUT_RDWR);
+        }
+        client.first.join();
+    }
+
+    Log::info() << "Server stopped";
+    return 0;
+}
+
+void JobServer::handle_connection(const std::shared_ptr<Connection>& client) {
+    std::string pending;
+    char buffer[4096];
+    for (;;) {
+        ssize_t n = recv(client->fd, buffer, sizeof(buffer), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        pending.append(buffer, static_cast<size_t>(n));
+
+        size_t newline;
+        while ((newline = pending.find('\n')) != std::string::npos) {
+            std::string line = pending.substr(0, newline);
+            pending.erase(0, newline + 1);
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (line.find_first_not_of(" \t") != std::string::npos) {
+                handle_request(client, line);
+            }
+        }
+        if (pending.size() > MAX_REQUEST_LINE) {
+            client->send_line("{\"status\": \"error\", \"error\": \"Request line longer than " +
+                              std::to_string(MAX_REQUEST_LINE) + " bytes\"}");
+            return;
+        }
+    }
+}
+
+void JobServer::handle_request(const std::shared_ptr<Connection>& client, const std::string& line) {
+    std::map<std::string, std::string> fields;
+    std::string error;
+    if (!parse_json_object(line, fields, error)) {
+        client->send_line("{\"status\": \"error\", \"error\": \"" + json_escape("Invalid request: " + error) + "\"}");
+        return;
+    }
+
+    std::string op = fields.count("op") ? fields["op"] : "convert";
+    if (op == "shutdown") {
+        stop_requested_ = true;
+        client->send_line("{\"status\": \"shutting_down\"}");
+        return;
+    }
+    if (op == "status") {
+        std::lock_guard<std::mutex> lock(mutex_);
+        client->send_line("{\"status\": \"ok\", \"queued\": " + std::to_string(queue_.size()) +
+                          ", \"running\": " + std::to_string(running_) + "}");
+        return;
+    }
+    if (op != "convert") {
+        client->send_line("{\"status\": \"error\", \"error\": \"" + json_escape("Unknown op: " + op) + "\"}");
+        return;
+    }
+
+    auto job = std::make_shared<Job>();
+    job->client = client;
+    if (!make_job(fields, *job, error)) {
+        client->send_line("{\"id\": \"" + json_escape(job->id) + "\", \"status\": \"error\", \"error\": \"" +
+                          json_escape(error) + "\"}");
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (draining_ || stop_requested_) {
+            error = "Server is shutting down";
+        } else {
+            job->sequence = next_sequence_++;
+            if (job->id.empty()) {
+                job->id = "job-" + std::to_string(job->sequence);
+            }
+            if (ConfigParser::apply_job_output(fields, job->id, job->config, error)) {
+                queue_.push_back(job);
+                std::push_heap(queue_.begin(), queue_.end(), runs_later);
+            }
+        }
+    }
+    if (!error.empty()) {
+        client->send_line("{\"id\": \"" + json_escape(job->id) + "\", \"status\": \"error\", \"error\": \"" +
+                          json_escape(error) + "\"}");
+        return;
+    }
+
+    client->send_line("{\"id\": \"" + json_escape(job->id) + "\", \"status\": \"queued\", \"priority\": " +
+                      std::to_string(job->priority) + "}");
+    work_available_.notify_one();
+}
+
+bool JobServer::make_job(const std::map<std::string, std::string>& fields, Job& job, std::string& error) const {
+    auto field = [&fields](const char* name) {
+        auto it = fields.find(name);
+        return it != fields.end() ? it->second : std::string();
+    };
+
+    job.id = field("id");
+    job.config = defaults_;
+    Config& config = job.config;
+
+    if (!field("priority").empty()) {
+        try {
+            job.priority = std::stoi(field("priority"));
+        } catch (const std::exception&) {
+            error = "Invalid priority: " + field("priority");
+            return false;
+        }
+    }
+
+    return ConfigParser::apply_job_request(fields, config, error);
+}
+
+void JobServer::worker_loop() {
+    for (;;) {
+        std::shared_ptr<Job> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            work_available_.wait(lock, [this] { return draining_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                return;
+            }
+            std::pop_heap(queue_.begin(), queue_.end(), runs_later);
+            job = std::move(queue_.back());
+            queue_.pop_back();
+            ++running_;
+        }
+
+        run_job(*job);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        --running_;
+    }
+}
+
+void JobServer::run_job(Job& job) {
+    // Workers only bound concurrency; the scheduler holds a job back until
+    // its JVM fits in memory next to the ones already running
+    std::optional<JobScheduler::Admission> admission(std::in_place, scheduler_, job.config);
+
+    const std::string id = "{\"id\": \"" + json_escape(job.id) + "\"";
+    job.client->send_line(id + ", \"status\": \"running\"}");
+    Log::debug() << "Job " << job.id << ": converting " << job.config.input_aab;
+    auto start_time = std::chrono::steady_clock::now();
+    ArtifactManifest manifest;
+    ConversionStats stats;
+    const Config& config = job.config;
+    // Progress events go to the job's client, between its running and
+    // final status lines
+    std::optional<EventStream> events;
+    if (defaults_.events) {
+        std::shared_ptr<Connection> client = job.client;
+        events.emplace(job.id, [client](const std::string& event) { client->send_line(event); });
+    }
+    bool success;
+    {
+        Logger::Scope log_scope(job.id);
+        success = converter_.convert(config, manifest, [&config] {
+            return ConfigParser::validate_config(config);
+        }, &stats, nullptr, events ? events->callback() : ProgressCallback());
+    }
+    admission->set_peak_rss(stats.bundletool_peak_rss);
+    admission.reset();
+
+    std::string error = "Conversion failed";
+    if (success && !config.manifest_path.empty() &&
+        !manifest.write_file(config.manifest_path, config.input_aab)) {
+        error = "Failed to write manifest: " + config.manifest_path;
+        success = false;
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start_time);
+    std::ostringstream line;
+    line << id << ", \"status\": \"" << (success ? "success" : "failure") << "\"";
+    line << ", \"execution_time\": " << std::fixed << std::setprecision(3) << elapsed.count() / 1000.0;
+    if (success) {
+        line << ", \"output_dir\": \"" << json_escape(config.output_dir) << "\"";
+        line << ", \"apks\": " << single_line(manifest.to_json());
+    } else {
+        line << ", \"error\": \"" << json_escape(error) << "\"";
+    }
+    line << "}";
+    job.client->send_line(line.str());
+
+    Log::debug() << "Job " << job.id << ": " << (success ? "done" : "failed");
+}
+
+bool JobServer::runs_later(const std::shared_ptr<Job>& a, const std::shared_ptr<Job>& b) {
+    if (a->priority != b->priority) {
+        return a->priority < b->priority;
+    }
+    return a->sequence > b->sequence;
+}
+
+#endif
+
+} // namespace aab2apk
@@ -0,0 +1,236 @@
+#include "json_utils.h"
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+
+namespace aab2apk {
+
+namespace {
+
+class JsonCursor {
+public:
+    explicit JsonCursor(const std::string& text) : text_(text) {}
+
+    void skip_space() {
+        while (pos_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[pos_]))) {
+            ++pos_;
+        }
+    }
+
+    bool consume(char c) {
+        skip_space();
+        if (pos_ < text_.size() && text_[pos_] == c) {
+            ++pos_;
+            return true;
+        }
+        return false;
+    }
+
+    bool at_end() {
+        skip_space();
+        return pos_ >= text_.size();
+    }
+
+    char peek() {
+        skip_space();
+        return pos_ < text_.size() ? text_[pos_] : '\0';
+    }
+
+    bool string(std::string& out) {
+        if (!consume('"')) {
+            return false;
+        }
+        out.clear();
+        while (pos_ < text_.size()) {
+            char c = text_[pos_++];
+            if (c == '"') {
+                return true;
+            }
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (pos_ >= text_.size()) {
+                return false;
+            }
+            char e = text_[pos_++];
+            switch (e) {
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                    uint32_t code = 0;
+                    if (!hex4(code)) {
+                        return false;
+                    }
+                    // Combine a surrogate pair into one code point
+                    if (code >= 0xD800 && code < 0xDC00 && text_.compare(pos_, 2, "\\u") == 0) {
+                        pos_ += 2;
+                        uint32_t low = 0;
+                        if (!hex4(low) || low < 0xDC00 || low > 0xDFFF) {
+                            return false;
+                        }
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    append_utf8(out, code);
+                    break;
+                }
+                default:
+                    return false;
+            }
+        }
+        return false;
+    }
+
+    // Number, true, false or null, returned as written
+    bool literal(std::string& out) {
+        skip_space();
+        size_t start = pos_;
+        while (pos_ < text_.size() &&
+               (std::isalnum(static_cast<unsigned char>(text_[pos_])) ||
+                text_[pos_] == '-' || text_[pos_] == '+' || text_[pos_] == '.')) {
+            ++pos_;
+        }
+        out = text_.substr(start, pos_ - start);
+        if (out == "true" || out == "false" || out == "null") {
+            return true;
+        }
+        char* end = nullptr;
+        std::strtod(out.c_str(), &end);
+        return !out.empty() && end == out.c_str() + out.size();
+    }
+
+private:
+    const std::string& text_;
+    size_t pos_ = 0;
+
+    bool hex4(uint32_t& code) {
+        if (pos_ + 4 > text_.size()) {
+            return false;
+        }
+        code = 0;
+        for (int i = 0; i < 4; ++i) {
+            char h = text_[pos_++];
+            code <<= 4;
+            if (h >= '0' && h <= '9') code |= static_cast<uint32_t>(h - '0');
+            else if (h >= 'a' && h <= 'f') code |= static_cast<uint32_t>(h - 'a' + 10);
+            else if (h >= 'A' && h <= 'F') code |= static_cast<uint32_t>(h - 'A' + 10);
+            else return false;
+        }
+        return true;
+    }
+
+    static void append_utf8(std::string& out, uint32_t code) {
+        if (code < 0x80) {
+            out += static_cast<char>(code);
+        } else if (code < 0x800) {
+            out += static_cast<char>(0xC0 | (code >> 6));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        } else if (code < 0x10000) {
+            out += static_cast<char>(0xE0 | (code >> 12));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (code >> 18));
+            out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        }
+    }
+};
+
+} // anonymous namespace
+
+std::string json_escape(const std::string& str) {
+    std::ostringstream o;
+    for (char c : str) {
+        if (c == '"') o << "\\\"";
+        else if (c == '\\') o << "\\\\";
+        else if (c == '\b') o << "\\b";
+        else if (c == '\f') o << "\\f";
+        else if (c == '\n') o << "\\n";
+        else if (c == '\r') o << "\\r";
+        else if (c == '\t') o << "\\t";
+        else if (static_cast<unsigned char>(c) < 0x20) {
+            o << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c);
+        } else {
+            o << c;
+        }
+    }
+    return o.str();
+}
+
+bool parse_json_object(const std::string& text, std::map<std::string, std::string>& fields, std::string& error) {
+    JsonCursor cursor(text);
+    fields.clear();
+
+    if (!cursor.consume('{')) {
+        error = "expected a JSON object";
+        return false;
+    }
+    bool empty = cursor.consume('}');
+    while (!empty) {
+        std::string key;
+        std::string value;
+        if (!cursor.string(key)) {
+            error = "expected a string key";
+            return false;
+        }
+        if (!cursor.consume(':')) {
+            error = "expected ':' after \"" + key + "\"";
+            return false;
+        }
+        char next = cursor.peek();
+        if (next == '{' || next == '[') {
+            error = "nested value for \"" + key + "\" is not supported";
+            return false;
+        }
+        bool ok = next == '"' ? cursor.string(value) : cursor.literal(value);
+        if (!ok) {
+            error = "invalid value for \"" + key + "\"";
+            return false;
+        }
+        fields[key] = value;
+
+        if (cursor.consume('}')) {
+            break;
+        }
+        if (!cursor.consume(',')) {
+            error = "expected ',' or '}'";
+            return false;
+        }
+    }
+
+    if (!cursor.at_end()) {
+        error = "trailing data after object";
+        return false;
+    }
+    return true;
+}
+
+std::string json_timestamp(std::chrono::system_clock::time_point time) {
+    std::time_t seconds = std::chrono::system_clock::to_time_t(time);
+    auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count() % 1000;
+    std::tm utc{};
+#ifdef _WIN32
+    gmtime_s(&utc, &seconds);
+#else
+    gmtime_r(&seconds, &utc);
+#endif
+    char buffer[32];
+    std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &utc);
+    char result[40];
+    std::snprintf(result, sizeof(result), "%s.%03dZ", buffer, static_cast<int>(millis));
+    return result;
+}
+
+} // namespace aab2apk
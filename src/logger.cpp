@@ -0,0 +1,340 @@
+#include "logger.h"
+#include "json_utils.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace aab2apk {
+
+namespace {
+
+constexpr size_t RING_CAPACITY = 256;
+constexpr auto WRITE_INTERVAL = std::chrono::milliseconds(20);
+
+struct Record {
+    uint64_t sequence = 0;
+    std::chrono::system_clock::time_point time;
+    LogLevel level = LogLevel::Info;
+    unsigned thread = 0;
+    std::string job;
+    std::string message;
+};
+
+// Single producer (its thread), single consumer (the writer)
+class ThreadRing {
+public:
+    explicit ThreadRing(unsigned id) : id_(id) {}
+
+    unsigned id() const { return id_; }
+
+    bool push(Record&& record) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == RING_CAPACITY) {
+            return false;
+        }
+        slots_[tail % RING_CAPACITY] = std::move(record);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    void drain(std::vector<Record>& out) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t tail = tail_.load(std::memory_order_acquire);
+        for (; head < tail; ++head) {
+            out.push_back(std::move(slots_[head % RING_CAPACITY]));
+        }
+        head_.store(head, std::memory_order_release);
+    }
+
+    bool empty() const {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+    std::atomic<bool> retired{false};   // its thread has exited
+
+private:
+    const unsigned id_;
+    std::array<Record, RING_CAPACITY> slots_;
+    std::atomic<size_t> head_{0};
+    std::atomic<size_t> tail_{0};
+};
+
+// Never destroyed: threads may still log while static objects are torn down
+struct LoggerState {
+    std::atomic<int> level{static_cast<int>(LogLevel::Info)};
+    std::atomic<uint64_t> next_sequence{0};
+
+    std::mutex rings_mutex;
+    std::vector<std::shared_ptr<ThreadRing>> rings;
+    unsigned next_thread = 0;
+
+    std::mutex sink_mutex;
+    LogFormat format = LogFormat::Text;
+    std::FILE* file = nullptr;
+    bool stdout_is_output = false;
+
+    // Writer passes: a flush waits for a pass that started after it
+    std::mutex pass_mutex;
+    std::condition_variable wake;
+    std::condition_variable pass_done;
+    uint64_t passes_requested = 0;
+    uint64_t passes_completed = 0;
+    bool stopping = false;
+    std::once_flag started;
+    std::atomic<bool> running{false};
+    std::thread writer;
+};
+
+LoggerState& state() {
+    static LoggerState* instance = new LoggerState();
+    return *instance;
+}
+
+thread_local LogContext t_context;
+
+// Marks the thread's ring for removal once drained
+struct RingHolder {
+    std::shared_ptr<ThreadRing> ring;
+    ~RingHolder() {
+        if (ring) {
+            ring->retired = true;
+        }
+    }
+};
+thread_local RingHolder t_ring;
+
+const char* level_name(LogLevel level) {
+    switch (level) {
+        case LogLevel::Debug: return "debug";
+        case LogLevel::Info: return "info";
+        case LogLevel::Warning: return "warning";
+        case LogLevel::Error: return "error";
+    }
+    return "info";
+}
+
+// last is the stream the previous record of the pass went to; it is
+// flushed before another one is written to, so stdout and stderr sharing a
+// pipe still see the records in order
+void write_record(LoggerState& s, const Record& record, std::FILE*& last) {
+    std::string line;
+    std::FILE* out = s.file;
+    if (s.format == LogFormat::Json) {
+        line = "{\"time\": \"" + json_timestamp(record.time) + "\", \"level\": \"" + level_name(record.level) +
+               "\", \"thread\": " + std::to_string(record.thread);
+        if (!record.job.empty()) {
+            line += ", \"job\": \"" + json_escape(record.job) + "\"";
+        }
+        line += ", \"message\": \"" + json_escape(record.message) + "\"}\n";
+        if (out == nullptr) {
+            out = stderr;
+        }
+    } else {
+        if (!record.job.empty()) {
+            line = "[" + record.job + "] ";
+        }
+        if (record.level == LogLevel::Error) {
+            line += "Error: ";
+        } else if (record.level == LogLevel::Warning) {
+            line += "Warning: ";
+        }
+        line += record.message;
+        line += '\n';
+        if (out == nullptr) {
+            out = record.level >= LogLevel::Warning || s.stdout_is_output ? stderr : stdout;
+        }
+    }
+    if (last != nullptr && last != out) {
+        std::fflush(last);
+    }
+    std::fwrite(line.data(), 1, line.size(), out);
+    last = out;
+}
+
+// Drains every ring once and writes the batch in sequence order
+void write_pass(LoggerState& s, std::vector<Record>& batch) {
+    std::vector<std::shared_ptr<ThreadRing>> rings;
+    {
+        std::lock_guard<std::mutex> lock(s.rings_mutex);
+        rings = s.rings;
+    }
+    batch.clear();
+    for (const auto& ring : rings) {
+        ring->drain(batch);
+    }
+    std::sort(batch.begin(), batch.end(), [](const Record& a, const Record& b) {
+        return a.sequence < b.sequence;
+    });
+    if (!batch.empty()) {
+        std::lock_guard<std::mutex> lock(s.sink_mutex);
+        std::FILE* last = nullptr;
+        for (const auto& record : batch) {
+            write_record(s, record, last);
+        }
+        std::fflush(last);
+    }
+
+    // Rings of exited threads go once drained; the retired flag is read
+    // first, so nothing pushed before it was set can be missed
+    std::lock_guard<std::mutex> lock(s.rings_mutex);
+    s.rings.erase(std::remove_if(s.rings.begin(), s.rings.end(), [](const std::shared_ptr<ThreadRing>& ring) {
+        return ring->retired && ring->empty();
+    }), s.rings.end());
+}
+
+void writer_loop() {
+    LoggerState& s = state();
+    std::vector<Record> batch;
+    for (;;) {
+        uint64_t pass;
+        bool stopping;
+        {
+            std::unique_lock<std::mutex> lock(s.pass_mutex);
+            s.wake.wait_for(lock, WRITE_INTERVAL, [&s] {
+                return s.stopping || s.passes_requested > s.passes_completed;
+            });
+            pass = s.passes_requested;
+            stopping = s.stopping;
+        }
+        write_pass(s, batch);
+        {
+            std::lock_guard<std::mutex> lock(s.pass_mutex);
+            s.passes_completed = std::max(s.passes_completed, pass);
+        }
+        s.pass_done.notify_all();
+        if (stopping) {
+            return;
+        }
+    }
+}
+
+void stop_writer() {
+    LoggerState& s = state();
+    {
+        std::lock_guard<std::mutex> lock(s.pass_mutex);
+        s.stopping = true;
+    }
+    s.wake.notify_all();
+    if (s.writer.joinable()) {
+        s.writer.join();
+    }
+}
+
+void start_writer() {
+    LoggerState& s = state();
+    std::call_once(s.started, [&s] {
+        s.writer = std::thread(writer_loop);
+        s.running = true;
+        std::atexit(stop_writer);
+    });
+}
+
+ThreadRing& thread_ring() {
+    if (!t_ring.ring) {
+        LoggerState& s = state();
+        std::lock_guard<std::mutex> lock(s.rings_mutex);
+        t_ring.ring = std::make_shared<ThreadRing>(s.next_thread++);
+        s.rings.push_back(t_ring.ring);
+    }
+    return *t_ring.ring;
+}
+
+} // anonymous namespace
+
+bool Logger::configure(const LogOptions& options) {
+    LoggerState& s = state();
+    s.level = static_cast<int>(options.level);
+    std::lock_guard<std::mutex> lock(s.sink_mutex);
+    s.format = options.format;
+    s.stdout_is_output = options.stdout_is_output;
+    if (s.file != nullptr) {
+        std::fclose(s.file);
+        s.file = nullptr;
+    }
+    if (!options.path.empty()) {
+        s.file = std::fopen(options.path.c_str(), "a");
+        if (s.file == nullptr) {
+            return false;
+        }
+    }
+    return true;
+}
+
+LogLevel Logger::level_for(bool verbose, bool quiet) {
+    return quiet ? LogLevel::Error : verbose ? LogLevel::Debug : LogLevel::Info;
+}
+
+bool Logger::enabled(LogLevel level) {
+    int threshold = t_context.level.has_value() ? static_cast<int>(*t_context.level) : state().level.load();
+    return static_cast<int>(level) >= threshold;
+}
+
+void Logger::write(LogLevel level, std::string message) {
+    if (!enabled(level)) {
+        return;
+    }
+    LoggerState& s = state();
+    start_writer();
+    ThreadRing& ring = thread_ring();
+
+    Record record;
+    record.sequence = s.next_sequence++;
+    record.time = std::chrono::system_clock::now();
+    record.level = level;
+    record.thread = ring.id();
+    record.job = t_context.job;
+    record.message = std::move(message);
+    // The writer runs every WRITE_INTERVAL; a full ring asks for a pass now
+    while (!ring.push(std::move(record))) {
+        {
+            std::lock_guard<std::mutex> lock(s.pass_mutex);
+            if (s.stopping) {
+                return;
+            }
+            ++s.passes_requested;
+        }
+        s.wake.notify_one();
+        std::this_thread::yield();
+    }
+}
+
+void Logger::flush() {
+    LoggerState& s = state();
+    std::unique_lock<std::mutex> lock(s.pass_mutex);
+    if (!s.running || s.stopping) {
+        return;
+    }
+    uint64_t target = ++s.passes_requested;
+    s.wake.notify_one();
+    s.pass_done.wait(lock, [&s, target] { return s.passes_completed >= target; });
+}
+
+LogContext Logger::context() {
+    return t_context;
+}
+
+Logger::Scope::Scope(const std::string& job) : saved_(t_context) {
+    t_context.job = job;
+}
+
+Logger::Scope::Scope(LogLevel level) : saved_(t_context) {
+    t_context.level = level;
+}
+
+Logger::Scope::Scope(const LogContext& context) : saved_(t_context) {
+    t_context = context;
+}
+
+Logger::Scope::~Scope() {
+    t_context = saved_;
+}
+
+} // namespace aab2apk
@@ -1,40 +1,37 @@
 #include "config.h"
 #include "aab_converter.h"
+#include "apk_patch.h"
+#include "batch_runner.h"
+#include "blob_store.h"
+#include "event_stream.h"
 #include "process_runner.h"
 #include "signing.h"
 #include "file_utils.h"
+#include "input_spool.h"
+#include "job_server.h"
+#include "json_utils.h"
+#include "logger.h"
+#include "staging.h"
+#include "temp_reaper.h"
+#include "work_queue.h"
 #include <iostream>
 #include <cstdlib>
 #include <chrono>
 #include <iomanip>
+#include <optional>
 #include <sstream>
 #include <vector>
 
 namespace {
 
-// Simple JSON string escaping
-std::string json_escape(const std::string& str) {
-    std::ostringstream o;
-    for (char c : str) {
-        if (c == '"') o << "\\\"";
-        else if (c == '\\') o << "\\\\";
-        else if (c == '\b') o << "\\b";
-        else if (c == '\f') o << "\\f";
-        else if (c == '\n') o << "\\n";
-        else if (c == '\r') o << "\\r";
-        else if (c == '\t') o << "\\t";
-        else if (static_cast<unsigned char>(c) < 0x20) {
-            o << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c);
-        } else {
-            o << c;
-        }
-    }
-    return o.str();
-}
+using aab2apk::json_escape;
+using aab2apk::Log;
 
 // Output JSON result
 void output_json(const std::string& status, const std::string& error_message = "", 
-                 double execution_time = -1.0, const std::string& output_dir = "") {
+                 double execution_time = -1.0, const std::string& output_dir = "",
+                 const aab2apk::ArtifactManifest* manifest = nullptr,
+                 const std::vector<aab2apk::BatchJobResult>* jobs = nullptr) {
     std::cout << "{\n";
     std::cout << "  \"status\": \"" << status << "\"";
     
@@ -49,22 +46,62 @@ void output_json(const std::string& status, const std::string& error_message = "
     if (!output_dir.empty()) {
         std::cout << ",\n  \"output_dir\": \"" << json_escape(output_dir) << "\"";
     }
+
+    if (manifest != nullptr) {
+        std::cout << ",\n  \"apks\": " << manifest->to_json("  ");
+    }
+
+    if (jobs != nullptr) {
+        std::cout << ",\n  \"jobs\": " << aab2apk::BatchRunner::to_json(*jobs, "  ");
+    }
     
     std::cout << "\n}\n";
 }
 
+// Clears out temp directories left behind by crashed runs
+void sweep_stale_temp(const aab2apk::Config& config) {
+    aab2apk::TempReaper::sweep_stale(aab2apk::FileUtils::get_temp_directory(), true);
+    if (auto memory_dir = aab2apk::StagingArea::find_memory_filesystem()) {
+        aab2apk::TempReaper::sweep_stale(memory_dir.value(), true);
+    }
+    std::filesystem::path output = std::filesystem::absolute(config.output_dir).lexically_normal();
+    if (!output.has_filename()) {
+        output = output.parent_path();
+    }
+    aab2apk::TempReaper::sweep_stale(output.parent_path(), false);
+    aab2apk::TempReaper::sweep_stale(output, false);
+}
+
 } // anonymous namespace
 
 int main(int argc, char* argv[]) {
     try {
-        // Parse configuration
-        aab2apk::Config config = aab2apk::ConfigParser::parse(argc, argv);
+        // Parse configuration. Input validation is deferred so a conversion
+        // can run it alongside bundletool's startup.
+        aab2apk::Config config = aab2apk::ConfigParser::parse_arguments(argc, argv);
+
+        // With the APKs or the progress events on stdout, messages and
+        // reports move to stderr
+        const bool stdout_is_output = config.output_fd == 1 || (config.events && !config.serve);
+        if (stdout_is_output) {
+            std::cout.rdbuf(std::cerr.rdbuf());
+        }
 
         // Enable quiet mode when JSON output is requested to suppress human-readable output
         if (config.json_output) {
             config.quiet = true;
         }
 
+        aab2apk::LogOptions log_options;
+        log_options.level = aab2apk::Logger::level_for(config.verbose, config.quiet);
+        log_options.format = config.log_json ? aab2apk::LogFormat::Json : aab2apk::LogFormat::Text;
+        log_options.path = config.log_file;
+        log_options.stdout_is_output = stdout_is_output;
+        if (!aab2apk::Logger::configure(log_options)) {
+            std::cerr << "Error: Cannot open log file: " << config.log_file << "\n";
+            return 1;
+        }
+
         // Handle --list-tools flag
         if (config.list_tools) {
             if (config.json_output) {
@@ -101,9 +138,112 @@ int main(int argc, char* argv[]) {
             return 0;
         }
 
+        if (config.dedup_gc) {
+            aab2apk::BlobStore store(config.dedup_store);
+            aab2apk::BlobStoreStats stats;
+            std::string gc_error;
+            if (!store.gc(stats, gc_error)) {
+                if (config.json_output) {
+                    output_json("error", gc_error);
+                } else {
+                    Log::error() << gc_error;
+                }
+                return 1;
+            }
+            if (config.json_output) {
+                std::cout << "{\n";
+                std::cout << "  \"status\": \"success\",\n";
+                std::cout << "  \"blobs_removed\": " << stats.blobs_removed << ",\n";
+                std::cout << "  \"bytes_freed\": " << stats.bytes_freed << ",\n";
+                std::cout << "  \"keys_removed\": " << stats.keys_removed << ",\n";
+                std::cout << "  \"blobs_kept\": " << stats.blobs_kept << ",\n";
+                std::cout << "  \"references\": " << stats.references << "\n";
+                std::cout << "}\n";
+            } else if (!config.quiet) {
+                std::cout << "Removed " << stats.blobs_removed << " unreferenced blob(s) ("
+                          << stats.bytes_freed << " bytes); kept " << stats.blobs_kept << " with "
+                          << stats.references << " reference(s)\n";
+            }
+            return 0;
+        }
+        if (config.patch_command == "diff") {
+            aab2apk::PatchStats stats;
+            std::string patch_error;
+            if (!aab2apk::ApkPatch::create(config.patch_old, config.patch_new, config.patch_file, config.jobs,
+                                           stats, patch_error)) {
+                if (config.json_output) {
+                    output_json("error", patch_error);
+                } else {
+                    Log::error() << patch_error;
+                }
+                return 1;
+            }
+            double percent = stats.new_size > 0 ? 100.0 * static_cast<double>(stats.patch_size) /
+                                                      static_cast<double>(stats.new_size) : 0.0;
+            if (config.json_output) {
+                std::cout << "{\n";
+                std::cout << "  \"status\": \"success\",\n";
+                std::cout << "  \"patch\": \"" << json_escape(config.patch_file) << "\",\n";
+                std::cout << "  \"patch_size\": " << stats.patch_size << ",\n";
+                std::cout << "  \"new_size\": " << stats.new_size << ",\n";
+                std::cout << "  \"copied\": " << stats.copied << ",\n";
+                std::cout << "  \"deltas\": " << stats.deltas << ",\n";
+                std::cout << "  \"literals\": " << stats.literals << "\n";
+                std::cout << "}\n";
+            } else if (!config.quiet) {
+                std::cout << "Patch written to " << config.patch_file << ": " << stats.patch_size << " bytes ("
+                          << std::fixed << std::setprecision(1) << percent << "% of " << stats.new_size << ")\n";
+                std::cout << "  " << stats.copied << " copied, " << stats.deltas << " delta, "
+                          << stats.literals << " literal regions\n";
+            }
+            return 0;
+        }
+        if (config.patch_command == "apply") {
+            std::string patch_error;
+            if (!aab2apk::ApkPatch::apply(config.patch_old, config.patch_file, config.patch_new, patch_error)) {
+                if (config.json_output) {
+                    output_json("error", patch_error);
+                } else {
+                    Log::error() << patch_error;
+                }
+                return 1;
+            }
+            if (config.json_output) {
+                output_json("success");
+            } else if (!config.quiet) {
+                std::cout << "Rebuilt " << config.patch_new << " (SHA-256 verified)\n";
+            }
+            return 0;
+        }
+
+        // A bundle piped in on stdin is spooled first: bundletool needs
+        // random access to reach the ZIP central directory at its end.
+        // Validation and conversion then run on the spooled copy.
+        aab2apk::InputSpool input_spool;
+        std::string input_label = config.input_aab;
+        if (config.input_aab == "-") {
+            std::string spool_error;
+            if (!input_spool.receive(0, config.input_name, config, spool_error)) {
+                Log::error() << spool_error;
+                return 1;
+            }
+            config.input_aab = input_spool.path().string();
+            config.inputs = {config.input_aab};
+            Log::debug() << "Received " << input_spool.size() << " bytes on stdin ("
+                         << (input_spool.in_memory() ? "memory" : "disk") << "), sha256 "
+                         << input_spool.sha256();
+        }
+
         // Handle --check / --validate flag
         if (config.check_only) {
-            // Validation has already been performed in ConfigParser::parse()
+            for (const auto& input : config.inputs) {
+                aab2apk::Config input_config = config;
+                input_config.input_aab = input;
+                if (!aab2apk::ConfigParser::validate_config(input_config)) {
+                    return 1;
+                }
+            }
+
             // At this point, we know:
             // - Input AAB file exists and is valid
             // - Java and bundletool are available
@@ -113,7 +253,7 @@ int main(int argc, char* argv[]) {
                 std::cout << "{\n";
                 std::cout << "  \"status\": \"success\",\n";
                 std::cout << "  \"validation\": {\n";
-                std::cout << "    \"input_aab\": \"" << json_escape(config.input_aab) << "\",\n";
+                std::cout << "    \"input_aab\": \"" << json_escape(input_label) << "\",\n";
                 std::cout << "    \"java\": \"" << json_escape(config.java_path) << "\",\n";
                 std::cout << "    \"bundletool\": \"" << json_escape(config.bundletool_path) << "\",\n";
                 std::cout << "    \"signing_enabled\": " << (config.signing.has_value() ? "true" : "false");
@@ -124,7 +264,7 @@ int main(int argc, char* argv[]) {
                 std::cout << "}\n";
             } else {
                 std::cout << "Validation successful:\n";
-                std::cout << "  Input AAB: " << config.input_aab << "\n";
+                std::cout << "  Input AAB: " << input_label << "\n";
                 std::cout << "  Java: " << config.java_path << "\n";
                 std::cout << "  bundletool: " << config.bundletool_path << "\n";
                 if (config.signing.has_value()) {
@@ -142,11 +282,90 @@ int main(int argc, char* argv[]) {
         aab2apk::SigningManager signer(runner);
         aab2apk::AabConverter converter(runner, signer);
 
+        if (config.serve) {
+            aab2apk::JobServer server(config, converter, signer);
+            return server.run();
+        }
+        if (!config.queue_dir.empty()) {
+            aab2apk::WorkQueue queue(config, converter);
+            return queue.run();
+        }
+
+        // Everything that does not feed bundletool's command line runs while
+        // its JVM starts up
+        auto preflight = [&config, &signer]() {
+            aab2apk::FileUtils::prefetch_file(config.input_aab);
+            aab2apk::FileUtils::prefetch_file(config.bundletool_path);
+
+            if (!aab2apk::ConfigParser::validate_config(config)) {
+                return false;
+            }
+            if (config.signing.has_value() && signer.apksigner().empty()) {
+                Log::error() << "apksigner not found. Please install Android SDK Build Tools or add it to PATH";
+                return false;
+            }
+
+            sweep_stale_temp(config);
+            return true;
+        };
+
+        if (config.inputs.size() > 1) {
+            sweep_stale_temp(config);
+            auto start_time = std::chrono::steady_clock::now();
+
+            std::vector<aab2apk::BatchJobResult> results;
+            aab2apk::BatchRunner batch(config, converter);
+            bool success = batch.run(results);
+            aab2apk::Logger::flush();
+
+            if (!config.manifest_path.empty() &&
+                !aab2apk::BatchRunner::write_manifest(config.manifest_path, results)) {
+                Log::error() << "Failed to write manifest: " << config.manifest_path;
+                success = false;
+            }
+
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start_time);
+            double seconds = elapsed.count() / 1000.0;
+
+            if (config.json_output) {
+                output_json(success ? "success" : "failure", success ? "" : "One or more conversions failed",
+                            seconds, config.output_dir, nullptr, &results);
+            } else {
+                if (config.show_timing) {
+                    std::cout << std::fixed << std::setprecision(3);
+                    std::cout << "\nBatch completed in " << seconds << " seconds\n";
+                }
+                if (!success) {
+                    Log::error() << "One or more conversions failed";
+                }
+            }
+            return success ? 0 : 1;
+        }
+
         // Record start time for JSON output or timing
         auto start_time = std::chrono::steady_clock::now();
 
         // Perform conversion
-        bool success = converter.convert(config);
+        aab2apk::ArtifactManifest manifest;
+        std::optional<aab2apk::EventStream> events;
+        if (config.events) {
+            events.emplace(input_label, aab2apk::EventStream::console(config));
+        }
+        bool success = converter.convert(config, manifest, preflight, nullptr, nullptr,
+                                         events ? events->callback() : aab2apk::ProgressCallback());
+        aab2apk::Logger::flush();
+
+        std::string error = "Conversion failed";
+        if (success && !config.manifest_path.empty() &&
+            !manifest.write_file(config.manifest_path, input_label, input_spool.sha256())) {
+            error = "Failed to write manifest: " + config.manifest_path;
+            Log::error() << error;
+            success = false;
+        }
+        if (events) {
+            events->finished(success, error);
+        }
 
         // Calculate elapsed time
         auto end_time = std::chrono::steady_clock::now();
@@ -155,7 +374,7 @@ int main(int argc, char* argv[]) {
 
         if (config.json_output) {
             if (success) {
-                output_json("success", "", seconds, config.output_dir);
+                output_json("success", "", seconds, config.output_dir, &manifest);
             } else {
                 output_json("failure", "Conversion failed", seconds);
             }
@@ -167,7 +386,7 @@ int main(int argc, char* argv[]) {
             }
 
             if (!success) {
-                std::cerr << "Conversion failed\n";
+                Log::error() << "Conversion failed";
                 return 1;
             }
         }
@@ -0,0 +1,224 @@
+#include "module_store.h"
+#include "file_utils.h"
+#include "json_utils.h"
+#include "sha256.h"
+#include "zip_archive.h"
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace aab2apk {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr size_t KEYS_PER_MODULE = 4;
+
+// Top-level directories of an AAB that are not modules
+bool is_module_dir(const std::string& name) {
+    return name != "META-INF" && name != "BUNDLE-METADATA";
+}
+
+std::string module_of(const std::string& entry_name) {
+    size_t slash = entry_name.find('/');
+    return slash == std::string::npos ? std::string() : entry_name.substr(0, slash);
+}
+
+void add_entry(Sha256& sha, const ZipEntry& entry) {
+    std::string line = entry.name + '\0' + std::to_string(entry.crc32) + '\0' +
+                       std::to_string(entry.uncompressed_size) + '\n';
+    sha.update(line.data(), line.size());
+}
+
+std::string unique_suffix() {
+    static std::atomic<unsigned> counter{0};
+#ifdef _WIN32
+    unsigned long pid = GetCurrentProcessId();
+#else
+    long pid = static_cast<long>(getpid());
+#endif
+    return std::to_string(pid) + "-" + std::to_string(counter++);
+}
+
+} // anonymous namespace
+
+bool ModuleStore::module_keys(
+    const fs::path& aab,
+    const std::string& context,
+    std::map<std::string, std::string>& keys,
+    std::string& error
+) {
+    ZipReader archive;
+    if (!archive.open(aab, error)) {
+        return false;
+    }
+
+    // Central directory order is up to the bundle's writer; sort so equal
+    // contents always give equal keys
+    std::vector<const ZipEntry*> entries;
+    for (const auto& entry : archive.entries()) {
+        if (!entry.is_directory()) {
+            entries.push_back(&entry);
+        }
+    }
+    std::sort(entries.begin(), entries.end(), [](const ZipEntry* a, const ZipEntry* b) {
+        return a->name < b->name;
+    });
+
+    Sha256 shared;
+    shared.update(context.data(), context.size());
+    std::map<std::string, Sha256> modules;
+    for (const ZipEntry* entry : entries) {
+        std::string module = module_of(entry->name);
+        // META-INF holds the bundle's own signature and BUNDLE-METADATA
+        // (mapping files and the like) only feeds the base module
+        if (!module.empty() && !is_module_dir(module)) {
+            continue;
+        }
+        if (module.empty()) {
+            add_entry(shared, *entry);
+            continue;
+        }
+        if (entry->name == "base/manifest/AndroidManifest.xml") {
+            add_entry(shared, *entry);
+        }
+        if (module != "base") {
+            add_entry(modules[module], *entry);
+        }
+    }
+
+    std::string shared_hex = Sha256::to_hex(shared.finish());
+    keys.clear();
+    for (auto& [module, sha] : modules) {
+        sha.update(shared_hex.data(), shared_hex.size());
+        keys[module] = Sha256::to_hex(sha.finish());
+    }
+    return true;
+}
+
+bool ModuleStore::prune_bundle(
+    const fs::path& aab,
+    const fs::path& dest,
+    const std::set<std::string>& modules,
+    std::string& error
+) {
+    ZipReader archive;
+    if (!archive.open(aab, error)) {
+        return false;
+    }
+    ZipWriter writer;
+    if (!writer.open(dest, error)) {
+        return false;
+    }
+    for (const auto& entry : archive.entries()) {
+        if (modules.count(module_of(entry.name)) > 0) {
+            continue;
+        }
+        if (!writer.add_raw(archive, entry, error)) {
+            return false;
+        }
+    }
+    return writer.finish(error);
+}
+
+bool ModuleStore::lookup(const std::string& module, const std::string& key, std::vector<ApkArtifact>& apks) const {
+    fs::path dir = root_ / module / key;
+    std::ifstream index(dir / "index");
+    if (!index.is_open()) {
+        return false;
+    }
+
+    apks.clear();
+    std::string line;
+    while (std::getline(index, line)) {
+        std::map<std::string, std::string> fields;
+        std::string error;
+        if (!parse_json_object(line, fields, error)) {
+            return false;
+        }
+        ApkArtifact apk = ArtifactManifest::from_record(fields);
+        apk.path = dir / apk.name;
+        std::error_code ec;
+        if (fs::file_size(apk.path, ec) != apk.size || ec) {
+            return false;
+        }
+        apks.push_back(std::move(apk));
+    }
+    if (apks.empty()) {
+        return false;
+    }
+
+    // Directory mtime orders keys for eviction
+    std::error_code ec;
+    fs::last_write_time(dir, fs::file_time_type::clock::now(), ec);
+    return true;
+}
+
+bool ModuleStore::save(const std::string& module, const std::string& key, const std::vector<ApkArtifact>& apks) const {
+    fs::path module_dir = root_ / module;
+    fs::path target = module_dir / key;
+    if (FileUtils::is_directory(target)) {
+        return true;
+    }
+
+    // Filled under a private name and renamed in whole, so concurrent
+    // conversions never see a partial entry
+    fs::path temp = module_dir / (".tmp-" + key.substr(0, 16) + "-" + unique_suffix());
+    if (!FileUtils::create_directories(temp)) {
+        return false;
+    }
+    std::ostringstream index;
+    bool ok = true;
+    for (const auto& apk : apks) {
+        if (!FileUtils::copy_file_fast(apk.path, temp / apk.name)) {
+            ok = false;
+            break;
+        }
+        index << ArtifactManifest::to_record(apk, "apk") << "\n";
+    }
+    if (ok) {
+        std::ofstream out(temp / "index", std::ios::trunc);
+        out << index.str();
+        out.close();
+        ok = !out.fail();
+    }
+
+    std::error_code ec;
+    if (ok) {
+        fs::rename(temp, target, ec);
+    }
+    if (!ok || ec) {
+        fs::remove_all(temp, ec);
+        return FileUtils::is_directory(target);
+    }
+
+    evict(module_dir);
+    return true;
+}
+
+void ModuleStore::evict(const fs::path& module_dir) const {
+    std::vector<std::pair<fs::file_time_type, fs::path>> keys;
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(module_dir, ec)) {
+        if (entry.is_directory(ec) && entry.path().filename().string()[0] != '.') {
+            keys.emplace_back(entry.last_write_time(ec), entry.path());
+        }
+    }
+    if (keys.size() <= KEYS_PER_MODULE) {
+        return;
+    }
+    std::sort(keys.begin(), keys.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+    for (size_t i = KEYS_PER_MODULE; i < keys.size(); ++i) {
+        fs::remove_all(keys[i].second, ec);
+    }
+}
+
+} // namespace aab2apk
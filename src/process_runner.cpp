@@ -1,4 +1,8 @@
 #include "process_runner.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
 #include <sstream>
 #include <stdexcept>
 #include <vector>
@@ -11,11 +15,127 @@
 #include <unistd.h>
 #include <sys/wait.h>
 #include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/time.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <cerrno>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+extern char** environ;
 #endif
 
 namespace aab2apk {
 
+namespace {
+
+constexpr size_t READ_CHUNK = 64 * 1024;
+
+// One stream's output held to a fixed size: the first half of the limit as
+// it arrives, then a ring over the most recent bytes
+class BoundedOutput {
+public:
+    explicit BoundedOutput(size_t limit) : head_limit_(limit - limit / 2), tail_limit_(limit / 2) {}
+
+    void append(const char* data, size_t size) {
+        total_ += size;
+        size_t to_head = std::min(size, head_limit_ - head_.size());
+        head_.append(data, to_head);
+        data += to_head;
+        size -= to_head;
+        if (size == 0 || tail_limit_ == 0) {
+            return;
+        }
+        if (size >= tail_limit_) {
+            tail_.assign(data + size - tail_limit_, tail_limit_);
+            tail_start_ = 0;
+            return;
+        }
+        if (tail_.size() < tail_limit_) {
+            size_t fill = std::min(size, tail_limit_ - tail_.size());
+            tail_.append(data, fill);
+            data += fill;
+            size -= fill;
+        }
+        // Full: overwrite the oldest bytes, which start at tail_start_
+        while (size > 0) {
+            size_t n = std::min(size, tail_limit_ - tail_start_);
+            std::memcpy(&tail_[tail_start_], data, n);
+            tail_start_ = (tail_start_ + n) % tail_limit_;
+            data += n;
+            size -= n;
+        }
+    }
+
+    uint64_t total() const { return total_; }
+
+    // The kept output, head then tail in order
+    std::string take() {
+        std::string out = std::move(head_);
+        uint64_t dropped = total_ - out.size() - tail_.size();
+        if (dropped > 0) {
+            out += "\n[... " + std::to_string(dropped) + " bytes omitted ...]\n";
+        }
+        out.append(tail_, tail_start_, std::string::npos);
+        out.append(tail_, 0, tail_start_);
+        return out;
+    }
+
+private:
+    const size_t head_limit_;
+    const size_t tail_limit_;
+    std::string head_;
+    std::string tail_;
+    size_t tail_start_ = 0;
+    uint64_t total_ = 0;
+};
+
+// Both streams of one child: bounded in memory, complete in the log
+struct OutputSink {
+    BoundedOutput out;
+    BoundedOutput err;
+    std::ofstream log;
+
+    explicit OutputSink(const CaptureOptions& capture) : out(capture.limit), err(capture.limit) {
+        if (!capture.log_path.empty()) {
+            log.open(capture.log_path, std::ios::binary | std::ios::app);
+        }
+    }
+
+    void append(BoundedOutput& stream, const char* data, size_t size) {
+        stream.append(data, size);
+        if (log.is_open()) {
+            log.write(data, static_cast<std::streamsize>(size));
+        }
+    }
+};
+
+} // anonymous namespace
+
+#ifndef _WIN32
+namespace {
+
+// Pipes must not leak into children spawned concurrently by other threads,
+// or those children would hold the write end open and delay EOF here
+bool make_cloexec_pipe(int fds[2]) {
+#ifdef __linux__
+    return pipe2(fds, O_CLOEXEC) == 0;
+#else
+    if (pipe(fds) != 0) {
+        return false;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return true;
+#endif
+}
+
+} // anonymous namespace
+#endif
+
 std::string ProcessRunner::escape_argument(const std::string& arg) const {
     // Basic escaping for Windows and Unix
     std::string escaped;
@@ -79,15 +199,33 @@ ProcessResult ProcessRunner::run(
     const std::string& command,
     const std::vector<std::string>& args,
     const std::optional<std::string>& working_dir,
-    const std::optional<std::vector<std::pair<std::string, std::string>>>& env
+    const std::optional<std::vector<std::pair<std::string, std::string>>>& env,
+    const CaptureOptions& capture
+) const {
+    ChildProcess child = spawn(command, args, working_dir, env);
+    return wait(child, capture);
+}
+
+ChildProcess ProcessRunner::spawn(
+    const std::string& command,
+    const std::vector<std::string>& args,
+    const std::optional<std::string>& working_dir,
+    const std::optional<std::vector<std::pair<std::string, std::string>>>& env,
+    const ProcessPriority& priority
 ) const {
     std::vector<std::string> full_args;
     full_args.push_back(command);
     full_args.insert(full_args.end(), args.begin(), args.end());
 
-    std::string full_command = join_args(full_args);
+    ChildProcess child;
 
 #ifdef _WIN32
+    // Environment overrides and priorities are only applied by the POSIX implementation
+    (void)env;
+    (void)priority;
+
+    std::string full_command = join_args(full_args);
+
     HANDLE h_stdout_read = nullptr;
     HANDLE h_stdout_write = nullptr;
     HANDLE h_stderr_read = nullptr;
@@ -99,7 +237,8 @@ ProcessResult ProcessRunner::run(
 
     if (!CreatePipe(&h_stdout_read, &h_stdout_write, &sa, 0) ||
         !CreatePipe(&h_stderr_read, &h_stderr_write, &sa, 0)) {
-        return ProcessResult{-1, "", "Failed to create pipes"};
+        child.error = "Failed to create pipes";
+        return child;
     }
 
     SetHandleInformation(h_stdout_read, HANDLE_FLAG_INHERIT, 0);
@@ -115,15 +254,11 @@ ProcessResult ProcessRunner::run(
     PROCESS_INFORMATION pi;
     ZeroMemory(&pi, sizeof(pi));
 
-    DWORD exit_code = 1;
-    std::string stdout_output;
-    std::string stderr_output;
-
     // CreateProcessA requires a mutable buffer
     std::vector<char> cmd_line_buf(full_command.begin(), full_command.end());
     cmd_line_buf.push_back('\0');
     
-    if (CreateProcessA(
+    bool created = CreateProcessA(
             nullptr,
             cmd_line_buf.data(),
             nullptr,
@@ -133,46 +268,70 @@ ProcessResult ProcessRunner::run(
             nullptr,
             working_dir.has_value() ? working_dir->c_str() : nullptr,
             &si,
-            &pi)) {
-        CloseHandle(h_stdout_write);
-        CloseHandle(h_stderr_write);
-
-        // Read output
-        char buffer[4096];
-        DWORD bytes_read;
-        while (ReadFile(h_stdout_read, buffer, sizeof(buffer) - 1, &bytes_read, nullptr) && bytes_read > 0) {
-            buffer[bytes_read] = '\0';
-            stdout_output += buffer;
-        }
-        while (ReadFile(h_stderr_read, buffer, sizeof(buffer) - 1, &bytes_read, nullptr) && bytes_read > 0) {
-            buffer[bytes_read] = '\0';
-            stderr_output += buffer;
-        }
+            &pi);
 
-        WaitForSingleObject(pi.hProcess, INFINITE);
-        GetExitCodeProcess(pi.hProcess, &exit_code);
-        CloseHandle(pi.hProcess);
-        CloseHandle(pi.hThread);
-    } else {
-        stderr_output = "Failed to create process";
-    }
+    CloseHandle(h_stdout_write);
+    CloseHandle(h_stderr_write);
 
-    CloseHandle(h_stdout_read);
-    CloseHandle(h_stderr_read);
+    if (!created) {
+        CloseHandle(h_stdout_read);
+        CloseHandle(h_stderr_read);
+        child.error = "Failed to create process";
+        return child;
+    }
 
-    return ProcessResult{
-        static_cast<int>(exit_code),
-        stdout_output,
-        stderr_output
-    };
+    child.process = pi.hProcess;
+    child.thread = pi.hThread;
+    child.stdout_pipe = h_stdout_read;
+    child.stderr_pipe = h_stderr_read;
+    return child;
 
 #else
     // Unix implementation
     int stdout_pipe[2];
     int stderr_pipe[2];
 
-    if (pipe(stdout_pipe) != 0 || pipe(stderr_pipe) != 0) {
-        return ProcessResult{-1, "", "Failed to create pipes"};
+    if (!make_cloexec_pipe(stdout_pipe)) {
+        child.error = "Failed to create pipes";
+        return child;
+    }
+    if (!make_cloexec_pipe(stderr_pipe)) {
+        close(stdout_pipe[0]);
+        close(stdout_pipe[1]);
+        child.error = "Failed to create pipes";
+        return child;
+    }
+
+    // Build argv and envp before forking: the child of a multi-threaded
+    // parent may only make async-signal-safe calls, so no allocation there
+    std::vector<char*> exec_args;
+    exec_args.reserve(full_args.size() + 1);
+    for (const auto& arg : full_args) {
+        exec_args.push_back(const_cast<char*>(arg.c_str()));
+    }
+    exec_args.push_back(nullptr);
+
+    std::vector<std::string> env_strings;
+    std::vector<char*> exec_env;
+    if (env.has_value()) {
+        for (char** var = environ; *var != nullptr; ++var) {
+            std::string entry(*var);
+            std::string name = entry.substr(0, entry.find('='));
+            bool overridden = false;
+            for (const auto& override_var : env.value()) {
+                overridden = overridden || override_var.first == name;
+            }
+            if (!overridden) {
+                env_strings.push_back(std::move(entry));
+            }
+        }
+        for (const auto& var : env.value()) {
+            env_strings.push_back(var.first + "=" + var.second);
+        }
+        for (auto& entry : env_strings) {
+            exec_env.push_back(entry.data());
+        }
+        exec_env.push_back(nullptr);
     }
 
     pid_t pid = fork();
@@ -181,7 +340,8 @@ ProcessResult ProcessRunner::run(
         close(stdout_pipe[1]);
         close(stderr_pipe[0]);
         close(stderr_pipe[1]);
-        return ProcessResult{-1, "", "Failed to fork process"};
+        child.error = "Failed to fork process";
+        return child;
     }
 
     if (pid == 0) {
@@ -196,71 +356,170 @@ ProcessResult ProcessRunner::run(
         close(stderr_pipe[1]);
 
         if (working_dir.has_value()) {
-            chdir(working_dir->c_str());
+            if (chdir(working_dir->c_str()) != 0) {
+                _exit(127);
+            }
+        }
+
+        if (!exec_env.empty()) {
+            environ = exec_env.data();
         }
 
-        // Prepare arguments for execvp
-        std::vector<char*> exec_args;
-        exec_args.reserve(full_args.size() + 1);
-        for (const auto& arg : full_args) {
-            exec_args.push_back(const_cast<char*>(arg.c_str()));
+        // Best effort: on failure the child keeps the inherited priority
+        if (priority.nice != 0) {
+            [[maybe_unused]] int niced = nice(priority.nice);
+        }
+#if defined(__linux__) && defined(SYS_ioprio_set)
+        if (priority.background_io) {
+            // IOPRIO_WHO_PROCESS, IOPRIO_CLASS_BE at its lowest level (7)
+            syscall(SYS_ioprio_set, 1, 0, (2 << 13) | 7);
         }
-        exec_args.push_back(nullptr);
+#endif
 
         execvp(command.c_str(), exec_args.data());
         _exit(127);
-    } else {
-        // Parent process
-        close(stdout_pipe[1]);
-        close(stderr_pipe[1]);
+    }
 
-        std::string stdout_output;
-        std::string stderr_output;
+    // Parent process
+    close(stdout_pipe[1]);
+    close(stderr_pipe[1]);
 
-        char buffer[4096];
-        ssize_t bytes_read;
+    child.pid = pid;
+    child.stdout_fd = stdout_pipe[0];
+    child.stderr_fd = stderr_pipe[0];
+    return child;
+#endif
+}
 
-        // Read stdout
-        while ((bytes_read = read(stdout_pipe[0], buffer, sizeof(buffer) - 1)) > 0) {
-            buffer[bytes_read] = '\0';
-            stdout_output += buffer;
-        }
+ProcessResult ProcessRunner::wait(ChildProcess& child, const CaptureOptions& capture) const {
+    if (!child.running()) {
+        return ProcessResult{-1, "", child.error};
+    }
+
+    OutputSink sink(capture);
+    std::unique_ptr<char[]> buffer(new char[READ_CHUNK]);
+
+#ifdef _WIN32
+    DWORD exit_code = 1;
+
+    DWORD bytes_read;
+    while (ReadFile(child.stdout_pipe, buffer.get(), READ_CHUNK, &bytes_read, nullptr) && bytes_read > 0) {
+        sink.append(sink.out, buffer.get(), bytes_read);
+    }
+    while (ReadFile(child.stderr_pipe, buffer.get(), READ_CHUNK, &bytes_read, nullptr) && bytes_read > 0) {
+        sink.append(sink.err, buffer.get(), bytes_read);
+    }
+
+    WaitForSingleObject(child.process, INFINITE);
+    GetExitCodeProcess(child.process, &exit_code);
+    CloseHandle(child.process);
+    CloseHandle(child.thread);
+    CloseHandle(child.stdout_pipe);
+    CloseHandle(child.stderr_pipe);
+    child = ChildProcess{};
+
+    ProcessResult result{static_cast<int>(exit_code), sink.out.take(), sink.err.take()};
 
-        // Read stderr
-        while ((bytes_read = read(stderr_pipe[0], buffer, sizeof(buffer) - 1)) > 0) {
-            buffer[bytes_read] = '\0';
-            stderr_output += buffer;
+#else
+    // Both pipes are drained together: a child blocked on a full stderr
+    // pipe would otherwise never close stdout
+    pollfd fds[2] = {{child.stdout_fd, POLLIN, 0}, {child.stderr_fd, POLLIN, 0}};
+    BoundedOutput* streams[2] = {&sink.out, &sink.err};
+    int open_fds = 2;
+    while (open_fds > 0) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
         }
+        for (int i = 0; i < 2; ++i) {
+            if (fds[i].fd < 0 || fds[i].revents == 0) {
+                continue;
+            }
+            ssize_t n = read(fds[i].fd, buffer.get(), READ_CHUNK);
+            if (n > 0) {
+                sink.append(*streams[i], buffer.get(), static_cast<size_t>(n));
+            } else if (n == 0 || errno != EINTR) {
+                fds[i].fd = -1;
+                --open_fds;
+            }
+        }
+    }
 
-        close(stdout_pipe[0]);
-        close(stderr_pipe[0]);
+    close(child.stdout_fd);
+    close(child.stderr_fd);
+
+    int status = 0;
+    struct rusage usage {};
+    wait4(child.pid, &status, 0, &usage);
+    child = ChildProcess{};
+
+    int exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+
+#ifdef __APPLE__
+    uint64_t peak_rss = static_cast<uint64_t>(usage.ru_maxrss);
+#else
+    uint64_t peak_rss = static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
 
-        int status;
-        waitpid(pid, &status, 0);
+    ProcessResult result{exit_code, sink.out.take(), sink.err.take(), peak_rss};
+#endif
 
-        int exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    result.stdout_bytes = sink.out.total();
+    result.stderr_bytes = sink.err.total();
+    return result;
+}
 
-        return ProcessResult{
-            exit_code,
-            stdout_output,
-            stderr_output
-        };
+void ProcessRunner::kill(ChildProcess& child) const {
+    if (!child.running()) {
+        return;
     }
+
+#ifdef _WIN32
+    TerminateProcess(child.process, 1);
+    WaitForSingleObject(child.process, INFINITE);
+    CloseHandle(child.process);
+    CloseHandle(child.thread);
+    CloseHandle(child.stdout_pipe);
+    CloseHandle(child.stderr_pipe);
+#else
+    ::kill(child.pid, SIGKILL);
+    close(child.stdout_fd);
+    close(child.stderr_fd);
+    int status;
+    waitpid(child.pid, &status, 0);
 #endif
+    child = ChildProcess{};
 }
 
 ProcessResult ProcessRunner::run_java(
     const std::string& java_path,
     const std::string& jar_path,
     const std::vector<std::string>& java_args,
-    const std::optional<std::string>& working_dir
+    const std::optional<std::string>& working_dir,
+    const std::vector<std::string>& jvm_args,
+    const ProcessPriority& priority,
+    const CaptureOptions& capture
+) const {
+    ChildProcess child = spawn_java(java_path, jar_path, java_args, working_dir, jvm_args, priority);
+    return wait(child, capture);
+}
+
+ChildProcess ProcessRunner::spawn_java(
+    const std::string& java_path,
+    const std::string& jar_path,
+    const std::vector<std::string>& java_args,
+    const std::optional<std::string>& working_dir,
+    const std::vector<std::string>& jvm_args,
+    const ProcessPriority& priority
 ) const {
-    std::vector<std::string> args;
+    std::vector<std::string> args(jvm_args);
     args.push_back("-jar");
     args.push_back(jar_path);
     args.insert(args.end(), java_args.begin(), java_args.end());
 
-    return run(java_path, args, working_dir);
+    return spawn(java_path, args, working_dir, std::nullopt, priority);
 }
 
 } // namespace aab2apk
@@ -1,11 +1,18 @@
 #include "signing.h"
+#include "apk_verity.h"
 #include "file_utils.h"
+#include "logger.h"
 #include "process_runner.h"
+#include "sha256.h"
+#include "staging.h"
+#include "zip_archive.h"
+#include <atomic>
 #include <filesystem>
 #include <sstream>
-#include <iostream>
 #include <algorithm>
 #include <cctype>
+#include <thread>
+#include <vector>
 
 namespace aab2apk {
 
@@ -74,6 +81,21 @@ std::string SigningManager::find_apksigner() const {
     return "";
 }
 
+std::string SigningManager::key_fingerprint(const SigningConfig& config) {
+    std::string keystore_sha256;
+    uint64_t size = 0;
+    if (!FileUtils::hash_file(config.keystore_path, keystore_sha256, size)) {
+        return {};
+    }
+    std::string identity = keystore_sha256 + "\n" + config.key_alias;
+    return Sha256::to_hex(Sha256::hash(identity.data(), identity.size()));
+}
+
+std::string SigningManager::apksigner() const {
+    std::call_once(apksigner_once_, [this] { apksigner_path_ = find_apksigner(); });
+    return apksigner_path_;
+}
+
 bool SigningManager::validate_signing_result(const ProcessResult& result) const {
     if (!result.success()) {
         return false;
@@ -102,16 +124,18 @@ bool SigningManager::validate_signing_result(const ProcessResult& result) const
 
 bool SigningManager::sign_apk(
     const std::filesystem::path& apk_path,
-    const SigningConfig& config
+    const SigningConfig& config,
+    bool v4,
+    const CaptureOptions& capture
 ) const {
-    std::string apksigner = find_apksigner();
-    if (apksigner.empty()) {
-        std::cerr << "Error: apksigner not found. Please install Android SDK Build Tools or add it to PATH\n";
+    std::string apksigner_path = apksigner();
+    if (apksigner_path.empty()) {
+        Log::error() << "apksigner not found. Please install Android SDK Build Tools or add it to PATH";
         return false;
     }
 
     if (!FileUtils::file_exists(apk_path)) {
-        std::cerr << "Error: APK file does not exist: " << apk_path << "\n";
+        Log::error() << "APK file does not exist: " << apk_path;
         return false;
     }
 
@@ -125,35 +149,50 @@ bool SigningManager::sign_apk(
     args.push_back("pass:" + config.key_password);
     args.push_back("--ks-key-alias");
     args.push_back(config.key_alias);
+    if (v4) {
+        // The tree is left out of apksigner's .idsig and filled in below
+        args.push_back("--v4-signing-enabled");
+        args.push_back("true");
+        args.push_back("--v4-no-merkle-tree");
+    }
     args.push_back(apk_path.string());
 
-    ProcessResult result = runner_.run(apksigner, args);
+    ProcessResult result = runner_.run(apksigner_path, args, std::nullopt, std::nullopt, capture);
+    if (v4 && !result.success() &&
+        (result.stderr_output.find("v4-no-merkle-tree") != std::string::npos ||
+         result.stdout_output.find("v4-no-merkle-tree") != std::string::npos)) {
+        // Older build tools always write the tree; it is replaced all the same
+        args.erase(std::find(args.begin(), args.end(), "--v4-no-merkle-tree"));
+        result = runner_.run(apksigner_path, args, std::nullopt, std::nullopt, capture);
+    }
 
     if (!validate_signing_result(result)) {
-        std::cerr << "Error: APK signing failed\n";
-        if (!result.stderr_output.empty()) {
-            std::cerr << result.stderr_output << "\n";
-        }
+        Log::error() << "APK signing failed"
+                     << (result.stderr_output.empty() ? "" : "\n") << result.stderr_output;
         return false;
     }
 
+    if (v4) {
+        std::filesystem::path idsig = apk_path;
+        idsig += ".idsig";
+        std::string error;
+        if (!ApkVerity::complete_idsig(apk_path, idsig, 0, error)) {
+            Log::error() << error;
+            return false;
+        }
+    }
+
     return true;
 }
 
 bool SigningManager::sign_apks(
     const std::filesystem::path& apks_path,
-    const SigningConfig& config
+    const SigningConfig& config,
+    unsigned jobs,
+    const CaptureOptions& capture
 ) const {
-    // For .apks files, we need to extract, sign each APK, then repackage
-    // This is more complex - for now, we'll sign the universal APK if it exists
-    // or sign all APKs in the directory
-
     if (apks_path.extension() == ".apks") {
-        // .apks is a ZIP file containing multiple APKs
-        // We need to extract, sign each, then repackage
-        // For simplicity, we'll focus on signing individual APKs
-        std::cerr << "Warning: Signing .apks files requires extraction. Please sign individual APKs.\n";
-        return false;
+        return sign_apks_archive(apks_path, config, jobs, capture);
     }
 
     // If it's a directory, sign all APKs in it
@@ -161,7 +200,7 @@ bool SigningManager::sign_apks(
         bool all_signed = true;
         for (const auto& entry : std::filesystem::directory_iterator(apks_path)) {
             if (entry.is_regular_file() && entry.path().extension() == ".apk") {
-                if (!sign_apk(entry.path(), config)) {
+                if (!sign_apk(entry.path(), config, false, capture)) {
                     all_signed = false;
                 }
             }
@@ -169,8 +208,126 @@ bool SigningManager::sign_apks(
         return all_signed;
     }
 
-    return sign_apk(apks_path, config);
+    return sign_apk(apks_path, config, false, capture);
 }
 
-} // namespace aab2apk
+bool SigningManager::sign_apks_archive(
+    const std::filesystem::path& apks_path,
+    const SigningConfig& config,
+    unsigned jobs,
+    const CaptureOptions& capture
+) const {
+    namespace fs = std::filesystem;
+
+    ZipReader archive;
+    std::string error;
+    if (!archive.open(apks_path, error)) {
+        Log::error() << "Cannot read " << apks_path << ": " << error;
+        return false;
+    }
+    std::vector<const ZipEntry*> apks;
+    for (const auto& entry : archive.entries()) {
+        if (!entry.is_directory() && fs::path(entry.name).extension() == ".apk") {
+            apks.push_back(&entry);
+        }
+    }
+
+    // Only the APKs are unpacked, since apksigner works on files; on tmpfs
+    // when there is one
+    fs::path work_dir;
+    try {
+        auto memory_dir = StagingArea::find_memory_filesystem();
+        work_dir = memory_dir ? FileUtils::create_temp_directory_in(*memory_dir)
+                              : FileUtils::create_temp_directory(apks_path.parent_path());
+    } catch (const std::exception& e) {
+        Log::error() << e.what();
+        return false;
+    }
+    struct WorkDirGuard {
+        fs::path path;
+        ~WorkDirGuard() {
+            std::error_code ec;
+            fs::remove_all(path, ec);
+        }
+    } guard{work_dir};
+
+    // Extraction uses positional reads, so every signer extracts its own APK
+    std::vector<fs::path> signed_paths(apks.size());
+    std::atomic<size_t> next{0};
+    std::atomic<bool> failed{false};
+    const LogContext log_context = Logger::context();
+    auto signer = [&]() {
+        Logger::Scope scope(log_context);
+        for (size_t i = next++; i < apks.size() && !failed; i = next++) {
+            signed_paths[i] = work_dir / (std::to_string(i) + ".apk");
+            std::string extract_error;
+            if (!archive.extract_to_file(*apks[i], signed_paths[i], extract_error)) {
+                Log::error() << extract_error;
+                failed = true;
+            } else if (!sign_apk(signed_paths[i], config, false, capture)) {
+                Log::error() << "Failed to sign " << apks[i]->name << " in " << apks_path.filename();
+                failed = true;
+            }
+        }
+    };
+
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    if (jobs == 0) {
+        jobs = std::min(4u, threads);
+    }
+    jobs = static_cast<unsigned>(std::min<size_t>(jobs, std::max<size_t>(apks.size(), 1)));
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < jobs; ++t) {
+        pool.emplace_back(signer);
+    }
+    signer();
+    for (auto& thread : pool) {
+        thread.join();
+    }
+    if (failed) {
+        return false;
+    }
 
+    // Rewritten beside the original and renamed over it, in the original
+    // entry order; signed APKs keep their original storage method
+    fs::path repacked = apks_path;
+    repacked += ".signing";
+    ZipWriter writer;
+    writer.set_threads(threads);
+    bool ok = writer.open(repacked, error);
+    size_t apk_index = 0;
+    for (const auto& entry : archive.entries()) {
+        if (!ok) {
+            break;
+        }
+        if (apk_index < apks.size() && apks[apk_index] == &entry) {
+            ZipAddOptions options;
+            options.compress = entry.method != ZipReader::METHOD_STORED;
+            options.mod_time = entry.mod_time;
+            options.mod_date = entry.mod_date;
+            options.external_attributes = entry.external_attributes;
+            ok = writer.add_file(entry.name, signed_paths[apk_index++], options, error);
+        } else {
+            ok = writer.add_raw(archive, entry, error);
+        }
+    }
+    ok = ok && writer.finish(error);
+    archive.close();
+
+    std::error_code ec;
+    if (ok) {
+        fs::rename(repacked, apks_path, ec);
+        if (ec) {
+            error = "cannot replace " + apks_path.string() + ": " + ec.message();
+            ok = false;
+        }
+    }
+    if (!ok) {
+        Log::error() << "Failed to repack " << apks_path.filename() << ": " << error;
+        fs::remove(repacked, ec);
+        return false;
+    }
+    return true;
+}
+
+} // namespace aab2apk
@@ -0,0 +1,118 @@
+#include "staging.h"
+#include "file_utils.h"
+#include "zip_archive.h"
+#include <cstdlib>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#endif
+
+namespace aab2apk {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// In split and apks mode bundletool also builds standalone APKs for
+// pre-Lollipop devices, each a near-complete copy of the app for one ABI and
+// screen density, so output.apks can be several times the bundle's size
+constexpr uint64_t SPLIT_OUTPUT_FACTOR = 4;
+
+std::string format_mib(uint64_t bytes) {
+    return std::to_string((bytes + (1 << 20) - 1) >> 20) + " MiB";
+}
+
+} // anonymous namespace
+
+std::optional<fs::path> StagingArea::find_memory_filesystem() {
+#ifdef __linux__
+    std::vector<fs::path> candidates;
+    if (const char* dir = std::getenv("AAB2APK_MEMORY_DIR")) {
+        candidates.emplace_back(dir);
+    }
+    candidates.emplace_back("/dev/shm");
+    candidates.emplace_back("/run/shm");
+
+    for (const auto& dir : candidates) {
+        struct statfs st;
+        if (statfs(dir.c_str(), &st) == 0 && st.f_type == TMPFS_MAGIC && FileUtils::is_directory(dir)) {
+            return dir;
+        }
+    }
+#endif
+    return std::nullopt;
+}
+
+std::optional<uint64_t> StagingArea::available_bytes(const fs::path& path) {
+    std::error_code ec;
+    fs::space_info info = fs::space(path, ec);
+    if (ec) {
+        return std::nullopt;
+    }
+    return static_cast<uint64_t>(info.available);
+}
+
+std::optional<uint64_t> StagingArea::uncompressed_size(const fs::path& archive) {
+    ZipReader reader;
+    std::string error;
+    if (!reader.open(archive, error)) {
+        return std::nullopt;
+    }
+    uint64_t total = 0;
+    for (const auto& entry : reader.entries()) {
+        total += entry.uncompressed_size;
+    }
+    return total;
+}
+
+bool StagingArea::plan(const Config& config, StagingPlan& plan, std::string& error) {
+    plan = StagingPlan{};
+
+    auto estimate = uncompressed_size(config.input_aab);
+    if (!estimate.has_value()) {
+        std::error_code ec;
+        uintmax_t size = fs::file_size(config.input_aab, ec);
+        estimate = ec ? 0 : static_cast<uint64_t>(size) * 2;
+    }
+    // Only tmpfs needs room for bundletool's whole output up front: there
+    // nothing would fall back to disk if it filled mid-run
+    const uint64_t bundle_bytes = estimate.value();
+    plan.estimated_bytes = config.mode == OutputMode::Universal ? bundle_bytes : bundle_bytes * SPLIT_OUTPUT_FACTOR;
+
+    uint64_t budget = config.memory_budget_mb << 20;
+    if (config.staging != StagingMode::Disk) {
+        auto memory_dir = find_memory_filesystem();
+        auto memory_free = memory_dir ? available_bytes(*memory_dir) : std::nullopt;
+        bool fits = memory_dir.has_value() && memory_free.has_value() &&
+                    plan.estimated_bytes <= budget && plan.estimated_bytes <= memory_free.value();
+        if (fits) {
+            plan.scratch_base = memory_dir.value();
+            plan.in_memory = true;
+        } else if (config.staging == StagingMode::Memory) {
+            if (!memory_dir.has_value()) {
+                error = "no tmpfs filesystem available for in-memory staging";
+            } else {
+                error = "bundle needs ~" + format_mib(plan.estimated_bytes) +
+                        " of staging, memory budget is " + format_mib(budget) +
+                        " and " + memory_dir->string() + " has " + format_mib(memory_free.value_or(0)) + " free";
+            }
+            return false;
+        }
+    }
+
+    // Extracted APKs always land on the output filesystem; on disk staging
+    // bundletool's output.apks shares it as well
+    uint64_t needed = plan.in_memory ? bundle_bytes : bundle_bytes * 2;
+    auto output_free = available_bytes(config.output_dir);
+    if (output_free.has_value() && output_free.value() < needed) {
+        error = "insufficient disk space in " + config.output_dir + ": need ~" + format_mib(needed) +
+                ", " + format_mib(output_free.value()) + " available";
+        return false;
+    }
+
+    return true;
+}
+
+} // namespace aab2apk
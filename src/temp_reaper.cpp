@@ -0,0 +1,173 @@
+#include "temp_reaper.h"
+#include "file_utils.h"
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <cerrno>
+#endif
+
+namespace aab2apk {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr const char* TRASH_SUFFIX = ".trash";
+constexpr std::time_t SHARED_STALE_AGE = 24 * 60 * 60;
+// /tmp and /dev/shm may be shared with other containers or PID namespaces,
+// where a live owner's pid is not visible: a missing process alone is not
+// proof that the run is over
+constexpr std::time_t LOCAL_STALE_AGE = 60 * 60;
+
+struct TempDirName {
+    long pid = 0;
+    std::time_t created = 0;
+};
+
+// Parses "aab2apk_<pid>_<time>_<seq>" (optionally dot-prefixed and/or .trash)
+bool parse_temp_dir_name(const std::string& name, TempDirName& parsed) {
+    std::string rest = name;
+    if (!rest.empty() && rest.front() == '.') {
+        rest.erase(0, 1);
+    }
+    const std::string prefix = "aab2apk_";
+    if (rest.compare(0, prefix.size(), prefix) != 0) {
+        return false;
+    }
+    rest.erase(0, prefix.size());
+    try {
+        size_t used = 0;
+        parsed.pid = std::stol(rest, &used);
+        if (used >= rest.size() || rest[used] != '_') {
+            return false;
+        }
+        parsed.created = static_cast<std::time_t>(std::stoll(rest.substr(used + 1)));
+    } catch (const std::exception&) {
+        return false;
+    }
+    return parsed.pid > 0;
+}
+
+bool process_exists(long pid) {
+#ifdef _WIN32
+    HANDLE h = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, static_cast<DWORD>(pid));
+    if (h == nullptr) {
+        return false;
+    }
+    DWORD code = 0;
+    bool running = GetExitCodeProcess(h, &code) && code == STILL_ACTIVE;
+    CloseHandle(h);
+    return running;
+#else
+    return kill(static_cast<pid_t>(pid), 0) == 0 || errno != ESRCH;
+#endif
+}
+
+// Deletes path in a grandchild that outlives us; false if it could not be spawned
+bool spawn_detached_remove(const fs::path& path) {
+#ifdef _WIN32
+    (void)path;
+    return false;
+#else
+    // Everything the child needs is prepared before fork
+    std::string target = path.string();
+    const char* argv[] = {"rm", "-rf", "--", target.c_str(), nullptr};
+    int devnull = open("/dev/null", O_RDWR | O_CLOEXEC);
+    if (devnull < 0) {
+        return false;
+    }
+
+    pid_t child = fork();
+    if (child < 0) {
+        close(devnull);
+        return false;
+    }
+    if (child == 0) {
+        // Double fork so the remover is re-parented and never becomes a zombie.
+        // It must not hold our stdout/stderr, or callers reading them would
+        // wait for the deletion to finish.
+        setsid();
+        if (fork() != 0) {
+            _exit(0);
+        }
+        dup2(devnull, STDIN_FILENO);
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        execvp(argv[0], const_cast<char* const*>(argv));
+        _exit(127);
+    }
+
+    close(devnull);
+    int status = 0;
+    while (waitpid(child, &status, 0) < 0 && errno == EINTR) {
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#endif
+}
+
+} // anonymous namespace
+
+void TempReaper::reap(const fs::path& path) {
+    std::error_code ec;
+    if (path.empty() || !fs::exists(path, ec)) {
+        return;
+    }
+
+    // Rename first: the original name disappears at once, and a crash
+    // before deletion leaves something the startup sweep recognises
+    static std::atomic<unsigned> sequence{0};
+    fs::path trash = path;
+    std::string name = path.filename().string();
+    bool already_trash = name.size() > std::string(TRASH_SUFFIX).size() &&
+                         name.compare(name.size() - std::string(TRASH_SUFFIX).size(),
+                                      std::string::npos, TRASH_SUFFIX) == 0;
+    if (!already_trash) {
+        trash += "_" + std::to_string(sequence++) + TRASH_SUFFIX;
+        fs::rename(path, trash, ec);
+        if (ec) {
+            trash = path;
+        }
+    }
+
+    if (!spawn_detached_remove(trash)) {
+        FileUtils::remove_temp_directory(trash);
+    }
+}
+
+void TempReaper::sweep_stale(const fs::path& base, bool local) {
+    std::error_code ec;
+    fs::directory_iterator it(base, ec);
+    if (ec) {
+        return;
+    }
+
+    std::time_t now = std::time(nullptr);
+    for (const auto& entry : it) {
+        std::error_code entry_ec;
+        if (!entry.is_directory(entry_ec)) {
+            continue;
+        }
+        TempDirName parsed;
+        if (!parse_temp_dir_name(entry.path().filename().string(), parsed)) {
+            continue;
+        }
+
+        std::time_t age = now - parsed.created;
+        bool stale = local ? age > LOCAL_STALE_AGE && !process_exists(parsed.pid)
+                           : age > SHARED_STALE_AGE;
+        if (stale) {
+            reap(entry.path());
+        }
+    }
+}
+
+} // namespace aab2apk
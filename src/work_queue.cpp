@@ -0,0 +1,349 @@
+#include "work_queue.h"
+#include "artifact_manifest.h"
+#include "event_stream.h"
+#include "file_utils.h"
+#include "json_utils.h"
+#include "logger.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+namespace aab2apk {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+volatile std::sig_atomic_t g_stop = 0;
+
+void on_stop_signal(int) {
+    g_stop = 1;
+}
+
+// Sets a file's mtime to the current time of the filesystem it lives on
+// (on NFS the server's clock), creating nothing
+bool touch(const fs::path& path) {
+#ifdef _WIN32
+    std::error_code ec;
+    fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+    return !ec;
+#else
+    return utime(path.c_str(), nullptr) == 0;
+#endif
+}
+
+std::string default_worker_id() {
+    char host[256] = "localhost";
+#ifdef _WIN32
+    DWORD size = sizeof(host);
+    GetComputerNameA(host, &size);
+    std::string id = std::string(host) + "-" + std::to_string(GetCurrentProcessId());
+#else
+    gethostname(host, sizeof(host) - 1);
+    std::string id = std::string(host) + "-" + std::to_string(getpid());
+#endif
+    return id;
+}
+
+// Worker ids become part of file names
+std::string sanitize(std::string id) {
+    std::replace_if(id.begin(), id.end(), [](char c) {
+        return c == '/' || c == '\\' || c == '@' || c == ':' || c == '\0';
+    }, '_');
+    return id;
+}
+
+bool is_job_file(const fs::directory_entry& entry) {
+    std::string name = entry.path().filename().string();
+    return entry.path().extension() == ".json" && name[0] != '.' &&
+           name.find(".result.json") == std::string::npos;
+}
+
+} // anonymous namespace
+
+bool WorkQueue::prepare() {
+    root_ = defaults_.queue_dir;
+    worker_id_ = sanitize(defaults_.worker_id.empty() ? default_worker_id() : defaults_.worker_id);
+
+    for (const char* dir : {"pending", "claimed", "done", "failed"}) {
+        if (!FileUtils::create_directories(root_ / dir)) {
+            Log::error() << "Failed to create queue directory: " << (root_ / dir).string();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool WorkQueue::queue_time(fs::file_time_type& now) const {
+    fs::path clock = root_ / "claimed" / (".clock-" + worker_id_);
+    if (!touch(clock)) {
+        std::ofstream create(clock, std::ios::app);
+        if (!create.is_open() || !touch(clock)) {
+            return false;
+        }
+    }
+    std::error_code ec;
+    now = fs::last_write_time(clock, ec);
+    return !ec;
+}
+
+void WorkQueue::requeue_expired() const {
+    fs::file_time_type now;
+    if (!queue_time(now)) {
+        return;
+    }
+    const auto lease = std::chrono::seconds(defaults_.lease_seconds);
+
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(root_ / "claimed", ec)) {
+        std::error_code time_ec;
+        auto renewed = fs::last_write_time(entry.path(), time_ec);
+        if (time_ec || now - renewed <= lease) {
+            continue;
+        }
+        // Clock files of workers that died without cleaning up
+        if (entry.path().filename().string().rfind(".clock-", 0) == 0) {
+            fs::remove(entry.path(), time_ec);
+            continue;
+        }
+        if (!is_job_file(entry)) {
+            continue;
+        }
+
+        std::string stem = entry.path().stem().string();
+        size_t at = stem.rfind('@');
+        std::string job_name = stem.substr(0, at);
+        std::string owner = at != std::string::npos ? stem.substr(at + 1) : "unknown";
+
+        // Only one worker's rename can succeed; the rest see ENOENT
+        std::error_code rename_ec;
+        fs::rename(entry.path(), root_ / "pending" / (job_name + ".json"), rename_ec);
+        if (!rename_ec) {
+            Log::info() << "Re-queued " << job_name << " (lease of " << owner << " expired)";
+        }
+    }
+}
+
+bool WorkQueue::claim(fs::path& claimed, std::string& job_name) const {
+    std::vector<fs::path> pending;
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(root_ / "pending", ec)) {
+        if (is_job_file(entry)) {
+            pending.push_back(entry.path());
+        }
+    }
+    // Name order, so submitters control ordering with sortable names
+    std::sort(pending.begin(), pending.end());
+
+    for (const auto& job : pending) {
+        job_name = job.stem().string();
+        claimed = root_ / "claimed" / (job_name + "@" + worker_id_ + ".json");
+
+        // rename() keeps the submission mtime; refresh it first so the claim
+        // does not look expired to other workers in the meantime
+        touch(job);
+        std::error_code rename_ec;
+        fs::rename(job, claimed, rename_ec);
+        if (!rename_ec) {
+            touch(claimed);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool WorkQueue::has_claims() const {
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(root_ / "claimed", ec)) {
+        if (is_job_file(entry)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkQueue::run_job(const fs::path& claimed, const std::string& job_name, JobScheduler& scheduler) {
+    auto start_time = std::chrono::steady_clock::now();
+
+    // Renew the lease while the job runs; losing the claim file means the
+    // job was re-queued from under us and its result belongs to someone else
+    std::mutex heartbeat_mutex;
+    std::condition_variable heartbeat_stop;
+    bool finished = false;
+    bool lease_lost = false;
+    std::thread heartbeat([&] {
+        auto interval = std::chrono::seconds(std::max(1u, defaults_.lease_seconds / 3));
+        std::unique_lock<std::mutex> lock(heartbeat_mutex);
+        while (!heartbeat_stop.wait_for(lock, interval, [&] { return finished; })) {
+            if (!touch(claimed)) {
+                lease_lost = true;
+            }
+        }
+    });
+
+    std::string error;
+    ArtifactManifest manifest;
+    Config job = defaults_;
+    bool success = false;
+    std::optional<EventStream> events;
+    if (defaults_.events) {
+        events.emplace(job_name, EventStream::console(defaults_));
+    }
+
+    std::ifstream request_file(claimed);
+    std::stringstream request;
+    request << request_file.rdbuf();
+    std::map<std::string, std::string> fields;
+    if (!parse_json_object(request.str(), fields, error)) {
+        error = "Invalid job request: " + error;
+    } else if (ConfigParser::apply_job_request(fields, job, error) &&
+               ConfigParser::apply_job_output(fields, job_name, job, error)) {
+        Log::info() << "Running " << job_name << " (" << job.input_aab << ")";
+
+        Logger::Scope log_scope(job_name);
+        {
+            JobScheduler::Admission admission(scheduler, job);
+            ConversionStats stats;
+            success = converter_.convert(job, manifest, [&job] {
+                return ConfigParser::validate_config(job);
+            }, &stats, nullptr, events ? events->callback() : ProgressCallback());
+            admission.set_peak_rss(stats.bundletool_peak_rss);
+        }
+
+        if (success && !job.manifest_path.empty() && !manifest.write_file(job.manifest_path, job.input_aab)) {
+            error = "Failed to write manifest: " + job.manifest_path;
+            success = false;
+        } else if (!success) {
+            error = "Conversion failed";
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(heartbeat_mutex);
+        finished = true;
+    }
+    heartbeat_stop.notify_all();
+    heartbeat.join();
+
+    if (lease_lost || !FileUtils::file_exists(claimed)) {
+        Log::error() << "Lost the lease on " << job_name << "; discarding its result";
+        any_failed_ = true;
+        if (events) {
+            events->finished(false, "Lost the lease on " + job_name);
+        }
+        return;
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start_time);
+    std::ostringstream result;
+    result << "{\n";
+    result << "  \"job\": \"" << json_escape(job_name) << "\",\n";
+    result << "  \"worker\": \"" << json_escape(worker_id_) << "\",\n";
+    result << "  \"status\": \"" << (success ? "success" : "failure") << "\",\n";
+    if (!success) {
+        result << "  \"error\": \"" << json_escape(error) << "\",\n";
+    }
+    result << "  \"input_aab\": \"" << json_escape(job.input_aab) << "\",\n";
+    result << "  \"output_dir\": \"" << json_escape(job.output_dir) << "\",\n";
+    result << "  \"execution_time\": " << std::fixed << std::setprecision(3) << elapsed.count() / 1000.0 << ",\n";
+    result << "  \"apks\": " << manifest.to_json("  ") << "\n";
+    result << "}\n";
+
+    // The result appears atomically, before the job file that announces it
+    fs::path dest_dir = root_ / (success ? "done" : "failed");
+    fs::path result_path = dest_dir / (job_name + ".result.json");
+    fs::path result_temp = dest_dir / ("." + job_name + ".result.json." + worker_id_);
+    {
+        std::ofstream out(result_temp, std::ios::trunc);
+        out << result.str();
+    }
+    std::error_code ec;
+    fs::rename(result_temp, result_path, ec);
+    if (!ec) {
+        fs::rename(claimed, dest_dir / (job_name + ".json"), ec);
+    }
+    if (ec) {
+        error = "Failed to record the result of " + job_name + ": " + ec.message();
+        Log::error() << error;
+        fs::remove(result_temp, ec);
+        success = false;
+    }
+
+    if (!success) {
+        any_failed_ = true;
+    }
+    if (events) {
+        events->finished(success, error);
+    }
+    Log::info() << (success ? "Finished " : "Failed ") << job_name;
+}
+
+int WorkQueue::run() {
+    if (!prepare()) {
+        return 1;
+    }
+
+    std::signal(SIGINT, on_stop_signal);
+    std::signal(SIGTERM, on_stop_signal);
+
+    Log::info() << "Worker " << worker_id_ << " serving queue " << root_.string();
+
+    JobScheduler scheduler(defaults_.jobs);
+    auto poll_interval = std::chrono::milliseconds(
+        std::min<unsigned>(2000, std::max(1u, defaults_.lease_seconds) * 1000 / 3));
+
+    auto worker = [&] {
+        while (!g_stop) {
+            requeue_expired();
+
+            fs::path claimed;
+            std::string job_name;
+            if (claim(claimed, job_name)) {
+                run_job(claimed, job_name, scheduler);
+                continue;
+            }
+
+            // Drained once nothing is pending and no claim can still expire
+            // back into pending/
+            if (!defaults_.queue_watch && !has_claims()) {
+                return;
+            }
+            auto deadline = std::chrono::steady_clock::now() + poll_interval;
+            while (!g_stop && std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < std::max(1u, defaults_.jobs); ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::error_code ec;
+    fs::remove(root_ / "claimed" / (".clock-" + worker_id_), ec);
+    return any_failed_ ? 1 : 0;
+}
+
+} // namespace aab2apk
@@ -0,0 +1,998 @@
+#include "zip_archive.h"
+#include "crc32.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <zlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace aab2apk {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr uint32_t LOCAL_HEADER_SIGNATURE = 0x04034b50;
+constexpr uint32_t CENTRAL_HEADER_SIGNATURE = 0x02014b50;
+constexpr uint32_t EOCD_SIGNATURE = 0x06054b50;
+constexpr uint32_t ZIP64_EOCD_SIGNATURE = 0x06064b50;
+constexpr uint32_t ZIP64_LOCATOR_SIGNATURE = 0x07064b50;
+constexpr uint16_t ZIP64_EXTRA_ID = 0x0001;
+// Alignment padding extra field, as written by zipalign and apksigner
+constexpr uint16_t ALIGNMENT_EXTRA_ID = 0xD935;
+
+constexpr size_t LOCAL_HEADER_SIZE = 30;
+constexpr size_t CENTRAL_HEADER_SIZE = 46;
+constexpr size_t EOCD_SIZE = 22;
+constexpr size_t MAX_COMMENT_SIZE = 0xFFFF;
+constexpr size_t STREAM_BUFFER_SIZE = 256 * 1024;
+constexpr size_t DEFLATE_BLOCK_SIZE = 256 * 1024;
+constexpr size_t DEFLATE_WINDOW = 32 * 1024;
+
+uint16_t le16(const unsigned char* p) {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+uint32_t le32(const unsigned char* p) {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+uint64_t le64(const unsigned char* p) {
+    return static_cast<uint64_t>(le32(p)) | (static_cast<uint64_t>(le32(p + 4)) << 32);
+}
+
+void put16(std::string& out, uint64_t value) {
+    out += static_cast<char>(value & 0xFF);
+    out += static_cast<char>((value >> 8) & 0xFF);
+}
+
+void put32(std::string& out, uint64_t value) {
+    put16(out, value & 0xFFFF);
+    put16(out, (value >> 16) & 0xFFFF);
+}
+
+void put64(std::string& out, uint64_t value) {
+    put32(out, value & 0xFFFFFFFFu);
+    put32(out, value >> 32);
+}
+
+constexpr uint64_t ZIP32_LIMIT = 0xFFFFFFFFu;
+
+// Entry names come from untrusted archives; refuse anything that could
+// resolve outside of the extraction directory.
+bool is_safe_entry_name(const std::string& name) {
+    if (name.empty() || name.front() == '/' || name.front() == '\\') {
+        return false;
+    }
+    if (name.find(':') != std::string::npos) {
+        return false;
+    }
+    for (const auto& part : fs::path(name)) {
+        if (part == "..") {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Raw deflate of the size bytes after data + history, in DEFLATE_BLOCK_SIZE
+// blocks on up to threads threads, appended to out. Every block ends with a
+// sync flush (byte-aligned, not final) except the stream's last one, so the
+// pieces concatenate into one valid stream. Priming each block with the
+// preceding 32 KiB, reaching back into the history bytes, keeps
+// back-references across block boundaries, so the ratio stays close to a
+// serial deflate.
+bool deflate_blocks(
+    const unsigned char* data,
+    size_t history,
+    size_t size,
+    int level,
+    unsigned threads,
+    bool finish,
+    std::string& out,
+    std::string& error
+) {
+    const size_t blocks = std::max<size_t>(1, (size + DEFLATE_BLOCK_SIZE - 1) / DEFLATE_BLOCK_SIZE);
+    std::vector<std::string> pieces(blocks);
+    std::vector<std::string> errors(blocks);
+    std::atomic<size_t> next{0};
+
+    auto worker = [&]() {
+        for (size_t i = next++; i < blocks; i = next++) {
+            size_t start = i * DEFLATE_BLOCK_SIZE;
+            size_t length = std::min(DEFLATE_BLOCK_SIZE, size - std::min(size, start));
+            bool last = finish && i + 1 == blocks;
+
+            z_stream zs{};
+            if (deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                errors[i] = "failed to initialise deflate";
+                continue;
+            }
+            if (history + start > 0) {
+                size_t window = std::min(DEFLATE_WINDOW, history + start);
+                deflateSetDictionary(&zs, data + history + start - window, static_cast<uInt>(window));
+            }
+
+            std::string& piece = pieces[i];
+            piece.resize(deflateBound(&zs, static_cast<uLong>(length)) + 16);
+            zs.next_in = const_cast<Bytef*>(data + history + start);
+            zs.avail_in = static_cast<uInt>(length);
+            zs.next_out = reinterpret_cast<Bytef*>(&piece[0]);
+            zs.avail_out = static_cast<uInt>(piece.size());
+            int status = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+            bool ok = last ? status == Z_STREAM_END : (status == Z_OK && zs.avail_in == 0 && zs.avail_out > 0);
+            piece.resize(zs.total_out);
+            deflateEnd(&zs);
+            if (!ok) {
+                errors[i] = "deflate failed";
+            }
+        }
+    };
+
+    unsigned workers = static_cast<unsigned>(std::min<size_t>(std::max(threads, 1u), blocks));
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < workers; ++t) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : pool) {
+        thread.join();
+    }
+
+    for (size_t i = 0; i < blocks; ++i) {
+        if (!errors[i].empty()) {
+            error = errors[i];
+            return false;
+        }
+        out += pieces[i];
+    }
+    return true;
+}
+
+} // anonymous namespace
+
+ZipReader::~ZipReader() {
+    close();
+}
+
+void ZipReader::close() {
+#ifdef _WIN32
+    if (handle_ != nullptr) {
+        CloseHandle(static_cast<HANDLE>(handle_));
+        handle_ = nullptr;
+    }
+#else
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+#endif
+    entries_.clear();
+    file_size_ = 0;
+}
+
+bool ZipReader::read_at(uint64_t offset, void* buffer, size_t size) const {
+    auto* out = static_cast<unsigned char*>(buffer);
+    while (size > 0) {
+#ifdef _WIN32
+        OVERLAPPED ov{};
+        ov.Offset = static_cast<DWORD>(offset & 0xFFFFFFFFu);
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD chunk = static_cast<DWORD>(std::min<size_t>(size, 1u << 30));
+        DWORD got = 0;
+        if (!ReadFile(static_cast<HANDLE>(handle_), out, chunk, &got, &ov) || got == 0) {
+            return false;
+        }
+        size_t n = got;
+#else
+        ssize_t got = pread(fd_, out, size, static_cast<off_t>(offset));
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        size_t n = static_cast<size_t>(got);
+#endif
+        out += n;
+        offset += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool ZipReader::open(const fs::path& path, std::string& error) {
+    close();
+    path_ = path;
+
+#ifdef _WIN32
+    HANDLE h = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE) {
+        error = "cannot open " + path.string();
+        return false;
+    }
+    handle_ = h;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(h, &size)) {
+        error = "cannot stat " + path.string();
+        close();
+        return false;
+    }
+    file_size_ = static_cast<uint64_t>(size.QuadPart);
+#else
+    fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+        error = "cannot open " + path.string() + ": " + std::strerror(errno);
+        return false;
+    }
+    off_t size = lseek(fd_, 0, SEEK_END);
+    if (size < 0) {
+        error = "cannot stat " + path.string();
+        close();
+        return false;
+    }
+    file_size_ = static_cast<uint64_t>(size);
+#endif
+
+    if (!read_central_directory(error)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool ZipReader::read_central_directory(std::string& error) {
+    if (file_size_ < EOCD_SIZE) {
+        error = "not a ZIP archive (too small)";
+        return false;
+    }
+
+    // The end of central directory record sits in the last 64 KiB + 22 bytes
+    size_t tail_size = static_cast<size_t>(std::min<uint64_t>(file_size_, EOCD_SIZE + MAX_COMMENT_SIZE));
+    uint64_t tail_offset = file_size_ - tail_size;
+    std::vector<unsigned char> tail(tail_size);
+    if (!read_at(tail_offset, tail.data(), tail.size())) {
+        error = "failed to read end of archive";
+        return false;
+    }
+
+    size_t eocd = std::string::npos;
+    for (size_t i = tail_size - EOCD_SIZE + 1; i-- > 0;) {
+        if (le32(&tail[i]) == EOCD_SIGNATURE) {
+            eocd = i;
+            break;
+        }
+    }
+    if (eocd == std::string::npos) {
+        error = "not a ZIP archive (end of central directory not found)";
+        return false;
+    }
+
+    uint64_t entry_count = le16(&tail[eocd + 10]);
+    uint64_t cd_size = le32(&tail[eocd + 12]);
+    uint64_t cd_offset = le32(&tail[eocd + 16]);
+
+    // Zip64: the locator immediately precedes the classic record
+    uint64_t eocd_offset = tail_offset + eocd;
+    if (eocd_offset >= 20) {
+        unsigned char locator[20];
+        if (read_at(eocd_offset - 20, locator, sizeof(locator)) &&
+            le32(locator) == ZIP64_LOCATOR_SIGNATURE) {
+            unsigned char record[56];
+            uint64_t record_offset = le64(locator + 8);
+            if (!read_at(record_offset, record, sizeof(record)) ||
+                le32(record) != ZIP64_EOCD_SIGNATURE) {
+                error = "corrupt zip64 end of central directory";
+                return false;
+            }
+            entry_count = le64(record + 32);
+            cd_size = le64(record + 40);
+            cd_offset = le64(record + 48);
+        }
+    }
+
+    // Bounds are checked by subtraction: zip64 values can make a sum wrap
+    if (cd_offset > file_size_ || cd_size > file_size_ - cd_offset) {
+        error = "central directory lies outside of the archive";
+        return false;
+    }
+
+    std::vector<unsigned char> cd(static_cast<size_t>(cd_size));
+    if (!read_at(cd_offset, cd.data(), cd.size())) {
+        error = "failed to read central directory";
+        return false;
+    }
+
+    entries_.clear();
+    // Every entry takes at least a fixed-size header, whatever the count claims
+    entries_.reserve(static_cast<size_t>(std::min<uint64_t>(entry_count, cd_size / CENTRAL_HEADER_SIZE)));
+    size_t pos = 0;
+    for (uint64_t i = 0; i < entry_count; ++i) {
+        if (cd.size() - pos < CENTRAL_HEADER_SIZE || le32(&cd[pos]) != CENTRAL_HEADER_SIGNATURE) {
+            error = "corrupt central directory";
+            return false;
+        }
+        const unsigned char* h = &cd[pos];
+        size_t name_len = le16(h + 28);
+        size_t extra_len = le16(h + 30);
+        size_t comment_len = le16(h + 32);
+        if (name_len + extra_len + comment_len > cd.size() - pos - CENTRAL_HEADER_SIZE) {
+            error = "corrupt central directory";
+            return false;
+        }
+
+        ZipEntry entry;
+        entry.flags = le16(h + 8);
+        entry.method = le16(h + 10);
+        entry.mod_time = le16(h + 12);
+        entry.mod_date = le16(h + 14);
+        entry.crc32 = le32(h + 16);
+        entry.compressed_size = le32(h + 20);
+        entry.uncompressed_size = le32(h + 24);
+        entry.external_attributes = le32(h + 38);
+        entry.local_header_offset = le32(h + 42);
+        entry.name.assign(reinterpret_cast<const char*>(h + CENTRAL_HEADER_SIZE), name_len);
+
+        // Values saturated at 0xFFFFFFFF are stored in the zip64 extra field, in order
+        const unsigned char* extra = h + CENTRAL_HEADER_SIZE + name_len;
+        size_t epos = 0;
+        while (extra_len - epos >= 4) {
+            uint16_t id = le16(extra + epos);
+            size_t size = le16(extra + epos + 2);
+            if (size > extra_len - epos - 4) {
+                break;
+            }
+            if (id == ZIP64_EXTRA_ID) {
+                const unsigned char* field = extra + epos + 4;
+                size_t fpos = 0;
+                auto take = [&](uint64_t& value) {
+                    if (value == 0xFFFFFFFFu && fpos + 8 <= size) {
+                        value = le64(field + fpos);
+                        fpos += 8;
+                    }
+                };
+                take(entry.uncompressed_size);
+                take(entry.compressed_size);
+                take(entry.local_header_offset);
+            }
+            epos += 4 + size;
+        }
+
+        entries_.push_back(std::move(entry));
+        pos += CENTRAL_HEADER_SIZE + name_len + extra_len + comment_len;
+    }
+
+    return true;
+}
+
+const ZipEntry* ZipReader::find(const std::string& name) const {
+    for (const auto& entry : entries_) {
+        if (entry.name == name) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+bool ZipReader::data_offset(const ZipEntry& entry, uint64_t& offset, std::string& error) const {
+    unsigned char header[LOCAL_HEADER_SIZE];
+    if (!read_at(entry.local_header_offset, header, sizeof(header)) ||
+        le32(header) != LOCAL_HEADER_SIGNATURE) {
+        error = "corrupt local header for " + entry.name;
+        return false;
+    }
+    offset = entry.local_header_offset + LOCAL_HEADER_SIZE + le16(header + 26) + le16(header + 28);
+    if (offset > file_size_ || entry.compressed_size > file_size_ - offset) {
+        error = "entry data lies outside of the archive: " + entry.name;
+        return false;
+    }
+    return true;
+}
+
+bool ZipReader::extract(const ZipEntry& entry, const Sink& sink, std::string& error) const {
+    if (entry.flags & 0x1) {
+        error = "encrypted entries are not supported: " + entry.name;
+        return false;
+    }
+    if (entry.method != METHOD_STORED && entry.method != METHOD_DEFLATED) {
+        error = "unsupported compression method " + std::to_string(entry.method) + " for " + entry.name;
+        return false;
+    }
+
+    uint64_t offset = 0;
+    if (!data_offset(entry, offset, error)) {
+        return false;
+    }
+
+    std::unique_ptr<unsigned char[]> in(new unsigned char[STREAM_BUFFER_SIZE]);
+    std::unique_ptr<unsigned char[]> out;
+    z_stream zs{};
+    bool inflating = entry.method == METHOD_DEFLATED;
+    if (inflating) {
+        out.reset(new unsigned char[STREAM_BUFFER_SIZE]);
+        if (inflateInit2(&zs, -MAX_WBITS) != Z_OK) {
+            error = "failed to initialise inflate";
+            return false;
+        }
+    }
+    struct InflateGuard {
+        z_stream* zs;
+        bool active;
+        ~InflateGuard() { if (active) inflateEnd(zs); }
+    } inflate_guard{&zs, inflating};
+
+    uint32_t crc = 0;
+    uint64_t produced = 0;
+    uint64_t remaining = entry.compressed_size;
+    int status = Z_OK;
+
+    while (remaining > 0 || (inflating && status != Z_STREAM_END)) {
+        size_t chunk = static_cast<size_t>(std::min<uint64_t>(remaining, STREAM_BUFFER_SIZE));
+        if (chunk > 0 && !read_at(offset, in.get(), chunk)) {
+            error = "failed to read data for " + entry.name;
+            return false;
+        }
+        offset += chunk;
+        remaining -= chunk;
+
+        if (!inflating) {
+            crc = Crc32::update(crc, in.get(), chunk);
+            produced += chunk;
+            if (!sink(in.get(), chunk)) {
+                error = "write failed for " + entry.name;
+                return false;
+            }
+            continue;
+        }
+
+        zs.next_in = in.get();
+        zs.avail_in = static_cast<uInt>(chunk);
+        do {
+            zs.next_out = out.get();
+            zs.avail_out = static_cast<uInt>(STREAM_BUFFER_SIZE);
+            status = inflate(&zs, Z_NO_FLUSH);
+            if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR) {
+                error = "corrupt deflate stream in " + entry.name;
+                return false;
+            }
+            size_t have = STREAM_BUFFER_SIZE - zs.avail_out;
+            if (have > 0) {
+                crc = Crc32::update(crc, out.get(), have);
+                produced += have;
+                if (!sink(out.get(), have)) {
+                    error = "write failed for " + entry.name;
+                    return false;
+                }
+            }
+        } while (zs.avail_out == 0 && status != Z_STREAM_END);
+
+        if (status != Z_STREAM_END && remaining == 0 && zs.avail_in == 0) {
+            error = "truncated deflate stream in " + entry.name;
+            return false;
+        }
+    }
+
+    if (produced != entry.uncompressed_size) {
+        error = "size mismatch for " + entry.name + " (expected " +
+                std::to_string(entry.uncompressed_size) + ", got " + std::to_string(produced) + ")";
+        return false;
+    }
+    if (crc != entry.crc32) {
+        char message[96];
+        std::snprintf(message, sizeof(message), " (expected %08x, got %08x)", entry.crc32, crc);
+        error = "CRC-32 mismatch for " + entry.name + message;
+        return false;
+    }
+    return true;
+}
+
+bool ZipReader::read_raw(const ZipEntry& entry, const Sink& sink, std::string& error) const {
+    uint64_t offset = 0;
+    if (!data_offset(entry, offset, error)) {
+        return false;
+    }
+    std::unique_ptr<unsigned char[]> buffer(new unsigned char[STREAM_BUFFER_SIZE]);
+    uint64_t remaining = entry.compressed_size;
+    while (remaining > 0) {
+        size_t chunk = static_cast<size_t>(std::min<uint64_t>(remaining, STREAM_BUFFER_SIZE));
+        if (!read_at(offset, buffer.get(), chunk)) {
+            error = "failed to read data for " + entry.name;
+            return false;
+        }
+        if (!sink(buffer.get(), chunk)) {
+            error = "write failed for " + entry.name;
+            return false;
+        }
+        offset += chunk;
+        remaining -= chunk;
+    }
+    return true;
+}
+
+bool ZipReader::extract_to_file(const ZipEntry& entry, const fs::path& dest, std::string& error) const {
+    std::ofstream out(dest, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        error = "cannot create " + dest.string();
+        return false;
+    }
+
+    bool ok = extract(entry, [&out](const unsigned char* data, size_t size) {
+        out.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+        return static_cast<bool>(out);
+    }, error);
+
+    out.close();
+    if (ok && out.fail()) {
+        error = "write failed for " + dest.string();
+        ok = false;
+    }
+    if (!ok) {
+        std::error_code ec;
+        fs::remove(dest, ec);
+    }
+    return ok;
+}
+
+bool ZipReader::extract_all(const fs::path& dest_dir, std::string& error) const {
+    for (const auto& entry : entries_) {
+        if (!is_safe_entry_name(entry.name)) {
+            error = "refusing to extract unsafe entry name: " + entry.name;
+            return false;
+        }
+
+        fs::path target = dest_dir / fs::path(entry.name);
+        std::error_code ec;
+        if (entry.is_directory()) {
+            fs::create_directories(target, ec);
+            if (ec) {
+                error = "cannot create directory " + target.string() + ": " + ec.message();
+                return false;
+            }
+            continue;
+        }
+
+        fs::create_directories(target.parent_path(), ec);
+        if (ec) {
+            error = "cannot create directory " + target.parent_path().string() + ": " + ec.message();
+            return false;
+        }
+        if (!extract_to_file(entry, target, error)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+ZipWriter::~ZipWriter() {
+    close_file();
+}
+
+void ZipWriter::close_file() {
+    if (fd_ >= 0) {
+#ifdef _WIN32
+        if (_close(fd_) != 0) {
+            write_failed_ = true;
+        }
+#else
+        if (::close(fd_) != 0) {
+            write_failed_ = true;
+        }
+#endif
+        fd_ = -1;
+    }
+}
+
+bool ZipWriter::open(const fs::path& path, std::string& error) {
+    close_file();
+    path_ = path;
+#ifdef _WIN32
+    fd_ = _open(path.string().c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif
+    if (fd_ < 0) {
+        error = "cannot create " + path.string();
+        return false;
+    }
+    buffer_.clear();
+    write_failed_ = false;
+    offset_ = 0;
+    entries_.clear();
+    return true;
+}
+
+bool ZipWriter::flush() {
+    const char* data = buffer_.data();
+    size_t size = buffer_.size();
+    while (size > 0 && !write_failed_) {
+#ifdef _WIN32
+        int n = _write(fd_, data, static_cast<unsigned>(std::min<size_t>(size, 1u << 30)));
+#else
+        ssize_t n = ::write(fd_, data, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+#endif
+        if (n <= 0) {
+            write_failed_ = true;
+            break;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    buffer_.clear();
+    return !write_failed_;
+}
+
+void ZipWriter::write(const std::string& bytes) {
+    write(reinterpret_cast<const unsigned char*>(bytes.data()), bytes.size());
+}
+
+void ZipWriter::write(const unsigned char* data, size_t size) {
+    buffer_.append(reinterpret_cast<const char*>(data), size);
+    offset_ += size;
+    if (buffer_.size() >= STREAM_BUFFER_SIZE) {
+        flush();
+    }
+}
+
+void ZipWriter::write_local_header(ZipEntry& entry, uint32_t alignment) {
+    entry.local_header_offset = offset_;
+    // Sizes go in the local header, so no data descriptor follows the data
+    entry.flags = static_cast<uint16_t>(entry.flags & ~0x0008);
+
+    bool zip64 = entry.compressed_size >= ZIP32_LIMIT || entry.uncompressed_size >= ZIP32_LIMIT;
+    std::string header;
+    put32(header, LOCAL_HEADER_SIGNATURE);
+    put16(header, zip64 ? 45 : 20);
+    put16(header, entry.flags);
+    put16(header, entry.method);
+    put16(header, entry.mod_time);
+    put16(header, entry.mod_date);
+    put32(header, entry.crc32);
+    put32(header, zip64 ? ZIP32_LIMIT : entry.compressed_size);
+    put32(header, zip64 ? ZIP32_LIMIT : entry.uncompressed_size);
+    std::string extra;
+    if (zip64) {
+        put16(extra, ZIP64_EXTRA_ID);
+        put16(extra, 16);
+        put64(extra, entry.uncompressed_size);
+        put64(extra, entry.compressed_size);
+    }
+    if (alignment > 1 && entry.method == ZipReader::METHOD_STORED) {
+        uint64_t data_start = offset_ + LOCAL_HEADER_SIZE + entry.name.size() + extra.size() + 6;
+        size_t padding = static_cast<size_t>((alignment - data_start % alignment) % alignment);
+        put16(extra, ALIGNMENT_EXTRA_ID);
+        put16(extra, 2 + padding);
+        put16(extra, alignment);
+        extra.append(padding, '\0');
+    }
+    put16(header, entry.name.size());
+    put16(header, extra.size());
+    header += entry.name;
+    header += extra;
+    write(header);
+}
+
+bool ZipWriter::add_raw(const ZipReader& source, const ZipEntry& entry, std::string& error, uint32_t alignment) {
+    ZipEntry copy = entry;
+    write_local_header(copy, alignment);
+
+    uint64_t remaining = entry.compressed_size;
+#if defined(__linux__)
+    // The data never passes through user space (and is reflinked on
+    // filesystems that can)
+    uint64_t source_offset = 0;
+    if (!source.data_offset(entry, source_offset, error)) {
+        return false;
+    }
+    if (remaining > 0 && flush()) {
+        loff_t in_offset = static_cast<loff_t>(source_offset);
+        while (remaining > 0) {
+            ssize_t n = copy_file_range(source.fd_, &in_offset, fd_, nullptr,
+                                        static_cast<size_t>(std::min<uint64_t>(remaining, 1u << 30)), 0);
+            if (n <= 0) {
+                break;
+            }
+            offset_ += static_cast<uint64_t>(n);
+            remaining -= static_cast<uint64_t>(n);
+        }
+    }
+#endif
+    if (remaining > 0) {
+        // Not supported here (or only partly done): copy the rest through a buffer
+        ZipEntry rest = entry;
+        uint64_t skip = entry.compressed_size - remaining;
+        bool ok = source.read_raw(rest, [this, &skip](const unsigned char* data, size_t size) {
+            if (skip >= size) {
+                skip -= size;
+                return true;
+            }
+            write(data + skip, size - static_cast<size_t>(skip));
+            skip = 0;
+            return !write_failed_;
+        }, error);
+        if (!ok) {
+            return false;
+        }
+    }
+    if (write_failed_) {
+        error = "write failed for " + path_.string();
+        return false;
+    }
+    entries_.push_back(std::move(copy));
+    return true;
+}
+
+bool ZipWriter::deflate_parallel(
+    const unsigned char* data,
+    size_t size,
+    int level,
+    unsigned threads,
+    std::string& out,
+    std::string& error
+) {
+    out.clear();
+    return deflate_blocks(data, 0, size, level, threads, true, out, error);
+}
+
+bool ZipWriter::add_data(
+    const std::string& name,
+    const unsigned char* data,
+    size_t size,
+    const ZipAddOptions& options,
+    std::string& error
+) {
+    ZipEntry entry;
+    entry.name = name;
+    entry.mod_time = options.mod_time;
+    entry.mod_date = options.mod_date;
+    entry.external_attributes = options.external_attributes;
+    entry.crc32 = Crc32::compute(data, size);
+    entry.uncompressed_size = size;
+
+    std::string compressed;
+    if (options.compress && size > 0) {
+        if (!deflate_parallel(data, size, options.level, threads_, compressed, error)) {
+            error += " for " + name;
+            return false;
+        }
+    }
+    bool deflated = options.compress && size > 0 && compressed.size() < size;
+    entry.method = deflated ? ZipReader::METHOD_DEFLATED : ZipReader::METHOD_STORED;
+    entry.compressed_size = deflated ? compressed.size() : size;
+    if (!deflated) {
+        compressed.assign(reinterpret_cast<const char*>(data), size);
+    }
+    return add_prepared(std::move(entry), compressed, options.alignment, error);
+}
+
+bool ZipWriter::add_prepared(ZipEntry entry, const std::string& data, uint32_t alignment, std::string& error) {
+    if (data.size() != entry.compressed_size) {
+        error = "size mismatch for " + entry.name;
+        return false;
+    }
+    write_local_header(entry, alignment);
+    write(data);
+    if (write_failed_) {
+        error = "write failed for " + path_.string();
+        return false;
+    }
+    entries_.push_back(std::move(entry));
+    return true;
+}
+
+bool ZipWriter::add_file(
+    const std::string& name,
+    const fs::path& source,
+    const ZipAddOptions& options,
+    std::string& error
+) {
+    std::ifstream in(source, std::ios::binary);
+    std::error_code ec;
+    uint64_t size = fs::file_size(source, ec);
+    if (!in.is_open() || ec) {
+        error = "cannot read " + source.string();
+        return false;
+    }
+    const std::string read_error = "cannot read " + source.string();
+
+    ZipEntry entry;
+    entry.name = name;
+    entry.mod_time = options.mod_time;
+    entry.mod_date = options.mod_date;
+    entry.external_attributes = options.external_attributes;
+    entry.uncompressed_size = size;
+
+    // The local header carries the CRC-32 and compressed size, so the file
+    // is deflated ahead of it into an anonymous temporary file, a few
+    // blocks per thread at a time; memory stays bounded however large the
+    // source is.
+    std::unique_ptr<std::FILE, int (*)(std::FILE*)> deflated(nullptr, &std::fclose);
+    uint64_t deflated_size = 0;
+    if (options.compress && size > 0) {
+        deflated.reset(std::tmpfile());
+        if (!deflated) {
+            error = "cannot create a temporary file for " + name;
+            return false;
+        }
+        const size_t chunk = DEFLATE_BLOCK_SIZE * 4 * threads_;
+        std::vector<unsigned char> buffer(DEFLATE_WINDOW + chunk);
+        size_t history = 0;
+        uint64_t remaining = size;
+        uint32_t crc = 0;
+        std::string compressed;
+        while (remaining > 0) {
+            size_t length = static_cast<size_t>(std::min<uint64_t>(remaining, chunk));
+            if (!in.read(reinterpret_cast<char*>(buffer.data() + history), static_cast<std::streamsize>(length))) {
+                error = read_error;
+                return false;
+            }
+            crc = Crc32::update(crc, buffer.data() + history, length);
+            remaining -= length;
+            compressed.clear();
+            if (!deflate_blocks(buffer.data(), history, length, options.level, threads_, remaining == 0,
+                                compressed, error)) {
+                error += " for " + name;
+                return false;
+            }
+            if (std::fwrite(compressed.data(), 1, compressed.size(), deflated.get()) != compressed.size()) {
+                error = "cannot write a temporary file for " + name;
+                return false;
+            }
+            deflated_size += compressed.size();
+            // The chunk's tail is the next chunk's dictionary
+            size_t keep = std::min(DEFLATE_WINDOW, history + length);
+            std::memmove(buffer.data(), buffer.data() + history + length - keep, keep);
+            history = keep;
+        }
+        entry.crc32 = crc;
+        if (deflated_size >= size) {
+            deflated.reset();
+        }
+    } else {
+        std::vector<unsigned char> buffer(STREAM_BUFFER_SIZE);
+        uint32_t crc = 0;
+        for (uint64_t remaining = size; remaining > 0;) {
+            size_t length = static_cast<size_t>(std::min<uint64_t>(remaining, buffer.size()));
+            if (!in.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(length))) {
+                error = read_error;
+                return false;
+            }
+            crc = Crc32::update(crc, buffer.data(), length);
+            remaining -= length;
+        }
+        entry.crc32 = crc;
+    }
+
+    // Copy the deflated data, or store the source when deflate did not
+    // make it smaller
+    std::FILE* data = deflated.get();
+    entry.method = data ? ZipReader::METHOD_DEFLATED : ZipReader::METHOD_STORED;
+    entry.compressed_size = data ? deflated_size : size;
+    if (data) {
+        std::rewind(data);
+    } else {
+        in.clear();
+        in.seekg(0);
+    }
+    write_local_header(entry, options.alignment);
+    std::vector<unsigned char> buffer(STREAM_BUFFER_SIZE);
+    for (uint64_t remaining = entry.compressed_size; remaining > 0;) {
+        size_t length = static_cast<size_t>(std::min<uint64_t>(remaining, buffer.size()));
+        bool ok = data ? std::fread(buffer.data(), 1, length, data) == length
+                       : static_cast<bool>(in.read(reinterpret_cast<char*>(buffer.data()),
+                                                   static_cast<std::streamsize>(length)));
+        if (!ok) {
+            error = data ? "cannot read back the temporary file for " + name : read_error;
+            return false;
+        }
+        write(buffer.data(), length);
+        remaining -= length;
+    }
+    if (write_failed_) {
+        error = "write failed for " + path_.string();
+        return false;
+    }
+    entries_.push_back(std::move(entry));
+    return true;
+}
+
+bool ZipWriter::finish(std::string& error) {
+    uint64_t cd_offset = offset_;
+    for (const auto& entry : entries_) {
+        // Saturated fields are repeated in the zip64 extra field, in order
+        std::string extra;
+        if (entry.uncompressed_size >= ZIP32_LIMIT) {
+            put64(extra, entry.uncompressed_size);
+        }
+        if (entry.compressed_size >= ZIP32_LIMIT) {
+            put64(extra, entry.compressed_size);
+        }
+        if (entry.local_header_offset >= ZIP32_LIMIT) {
+            put64(extra, entry.local_header_offset);
+        }
+
+        std::string header;
+        put32(header, CENTRAL_HEADER_SIGNATURE);
+        put16(header, (3 << 8) | 45);   // made by Unix, spec 4.5
+        put16(header, extra.empty() ? 20 : 45);
+        put16(header, entry.flags);
+        put16(header, entry.method);
+        put16(header, entry.mod_time);
+        put16(header, entry.mod_date);
+        put32(header, entry.crc32);
+        put32(header, std::min(entry.compressed_size, ZIP32_LIMIT));
+        put32(header, std::min(entry.uncompressed_size, ZIP32_LIMIT));
+        put16(header, entry.name.size());
+        put16(header, extra.empty() ? 0 : extra.size() + 4);
+        put16(header, 0);   // comment
+        put16(header, 0);   // disk
+        put16(header, 0);   // internal attributes
+        put32(header, entry.external_attributes);
+        put32(header, std::min(entry.local_header_offset, ZIP32_LIMIT));
+        header += entry.name;
+        if (!extra.empty()) {
+            put16(header, ZIP64_EXTRA_ID);
+            put16(header, extra.size());
+            header += extra;
+        }
+        write(header);
+    }
+    uint64_t cd_size = offset_ - cd_offset;
+    uint64_t count = entries_.size();
+
+    std::string tail;
+    if (count >= 0xFFFF || cd_offset >= ZIP32_LIMIT || cd_size >= ZIP32_LIMIT) {
+        uint64_t record_offset = offset_;
+        put32(tail, ZIP64_EOCD_SIGNATURE);
+        put64(tail, 44);
+        put16(tail, 45);
+        put16(tail, 45);
+        put32(tail, 0);
+        put32(tail, 0);
+        put64(tail, count);
+        put64(tail, count);
+        put64(tail, cd_size);
+        put64(tail, cd_offset);
+        put32(tail, ZIP64_LOCATOR_SIGNATURE);
+        put32(tail, 0);
+        put64(tail, record_offset);
+        put32(tail, 1);
+    }
+    put32(tail, EOCD_SIGNATURE);
+    put16(tail, 0);
+    put16(tail, 0);
+    put16(tail, std::min<uint64_t>(count, 0xFFFF));
+    put16(tail, std::min<uint64_t>(count, 0xFFFF));
+    put32(tail, std::min(cd_size, ZIP32_LIMIT));
+    put32(tail, std::min(cd_offset, ZIP32_LIMIT));
+    put16(tail, 0);
+    write(tail);
+
+    flush();
+    close_file();
+    if (write_failed_) {
+        error = "write failed for " + path_.string();
+        return false;
+    }
+    return true;
+}
+
+} // namespace aab2apk
@@ -0,0 +1,224 @@
+#include "apk_patch.h"
+#include "delta.h"
+#include "test_support.h"
+#include "zip_archive.h"
+#include <cstring>
+#include <map>
+#include <zlib.h>
+
+using aab2apk::ApkPatch;
+using aab2apk::Delta;
+using aab2apk::PatchStats;
+using aab2apk::ZipEntry;
+using aab2apk::ZipReader;
+using aab2apk::ZipAddOptions;
+using aab2apk::ZipWriter;
+
+namespace {
+
+struct Entry {
+    std::string data;
+    bool compress;
+};
+
+void write_apk(const std::filesystem::path& path, const std::map<std::string, Entry>& entries) {
+    ZipWriter writer;
+    std::string error;
+    CHECK(writer.open(path, error));
+    for (const auto& [name, entry] : entries) {
+        ZipAddOptions options;
+        options.compress = entry.compress;
+        options.alignment = entry.compress ? 0 : 4;
+        CHECK(writer.add_data(name, reinterpret_cast<const unsigned char*>(entry.data.data()), entry.data.size(),
+                              options, error));
+    }
+    CHECK(writer.finish(error));
+}
+
+// diff then apply must give back the new APK byte for byte
+void test_round_trip(const test::TempDir& dir) {
+    std::string dex = test::make_data(300 * 1024, 1);
+    std::string resources = test::make_data(64 * 1024, 2, true);
+    std::string lib = test::make_data(128 * 1024, 3, true);
+    std::string asset = test::make_data(40 * 1024, 4);
+
+    std::string new_dex = dex;
+    new_dex.replace(1000, 5000, test::make_data(5000, 5));
+    new_dex += test::make_data(20 * 1024, 6);
+    std::string new_resources = resources;
+    std::memcpy(&new_resources[4096], "changed stored bytes", 20);
+
+    write_apk(dir / "old.apk", {
+        {"classes.dex", {dex, true}},
+        {"resources.arsc", {resources, false}},
+        {"lib/arm64-v8a/libfoo.so", {lib, false}},
+        {"assets/old_name.bin", {asset, true}},
+        {"assets/removed.txt", {test::make_data(8 * 1024, 7), true}},
+        {"AndroidManifest.xml", {test::make_data(2048, 8), true}},
+    });
+    write_apk(dir / "new.apk", {
+        {"classes.dex", {new_dex, true}},                       // changed
+        {"resources.arsc", {new_resources, false}},             // stored and changed
+        {"lib/arm64-v8a/libfoo.so", {lib, false}},              // unchanged
+        {"assets/new_name.bin", {asset, true}},                 // renamed
+        {"assets/added.txt", {test::make_data(16 * 1024, 9), true}},
+        {"AndroidManifest.xml", {test::make_data(2048, 8), true}},
+    });
+
+    PatchStats stats;
+    std::string error;
+    CHECK(ApkPatch::create(dir / "old.apk", dir / "new.apk", dir / "update.patch", 2, stats, error));
+    CHECK(stats.copied > 0);
+    CHECK(stats.deltas > 0);
+    CHECK(stats.patch_size < stats.new_size);
+
+    CHECK(ApkPatch::apply(dir / "old.apk", dir / "update.patch", dir / "rebuilt.apk", error));
+    CHECK(test::read_file(dir / "rebuilt.apk") == test::read_file(dir / "new.apk"));
+}
+
+// A damaged patch or the wrong old APK fails without writing the output
+void test_bad_patches(const test::TempDir& dir) {
+    const std::string patch = test::read_file(dir / "update.patch");
+    std::string error;
+
+    for (size_t size : {size_t(0), size_t(7), patch.size() / 2, patch.size() - 1}) {
+        test::write_file(dir / "truncated.patch", patch.substr(0, size));
+        CHECK(!ApkPatch::apply(dir / "old.apk", dir / "truncated.patch", dir / "out.apk", error));
+        CHECK(!std::filesystem::exists(dir / "out.apk"));
+    }
+
+    for (size_t offset = 16; offset < patch.size(); offset += patch.size() / 7) {
+        std::string corrupt = patch;
+        corrupt[offset] = static_cast<char>(corrupt[offset] ^ 0x5a);
+        test::write_file(dir / "corrupt.patch", corrupt);
+        CHECK(!ApkPatch::apply(dir / "old.apk", dir / "corrupt.patch", dir / "out.apk", error));
+        CHECK(!std::filesystem::exists(dir / "out.apk"));
+    }
+
+    CHECK(!ApkPatch::apply(dir / "new.apk", dir / "update.patch", dir / "out.apk", error));
+    CHECK(!std::filesystem::exists(dir / "out.apk"));
+}
+
+// A single zlib stream, as Java's Deflater writes entries
+void add_zlib_entry(ZipWriter& writer, const std::string& name, const std::string& data, int level) {
+    z_stream zs{};
+    CHECK(deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+    std::string deflated(deflateBound(&zs, static_cast<uLong>(data.size())), '\0');
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    zs.avail_in = static_cast<uInt>(data.size());
+    zs.next_out = reinterpret_cast<Bytef*>(&deflated[0]);
+    zs.avail_out = static_cast<uInt>(deflated.size());
+    CHECK(deflate(&zs, Z_FINISH) == Z_STREAM_END);
+    deflated.resize(zs.total_out);
+    deflateEnd(&zs);
+
+    ZipEntry entry;
+    entry.name = name;
+    entry.method = ZipReader::METHOD_DEFLATED;
+    entry.crc32 = static_cast<uint32_t>(crc32(0, reinterpret_cast<const Bytef*>(data.data()),
+                                              static_cast<uInt>(data.size())));
+    entry.compressed_size = deflated.size();
+    entry.uncompressed_size = data.size();
+    std::string error;
+    CHECK(writer.add_prepared(entry, deflated, 0, error));
+}
+
+void write_deflated_apk(const std::filesystem::path& path, const std::string& dex, const std::string& manifest) {
+    ZipWriter writer;
+    std::string error;
+    CHECK(writer.open(path, error));
+    CHECK(writer.add_data("classes.dex", reinterpret_cast<const unsigned char*>(dex.data()), dex.size(),
+                          ZipAddOptions{}, error));
+    add_zlib_entry(writer, "AndroidManifest.xml", manifest, 9);
+    CHECK(writer.finish(error));
+}
+
+// An insertion near the start shifts every later bit of a deflate stream,
+// so changed deflated entries are diffed inflated and deflated again: the
+// patch stays a small fraction of the entries, for both ZipWriter's block
+// deflate and a plain zlib stream
+void test_deflated_delta(const test::TempDir& dir) {
+    std::string dex = test::make_data(600 * 1024, 11);
+    std::string manifest = test::make_data(40 * 1024, 12);
+    std::string new_dex = dex;
+    new_dex.insert(100, "inserted near the start");
+    std::memcpy(&new_dex[400 * 1024], "changed", 7);
+    std::string new_manifest = manifest;
+    new_manifest.insert(50, "<uses-permission/>");
+
+    write_deflated_apk(dir / "old_deflated.apk", dex, manifest);
+    write_deflated_apk(dir / "new_deflated.apk", new_dex, new_manifest);
+
+    PatchStats stats;
+    std::string error;
+    CHECK(ApkPatch::create(dir / "old_deflated.apk", dir / "new_deflated.apk", dir / "deflated.patch", 2, stats,
+                           error));
+    ZipReader reader;
+    CHECK(reader.open(dir / "new_deflated.apk", error));
+    uint64_t entries_size = reader.find("classes.dex")->compressed_size +
+                            reader.find("AndroidManifest.xml")->compressed_size;
+    CHECK(stats.patch_size < entries_size / 20);
+
+    CHECK(ApkPatch::apply(dir / "old_deflated.apk", dir / "deflated.patch", dir / "rebuilt_deflated.apk", error));
+    CHECK(test::read_file(dir / "rebuilt_deflated.apk") == test::read_file(dir / "new_deflated.apk"));
+}
+
+void put64(std::string& out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        out += static_cast<char>(value >> (8 * i));
+    }
+}
+
+// Diff lengths whose sum wraps around 2^64 look like a 2-byte diff block;
+// the first control would then read 64 bytes from it. Built with
+// -fsanitize=address this reads out of bounds unless the sum is checked.
+void test_delta_overflow() {
+    std::string encoded;
+    put64(encoded, 2);
+    put64(encoded, 64);                 // x
+    put64(encoded, 0);                  // y
+    put64(encoded, 0);                  // z
+    put64(encoded, UINT64_MAX - 61);    // 64 + this wraps to 2
+    put64(encoded, 0);
+    put64(encoded, 0);
+    encoded += "ab";
+
+    std::string delta;
+    std::string out;
+    std::string error;
+    CHECK(Delta::compress(encoded, delta, error));
+    const unsigned char old_data[4] = {1, 2, 3, 4};
+    CHECK(!Delta::apply(old_data, sizeof(old_data), delta, 64, out, error));
+}
+
+// 64 MiB of zeros deflates to about 64 KiB; inflating must stop as
+// soon as it passes what a 64-byte result can need
+void test_delta_bomb() {
+    std::string encoded;
+    put64(encoded, 1);
+    put64(encoded, 0);
+    put64(encoded, 64);
+    put64(encoded, 0);
+    encoded.append(64u * 1024 * 1024, '\0');
+
+    std::string delta;
+    std::string out;
+    std::string error;
+    CHECK(Delta::compress(encoded, delta, error));
+    const unsigned char old_data[4] = {1, 2, 3, 4};
+    CHECK(!Delta::apply(old_data, sizeof(old_data), delta, 64, out, error));
+    CHECK(!Delta::decompress(delta, 64, out, error));
+}
+
+} // anonymous namespace
+
+int main() {
+    test::TempDir dir("aab2apk_patch_test");
+    test_round_trip(dir);
+    test_bad_patches(dir);
+    test_deflated_delta(dir);
+    test_delta_overflow();
+    test_delta_bomb();
+    std::cout << "apk_patch_test: all checks passed\n";
+    return 0;
+}
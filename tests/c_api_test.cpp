@@ -0,0 +1,140 @@
+#include "aab2apk.h"
+#include "test_support.h"
+#include "zip_archive.h"
+#include <atomic>
+#include <cstring>
+
+using aab2apk::ZipAddOptions;
+using aab2apk::ZipWriter;
+
+namespace {
+
+std::atomic<int> g_progress_calls{0};
+std::atomic<int> g_published{0};
+
+void on_progress(const aab2apk_progress* progress, void* user_data) {
+    CHECK(progress->job_id != nullptr && progress->phase != nullptr && progress->apk != nullptr);
+    CHECK(user_data == &g_progress_calls);
+    g_progress_calls++;
+    if (std::strcmp(progress->phase, "published") == 0) {
+        g_published++;
+    }
+}
+
+void write_zip(const std::filesystem::path& path, const std::string& name, const std::string& data) {
+    ZipWriter writer;
+    std::string error;
+    CHECK(writer.open(path, error));
+    CHECK(writer.add_data(name, reinterpret_cast<const unsigned char*>(data.data()), data.size(), ZipAddOptions{},
+                          error));
+    CHECK(writer.finish(error));
+}
+
+// bundletool's stand-in: writes a prepared universal .apks wherever
+// --output= points
+void write_fake_java(const std::filesystem::path& java, const std::filesystem::path& apks) {
+    test::write_file(java, "#!/bin/sh\n"
+                           "for arg in \"$@\"; do\n"
+                           "    case \"$arg\" in --output=*) out=\"${arg#--output=}\";; esac\n"
+                           "done\n"
+                           "cp '" + apks.string() + "' \"$out\"\n");
+    std::filesystem::permissions(java, std::filesystem::perms::owner_all);
+}
+
+std::string options_json(const test::TempDir& dir, const std::string& jobs) {
+    return "{\"bundletool\": \"" + (dir / "bundletool.jar").string() + "\", \"java\": \"" +
+           (dir / "java").string() + "\", \"jobs\": \"" + jobs + "\"}";
+}
+
+void test_context_errors(const test::TempDir& dir) {
+    aab2apk_context* context = reinterpret_cast<aab2apk_context*>(&context);
+    CHECK(aab2apk_context_create("{\"jobs\": ", &context) == AAB2APK_INVALID_ARGUMENT);
+    CHECK(context == nullptr);
+    CHECK(std::strlen(aab2apk_last_error()) > 0);
+    for (const char* jobs : {"0", "-1", "257", "two"}) {
+        CHECK(aab2apk_context_create(options_json(dir, jobs).c_str(), &context) == AAB2APK_INVALID_ARGUMENT);
+        CHECK(context == nullptr);
+    }
+    CHECK(aab2apk_context_create(nullptr, nullptr) == AAB2APK_INVALID_ARGUMENT);
+}
+
+// Two jobs at once, one with an explicit output and one publishing into
+// the default ./dist/<id>, then a failing conversion and a malformed request
+void test_jobs(const test::TempDir& dir) {
+    aab2apk_context* context = nullptr;
+    CHECK(aab2apk_context_create(options_json(dir, "2").c_str(), &context) == AAB2APK_OK);
+    CHECK(context != nullptr);
+
+    aab2apk_job* first = nullptr;
+    aab2apk_job* second = nullptr;
+    const std::string first_request = "{\"id\": \"first\", \"input\": \"" + (dir / "app.aab").string() +
+                                      "\", \"output\": \"" + (dir / "out").string() + "\"}";
+    const std::string second_request = "{\"id\": \"second\", \"input\": \"" + (dir / "app.aab").string() + "\"}";
+    CHECK(aab2apk_submit(context, first_request.c_str(), on_progress, &g_progress_calls, &first) == AAB2APK_OK);
+    CHECK(aab2apk_submit(context, second_request.c_str(), on_progress, &g_progress_calls, &second) == AAB2APK_OK);
+
+    const aab2apk_result* result = nullptr;
+    CHECK(aab2apk_job_wait(first, &result) == AAB2APK_OK);
+    CHECK(aab2apk_result_status(result) == AAB2APK_OK);
+    CHECK(std::strcmp(aab2apk_result_error(result), "") == 0);
+    CHECK(aab2apk_result_apk_count(result) == 1);
+    aab2apk_apk apk{};
+    CHECK(aab2apk_result_apk(result, 0, &apk) == 1);
+    CHECK(std::strcmp(apk.name, "app.apk") == 0);
+    CHECK(std::filesystem::path(apk.path) == dir / "out" / "app.apk");
+    CHECK(test::read_file(apk.path) == test::read_file(dir / "universal.apk"));
+    CHECK(apk.size == std::filesystem::file_size(dir / "universal.apk"));
+    CHECK(std::strlen(apk.sha256) == 64);
+    CHECK(std::strcmp(apk.module, "base") == 0 && std::strcmp(apk.split_id, "") == 0);
+    CHECK(aab2apk_result_apk(result, 1, &apk) == 0);
+    const std::string json = aab2apk_result_json(result);
+    CHECK(json.find("\"id\": \"first\"") != std::string::npos);
+    CHECK(json.find("\"status\": \"success\"") != std::string::npos);
+    CHECK(json.find('\n') == std::string::npos);
+
+    CHECK(aab2apk_job_wait(second, &result) == AAB2APK_OK);
+    CHECK(std::filesystem::exists(dir / "dist" / "second" / "app.apk"));
+    aab2apk_job_free(first);
+    aab2apk_job_free(second);
+    CHECK(g_published == 2);
+    CHECK(g_progress_calls > 2);
+
+    aab2apk_result* failed = nullptr;
+    const std::string missing = "{\"input\": \"" + (dir / "missing.aab").string() + "\"}";
+    CHECK(aab2apk_convert(context, missing.c_str(), nullptr, nullptr, &failed) == AAB2APK_CONVERSION_FAILED);
+    CHECK(aab2apk_result_status(failed) == AAB2APK_CONVERSION_FAILED);
+    CHECK(std::strlen(aab2apk_result_error(failed)) > 0);
+    CHECK(std::string(aab2apk_result_json(failed)).find("\"status\": \"failure\"") != std::string::npos);
+    CHECK(aab2apk_result_apk_count(failed) == 0);
+    aab2apk_result_free(failed);
+
+    aab2apk_job* rejected = reinterpret_cast<aab2apk_job*>(&rejected);
+    CHECK(aab2apk_submit(context, "{\"input\": \"app.aab\", \"mode\": \"bogus\"}", nullptr, nullptr, &rejected) ==
+          AAB2APK_INVALID_ARGUMENT);
+    CHECK(rejected == nullptr);
+    CHECK(std::strlen(aab2apk_last_error()) > 0);
+    CHECK(aab2apk_submit(context, "{\"input\": ", nullptr, nullptr, &rejected) == AAB2APK_INVALID_ARGUMENT);
+
+    aab2apk_context_destroy(context);
+}
+
+} // anonymous namespace
+
+int main() {
+    test::TempDir dir("aab2apk_c_api_test");
+    // Jobs without an "output" publish below the working directory
+    std::filesystem::current_path(dir / "");
+
+    CHECK(aab2apk_api_version() == AAB2APK_API_VERSION);
+    write_zip(dir / "app.aab", "base/manifest/AndroidManifest.xml", "manifest");
+    write_zip(dir / "universal.apk", "classes.dex", test::make_data(64 * 1024, 1));
+    write_zip(dir / "universal.apks", "universal.apk", test::read_file(dir / "universal.apk"));
+    test::write_file(dir / "bundletool.jar", "");
+    write_fake_java(dir / "java", dir / "universal.apks");
+
+    test_context_errors(dir);
+    test_jobs(dir);
+    std::filesystem::current_path(std::filesystem::temp_directory_path());
+    std::cout << "c_api_test: all checks passed\n";
+    return 0;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+// Minimal helpers shared by the test programs: each test is a plain
+// executable registered with ctest that exits non-zero on the first
+// failed check.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+#define CHECK(condition)                                                               \
+    do {                                                                               \
+        if (!(condition)) {                                                            \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK failed: " #condition  \
+                      << "\n";                                                         \
+            std::exit(1);                                                              \
+        }                                                                              \
+    } while (false)
+
+namespace test {
+
+// A fresh directory under the system temp, removed when the test ends
+class TempDir {
+public:
+    explicit TempDir(const std::string& name)
+        : path_(std::filesystem::temp_directory_path() / (name + "_" + std::to_string(
+              std::chrono::steady_clock::now().time_since_epoch().count()))) {
+        std::filesystem::remove_all(path_);
+        std::filesystem::create_directories(path_);
+    }
+    ~TempDir() {
+        std::error_code ec;
+        std::filesystem::remove_all(path_, ec);
+    }
+
+    TempDir(const TempDir&) = delete;
+    TempDir& operator=(const TempDir&) = delete;
+
+    std::filesystem::path operator/(const std::string& name) const { return path_ / name; }
+
+private:
+    std::filesystem::path path_;
+};
+
+// Deterministic bytes: text-like (compressible) unless noisy is set
+inline std::string make_data(size_t size, uint32_t seed, bool noisy = false) {
+    std::string data(size, '\0');
+    uint32_t state = seed * 2654435761u + 1;
+    for (size_t i = 0; i < size; ++i) {
+        state = state * 1664525u + 1013904223u;
+        data[i] = noisy ? static_cast<char>(state >> 24) : static_cast<char>('a' + (state >> 24) % 8);
+    }
+    return data;
+}
+
+inline std::string read_file(const std::filesystem::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+inline void write_file(const std::filesystem::path& path, const std::string& data) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(data.data(), static_cast<std::streamsize>(data.size()));
+}
+
+} // namespace test
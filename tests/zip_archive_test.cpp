@@ -0,0 +1,240 @@
+#include "crc32.h"
+#include "test_support.h"
+#include "zip_archive.h"
+#include <cstdint>
+#include <map>
+#include <vector>
+
+using aab2apk::Crc32;
+using aab2apk::ZipAddOptions;
+using aab2apk::ZipEntry;
+using aab2apk::ZipReader;
+using aab2apk::ZipWriter;
+
+namespace {
+
+struct Expected {
+    std::string data;
+    uint16_t method;
+    uint32_t alignment;
+};
+
+const unsigned char* bytes(const std::string& data) {
+    return reinterpret_cast<const unsigned char*>(data.data());
+}
+
+ZipAddOptions options_for(bool compress, uint32_t alignment) {
+    ZipAddOptions options;
+    options.compress = compress;
+    options.alignment = alignment;
+    return options;
+}
+
+// Every entry reads back (CRC-32 checked by extract) with the expected
+// method, and stored data starts on its alignment boundary
+void check_archive(const std::filesystem::path& path, const std::map<std::string, Expected>& expected) {
+    ZipReader reader;
+    std::string error;
+    CHECK(reader.open(path, error));
+    CHECK(reader.entries().size() == expected.size());
+    for (const auto& [name, want] : expected) {
+        const ZipEntry* entry = reader.find(name);
+        CHECK(entry != nullptr);
+        CHECK(entry->method == want.method);
+        CHECK(entry->uncompressed_size == want.data.size());
+        CHECK(entry->crc32 == Crc32::compute(want.data.data(), want.data.size()));
+
+        std::string data;
+        CHECK(reader.extract(*entry, [&data](const unsigned char* chunk, size_t size) {
+            data.append(reinterpret_cast<const char*>(chunk), size);
+            return true;
+        }, error));
+        CHECK(data == want.data);
+
+        uint64_t offset = 0;
+        CHECK(reader.data_offset(*entry, offset, error));
+        if (want.alignment > 1) {
+            CHECK(offset % want.alignment == 0);
+        }
+    }
+}
+
+// add_data and add_file: stored, aligned, multi-block deflated (on several
+// threads) and deflate falling back to stored
+void test_write_entries(const test::TempDir& dir, std::map<std::string, Expected>& expected) {
+    expected = {
+        {"stored.bin", {test::make_data(10000, 1, true), ZipReader::METHOD_STORED, 0}},
+        {"resources.arsc", {test::make_data(7001, 2, true), ZipReader::METHOD_STORED, 4}},
+        {"lib/arm64-v8a/libapp.so", {test::make_data(50000, 3, true), ZipReader::METHOD_STORED, 16384}},
+        {"classes.dex", {test::make_data(3 * 1024 * 1024 + 123, 4), ZipReader::METHOD_DEFLATED, 0}},
+        {"noise.bin", {test::make_data(300 * 1024, 5, true), ZipReader::METHOD_STORED, 4}},
+        {"empty.txt", {"", ZipReader::METHOD_STORED, 0}},
+        {"file/classes2.dex", {test::make_data(9 * 1024 * 1024 + 77, 6), ZipReader::METHOD_DEFLATED, 0}},
+        {"file/libother.so", {test::make_data(40000, 7, true), ZipReader::METHOD_STORED, 16384}},
+        {"file/noise.bin", {test::make_data(1024 * 1024 + 5, 8, true), ZipReader::METHOD_STORED, 4}},
+        {"file/empty.txt", {"", ZipReader::METHOD_STORED, 0}},
+    };
+
+    ZipWriter writer;
+    std::string error;
+    CHECK(writer.open(dir / "written.zip", error));
+    writer.set_threads(4);
+    for (const auto& [name, want] : expected) {
+        ZipAddOptions options = options_for(want.method == ZipReader::METHOD_DEFLATED || name.find("noise") !=
+                                            std::string::npos, want.alignment);
+        if (name.compare(0, 5, "file/") == 0) {
+            std::filesystem::path source = dir / name.substr(5);
+            test::write_file(source, want.data);
+            CHECK(writer.add_file(name, source, options, error));
+        } else {
+            CHECK(writer.add_data(name, bytes(want.data), want.data.size(), options, error));
+        }
+    }
+    CHECK(writer.finish(error));
+    check_archive(dir / "written.zip", expected);
+
+    // The thread count does not change the stream, and add_file's chunks
+    // give the same blocks as deflating the whole file at once
+    const std::string& dex = expected.at("classes.dex").data;
+    std::string serial;
+    std::string parallel;
+    CHECK(ZipWriter::deflate_parallel(bytes(dex), dex.size(), 6, 1, serial, error));
+    CHECK(ZipWriter::deflate_parallel(bytes(dex), dex.size(), 6, 4, parallel, error));
+    CHECK(serial == parallel);
+    ZipReader reader;
+    CHECK(reader.open(dir / "written.zip", error));
+    CHECK(reader.find("classes.dex")->compressed_size == parallel.size());
+    const std::string& dex2 = expected.at("file/classes2.dex").data;
+    CHECK(ZipWriter::deflate_parallel(bytes(dex2), dex2.size(), 6, 4, parallel, error));
+    CHECK(reader.find("file/classes2.dex")->compressed_size == parallel.size());
+}
+
+// add_raw keeps every entry's bytes and realigns the stored ones
+void test_raw_copy(const test::TempDir& dir, std::map<std::string, Expected> expected) {
+    ZipReader source;
+    std::string error;
+    CHECK(source.open(dir / "written.zip", error));
+    ZipWriter writer;
+    CHECK(writer.open(dir / "copied.zip", error));
+    for (const ZipEntry& entry : source.entries()) {
+        CHECK(writer.add_raw(source, entry, error, 4096));
+        Expected& want = expected.at(entry.name);
+        want.alignment = want.method == ZipReader::METHOD_STORED ? 4096 : 0;
+    }
+    CHECK(writer.finish(error));
+    check_archive(dir / "copied.zip", expected);
+}
+
+// More entries than the 16-bit count holds: the zip64 end records are written
+void test_zip64_entry_count(const test::TempDir& dir) {
+    const size_t count = 70000;
+    ZipWriter writer;
+    std::string error;
+    CHECK(writer.open(dir / "many.zip", error));
+    for (size_t i = 0; i < count; ++i) {
+        std::string data = std::to_string(i);
+        CHECK(writer.add_data("e/" + data, bytes(data), data.size(), options_for(false, 0), error));
+    }
+    CHECK(writer.finish(error));
+
+    ZipReader reader;
+    CHECK(reader.open(dir / "many.zip", error));
+    CHECK(reader.entries().size() == count);
+    const ZipEntry* last = reader.find("e/" + std::to_string(count - 1));
+    CHECK(last != nullptr);
+    std::string data;
+    CHECK(reader.extract(*last, [&data](const unsigned char* chunk, size_t size) {
+        data.append(reinterpret_cast<const char*>(chunk), size);
+        return true;
+    }, error));
+    CHECK(data == std::to_string(count - 1));
+}
+
+// A flipped data byte is reported as a CRC mismatch
+void test_corrupt_entry(const test::TempDir& dir) {
+    std::string data = test::make_data(4096, 9, true);
+    ZipWriter writer;
+    std::string error;
+    CHECK(writer.open(dir / "corrupt.zip", error));
+    CHECK(writer.add_data("data.bin", bytes(data), data.size(), options_for(false, 0), error));
+    CHECK(writer.finish(error));
+
+    uint64_t offset = 0;
+    {
+        ZipReader reader;
+        CHECK(reader.open(dir / "corrupt.zip", error));
+        CHECK(reader.data_offset(reader.entries().front(), offset, error));
+    }
+    std::string archive = test::read_file(dir / "corrupt.zip");
+    archive[static_cast<size_t>(offset) + 100] ^= 0x01;
+    test::write_file(dir / "corrupt.zip", archive);
+
+    ZipReader reader;
+    CHECK(reader.open(dir / "corrupt.zip", error));
+    error.clear();
+    CHECK(!reader.extract(reader.entries().front(), [](const unsigned char*, size_t) { return true; }, error));
+    CHECK(!error.empty());
+}
+
+void put_le(std::string& out, uint64_t value, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+}
+
+// Nothing but zip64 end records, whose values are written as given
+std::string zip64_end_records(uint64_t entry_count, uint64_t cd_size, uint64_t cd_offset) {
+    std::string archive;
+    put_le(archive, 0x06064b50, 4);
+    put_le(archive, 44, 8);
+    put_le(archive, 45, 2);
+    put_le(archive, 45, 2);
+    put_le(archive, 0, 8);
+    put_le(archive, entry_count, 8);
+    put_le(archive, entry_count, 8);
+    put_le(archive, cd_size, 8);
+    put_le(archive, cd_offset, 8);
+    put_le(archive, 0x07064b50, 4);
+    put_le(archive, 0, 4);
+    put_le(archive, 0, 8);
+    put_le(archive, 1, 4);
+    put_le(archive, 0x06054b50, 4);
+    put_le(archive, 0, 4);
+    put_le(archive, 0xFFFF, 2);
+    put_le(archive, 0xFFFF, 2);
+    put_le(archive, 0xFFFFFFFF, 4);
+    put_le(archive, 0xFFFFFFFF, 4);
+    put_le(archive, 0, 2);
+    return archive;
+}
+
+// Sizes that wrap the bounds check or claim impossible entry counts are
+// rejected as errors rather than allocated
+void test_corrupt_directory(const test::TempDir& dir) {
+    const std::vector<std::string> archives = {
+        zip64_end_records(1, UINT64_MAX - 7, 16),
+        zip64_end_records(UINT64_MAX / 2, 56, 0),
+        zip64_end_records(1, 56, UINT64_MAX),
+    };
+    for (const std::string& archive : archives) {
+        test::write_file(dir / "directory.zip", archive);
+        ZipReader reader;
+        std::string error;
+        CHECK(!reader.open(dir / "directory.zip", error));
+        CHECK(!error.empty());
+    }
+}
+
+} // namespace
+
+int main() {
+    test::TempDir dir("zip_archive_test");
+    std::map<std::string, Expected> expected;
+    test_write_entries(dir, expected);
+    test_raw_copy(dir, expected);
+    test_zip64_entry_count(dir);
+    test_corrupt_entry(dir);
+    test_corrupt_directory(dir);
+    std::cout << "zip_archive_test: all checks passed\n";
+    return 0;
+}